@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <iostream>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 
 void print_vec(glm::vec3 v) {
@@ -67,6 +68,22 @@ collutils::PolyCollMesh::PolyCollMesh(collutils::PolyCollMesh* pcm)
 
 	anims = pcm->anims;
 	running_anims = pcm->running_anims;
+	running_anim = pcm->running_anim;
+	anim_time = pcm->anim_time;
+	anim_seg = pcm->anim_seg;
+	anim_event = pcm->anim_event;
+	anim_blend_left = pcm->anim_blend_left;
+	anim_blend_from = pcm->anim_blend_from;
+	anim_parent = pcm->anim_parent;
+
+	rest_verts = pcm->rest_verts;
+	rest_normals = pcm->rest_normals;
+	_rot = pcm->_rot;
+	_scale = pcm->_scale;
+
+	coll_behav = pcm->coll_behav;
+	coll_behav_args = pcm->coll_behav_args;
+	controlled = pcm->controlled;
 
 	_center = pcm->_center;
 	_init_center = pcm->_init_center;
@@ -128,8 +145,9 @@ void collutils::PolyCollMesh::apply_displacement(glm::vec3 disp)
 	for (uint32_t i = 0; i < verts_size; i++) {
 		verts[i] += disp;
 	}
+	// a translation keeps the normals, only the plane offsets move
 	for (uint32_t i = 0; i < faces_size; i++) {
-		faces[i].process_plane(&verts);
+		faces[i].equation.w -= glm::dot(faces[i].normal, disp);
 	}
 }
 
@@ -141,27 +159,89 @@ void collutils::PolyCollMesh::apply_LRS(LRS mlrs)
 	for (uint32_t i = 0; i < verts_size; i++) {
 		verts[i] = glm::vec3(mlrs.rotate * glm::vec4(verts[i], 1));
 	}
+	for (uint32_t i = 0; i < faces_size; i++) {
+		faces[i].process_plane(&verts);
+	}
 	cdisp = mlrs.location - _center;
 	apply_displacement(cdisp);
 }
 
-void collutils::PolyCollMesh::updateAnim(std::string animName, int gap_ms)
+void collutils::PolyCollMesh::apply_pose(AnimPose pose)
 {
-	LRS animLRS = anims[animName].transformAfterGap(gap_ms);
-	glm::vec3 disp = animLRS.location - _center;
-	apply_displacement(disp);
-	_vel = anims[animName].getNextVelHint();
-	_bvel = anims[animName].getNextVelHint();
-	if (animLRS.anim_finished) {
-		running_anims.clear();
-		_vel = glm::vec3(0);
-		_bvel = glm::vec3(0);
+	if (pose.rotate == _rot && pose.scale == _scale) {
+		apply_displacement(pose.location - _center);
+		return;
+	}
+
+	// only reachable from the unrotated, unscaled state the first time
+	if (rest_verts.size() == 0) {
+		rest_verts.resize(verts_size);
+		for (uint32_t i = 0; i < verts_size; i++) {
+			rest_verts[i] = verts[i] - _center;
+		}
+		rest_normals.resize(faces_size);
+		for (uint32_t i = 0; i < faces_size; i++) {
+			rest_normals[i] = faces[i].normal;
+		}
 	}
+
+	glm::mat3 rmat = glm::mat3_cast(pose.rotate);
+	glm::mat3 tmat = rmat;
+	tmat[0] *= pose.scale.x;
+	tmat[1] *= pose.scale.y;
+	tmat[2] *= pose.scale.z;
+	for (uint32_t i = 0; i < verts_size; i++) {
+		verts[i] = pose.location + tmat * rest_verts[i];
+	}
+	for (uint32_t i = 0; i < faces_size; i++) {
+		faces[i].normal = glm::normalize(rmat * (rest_normals[i] / pose.scale));
+		faces[i].equation = glm::vec4(faces[i].normal, -glm::dot(faces[i].normal, verts[faces[i].vinds[0]]));
+	}
+	_center = pose.location;
+	_rot = pose.rotate;
+	_scale = pose.scale;
 }
 
-int collutils::PolyCollMesh::getAnimEventTime(std::string animName)
+AnimPose collutils::PolyCollMesh::get_pose()
 {
-	return anims[animName].getNextEventTime();
+	AnimPose pose;
+	pose.location = _center;
+	pose.rotate = _rot;
+	pose.scale = _scale;
+	return pose;
+}
+
+glm::mat4 collutils::PolyCollMesh::get_model_matrix()
+{
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), _center) * glm::mat4_cast(_rot);
+	model = glm::scale(model, _scale);
+	return glm::translate(model, -_init_center);
+}
+
+// copies what a physics step changes, the per tick sync of lmeshes from lmeshes_future
+// doesn't need to copy anims and behaviour strings
+void collutils::PolyCollMesh::copy_motion_state(PolyCollMesh* pcm)
+{
+	verts = pcm->verts;
+	for (uint32_t i = 0; i < faces_size; i++) {
+		faces[i].normal = pcm->faces[i].normal;
+		faces[i].equation = pcm->faces[i].equation;
+	}
+
+	running_anim = pcm->running_anim;
+	anim_time = pcm->anim_time;
+	anim_seg = pcm->anim_seg;
+	anim_event = pcm->anim_event;
+	anim_blend_left = pcm->anim_blend_left;
+	anim_blend_from = pcm->anim_blend_from;
+
+	_rot = pcm->_rot;
+	_scale = pcm->_scale;
+	_center = pcm->_center;
+	_vel = pcm->_vel;
+	_bvel = pcm->_bvel;
+	_acc = pcm->_acc;
+	_bacc = pcm->_bacc;
 }
 
 bool collutils::PolyCollMesh::is_point_on_face_bounds(int plane_idx, glm::vec3 p)
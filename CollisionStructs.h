@@ -75,7 +75,22 @@ namespace collutils {
 		float mass = 1;
 
 		std::unordered_map<std::string, BoneAnimData> anims;
+		// anims to start when the mesh is added, PrismPhysics resolves them to running_anim
 		std::vector<std::string> running_anims;
+		int running_anim = -1;
+		int anim_time = 0;
+		uint32_t anim_seg = 0;
+		uint32_t anim_event = 0;
+		int anim_blend_left = 0;
+		AnimPose anim_blend_from;
+		// lmesh index this mesh's anim is relative to, the mesh follows its parent's motion
+		int anim_parent = -1;
+
+		// rest pose relative to the center, captured the first time the mesh rotates or scales
+		std::vector<glm::vec3> rest_verts;
+		std::vector<glm::vec3> rest_normals;
+		glm::quat _rot = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 _scale = glm::vec3(1.0f);
 
 		glm::vec3 _init_center = glm::vec3(0);
 		glm::vec3 _center = glm::vec3(0);
@@ -100,8 +115,10 @@ namespace collutils {
 		Mesh gen_mesh();
 		void apply_displacement(glm::vec3 disp);
 		void apply_LRS(LRS mlrs);
-		void updateAnim(std::string animName, int gap_ms);
-		int getAnimEventTime(std::string animName);
+		void apply_pose(AnimPose pose);
+		AnimPose get_pose();
+		glm::mat4 get_model_matrix();
+		void copy_motion_state(PolyCollMesh* pcm);
 		bool is_point_on_face_bounds(int plane_idx, glm::vec3 p);
 		bool is_point_on_face_bounds(int plane_idx, glm::vec3 p, float after_time);
 		CollPoint find_ray_first_coll(glm::vec3 raystart, glm::vec3 raydir);
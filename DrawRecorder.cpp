@@ -0,0 +1,94 @@
+#include "DrawRecorder.h"
+
+DrawRecordStats recordDrawRange(const SecondaryCmdJob& job, const DrawRecordTarget& target)
+{
+	// draw lists are sorted by mesh pool, texture set and mesh. A run of pooled meshes sharing the pool and texture
+	// set is one bind and one multi draw. The objects of each mesh in the run are written to the run's draw list
+	// positions of the instance buffer grouped by LOD, each group is one command instancing over its entries.
+	// The commands are packed from the run's first position of the slot's part of the indirect buffer
+	DrawRecordStats stats;
+	VkDeviceSize instanceOffset = 0;
+	vkCmdBindVertexBuffers(job.cmdBuffer, 3, 1, &target.instanceBuffer, &instanceOffset);
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkDescriptorSet boundTexDSet = VK_NULL_HANDLE;
+	size_t di = job.draw_start;
+	const RenderListItem* items = target.items;
+	const uint32_t* drawList = job.drawList->data();
+	while (di < job.draw_end) {
+		const RenderListItem& item = items[drawList[di] & DRAW_OBJ_MASK];
+		size_t run_end = di + 1;
+		if (item.pool >= 0) {
+			while (run_end < job.draw_end) {
+				const RenderListItem& next = items[drawList[run_end] & DRAW_OBJ_MASK];
+				if (next.pool != item.pool || (!job.shadow_pass && next.texDSet != item.texDSet)) break;
+				run_end++;
+			}
+		}
+
+		if (item.vertexBuffer != boundVertexBuffer) {
+			// shadow pipelines only take the position stream
+			VkBuffer vertexBuffers[] = { item.vertexBuffer, item.attribBuffer };
+			VkDeviceSize offsets[] = { 0, 0 };
+			vkCmdBindVertexBuffers(job.cmdBuffer, 0, job.shadow_pass ? 1 : 2, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(job.cmdBuffer, item.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			boundVertexBuffer = item.vertexBuffer;
+		}
+		if (!job.shadow_pass && item.texDSet != boundTexDSet) {
+			VkDescriptorSet dSets[] = { job.dSets[0], job.dSets[1], item.texDSet };
+			vkCmdBindDescriptorSets(job.cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, job.pipeline._pipelineLayout, 0, 3, dSets, 0, NULL);
+			boundTexDSet = item.texDSet;
+		}
+
+		// maintained meshes are drawn on their own, direct draws instance like the indirect commands do
+		bool run_indirect = target.indirect && item.pool >= 0;
+		size_t ci = di;
+		size_t mi = di;
+		while (mi < run_end) {
+			const RenderListItem& mitem = items[drawList[mi] & DRAW_OBJ_MASK];
+			size_t mesh_end = mi + 1;
+			if (item.pool >= 0) {
+				while (mesh_end < run_end && items[drawList[mesh_end] & DRAW_OBJ_MASK].vertexOffset == mitem.vertexOffset) mesh_end++;
+			}
+			size_t pos = mi;
+			for (uint32_t l = 0; l < mitem.lodCount && pos < mesh_end; l++) {
+				size_t first = pos;
+				for (size_t ri = mi; ri < mesh_end; ri++) {
+					if ((drawList[ri] >> DRAW_LOD_SHIFT) == l) target.slotObjs[pos++] = items[drawList[ri] & DRAW_OBJ_MASK].objIdx;
+				}
+				if (pos == first) continue;
+				const MeshLod& lod = mitem.lods[l];
+				uint32_t instances = uint32_t(pos - first);
+				if (run_indirect) {
+					target.slotCmds[ci++] = { lod.indexCount, instances, lod.firstIndex, mitem.vertexOffset, target.slotBase + uint32_t(first) };
+				}
+				else {
+					vkCmdDrawIndexed(job.cmdBuffer, lod.indexCount, instances, lod.firstIndex, mitem.vertexOffset + int32_t(target.frameNo * mitem.frameVertices), target.slotBase + uint32_t(first));
+					stats.drawCalls++;
+				}
+			}
+			mi = mesh_end;
+		}
+		if (run_indirect) {
+			uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+			if (target.multiDrawIndirect) {
+				vkCmdDrawIndexedIndirect(job.cmdBuffer, target.indirectBuffer, target.slotCmdsOffset + di * stride, uint32_t(ci - di), stride);
+				stats.drawCalls++;
+			}
+			else {
+				for (size_t c = di; c < ci; c++) {
+					vkCmdDrawIndexedIndirect(job.cmdBuffer, target.indirectBuffer, target.slotCmdsOffset + c * stride, 1, stride);
+				}
+				stats.drawCalls += ci - di;
+			}
+		}
+		stats.draws += run_end - di;
+		if (job.shadow_pass) {
+			// every index fetches a position, the post-transform cache saves some of them
+			for (size_t ri = di; ri < run_end; ri++) {
+				stats.shadowFetchBytes += items[drawList[ri] & DRAW_OBJ_MASK].lods[drawList[ri] >> DRAW_LOD_SHIFT].indexCount * sizeof(glm::vec3);
+			}
+		}
+		di = run_end;
+	}
+	return stats;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vkstructs.h"
+
+#include <cstdint>
+
+// what recording a range of a draw list adds to its worker's stats
+struct DrawRecordStats {
+	size_t draws = 0;
+	size_t drawCalls = 0;
+	size_t shadowFetchBytes = 0;
+};
+
+// the frame's render list and draw buffers a range is recorded from and into. slotCmds and slotObjs are the pass
+// slot's part of the indirect commands and instance entries, slotCmdsOffset and slotBase where that part starts
+struct DrawRecordTarget {
+	const RenderListItem* items = NULL;
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	VkBuffer indirectBuffer = VK_NULL_HANDLE;
+	VkDrawIndexedIndirectCommand* slotCmds = NULL;
+	uint32_t* slotObjs = NULL;
+	VkDeviceSize slotCmdsOffset = 0;
+	uint32_t slotBase = 0;
+	// maintained meshes draw the copy of frame frameNo
+	size_t frameNo = 0;
+	bool indirect = false;
+	bool multiDrawIndirect = false;
+};
+
+// records the draws of job's draw list range into job.cmdBuffer, once its pipeline and pass state are bound. Only the
+// range's positions of the slot's commands and instance entries are written, so ranges can be recorded side by side
+DrawRecordStats recordDrawRange(const SecondaryCmdJob& job, const DrawRecordTarget& target);
@@ -0,0 +1,279 @@
+#include "GPUAllocator.h"
+
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+static VkDeviceSize align_up(VkDeviceSize v, VkDeviceSize alignment) {
+	return (v + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t order_of(VkDeviceSize size, VkDeviceSize min_size) {
+	uint32_t order = 0;
+	while ((min_size << order) < size) order++;
+	return order;
+}
+
+BuddyRanges::BuddyRanges(VkDeviceSize block_size, VkDeviceSize min_size)
+{
+	this->min_size = min_size;
+	free_lists.resize(order_of(block_size, min_size) + 1);
+	free_lists.back().insert(0);
+}
+
+bool BuddyRanges::alloc(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& rounded)
+{
+	// ranges sit at multiples of their own size, so rounding up to the alignment covers it
+	uint32_t order = order_of(std::max(size, alignment), min_size);
+	uint32_t k = order;
+	while (k < free_lists.size() && free_lists[k].empty()) k++;
+	if (k >= free_lists.size()) return false;
+
+	offset = *free_lists[k].begin();
+	free_lists[k].erase(free_lists[k].begin());
+	while (k > order) {
+		k--;
+		free_lists[k].insert(offset + (min_size << k));
+	}
+	rounded = min_size << order;
+	live_orders[offset] = order;
+	used += rounded;
+	count++;
+	return true;
+}
+
+void BuddyRanges::free(VkDeviceSize offset)
+{
+	auto it = live_orders.find(offset);
+	if (it == live_orders.end()) return;
+	uint32_t k = it->second;
+	live_orders.erase(it);
+	used -= min_size << k;
+	count--;
+
+	while (k + 1 < free_lists.size()) {
+		VkDeviceSize buddy = offset ^ (min_size << k);
+		auto bit = free_lists[k].find(buddy);
+		if (bit == free_lists[k].end()) break;
+		free_lists[k].erase(bit);
+		offset = std::min(offset, buddy);
+		k++;
+	}
+	free_lists[k].insert(offset);
+}
+
+VkDeviceSize BuddyRanges::largest_free()
+{
+	for (size_t k = free_lists.size(); k > 0; k--) {
+		if (!free_lists[k - 1].empty()) return min_size << (k - 1);
+	}
+	return 0;
+}
+
+LinearRanges::LinearRanges(VkDeviceSize block_size)
+{
+	this->block_size = block_size;
+}
+
+bool LinearRanges::alloc(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	VkDeviceSize start = align_up(head, alignment);
+	if (start + size > block_size) return false;
+	offset = start;
+	head = start + size;
+	count++;
+	return true;
+}
+
+void LinearRanges::free(VkDeviceSize offset)
+{
+	if (count > 0) count--;
+	if (count == 0) head = 0;
+}
+
+GPUAllocator::GPUAllocator(VkDevice device, VkPhysicalDeviceMemoryProperties memProps, VkDeviceSize nonCoherentAtomSize)
+{
+	this->device = device;
+	this->memProps = memProps;
+	// non-coherent flushes are rounded to the atom size, ranges at least that big never share an atom
+	while (MIN_RANGE_SIZE < nonCoherentAtomSize) MIN_RANGE_SIZE <<= 1;
+}
+
+GPUAllocator::~GPUAllocator()
+{
+	for (Block* block : blocks) destroyBlock(block);
+	blocks.clear();
+	block_by_memory.clear();
+}
+
+uint32_t GPUAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags props)
+{
+	for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+		if ((typeFilter & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & props) == props) {
+			return i;
+		}
+	}
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+GPUAllocator::Block* GPUAllocator::createBlock(uint32_t memType, VkDeviceSize size, uint32_t key)
+{
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, NULL, &memory) != VK_SUCCESS) return NULL;
+	device_allocs++;
+
+	Block* block = new Block();
+	block->memory = memory;
+	block->size = size;
+	block->key = key;
+	if (memProps.memoryTypes[memType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+	}
+	blocks.push_back(block);
+	block_by_memory[memory] = block;
+	return block;
+}
+
+void GPUAllocator::destroyBlock(Block* block)
+{
+	if (block->mapped != NULL) vkUnmapMemory(device, block->memory);
+	vkFreeMemory(device, block->memory, NULL);
+	delete block->buddy;
+	delete block->linear;
+	delete block;
+}
+
+GPUMemoryRange GPUAllocator::allocate(VkMemoryRequirements memReqs, VkMemoryPropertyFlags props, bool image, int strategy)
+{
+	uint32_t memType = findMemoryType(memReqs.memoryTypeBits, props);
+	uint32_t key = memType * 4 + (image ? 2 : 0) + strategy;
+	VkDeviceSize block_size = (strategy == PRISM_ALLOC_LINEAR) ? LINEAR_BLOCK_SIZE : BUDDY_BLOCK_SIZE;
+	GPUMemoryRange range;
+
+	std::lock_guard<std::mutex> lock(alloc_mut);
+	sub_allocs++;
+	if (memReqs.size <= block_size / 2) {
+		for (size_t pass = 0; pass < 2; pass++) {
+			Block* block = NULL;
+			if (pass == 0) {
+				for (Block* b : blocks) {
+					if (b->key != key || b->dedicated) continue;
+					bool fits = (strategy == PRISM_ALLOC_LINEAR)
+						? b->linear->alloc(memReqs.size, std::max(memReqs.alignment, MIN_RANGE_SIZE), range.offset)
+						: b->buddy->alloc(memReqs.size, memReqs.alignment, range.offset, range.size);
+					if (fits) {
+						block = b;
+						break;
+					}
+				}
+			}
+			else {
+				block = createBlock(memType, block_size, key);
+				// the heap might not have room for a whole block, fall through to a dedicated allocation
+				if (block == NULL) break;
+				if (strategy == PRISM_ALLOC_LINEAR) {
+					block->linear = new LinearRanges(block_size);
+					block->linear->alloc(memReqs.size, std::max(memReqs.alignment, MIN_RANGE_SIZE), range.offset);
+				}
+				else {
+					block->buddy = new BuddyRanges(block_size, MIN_RANGE_SIZE);
+					block->buddy->alloc(memReqs.size, memReqs.alignment, range.offset, range.size);
+				}
+			}
+			if (block != NULL) {
+				if (strategy == PRISM_ALLOC_LINEAR) range.size = align_up(memReqs.size, MIN_RANGE_SIZE);
+				range.memory = block->memory;
+				if (block->mapped != NULL) range.mapped = (char*)block->mapped + range.offset;
+				return range;
+			}
+		}
+	}
+
+	Block* block = createBlock(memType, memReqs.size, key);
+	if (block == NULL) throw std::runtime_error("failed to allocate device memory!");
+	block->dedicated = true;
+	range.memory = block->memory;
+	range.offset = 0;
+	range.size = VK_WHOLE_SIZE;
+	range.mapped = block->mapped;
+	return range;
+}
+
+void GPUAllocator::free(VkDeviceMemory memory, VkDeviceSize offset)
+{
+	std::lock_guard<std::mutex> lock(alloc_mut);
+	auto it = block_by_memory.find(memory);
+	if (it == block_by_memory.end()) return;
+	Block* block = it->second;
+
+	bool empty = true;
+	if (block->buddy != NULL) {
+		block->buddy->free(offset);
+		empty = block->buddy->count == 0;
+	}
+	else if (block->linear != NULL) {
+		block->linear->free(offset);
+		empty = block->linear->count == 0;
+	}
+	if (!empty) return;
+
+	// keep one empty block per kind around so a freed and reloaded resource doesn't cost an allocation
+	if (!block->dedicated) {
+		size_t same_kind = 0;
+		for (Block* b : blocks) {
+			if (b->key == block->key && !b->dedicated) same_kind++;
+		}
+		if (same_kind <= 1) return;
+	}
+	block_by_memory.erase(it);
+	blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+	destroyBlock(block);
+}
+
+GPUAllocatorStats GPUAllocator::getStats()
+{
+	std::lock_guard<std::mutex> lock(alloc_mut);
+	GPUAllocatorStats stats;
+	stats.device_allocs = device_allocs;
+	stats.sub_allocs = sub_allocs;
+	std::unordered_map<uint32_t, VkDeviceSize> used_by_key;
+	for (Block* b : blocks) {
+		stats.blocks++;
+		stats.reserved_bytes += b->size;
+		if (b->dedicated) {
+			stats.dedicated++;
+			stats.live_sub_allocs++;
+			stats.used_bytes += b->size;
+			continue;
+		}
+		VkDeviceSize used = (b->buddy != NULL) ? b->buddy->used : b->linear->head;
+		stats.live_sub_allocs += (b->buddy != NULL) ? b->buddy->count : b->linear->count;
+		stats.used_bytes += used;
+		stats.free_bytes += b->size - used;
+		stats.largest_free += (b->buddy != NULL) ? b->buddy->largest_free() : b->size - used;
+		used_by_key[b->key] += used;
+	}
+	// how many blocks the same live ranges would need if they were moved together
+	for (auto it : used_by_key) {
+		VkDeviceSize block_size = (it.first & PRISM_ALLOC_LINEAR) ? LINEAR_BLOCK_SIZE : BUDDY_BLOCK_SIZE;
+		stats.compacted_blocks += size_t(std::max(VkDeviceSize(1), (it.second + block_size - 1) / block_size));
+	}
+	stats.compacted_blocks += stats.dedicated;
+	return stats;
+}
+
+void GPUAllocator::printStats(std::string label)
+{
+	GPUAllocatorStats stats = getStats();
+	float fragmented = (stats.free_bytes > 0) ? 100.0f * (1.0f - float(stats.largest_free) / float(stats.free_bytes)) : 0.0f;
+	std::cout << "gpu memory (" << label << "): " << stats.live_sub_allocs << " live allocations in "
+		<< stats.blocks << " blocks (" << stats.dedicated << " dedicated), "
+		<< stats.used_bytes / (1024 * 1024) << "MB used of " << stats.reserved_bytes / (1024 * 1024) << "MB reserved, "
+		<< fragmented << "% of the free space fragmented, " << stats.compacted_blocks << " blocks if compacted, "
+		<< stats.device_allocs << " vkAllocateMemory calls for " << stats.sub_allocs << " allocations\n";
+}
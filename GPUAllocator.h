@@ -0,0 +1,101 @@
+#pragma once
+
+#include "vkstructs.h"
+
+#include <set>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#define PRISM_ALLOC_BUDDY 0
+#define PRISM_ALLOC_LINEAR 1
+
+// a sub-allocated range of a VkDeviceMemory block. mapped is set when the block is host visible,
+// size is the rounded size of the range so non-coherent writes can be flushed without touching a neighbour
+struct GPUMemoryRange {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = VK_WHOLE_SIZE;
+	void* mapped = NULL;
+};
+
+struct GPUAllocatorStats {
+	size_t blocks = 0;
+	size_t dedicated = 0;
+	size_t device_allocs = 0;
+	size_t sub_allocs = 0;
+	size_t live_sub_allocs = 0;
+	VkDeviceSize reserved_bytes = 0;
+	VkDeviceSize used_bytes = 0;
+	VkDeviceSize free_bytes = 0;
+	VkDeviceSize largest_free = 0;
+	size_t compacted_blocks = 0;
+};
+
+// power of two buddy ranges over one block, offsets are aligned to their rounded size
+class BuddyRanges {
+public:
+	BuddyRanges(VkDeviceSize block_size, VkDeviceSize min_size);
+	bool alloc(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, VkDeviceSize& rounded);
+	void free(VkDeviceSize offset);
+	VkDeviceSize largest_free();
+
+	VkDeviceSize used = 0;
+	size_t count = 0;
+private:
+	VkDeviceSize min_size;
+	std::vector<std::set<VkDeviceSize>> free_lists;
+	std::unordered_map<VkDeviceSize, uint32_t> live_orders;
+};
+
+// bump ranges for short lived allocations like staging buffers, rewinds once all of them are freed
+class LinearRanges {
+public:
+	LinearRanges(VkDeviceSize block_size);
+	bool alloc(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void free(VkDeviceSize offset);
+
+	VkDeviceSize block_size;
+	VkDeviceSize head = 0;
+	size_t count = 0;
+};
+
+// hands out ranges of big VkDeviceMemory blocks instead of one allocation per resource. Blocks are kept
+// per memory type, strategy and buffer/image so linear and optimal tiling resources never share a block
+// (no bufferImageGranularity padding needed). Resources bigger than half a block get their own allocation
+class GPUAllocator {
+public:
+	GPUAllocator(VkDevice device, VkPhysicalDeviceMemoryProperties memProps, VkDeviceSize nonCoherentAtomSize);
+	~GPUAllocator();
+
+	GPUMemoryRange allocate(VkMemoryRequirements memReqs, VkMemoryPropertyFlags props, bool image, int strategy = PRISM_ALLOC_BUDDY);
+	void free(VkDeviceMemory memory, VkDeviceSize offset);
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags props);
+	GPUAllocatorStats getStats();
+	void printStats(std::string label);
+
+	VkDeviceSize BUDDY_BLOCK_SIZE = VkDeviceSize(1) << 26;
+	VkDeviceSize LINEAR_BLOCK_SIZE = VkDeviceSize(1) << 25;
+	VkDeviceSize MIN_RANGE_SIZE = 256;
+private:
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = NULL;
+		VkDeviceSize size = 0;
+		uint32_t key = 0;
+		bool dedicated = false;
+		BuddyRanges* buddy = NULL;
+		LinearRanges* linear = NULL;
+	};
+	Block* createBlock(uint32_t memType, VkDeviceSize size, uint32_t key);
+	void destroyBlock(Block* block);
+
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memProps;
+	std::vector<Block*> blocks;
+	std::unordered_map<VkDeviceMemory, Block*> block_by_memory;
+	size_t device_allocs = 0;
+	size_t sub_allocs = 0;
+	std::mutex alloc_mut;
+};
@@ -0,0 +1,288 @@
+#include "GPUUploader.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+GPUUploader::GPUUploader(VkDevice device, VkPhysicalDevice physicalDevice, VkQueue transferQueue, uint32_t transferFamily, uint32_t graphicsFamily)
+{
+	this->device = device;
+	this->physicalDevice = physicalDevice;
+	this->transferQueue = transferQueue;
+	this->transferFamily = transferFamily;
+	this->graphicsFamily = graphicsFamily;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = transferFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	if (vkCreateCommandPool(device, &poolInfo, NULL, &cmdPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create command pool!");
+	}
+
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if (vkCreateSemaphore(device, &semaphoreInfo, NULL, &timeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create upload timeline semaphore!");
+	}
+
+	ring = vkutils::createBuffer(
+		device,
+		physicalDevice,
+		STAGING_RING_SIZE,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+	);
+}
+
+GPUUploader::~GPUUploader()
+{
+	waitIdle();
+	vkDestroyCommandPool(device, cmdPool, NULL);
+	vkDestroySemaphore(device, timeline, NULL);
+	vkutils::destroyBuffer(device, ring);
+}
+
+VkCommandBuffer GPUUploader::batchCmdBuffer()
+{
+	if (current.cmdBuffer != VK_NULL_HANDLE) return current.cmdBuffer;
+	if (freeCmdBuffers.empty()) {
+		current.cmdBuffer = vkutils::createCmdBuffer(device, cmdPool);
+	}
+	else {
+		current.cmdBuffer = freeCmdBuffers.back();
+		freeCmdBuffers.pop_back();
+	}
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (vkBeginCommandBuffer(current.cmdBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
+	return current.cmdBuffer;
+}
+
+void GPUUploader::submitBatch()
+{
+	// called with upload_mut held
+	if (current.cmdBuffer == VK_NULL_HANDLE) return;
+	vkEndCommandBuffer(current.cmdBuffer);
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &current.ticket;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &current.cmdBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline;
+	if (vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit upload command buffer!");
+	}
+
+	current.ringEnd = ring_written;
+	inflight.push_back(current);
+	current = { current.ticket + 1, VK_NULL_HANDLE, 0, {} };
+	stats_batches++;
+}
+
+void GPUUploader::retireBatches(uint64_t completed)
+{
+	while (!inflight.empty() && inflight.front().ticket <= completed) {
+		UploadBatch& batch = inflight.front();
+		ring_released = batch.ringEnd;
+		vkResetCommandBuffer(batch.cmdBuffer, 0);
+		freeCmdBuffers.push_back(batch.cmdBuffer);
+		for (GPUBuffer& buffer : batch.oversized) vkutils::destroyBuffer(device, buffer);
+		inflight.pop_front();
+	}
+}
+
+VkDeviceSize GPUUploader::ringAlloc(VkDeviceSize size, VkDeviceSize alignment)
+{
+	while (true) {
+		VkDeviceSize pos = ring_written % STAGING_RING_SIZE;
+		VkDeviceSize pad = (pos + alignment - 1) / alignment * alignment - pos;
+		// a range never wraps, the end of the ring is skipped instead
+		if (pos + pad + size > STAGING_RING_SIZE) pad = STAGING_RING_SIZE - pos;
+		if (ring_written + pad + size - ring_released <= STAGING_RING_SIZE) {
+			ring_written += pad + size;
+			return (pos + pad) % STAGING_RING_SIZE;
+		}
+
+		// full, push out what is recorded so far and wait for the oldest batch to free its part
+		stats_ring_waits++;
+		submitBatch();
+		if (inflight.empty()) throw std::runtime_error("staging ring can't fit the upload!");
+		VkSemaphoreWaitInfo waitInfo{};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &timeline;
+		waitInfo.pValues = &inflight.front().ticket;
+		vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+		retireBatches(inflight.front().ticket);
+	}
+}
+
+uint64_t GPUUploader::uploadToBuffer(GPUBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, void* data)
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	VkBufferCopy copyRegion{};
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	VkBuffer src = ring._buffer;
+	if (size > STAGING_RING_SIZE) {
+		GPUBuffer stage = vkutils::createBuffer(device, physicalDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		memcpy(stage._mapped, data, (size_t)size);
+		current.oversized.push_back(stage);
+		src = stage._buffer;
+	}
+	else {
+		copyRegion.srcOffset = ringAlloc(size, 16);
+		memcpy((char*)ring._mapped + copyRegion.srcOffset, data, (size_t)size);
+	}
+	vkCmdCopyBuffer(batchCmdBuffer(), src, dst._buffer, 1, &copyRegion);
+	stats_bytes += size;
+	return current.ticket;
+}
+
+uint64_t GPUUploader::uploadToImage(GPUImage dst, VkFormat format, VkExtent3D extent, uint32_t mipLevels, VkDeviceSize size, void* data)
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	VkDeviceSize srcOffset = 0;
+	VkBuffer src = ring._buffer;
+	if (size > STAGING_RING_SIZE) {
+		GPUBuffer stage = vkutils::createBuffer(device, physicalDevice, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		memcpy(stage._mapped, data, (size_t)size);
+		current.oversized.push_back(stage);
+		src = stage._buffer;
+	}
+	else {
+		srcOffset = ringAlloc(size, 16);
+		memcpy((char*)ring._mapped + srcOffset, data, (size_t)size);
+	}
+
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+	for (uint32_t lvl = 0; lvl < mipLevels; lvl++) {
+		VkBufferImageCopy& region = regions[lvl];
+		region.bufferOffset = srcOffset;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = lvl;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(1u, extent.width >> lvl), std::max(1u, extent.height >> lvl), 1 };
+		srcOffset += VkDeviceSize(region.imageExtent.width) * region.imageExtent.height * 4;
+	}
+	VkImageSubresourceRange mipRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 };
+
+	VkCommandBuffer cmdBuffer = batchCmdBuffer();
+	vkutils::transitionImageLayout(
+		cmdBuffer,
+		dst._image,
+		format,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		mipRange
+	);
+	vkCmdCopyBufferToImage(cmdBuffer, src, dst._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()), regions.data());
+	if (transferFamily == graphicsFamily) {
+		vkutils::transitionImageLayout(
+			cmdBuffer,
+			dst._image,
+			format,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			mipRange
+		);
+	}
+	else {
+		// release half of the ownership transfer, the layout change happens with the acquire on the graphics queue
+		vkutils::transitionImageLayout(
+			cmdBuffer,
+			dst._image,
+			format,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			mipRange,
+			transferFamily,
+			graphicsFamily
+		);
+		acquires.push_back({ current.ticket, dst._image, format, mipLevels });
+	}
+	stats_bytes += size;
+	return current.ticket;
+}
+
+void GPUUploader::submit()
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	submitBatch();
+}
+
+uint64_t GPUUploader::completedTicket()
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	uint64_t completed = 0;
+	vkGetSemaphoreCounterValue(device, timeline, &completed);
+	retireBatches(completed);
+	return completed;
+}
+
+bool GPUUploader::recordAcquires(VkCommandBuffer cmdBuffer, uint64_t ticket)
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	size_t kept = 0;
+	for (size_t i = 0; i < acquires.size(); i++) {
+		if (acquires[i].ticket > ticket) {
+			acquires[kept++] = acquires[i];
+			continue;
+		}
+		vkutils::transitionImageLayout(
+			cmdBuffer,
+			acquires[i].image,
+			acquires[i].format,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			{ VK_IMAGE_ASPECT_COLOR_BIT, 0, acquires[i].mipLevels, 0, 1 },
+			transferFamily,
+			graphicsFamily
+		);
+	}
+	bool recorded = kept < acquires.size();
+	acquires.resize(kept);
+	return recorded;
+}
+
+void GPUUploader::waitIdle()
+{
+	std::lock_guard<std::mutex> lock(upload_mut);
+	submitBatch();
+	uint64_t last = current.ticket - 1;
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &last;
+	vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+	retireBatches(last);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "vkutils.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// an image waiting for its batch, the graphics queue half of its ownership transfer is recorded once the batch finished
+struct UploadAcquire {
+	uint64_t ticket;
+	VkImage image;
+	VkFormat format;
+	uint32_t mipLevels;
+};
+
+struct UploadBatch {
+	uint64_t ticket;
+	VkCommandBuffer cmdBuffer;
+	// ring position after the batch's last copy, everything before it is free once the batch finished
+	uint64_t ringEnd;
+	// staging buffers for uploads bigger than the whole ring
+	std::vector<GPUBuffer> oversized;
+};
+
+// batches buffer and image uploads into one transfer queue submit per frame. Data is copied into a persistently mapped
+// staging ring right away, the copies are recorded and go out on submit(). Every batch signals the next value of a
+// timeline semaphore, the value is the ticket of the uploads in it and they are on the device once completedTicket() reaches it
+class GPUUploader {
+public:
+	GPUUploader(VkDevice device, VkPhysicalDevice physicalDevice, VkQueue transferQueue, uint32_t transferFamily, uint32_t graphicsFamily);
+	~GPUUploader();
+
+	// dst has to be shared with the transfer family, buffers don't go through ownership transfers
+	uint64_t uploadToBuffer(GPUBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, void* data);
+	// data holds mipLevels tightly packed RGBA8 levels, largest first. dst is left in SHADER_READ_ONLY_OPTIMAL
+	// and owned by the graphics family after recordAcquires
+	uint64_t uploadToImage(GPUImage dst, VkFormat format, VkExtent3D extent, uint32_t mipLevels, VkDeviceSize size, void* data);
+	void submit();
+	uint64_t completedTicket();
+	// records the acquire barriers of the images in batches up to ticket, returns false if there were none
+	bool recordAcquires(VkCommandBuffer cmdBuffer, uint64_t ticket);
+	void waitIdle();
+
+	VkSemaphore timeline;
+	const VkDeviceSize STAGING_RING_SIZE = VkDeviceSize(1) << 26;
+
+	size_t stats_bytes = 0;
+	size_t stats_batches = 0;
+	size_t stats_ring_waits = 0;
+private:
+	VkDeviceSize ringAlloc(VkDeviceSize size, VkDeviceSize alignment);
+	VkCommandBuffer batchCmdBuffer();
+	void submitBatch();
+	void retireBatches(uint64_t completed);
+
+	VkDevice device;
+	VkPhysicalDevice physicalDevice;
+	VkQueue transferQueue;
+	uint32_t transferFamily, graphicsFamily;
+	VkCommandPool cmdPool;
+	std::vector<VkCommandBuffer> freeCmdBuffers;
+
+	GPUBuffer ring;
+	uint64_t ring_written = 0;
+	uint64_t ring_released = 0;
+
+	UploadBatch current = { 1, VK_NULL_HANDLE, 0, {} };
+	std::deque<UploadBatch> inflight;
+	std::vector<UploadAcquire> acquires;
+	std::mutex upload_mut;
+};
@@ -0,0 +1,84 @@
+#include "LevelReload.h"
+
+#include <iostream>
+#include <cctype>
+#include <unordered_map>
+
+static bool is_level_geometry_tag(std::string tag) {
+	return tag == "PUVL" || tag == "PNSP" || tag == "CUVH" || tag == "CNPH";
+}
+
+static bool is_level_light_tag(std::string tag) {
+	return tag == "DLES" || tag == "DLEN" || tag == "PLEN" || tag == "PLES";
+}
+
+std::vector<LevelEntity> readLevelEntities(std::string cfname)
+{
+	std::vector<LevelEntity> ents;
+	std::unordered_map<std::string, int> content_count;
+	std::ifstream fr(cfname, std::ios::binary);
+	std::string line;
+	while (std::getline(fr, line)) {
+		while (line.length() > 0 && isspace((unsigned char)line.back())) line.pop_back();
+		if (line.length() < 4 || line[0] == '#') continue;
+
+		std::string tag = line.substr(0, 4);
+		if (is_level_geometry_tag(tag) || is_level_light_tag(tag) || tag == "STRM") {
+			LevelEntity ent;
+			ent.tag = tag;
+			ent.is_light = is_level_light_tag(tag);
+			size_t nmpos = line.find('#');
+			if (nmpos != std::string::npos) ent.id = "name:" + line.substr(nmpos + 1);
+			if (tag == "STRM") ent.stream_offset = fr.tellg();
+			ents.push_back(ent);
+		}
+		else if (ents.size() == 0 || ents.back().is_light || ents.back().tag == "STRM") {
+			std::cout << cfname << ": " << tag << " has no geometry to apply to, skipping\n";
+			continue;
+		}
+		ents.back().lines.push_back(line);
+		ents.back().content += line + '\n';
+		if (tag == "STRM") break;
+	}
+	for (LevelEntity& ent : ents) {
+		if (ent.id.empty()) {
+			ent.id = "auto:" + ent.content + "@" + std::to_string(content_count[ent.content]++);
+		}
+	}
+	return ents;
+}
+
+LevelDiff diffLevelEntities(const std::vector<LevelEntity>& old_ents, std::vector<LevelEntity>& new_ents)
+{
+	LevelDiff diff;
+	std::unordered_map<std::string, size_t> old_idx;
+	for (size_t i = 0; i < old_ents.size(); i++) {
+		old_idx[old_ents[i].id] = i;
+	}
+	std::vector<bool> old_kept(old_ents.size(), false);
+
+	for (size_t ni = 0; ni < new_ents.size(); ni++) {
+		LevelEntity& ent = new_ents[ni];
+		auto it = old_idx.find(ent.id);
+		if (it == old_idx.end() || old_ents[it->second].tag != ent.tag) {
+			if (ent.is_light) diff.lights_changed = true;
+			else diff.added.push_back(ni);
+			continue;
+		}
+		const LevelEntity& old = old_ents[it->second];
+		old_kept[it->second] = true;
+		ent.slot = old.slot;
+		if (old.content == ent.content) continue;
+
+		if (ent.is_light) diff.lights_changed = true;
+		else if (ent.tag == "STRM") diff.streaming_changed = true;
+		else diff.changed.push_back({ it->second, ni });
+	}
+
+	for (size_t i = 0; i < old_ents.size(); i++) {
+		if (old_kept[i]) continue;
+		if (old_ents[i].is_light) diff.lights_changed = true;
+		else if (old_ents[i].slot >= 0) diff.removed.push_back(i);
+	}
+	return diff;
+}
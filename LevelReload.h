@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+struct LevelEntity {
+	std::string id;
+	std::string tag;
+	std::string content;
+	std::vector<std::string> lines;
+	bool is_light = false;
+	int slot = -1;
+	std::streamoff stream_offset = 0;
+};
+
+// what a reload changes, indices are into the old and new entity lists
+struct LevelDiff {
+	// old index, new index. The new entity already has the old one's slot
+	std::vector<std::pair<size_t, size_t>> changed;
+	std::vector<size_t> removed;
+	std::vector<size_t> added;
+	bool lights_changed = false;
+	bool streaming_changed = false;
+};
+
+// a geometry line and the modifier lines after it form one entity, a light line is one on its own. A trailing
+// #name on the first line names the entity, otherwise it is identified by its content
+std::vector<LevelEntity> readLevelEntities(std::string cfname);
+// matches entities by id and tag, kept entities of new_ents take over the slots of their old ones
+LevelDiff diffLevelEntities(const std::vector<LevelEntity>& old_ents, std::vector<LevelEntity>& new_ents);
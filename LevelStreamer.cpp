@@ -0,0 +1,339 @@
+#include "LevelStreamer.h"
+
+#include <iostream>
+#include <sstream>
+
+static inline int64_t chunk_key(glm::ivec2 coord) {
+	return (int64_t(coord.x) << 32) | int64_t(uint32_t(coord.y));
+}
+
+static inline int chunk_dist(glm::ivec2 a, glm::ivec2 b) {
+	return std::max(abs(a.x - b.x), abs(a.y - b.y));
+}
+
+static size_t pcmesh_bytes(PolyCollMesh* pcm) {
+	size_t bytes = sizeof(PolyCollMesh) + pcm->verts.size() * sizeof(glm::vec3) + pcm->edges.size() * sizeof(glm::ivec2);
+	for (size_t i = 0; i < pcm->faces.size(); i++) {
+		bytes += sizeof(PlaneMeta) + pcm->faces[i].vinds.size() * sizeof(size_t);
+	}
+	return bytes;
+}
+
+static PolyCollMesh* parse_geometry_line(std::istringstream& lss, std::string itype) {
+	float plane_thickness;
+	float plane_friction;
+	if (itype == "PUVL") {
+		glm::vec3 u, v, rcenter;
+		float ulen, vlen;
+		lss >> plane_thickness >> plane_friction;
+		lss >> rcenter.x >> rcenter.y >> rcenter.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z >> ulen >> vlen;
+		return PrismPhysics::gen_pcmesh(rcenter, u, v, ulen, vlen, plane_thickness, plane_friction);
+	}
+	if (itype == "PNSP") {
+		int n;
+		lss >> plane_thickness >> plane_friction >> n;
+		std::vector<glm::vec3> points(n);
+		for (int i = 0; i < n; i++) {
+			lss >> points[i].x >> points[i].y >> points[i].z;
+		}
+		return PrismPhysics::gen_pcmesh(points, plane_thickness, plane_friction);
+	}
+	if (itype == "CUVH") {
+		glm::vec3 u, v, rcenter;
+		float ulen, vlen, tlen;
+		lss >> plane_thickness >> plane_friction;
+		lss >> rcenter.x >> rcenter.y >> rcenter.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z >> ulen >> vlen >> tlen;
+		return PrismPhysics::gen_pcmesh(rcenter, u, v, ulen, vlen, tlen, plane_thickness, plane_friction);
+	}
+	if (itype == "CNPH") {
+		int n;
+		float h;
+		lss >> plane_thickness >> plane_friction >> n;
+		std::vector<glm::vec3> points(n);
+		for (int i = 0; i < n; i++) {
+			lss >> points[i].x >> points[i].y >> points[i].z;
+		}
+		lss >> h;
+		return PrismPhysics::gen_pcmesh(points, glm::cross(points[2] - points[1], points[1] - points[0]), h, plane_thickness, plane_friction);
+	}
+	return NULL;
+}
+
+LevelStreamer::LevelStreamer(PrismPhysics* physics, uint32_t loader_threads)
+{
+	physicsmgr = physics;
+	loader_pool = new SimpleThreadPooler(loader_threads);
+	loader_pool->run();
+	last_stats_time = std::chrono::steady_clock::now();
+}
+
+LevelStreamer::~LevelStreamer()
+{
+	delete loader_pool;
+	for (LevelChunk* lc : live_chunks) {
+		for (size_t i = lc->physics_inserted; i < lc->pcmeshes.size(); i++) {
+			delete lc->pcmeshes[i];
+		}
+	}
+}
+
+glm::ivec2 LevelStreamer::chunkCoord(glm::vec3 pos)
+{
+	return glm::ivec2(int(floor(pos.x / CHUNK_SIZE)), int(floor(pos.z / CHUNK_SIZE)));
+}
+
+void LevelStreamer::indexLevelFile(std::string lfname, std::streamoff start_offset)
+{
+	level_file = lfname;
+	std::ifstream fr(lfname, std::ios::binary);
+	fr.seekg(start_offset);
+
+	std::string line;
+	LevelChunk* curr_chunk = NULL;
+	size_t entry_count = 0;
+	std::streamoff loffset = fr.tellg();
+	while (std::getline(fr, line)) {
+		std::streamoff lstart = loffset;
+		loffset = fr.tellg();
+		if (line.length() < 4 || line[0] == '#') continue;
+
+		std::string itype = line.substr(0, 4);
+		if (itype == "HIDE" || itype == "KILL") {
+			if (curr_chunk != NULL) curr_chunk->line_offsets.push_back(lstart);
+			continue;
+		}
+
+		std::istringstream lss(line);
+		lss.seekg(4);
+		PolyCollMesh* pcm = parse_geometry_line(lss, itype);
+		if (pcm == NULL) {
+			std::cout << "streamed level entry " << itype << " is not supported, skipping\n";
+			curr_chunk = NULL;
+			continue;
+		}
+		glm::ivec2 cc = chunkCoord(pcm->_center);
+		delete pcm;
+
+		curr_chunk = &chunks[chunk_key(cc)];
+		curr_chunk->coord = cc;
+		curr_chunk->line_offsets.push_back(lstart);
+		entry_count++;
+	}
+	std::cout << "indexed " << entry_count << " entries into " << chunks.size() << " chunks from " << lfname << '\n';
+}
+
+void LevelStreamer::loadChunk(LevelStreamer* streamer, LevelChunk* chunk)
+{
+	std::ifstream fr(streamer->level_file, std::ios::binary);
+	std::string line;
+	std::vector<PolyCollMesh*> pcmeshes;
+	std::vector<bool> visible;
+	for (size_t i = 0; i < chunk->line_offsets.size(); i++) {
+		fr.clear();
+		fr.seekg(chunk->line_offsets[i]);
+		if (!std::getline(fr, line) || line.length() < 4) continue;
+
+		std::string itype = line.substr(0, 4);
+		std::istringstream lss(line);
+		lss.seekg(4);
+		PolyCollMesh* pcm = parse_geometry_line(lss, itype);
+		if (pcm != NULL) {
+			pcmeshes.push_back(pcm);
+			visible.push_back(true);
+			continue;
+		}
+		if (pcmeshes.size() == 0) continue;
+		if (itype == "HIDE") visible.back() = false;
+		if (itype == "KILL") pcmeshes.back()->coll_behav = "kill";
+	}
+
+	std::vector<Mesh> rmeshes;
+	std::vector<std::string> rids;
+	size_t cpu_bytes = 0;
+	size_t gpu_bytes = 0;
+	std::string idprefix = "chunk-" + std::to_string(chunk->coord.x) + "_" + std::to_string(chunk->coord.y) + "-" + std::to_string(chunk->generation) + "-";
+	for (size_t i = 0; i < pcmeshes.size(); i++) {
+		// physics keeps a second copy of every static mesh for the future step
+		cpu_bytes += 2 * pcmesh_bytes(pcmeshes[i]);
+		if (visible[i]) {
+			Mesh rmesh = pcmeshes[i]->gen_mesh();
+			size_t mbytes = rmesh._vertices.size() * sizeof(Vertex) + rmesh._indices.size() * sizeof(uint32_t);
+			cpu_bytes += mbytes;
+			gpu_bytes += mbytes;
+			rmeshes.push_back(rmesh);
+			rids.push_back(idprefix + std::to_string(i));
+		}
+	}
+
+	streamer->chunk_lock.lock();
+	chunk->pcmeshes = pcmeshes;
+	chunk->rmeshes = rmeshes;
+	chunk->rids = rids;
+	chunk->cpu_bytes = cpu_bytes;
+	chunk->gpu_bytes = gpu_bytes;
+	chunk->state = PRISM_CHUNK_LOADED;
+	streamer->chunk_lock.unlock();
+}
+
+void LevelStreamer::evictChunk(LevelChunk* chunk)
+{
+	for (size_t i = 0; i < chunk->pcmeshes.size(); i++) {
+		if (i < chunk->physics_inserted) {
+			physicsmgr->remove_pcmesh(chunk->pcmeshes[i]);
+			lmeshes_changed = true;
+		}
+		else {
+			delete chunk->pcmeshes[i];
+		}
+	}
+	for (size_t i = 0; i < chunk->renderer_inserted; i++) {
+		render_unload_queue.push_back(chunk->rids[i]);
+	}
+	chunk->pcmeshes.clear();
+	chunk->rmeshes.clear();
+	chunk->rids.clear();
+	chunk->physics_inserted = 0;
+	chunk->renderer_inserted = 0;
+	chunk->cpu_bytes = 0;
+	chunk->gpu_bytes = 0;
+	chunk->state = PRISM_CHUNK_INDEXED;
+	stats.evictions++;
+}
+
+void LevelStreamer::update(glm::vec3 focus, bool blocking)
+{
+	std::chrono::steady_clock::time_point ustart = std::chrono::steady_clock::now();
+	lmeshes_changed = false;
+	glm::ivec2 fc = chunkCoord(focus);
+
+	chunk_lock.lock();
+	// chunks still being loaded are dropped on a later tick once the worker is done with them
+	for (size_t i = 0; i < live_chunks.size();) {
+		if (live_chunks[i]->state != PRISM_CHUNK_LOADING && chunk_dist(live_chunks[i]->coord, fc) > UNLOAD_RADIUS) {
+			evictChunk(live_chunks[i]);
+			live_chunks.erase(live_chunks.begin() + i);
+		}
+		else {
+			i++;
+		}
+	}
+
+	// request nearest rings first so the budget goes to the chunks around the focus
+	for (int r = 0; r <= LOAD_RADIUS; r++) {
+		for (int dx = -r; dx <= r; dx++) {
+			for (int dz = -r; dz <= r; dz++) {
+				if (std::max(abs(dx), abs(dz)) != r) continue;
+				auto it = chunks.find(chunk_key(fc + glm::ivec2(dx, dz)));
+				if (it == chunks.end() || it->second.state != PRISM_CHUNK_INDEXED) continue;
+
+				if (live_chunks.size() >= MAX_RESIDENT_CHUNKS) {
+					size_t far_idx = live_chunks.size();
+					int far_dist = r;
+					for (size_t j = 0; j < live_chunks.size(); j++) {
+						int ldist = chunk_dist(live_chunks[j]->coord, fc);
+						if (live_chunks[j]->state != PRISM_CHUNK_LOADING && ldist > far_dist) {
+							far_idx = j;
+							far_dist = ldist;
+						}
+					}
+					if (far_idx == live_chunks.size()) continue;
+					evictChunk(live_chunks[far_idx]);
+					live_chunks.erase(live_chunks.begin() + far_idx);
+				}
+
+				LevelChunk* lc = &it->second;
+				lc->state = PRISM_CHUNK_LOADING;
+				lc->generation++;
+				live_chunks.push_back(lc);
+				loader_pool->add_task(&LevelStreamer::loadChunk, this, lc);
+				stats.loads++;
+			}
+		}
+	}
+	chunk_lock.unlock();
+
+	if (blocking) loader_pool->wait_till_done();
+
+	size_t inserts = 0;
+	stats.cpu_bytes = 0;
+	stats.gpu_bytes = 0;
+	chunk_lock.lock();
+	for (LevelChunk* lc : live_chunks) {
+		if (lc->state == PRISM_CHUNK_LOADED) {
+			while (lc->physics_inserted < lc->pcmeshes.size() && (blocking || inserts < MAX_PHYSICS_INSERTS_PER_TICK)) {
+				physicsmgr->add_pcmesh(lc->pcmeshes[lc->physics_inserted]);
+				lc->physics_inserted++;
+				inserts++;
+			}
+			if (lc->physics_inserted == lc->pcmeshes.size()) lc->state = PRISM_CHUNK_RESIDENT;
+		}
+		stats.cpu_bytes += lc->cpu_bytes;
+		stats.gpu_bytes += lc->gpu_bytes;
+	}
+	chunk_lock.unlock();
+	if (inserts > 0) lmeshes_changed = true;
+
+	stats.resident_chunks = live_chunks.size();
+	stats.peak_resident_chunks = std::max(stats.peak_resident_chunks, stats.resident_chunks);
+	stats.peak_cpu_bytes = std::max(stats.peak_cpu_bytes, stats.cpu_bytes);
+	stats.peak_gpu_bytes = std::max(stats.peak_gpu_bytes, stats.gpu_bytes);
+
+	std::chrono::steady_clock::time_point uend = std::chrono::steady_clock::now();
+	float update_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(uend - ustart).count();
+	if (!blocking) {
+		stats.max_update_ms = std::max(stats.max_update_ms, update_ms);
+		if (update_ms > HITCH_THRESHOLD_MS) stats.update_hitches++;
+	}
+	if (std::chrono::duration_cast<std::chrono::milliseconds>(uend - last_stats_time).count() >= STATS_INTERVAL_MS) {
+		printStats();
+		last_stats_time = uend;
+	}
+}
+
+void LevelStreamer::pushToRenderer(PrismRenderer* renderer)
+{
+	std::chrono::steady_clock::time_point pstart = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < MAX_RENDER_REMOVES_PER_FRAME && render_unload_queue.size() > 0; i++) {
+		renderer->unloadRenderObj(render_unload_queue.back());
+		render_unload_queue.pop_back();
+	}
+
+	size_t adds = 0;
+	chunk_lock.lock();
+	for (LevelChunk* lc : live_chunks) {
+		if (lc->state != PRISM_CHUNK_LOADED && lc->state != PRISM_CHUNK_RESIDENT) continue;
+		while (lc->renderer_inserted < lc->rmeshes.size() && adds < MAX_RENDER_INSERTS_PER_FRAME) {
+			renderer->addRenderObj(
+				lc->rids[lc->renderer_inserted],
+				lc->rmeshes[lc->renderer_inserted],
+				"textures/basic_tile.png",
+				"textures/flat_nmap.png",
+				"textures/basic_tile_se.png",
+				"linear",
+				glm::mat4(1)
+			);
+			// the renderer keeps its own copy
+			lc->rmeshes[lc->renderer_inserted] = Mesh();
+			lc->renderer_inserted++;
+			adds++;
+		}
+	}
+	chunk_lock.unlock();
+
+	float push_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - pstart).count();
+	stats.max_push_ms = std::max(stats.max_push_ms, push_ms);
+	if (push_ms > HITCH_THRESHOLD_MS) stats.push_hitches++;
+}
+
+void LevelStreamer::printStats()
+{
+	std::cout << "streamer: " << stats.resident_chunks << "/" << MAX_RESIDENT_CHUNKS << " chunks (peak " << stats.peak_resident_chunks << ") of " << chunks.size()
+		<< ", loads " << stats.loads << ", evictions " << stats.evictions
+		<< ", cpu " << stats.cpu_bytes / 1024 << "KB (peak " << stats.peak_cpu_bytes / 1024 << "KB)"
+		<< ", gpu " << stats.gpu_bytes / 1024 << "KB (peak " << stats.peak_gpu_bytes / 1024 << "KB)"
+		<< ", max update " << stats.max_update_ms << "ms (" << stats.update_hitches << " hitches)"
+		<< ", max push " << stats.max_push_ms << "ms (" << stats.push_hitches << " hitches)\n";
+	stats.max_update_ms = 0;
+	stats.max_push_ms = 0;
+}
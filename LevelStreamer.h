@@ -0,0 +1,81 @@
+#pragma once
+#include "PrismPhysics.h"
+#include "PrismRenderer.h"
+#include "SimpleThreadPooler.h"
+
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+
+#define PRISM_CHUNK_INDEXED 0
+#define PRISM_CHUNK_LOADING 1
+#define PRISM_CHUNK_LOADED 2
+#define PRISM_CHUNK_RESIDENT 3
+
+struct LevelChunk {
+	glm::ivec2 coord = glm::ivec2(0);
+	int state = PRISM_CHUNK_INDEXED;
+	uint32_t generation = 0;
+	std::vector<std::streamoff> line_offsets;
+
+	std::vector<PolyCollMesh*> pcmeshes;
+	std::vector<Mesh> rmeshes;
+	std::vector<std::string> rids;
+	size_t physics_inserted = 0;
+	size_t renderer_inserted = 0;
+	size_t cpu_bytes = 0;
+	size_t gpu_bytes = 0;
+};
+
+struct StreamStats {
+	size_t resident_chunks = 0;
+	size_t peak_resident_chunks = 0;
+	size_t loads = 0;
+	size_t evictions = 0;
+	size_t cpu_bytes = 0;
+	size_t gpu_bytes = 0;
+	size_t peak_cpu_bytes = 0;
+	size_t peak_gpu_bytes = 0;
+	float max_update_ms = 0;
+	float max_push_ms = 0;
+	size_t update_hitches = 0;
+	size_t push_hitches = 0;
+};
+
+class LevelStreamer
+{
+public:
+	float CHUNK_SIZE = 64.0f;
+	int LOAD_RADIUS = 2;
+	int UNLOAD_RADIUS = 3;
+	size_t MAX_RESIDENT_CHUNKS = 25;
+	size_t MAX_PHYSICS_INSERTS_PER_TICK = 8;
+	size_t MAX_RENDER_INSERTS_PER_FRAME = 4;
+	size_t MAX_RENDER_REMOVES_PER_FRAME = 16;
+	float HITCH_THRESHOLD_MS = 2.0f;
+	int STATS_INTERVAL_MS = 5000;
+
+	StreamStats stats;
+	bool lmeshes_changed = false;
+
+	LevelStreamer(PrismPhysics* physics, uint32_t loader_threads = 1);
+	~LevelStreamer();
+	void indexLevelFile(std::string lfname, std::streamoff start_offset = 0);
+	void update(glm::vec3 focus, bool blocking = false);
+	void pushToRenderer(PrismRenderer* renderer);
+	void printStats();
+private:
+	PrismPhysics* physicsmgr;
+	SimpleThreadPooler* loader_pool;
+	std::string level_file;
+	std::unordered_map<int64_t, LevelChunk> chunks;
+	std::vector<LevelChunk*> live_chunks;
+	std::vector<std::string> render_unload_queue;
+	std::mutex chunk_lock;
+	std::chrono::steady_clock::time_point last_stats_time;
+
+	static void loadChunk(LevelStreamer* streamer, LevelChunk* chunk);
+	void evictChunk(LevelChunk* chunk);
+	glm::ivec2 chunkCoord(glm::vec3 pos);
+};
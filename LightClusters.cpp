@@ -0,0 +1,247 @@
+#include "LightClusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PRISM_CLUSTERS_SSE
+#endif
+
+// lights per bounding task, the pool's task ring holds 1000
+static const size_t BOUND_CHUNK = 2048;
+static const int TILE_PLANES = LIGHT_CLUSTER_X + 1 + LIGHT_CLUSTER_Y + 1;
+
+LightClusterer::LightClusterer(SimpleThreadPooler* pool, uint32_t threads)
+{
+	thread_pool = pool;
+	threadCount = std::max(threads, 1u);
+	ranges.assign(LIGHT_CLUSTER_COUNT, glm::uvec2(0));
+}
+
+void LightClusterer::makeTilePlanes(const ClusterView& view, glm::vec4* planes)
+{
+	// boundary j of the columns is x_ndc = -1 + 2j/X, so the plane row0 - x_j * row3 with the positive side to the
+	// right of it. Rows likewise from row1
+	glm::mat4 rows = glm::transpose(view.viewproj);
+	for (int j = 0; j <= LIGHT_CLUSTER_X; j++) {
+		float x = -1.0f + 2.0f * j / LIGHT_CLUSTER_X;
+		planes[j] = rows[0] - x * rows[3];
+	}
+	for (int j = 0; j <= LIGHT_CLUSTER_Y; j++) {
+		float y = -1.0f + 2.0f * j / LIGHT_CLUSTER_Y;
+		planes[LIGHT_CLUSTER_X + 1 + j] = rows[1] - y * rows[3];
+	}
+	for (int p = 0; p < TILE_PLANES; p++) planes[p] /= glm::length(glm::vec3(planes[p]));
+}
+
+int LightClusterer::depthSlice(const ClusterView& view, float depth)
+{
+	if (depth <= LIGHT_CLUSTER_NEAR) return 0;
+	int slice = int(std::log(depth / LIGHT_CLUSTER_NEAR) / std::log(view.farPlane / LIGHT_CLUSTER_NEAR) * LIGHT_CLUSTER_Z);
+	return std::min(slice, LIGHT_CLUSTER_Z - 1);
+}
+
+uint32_t LightClusterer::clusterIndex(const ClusterView& view, glm::vec3 pos)
+{
+	glm::vec4 clip = view.viewproj * glm::vec4(pos, 1.0f);
+	glm::vec2 ndc = glm::vec2(clip) / clip.w;
+	int x = glm::clamp(int(std::floor((ndc.x * 0.5f + 0.5f) * LIGHT_CLUSTER_X)), 0, LIGHT_CLUSTER_X - 1);
+	int y = glm::clamp(int(std::floor((ndc.y * 0.5f + 0.5f) * LIGHT_CLUSTER_Y)), 0, LIGHT_CLUSTER_Y - 1);
+	int z = depthSlice(view, glm::dot(pos - view.camPos, view.camDir));
+	return uint32_t((z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x);
+}
+
+void LightClusterer::bin(const ClusterView& view, const GPULight* lights, size_t count)
+{
+	currentView = view;
+	currentLights = lights;
+	makeTilePlanes(view, tilePlanes);
+	lx.resize(count);
+	ly.resize(count);
+	lz.resize(count);
+	lr.resize(count);
+	lightTiles.resize(count);
+	lightSlices.resize(count);
+	ranges.resize(LIGHT_CLUSTER_COUNT);
+
+	for (size_t start = 0; start < count; start += BOUND_CHUNK) {
+		thread_pool->add_task(&LightClusterer::boundLights, this, start, std::min(start + BOUND_CHUNK, count));
+	}
+	thread_pool->wait_till_done();
+
+	// every task owns a run of whole depth slices, so its clusters and their lists are contiguous
+	uint32_t tasks = std::min(threadCount * 2, uint32_t(LIGHT_CLUSTER_Z));
+	sliceIndices.resize(tasks);
+	for (uint32_t t = 0; t < tasks; t++) {
+		thread_pool->add_task(&LightClusterer::fillSlices, this, t, t * LIGHT_CLUSTER_Z / tasks, (t + 1) * LIGHT_CLUSTER_Z / tasks);
+	}
+	thread_pool->wait_till_done();
+
+	size_t total = 0;
+	for (uint32_t t = 0; t < tasks; t++) {
+		size_t first = size_t(t * LIGHT_CLUSTER_Z / tasks) * LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y;
+		size_t end = size_t((t + 1) * LIGHT_CLUSTER_Z / tasks) * LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y;
+		for (size_t c = first; c < end; c++) ranges[c].x += uint32_t(total);
+		total += sliceIndices[t].size();
+	}
+	size_t kept = std::min(total, max_indices);
+	indices.resize(kept);
+	droppedIndices = total - kept;
+	size_t offset = 0;
+	for (uint32_t t = 0; t < tasks && offset < kept; t++) {
+		size_t n = std::min(sliceIndices[t].size(), kept - offset);
+		if (n > 0) memcpy(indices.data() + offset, sliceIndices[t].data(), n * sizeof(uint32_t));
+		offset += n;
+	}
+	if (droppedIndices > 0) {
+		for (glm::uvec2& range : ranges) {
+			if (range.x >= kept) range = glm::uvec2(0);
+			else range.y = uint32_t(std::min(size_t(range.y), kept - range.x));
+		}
+	}
+}
+
+void LightClusterer::boundLights(LightClusterer* lc, size_t start, size_t end)
+{
+	const glm::vec4* planes = lc->tilePlanes;
+	float* lx = lc->lx.data();
+	float* ly = lc->ly.data();
+	float* lz = lc->lz.data();
+	float* lr = lc->lr.data();
+	for (size_t i = start; i < end; i++) {
+		const GPULight& light = lc->currentLights[i];
+		lx[i] = light.pos.x;
+		ly[i] = light.pos.y;
+		lz[i] = light.pos.z;
+		// lights that add no diffuse light or have no range touch no cluster
+		lr[i] = ((light.flags.x & PRISM_LIGHT_DIFFUSE_FLAG) && light.props.y > 0) ? light.props.y : -1.0f;
+	}
+
+	// a light lies fully right of the column planes up to its first tile and fully left of those past its last.
+	// Within the frustum's positive depth the planes are nested, so counting both gives the tile range
+	size_t i = start;
+#ifdef PRISM_CLUSTERS_SSE
+	if (lc->use_simd) {
+		__m128 one = _mm_set1_ps(1.0f);
+		for (; i + 4 <= end; i += 4) {
+			__m128 cx = _mm_loadu_ps(lx + i);
+			__m128 cy = _mm_loadu_ps(ly + i);
+			__m128 cz = _mm_loadu_ps(lz + i);
+			__m128 r = _mm_loadu_ps(lr + i);
+			__m128 nr = _mm_sub_ps(_mm_setzero_ps(), r);
+			__m128 cnt[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+			for (int p = 0; p < TILE_PLANES; p++) {
+				__m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), cx), _mm_mul_ps(_mm_set1_ps(planes[p].y), cy)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), cz), _mm_set1_ps(planes[p].w)));
+				int k = p <= LIGHT_CLUSTER_X ? 0 : 2;
+				cnt[k] = _mm_add_ps(cnt[k], _mm_and_ps(_mm_cmpge_ps(s, r), one));
+				cnt[k + 1] = _mm_add_ps(cnt[k + 1], _mm_and_ps(_mm_cmple_ps(s, nr), one));
+			}
+			float counts[4][4];
+			for (int k = 0; k < 4; k++) _mm_storeu_ps(counts[k], cnt[k]);
+			for (int l = 0; l < 4; l++) {
+				glm::ivec4 lcnt = glm::ivec4(counts[0][l], counts[1][l], counts[2][l], counts[3][l]);
+				storeLightRange(lc, i + l, lcnt);
+			}
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		glm::ivec4 cnt = glm::ivec4(0);
+		for (int p = 0; p < TILE_PLANES; p++) {
+			float s = (planes[p].x * lx[i] + planes[p].y * ly[i]) + (planes[p].z * lz[i] + planes[p].w);
+			int k = p <= LIGHT_CLUSTER_X ? 0 : 2;
+			cnt[k] += s >= lr[i];
+			cnt[k + 1] += s <= -lr[i];
+		}
+		storeLightRange(lc, i, cnt);
+	}
+}
+
+void LightClusterer::storeLightRange(LightClusterer* lc, size_t i, glm::ivec4 cnt)
+{
+	// cnt holds the column planes the light is fully right and fully left of, then the same for the rows
+	const ClusterView& view = lc->currentView;
+	float r = lc->lr[i];
+	float depth = glm::dot(glm::vec3(lc->lx[i], lc->ly[i], lc->lz[i]) - view.camPos, view.camDir);
+	glm::ivec4 tiles = glm::ivec4(
+		std::max(cnt[0] - 1, 0), std::min(LIGHT_CLUSTER_X - cnt[1], LIGHT_CLUSTER_X - 1),
+		std::max(cnt[2] - 1, 0), std::min(LIGHT_CLUSTER_Y - cnt[3], LIGHT_CLUSTER_Y - 1)
+	);
+	// behind the eye the planes aren't nested anymore, a light reaching across it gets every tile
+	if (depth - r < 0) tiles = glm::ivec4(0, LIGHT_CLUSTER_X - 1, 0, LIGHT_CLUSTER_Y - 1);
+	bool touches = r >= 0 && depth + r >= 0 && depth - r <= view.farPlane && tiles.x <= tiles.y && tiles.z <= tiles.w;
+	lc->lightTiles[i] = touches ? tiles : glm::ivec4(0, -1, 0, -1);
+	lc->lightSlices[i] = touches ? glm::ivec2(depthSlice(view, depth - r), depthSlice(view, depth + r)) : glm::ivec2(0, -1);
+}
+
+void LightClusterer::fillSlices(LightClusterer* lc, uint32_t task, uint32_t zstart, uint32_t zend)
+{
+	// counts first, then the task's offsets, then the indices in light order. bin() moves the offsets to where
+	// the task's list lands in indices
+	const int slice_clusters = LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y;
+	glm::uvec2* ranges = lc->ranges.data();
+	std::vector<uint32_t>& out = lc->sliceIndices[task];
+	for (size_t c = size_t(zstart) * slice_clusters; c < size_t(zend) * slice_clusters; c++) ranges[c] = glm::uvec2(0);
+
+	uint32_t count = uint32_t(lc->lightTiles.size());
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t i = 0; i < count; i++) {
+			int z0 = std::max(lc->lightSlices[i].x, int(zstart));
+			int z1 = std::min(lc->lightSlices[i].y, int(zend) - 1);
+			if (z0 > z1) continue;
+			const glm::ivec4& tiles = lc->lightTiles[i];
+			for (int z = z0; z <= z1; z++) {
+				for (int y = tiles.z; y <= tiles.w; y++) {
+					glm::uvec2* row = ranges + (z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X;
+					for (int x = tiles.x; x <= tiles.y; x++) {
+						if (pass == 1) out[row[x].x + row[x].y] = i;
+						row[x].y++;
+					}
+				}
+			}
+		}
+		if (pass == 1) break;
+		uint32_t offset = 0;
+		for (size_t c = size_t(zstart) * slice_clusters; c < size_t(zend) * slice_clusters; c++) {
+			ranges[c].x = offset;
+			offset += ranges[c].y;
+			ranges[c].y = 0;
+		}
+		out.resize(offset);
+	}
+}
+
+std::vector<std::vector<uint32_t>> LightClusterer::binReference(const ClusterView& view, const GPULight* lights, size_t count)
+{
+	glm::vec4 planes[TILE_PLANES];
+	makeTilePlanes(view, planes);
+	std::vector<std::vector<uint32_t>> lists(LIGHT_CLUSTER_COUNT);
+	for (int z = 0; z < LIGHT_CLUSTER_Z; z++) {
+		for (int y = 0; y < LIGHT_CLUSTER_Y; y++) {
+			for (int x = 0; x < LIGHT_CLUSTER_X; x++) {
+				const glm::vec4* bounds[4] = { &planes[x], &planes[x + 1], &planes[LIGHT_CLUSTER_X + 1 + y], &planes[LIGHT_CLUSTER_X + 2 + y] };
+				std::vector<uint32_t>& list = lists[(z * LIGHT_CLUSTER_Y + y) * LIGHT_CLUSTER_X + x];
+				for (uint32_t i = 0; i < count; i++) {
+					const GPULight& light = lights[i];
+					if (!(light.flags.x & PRISM_LIGHT_DIFFUSE_FLAG) || light.props.y <= 0) continue;
+					glm::vec3 c = glm::vec3(light.pos);
+					float r = light.props.y;
+					float depth = glm::dot(c - view.camPos, view.camDir);
+					if (depth + r < 0 || depth - r > view.farPlane) continue;
+					if (z < depthSlice(view, depth - r) || z > depthSlice(view, depth + r)) continue;
+					if (depth - r >= 0) {
+						float s[4];
+						for (int b = 0; b < 4; b++) s[b] = (bounds[b]->x * c.x + bounds[b]->y * c.y) + (bounds[b]->z * c.z + bounds[b]->w);
+						// inside the left and bottom boundaries, not fully past the right and top ones
+						if (!(s[0] > -r) || !(s[1] < r) || !(s[2] > -r) || !(s[3] < r)) continue;
+					}
+					list.push_back(i);
+				}
+			}
+		}
+	}
+	return lists;
+}
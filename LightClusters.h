@@ -0,0 +1,67 @@
+#pragma once
+#include "vkstructs.h"
+#include "SimpleThreadPooler.h"
+
+#include <vector>
+#include <cstdint>
+
+// the view frustum is split into LIGHT_CLUSTER_X x LIGHT_CLUSTER_Y tiles in NDC and LIGHT_CLUSTER_Z slices of view
+// depth, exponentially spaced between LIGHT_CLUSTER_NEAR and the far plane. finalimage.frag has the same defines
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z)
+#define LIGHT_CLUSTER_NEAR 1.0f
+
+// what the lights are binned against, all of it is in GPUCameraData so the shader finds the same cluster
+struct ClusterView {
+	glm::mat4 viewproj;
+	glm::vec3 camPos;
+	glm::vec3 camDir;
+	float farPlane;
+};
+
+// bins light spheres (pos, props.y as the radius) into the clusters they touch. Column and row tiles are bounded by
+// planes through the eye, a light's tile range is found by counting the planes it lies fully on one side of
+class LightClusterer
+{
+public:
+	// explicit SSE for the plane tests, the scalar loop is kept for the test's comparison
+	bool use_simd = true;
+	// indices past this are dropped and the clusters they belonged to shortened
+	size_t max_indices = SIZE_MAX;
+
+	// cluster c's lights are indices[ranges[c].x .. ranges[c].x + ranges[c].y), clusters are ordered x, then y, then z
+	std::vector<glm::uvec2> ranges;
+	std::vector<uint32_t> indices;
+	// lights dropped by the last bin() because indices was full
+	size_t droppedIndices = 0;
+
+	LightClusterer(SimpleThreadPooler* pool, uint32_t threads);
+	void bin(const ClusterView& view, const GPULight* lights, size_t count);
+	static uint32_t clusterIndex(const ClusterView& view, glm::vec3 pos);
+	// one sphere against the planes of every cluster, bin() has to give the same lists
+	static std::vector<std::vector<uint32_t>> binReference(const ClusterView& view, const GPULight* lights, size_t count);
+
+private:
+	SimpleThreadPooler* thread_pool;
+	uint32_t threadCount;
+
+	// view of the current bin() call, column planes then row planes, normalized
+	glm::vec4 tilePlanes[LIGHT_CLUSTER_X + 1 + LIGHT_CLUSTER_Y + 1];
+	ClusterView currentView;
+	const GPULight* currentLights = NULL;
+
+	// light spheres, structure-of-arrays so the plane tests take 4 lights per SSE register
+	std::vector<float> lx, ly, lz, lr;
+	// x0, x1, y0, y1 tiles and z0, z1 slices per light, empty ranges for lights that touch no cluster
+	std::vector<glm::ivec4> lightTiles;
+	std::vector<glm::ivec2> lightSlices;
+	std::vector<std::vector<uint32_t>> sliceIndices;
+
+	static void makeTilePlanes(const ClusterView& view, glm::vec4* planes);
+	static int depthSlice(const ClusterView& view, float depth);
+	static void boundLights(LightClusterer* lc, size_t start, size_t end);
+	static void storeLightRange(LightClusterer* lc, size_t i, glm::ivec4 cnt);
+	static void fillSlices(LightClusterer* lc, uint32_t task, uint32_t zstart, uint32_t zend);
+};
@@ -6,11 +6,16 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
+#include "rapidjson/schema.h"
+#include "rapidjson/error/en.h"
 
 using namespace collutils;
 
@@ -18,6 +23,252 @@ static inline glm::vec3 jlist_to_vec3(rapidjson::Value& jval) {
     return glm::vec3(jval[0].GetFloat(), jval[1].GetFloat(), jval[2].GetFloat());
 };
 
+static const char* LEVEL_JSON_SCHEMA = R"({
+    "definitions": {
+        "vec3": { "type": "array", "items": { "type": "number" }, "minItems": 3, "maxItems": 3 },
+        "vec3list": { "type": "array", "items": { "$ref": "#/definitions/vec3" }, "minItems": 3 },
+        "animstep": {
+            "type": "object",
+            "required": ["anim_time", "init_pos", "final_pos"],
+            "properties": {
+                "anim_time": { "type": "integer", "minimum": 0 },
+                "init_pos": { "$ref": "#/definitions/vec3" },
+                "final_pos": { "$ref": "#/definitions/vec3" },
+                "rot_axis": { "$ref": "#/definitions/vec3" },
+                "init_angle": { "type": "number" },
+                "final_angle": { "type": "number" },
+                "init_scale": { "$ref": "#/definitions/vec3" },
+                "final_scale": { "$ref": "#/definitions/vec3" }
+            }
+        },
+        "animevent": {
+            "type": "object",
+            "required": ["time", "name"],
+            "properties": {
+                "time": { "type": "integer", "minimum": 0 },
+                "name": { "type": "string" }
+            }
+        },
+        "anim": {
+            "type": "object",
+            "required": ["name", "steps"],
+            "properties": {
+                "name": { "type": "string" },
+                "loop": { "type": "boolean" },
+                "blend_ms": { "type": "integer", "minimum": 0 },
+                "steps": { "type": "array", "items": { "$ref": "#/definitions/animstep" } },
+                "events": { "type": "array", "items": { "$ref": "#/definitions/animevent" } }
+            }
+        },
+        "display_model": {
+            "type": "object",
+            "required": ["model_path", "texture_path", "normal_map_path", "se_map_path", "init_loc", "init_scale"],
+            "properties": {
+                "model_path": { "type": "string" },
+                "texture_path": { "type": "string" },
+                "normal_map_path": { "type": "string" },
+                "se_map_path": { "type": "string" },
+                "init_loc": { "$ref": "#/definitions/vec3" },
+                "init_scale": { "$ref": "#/definitions/vec3" }
+            }
+        }
+    },
+    "type": "array",
+    "items": {
+        "type": "object",
+        "required": ["type"],
+        "properties": {
+            "type": { "enum": ["geometry", "light"] },
+            "geo_type": { "enum": ["plane_uv", "plane_np", "cylinder_uv", "cylinder_np"] },
+            "center": { "$ref": "#/definitions/vec3" },
+            "u": { "$ref": "#/definitions/vec3" },
+            "v": { "$ref": "#/definitions/vec3" },
+            "ulen": { "type": "number" },
+            "vlen": { "type": "number" },
+            "tlen": { "type": "number" },
+            "tf_verts": { "$ref": "#/definitions/vec3list" },
+            "epsilon": { "type": "number" },
+            "friction": { "type": "number" },
+            "hide": { "type": "boolean" },
+            "collision_behaviour": { "enum": ["physics", "kill", "animate", "animate_self"] },
+            "collision_behaviour_args": { "type": "array", "items": { "type": "string" } },
+            "anims": { "type": "array", "items": { "$ref": "#/definitions/anim" } },
+            "anim_parent": { "type": "integer", "minimum": 0 },
+            "display_model": { "$ref": "#/definitions/display_model" },
+            "position": { "$ref": "#/definitions/vec3" },
+            "direction": { "$ref": "#/definitions/vec3" },
+            "color": { "$ref": "#/definitions/vec3" },
+            "distance": { "type": "number" },
+            "shadowcasting": { "type": "boolean" },
+            "shadow_type": { "enum": ["directional", "point"] },
+            "fov": { "type": "number" },
+            "aspect": { "type": "number" }
+        }
+    }
+})";
+
+// fields the schema can't make conditional on geo_type/shadow_type
+static const std::unordered_map<std::string, std::vector<const char*>> LEVEL_JSON_REQUIRED = {
+    { "geometry", { "geo_type", "epsilon", "friction" } },
+    { "plane_uv", { "center", "u", "v", "ulen", "vlen" } },
+    { "plane_np", { "tf_verts" } },
+    { "cylinder_uv", { "center", "u", "v", "ulen", "vlen", "tlen" } },
+    { "cylinder_np", { "tf_verts", "tlen" } },
+    { "light", { "position", "color", "shadowcasting" } },
+    { "directional", { "direction", "fov", "aspect" } }
+};
+
+static rapidjson::Document parse_level_schema() {
+    rapidjson::Document sdoc;
+    sdoc.Parse(LEVEL_JSON_SCHEMA);
+    return sdoc;
+}
+
+// built once on first use, the schema document keeps what it needs so the parsed schema can go right after
+static const rapidjson::SchemaDocument& get_level_schema() {
+    static const rapidjson::SchemaDocument level_schema(parse_level_schema());
+    return level_schema;
+}
+
+static std::string json_error_location(std::vector<char>& jbuf, size_t offset) {
+    size_t line = 1, col = 1;
+    for (size_t i = 0; i < offset && i < jbuf.size(); i++) {
+        if (jbuf[i] == '\n') {
+            line++;
+            col = 1;
+        }
+        else {
+            col++;
+        }
+    }
+    return std::to_string(line) + ":" + std::to_string(col);
+}
+
+static void check_json_fields(std::string cfname, uint32_t eidx, rapidjson::Value& entry, std::string group) {
+    for (const char* field : LEVEL_JSON_REQUIRED.at(group)) {
+        if (!entry.HasMember(field)) {
+            throw std::runtime_error(cfname + ": entry " + std::to_string(eidx) + " (" + group + ") is missing \"" + field + "\"");
+        }
+    }
+}
+
+static PolyCollMesh* build_json_geometry(rapidjson::Value& tmpgd) {
+    PolyCollMesh* gen_pcm = NULL;
+    std::string geo_type = tmpgd["geo_type"].GetString();
+    if (geo_type == "plane_uv") {
+        gen_pcm = PrismPhysics::gen_pcmesh(
+            jlist_to_vec3(tmpgd["center"]),
+            jlist_to_vec3(tmpgd["u"]),
+            jlist_to_vec3(tmpgd["v"]),
+            tmpgd["ulen"].GetFloat(),
+            tmpgd["vlen"].GetFloat(),
+            tmpgd["epsilon"].GetFloat(),
+            tmpgd["friction"].GetFloat()
+        );
+    }
+    else if (geo_type == "plane_np") {
+        std::vector<glm::vec3> tfverts(tmpgd["tf_verts"].Size());
+        for (uint32_t j = 0; j < tmpgd["tf_verts"].Size(); j++) {
+            tfverts[j] = jlist_to_vec3(tmpgd["tf_verts"][j]);
+        }
+        gen_pcm = PrismPhysics::gen_pcmesh(
+            tfverts,
+            tmpgd["epsilon"].GetFloat(),
+            tmpgd["friction"].GetFloat()
+        );
+    }
+    else if (geo_type == "cylinder_uv") {
+        gen_pcm = PrismPhysics::gen_pcmesh(
+            jlist_to_vec3(tmpgd["center"]),
+            jlist_to_vec3(tmpgd["u"]),
+            jlist_to_vec3(tmpgd["v"]),
+            tmpgd["ulen"].GetFloat(),
+            tmpgd["vlen"].GetFloat(),
+            tmpgd["tlen"].GetFloat(),
+            tmpgd["epsilon"].GetFloat(),
+            tmpgd["friction"].GetFloat()
+        );
+    }
+    else {
+        std::vector<glm::vec3> tfverts(tmpgd["tf_verts"].Size());
+        for (uint32_t j = 0; j < tmpgd["tf_verts"].Size(); j++) {
+            tfverts[j] = jlist_to_vec3(tmpgd["tf_verts"][j]);
+        }
+        gen_pcm = PrismPhysics::gen_pcmesh(
+            tfverts,
+            glm::cross(tfverts[2] - tfverts[1], tfverts[1] - tfverts[0]),
+            tmpgd["tlen"].GetFloat(),
+            tmpgd["epsilon"].GetFloat(),
+            tmpgd["friction"].GetFloat()
+        );
+    }
+
+    if (tmpgd.HasMember("anims")) {
+        for (uint32_t k = 0; k < tmpgd["anims"].Size(); k++) {
+            rapidjson::Value& tmpad = tmpgd["anims"][k];
+            BoneAnimData tmp_bad;
+            tmp_bad.name = tmpad["name"].GetString();
+            tmp_bad.loop_anim = tmpad.HasMember("loop") && tmpad["loop"].GetBool();
+            tmp_bad.total_time = 0;
+            for (uint32_t sti = 0; sti < tmpad["steps"].Size(); sti++) {
+                rapidjson::Value& tmpst = tmpad["steps"][sti];
+                BoneAnimStep tmp_bas;
+                tmp_bas.stepduration_ms = tmpst["anim_time"].GetInt();
+                tmp_bas.initPos = jlist_to_vec3(tmpst["init_pos"]);
+                tmp_bas.finalPos = jlist_to_vec3(tmpst["final_pos"]);
+                if (tmpst.HasMember("rot_axis")) tmp_bas.rotAxis = jlist_to_vec3(tmpst["rot_axis"]);
+                if (tmpst.HasMember("init_angle")) tmp_bas.initAngle = glm::radians(tmpst["init_angle"].GetFloat());
+                if (tmpst.HasMember("final_angle")) tmp_bas.finalAngle = glm::radians(tmpst["final_angle"].GetFloat());
+                if (tmpst.HasMember("init_scale")) tmp_bas.initScale = jlist_to_vec3(tmpst["init_scale"]);
+                if (tmpst.HasMember("final_scale")) tmp_bas.finalScale = jlist_to_vec3(tmpst["final_scale"]);
+                tmp_bad.steps.push_back(tmp_bas);
+                tmp_bad.total_time += tmp_bas.stepduration_ms;
+            }
+            if (tmpad.HasMember("blend_ms")) tmp_bad.blend_ms = tmpad["blend_ms"].GetInt();
+            if (tmpad.HasMember("events")) {
+                for (uint32_t ei = 0; ei < tmpad["events"].Size(); ei++) {
+                    AnimEvent tmp_aev;
+                    tmp_aev.time = tmpad["events"][ei]["time"].GetInt();
+                    tmp_aev.name = tmpad["events"][ei]["name"].GetString();
+                    tmp_bad.events.push_back(tmp_aev);
+                }
+            }
+            gen_pcm->anims[tmp_bad.name] = tmp_bad;
+            if (tmp_bad.loop_anim) {
+                gen_pcm->running_anims.push_back(tmp_bad.name);
+            }
+        }
+    }
+
+    if (tmpgd.HasMember("anim_parent")) {
+        gen_pcm->anim_parent = tmpgd["anim_parent"].GetInt();
+    }
+
+    if (tmpgd.HasMember("collision_behaviour")) {
+        std::string cbehav = tmpgd["collision_behaviour"].GetString();
+        if (cbehav == "kill") {
+            gen_pcm->coll_behav = "kill";
+        }
+        else if (cbehav == "animate" || cbehav == "animate_self") {
+            // same as RRAT/RAOT in the text format, the anim only runs once triggered
+            gen_pcm->coll_behav = (cbehav == "animate") ? "animremote" : "animself";
+            if (tmpgd.HasMember("collision_behaviour_args")) {
+                for (uint32_t cai = 0; cai < tmpgd["collision_behaviour_args"].Size(); cai++) {
+                    gen_pcm->coll_behav_args.push_back(tmpgd["collision_behaviour_args"][cai].GetString());
+                }
+            }
+            gen_pcm->running_anims.clear();
+        }
+    }
+    return gen_pcm;
+}
+
+static void build_json_geometry_range(std::vector<rapidjson::Value*>* gentries, std::vector<PolyCollMesh*>* built, size_t gstart, size_t gend) {
+    for (size_t i = gstart; i < gend; i++) {
+        (*built)[i] = build_json_geometry(*(*gentries)[i]);
+    }
+}
+
 void gen_grapple_verts(glm::vec3 pcen, glm::vec3 gpoint, MaintainedMesh* ghookm, bool never_filled) {
     
     if (never_filled) {
@@ -135,22 +386,167 @@ void gen_grapple_verts(glm::vec3 pcen, glm::vec3 gpoint, MaintainedMesh* ghookm,
     ghookm->_vertices[23].pos = gpoint - i - j;
     ghookm->_vertices[23].normal = ghookm->_vertices[20].normal;
     ghookm->_vertices[23].texCoord = glm::vec2(0, 0);
-    
+    ghookm->mark_dirty();
 }
 
-LogicManager::LogicManager(PrismInputs* ipmgr, PrismAudioManager* audman, int logicpolltime_ms)
+LogicManager::LogicManager(PrismInputs* ipmgr, PrismAudioManager* audman, int logicpolltime_ms, std::string level_path)
 {
 	inputmgr = ipmgr;
     audiomgr = audman;
+    levelPath = level_path;
     if (logicpolltime_ms != 0) logicPollTime = logicpolltime_ms;
     init();
 }
 
+void LogicManager::setPrintStats(bool print_stats)
+{
+    physicsmgr->print_step_stats = print_stats;
+    particles->print_step_stats = print_stats;
+}
+
 void LogicManager::parseCollDataFile(std::string cfname)
 {
-    std::ifstream fr(cfname);
-    std::string line;
-    while (std::getline(fr, line)) {
+    levelEntities = readLevelEntities(cfname);
+    for (LevelEntity& ent : levelEntities) {
+        addLevelEntity(ent);
+    }
+}
+
+size_t LogicManager::placeLevelMesh(PolyCollMesh* pcm, int slot)
+{
+    if (slot < 0) {
+        physicsmgr->add_pcmesh(pcm);
+        sb_visible_flags.push_back(true);
+        return physicsmgr->lmeshes->size() - 1;
+    }
+    physicsmgr->replace_pcmesh(slot, pcm);
+    sb_visible_flags[slot] = true;
+    return slot;
+}
+
+void LogicManager::queueLevelMeshForRenderer(size_t sbi)
+{
+    std::string sbid = "sbound-" + std::to_string(sbi);
+    if (mobjects.find(sbid) != mobjects.end()) {
+        newObjQueue.push_back(sbid);
+    }
+    else if (sb_visible_flags[sbi]) {
+        new_bp_meshes[sbid] = (*(physicsmgr->lmeshes))[sbi]->gen_mesh();
+    }
+}
+
+void LogicManager::dropLevelMeshFromRenderer(size_t sbi)
+{
+    std::string sbid = "sbound-" + std::to_string(sbi);
+    if (mobjects.find(sbid) != mobjects.end()) {
+        // model meshes are shared by file path, only drop the object
+        removeObjQueue.push_back(sbid);
+        mobjects.erase(sbid);
+    }
+    else if (sb_visible_flags[sbi]) {
+        unloadObjQueue.push_back(sbid);
+    }
+    new_bp_meshes.erase(sbid);
+}
+
+void LogicManager::reloadLevel()
+{
+    std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+    std::vector<LevelEntity> new_ents = readLevelEntities(levelPath);
+    std::chrono::steady_clock::time_point tread = std::chrono::steady_clock::now();
+
+    LevelDiff diff = diffLevelEntities(levelEntities, new_ents);
+    size_t added = 0;
+    if (diff.streaming_changed) {
+        std::cout << "hot reload: streaming settings changed, restart to apply them\n";
+    }
+
+    for (auto& oi_ni : diff.changed) {
+        LevelEntity& ent = new_ents[oi_ni.second];
+        dropLevelMeshFromRenderer(ent.slot);
+        addLevelEntity(ent, ent.slot);
+        queueLevelMeshForRenderer(ent.slot);
+    }
+
+    for (size_t oi : diff.removed) {
+        // keep the slot so sbound ids and RRAT indices of the other meshes stay valid
+        int slot = levelEntities[oi].slot;
+        dropLevelMeshFromRenderer(slot);
+        physicsmgr->deactivate_pcmesh(slot);
+        sb_visible_flags[slot] = false;
+    }
+
+    for (size_t ni : diff.added) {
+        LevelEntity& ent = new_ents[ni];
+        if (ent.tag == "STRM" || levelStreamer != NULL) {
+            // streamed meshes sit after the level meshes in lmeshes, appending would shift them
+            std::cout << "hot reload: can't add " << ent.tag << " entities to a streamed level, restart to apply them\n";
+            continue;
+        }
+        addLevelEntity(ent);
+        queueLevelMeshForRenderer(ent.slot);
+        added++;
+    }
+
+    bool lights_changed = diff.lights_changed;
+    if (lights_changed) {
+        nslights.clear();
+        nslightsChanged = true;
+        plights.clear();
+        dlights.clear();
+        for (LevelEntity& ent : new_ents) {
+            if (ent.is_light) addLevelEntity(ent);
+        }
+    }
+    levelEntities = new_ents;
+    memoryReportPending = true;
+
+    std::chrono::steady_clock::time_point tapplied = std::chrono::steady_clock::now();
+    std::cout << "hot reload: " << added << " added, " << diff.changed.size() << " changed, " << diff.removed.size() << " removed"
+        << (lights_changed ? ", lights updated" : "") << " of " << levelEntities.size() << " entities, "
+        << "read " << std::chrono::duration<float, std::chrono::milliseconds::period>(tread - tstart).count() << "ms, "
+        << "diff+apply " << std::chrono::duration<float, std::chrono::milliseconds::period>(tapplied - tread).count() << "ms\n";
+}
+
+void LogicManager::checkLevelReload(std::chrono::milliseconds gap)
+{
+    reloadPollTime += int(gap.count());
+    if (reloadPollTime < RELOAD_POLL_MS) return;
+    reloadPollTime = 0;
+
+    std::error_code ec;
+    std::filesystem::file_time_type wtime = std::filesystem::last_write_time(levelPath, ec);
+    if (ec || wtime == levelWriteTime) return;
+    levelWriteTime = wtime;
+    reloadLevel();
+}
+
+void LogicManager::onAnimEvent(size_t lmesh, std::string name)
+{
+    // "sound:<buffer id>" plays a loaded sound at the mesh, other events are only logged with the step stats
+    if (name.rfind("sound:", 0) == 0) {
+        size_t src = 0;
+        while (src < animSourceMesh.size() && animSourceMesh[src] != lmesh) src++;
+        if (src == animSourceMesh.size()) {
+            src = animSourceNext;
+            animSourceNext = (animSourceNext + 1) % animSourceMesh.size();
+            animSourceMesh[src] = lmesh;
+        }
+        std::string source_id = "anim" + std::to_string(src);
+        PolyCollMesh* pm = physicsmgr->lmeshes->at(lmesh);
+        audiomgr->update_aud_source(source_id, pm->_center, pm->_vel);
+        audiomgr->play_aud_buffer_from_source(source_id, name.substr(6));
+        return;
+    }
+    if (physicsmgr->print_step_stats) {
+        std::cout << "anim event " << name << " on sbound-" << lmesh << "\n";
+    }
+}
+
+void LogicManager::addLevelEntity(LevelEntity& ent, int slot)
+{
+    size_t tgt = slot;
+    for (std::string line : ent.lines) {
         if (line.length() < 4) continue;
 
         std::istringstream lss(line);
@@ -163,6 +559,13 @@ void LogicManager::parseCollDataFile(std::string cfname)
         if (itype[0] != '#') {
             try {
                 lss.seekg(4);
+                if (strcmp(itype, "STRM") == 0) {
+                    // everything after this line is streamed in by chunks
+                    levelStreamer = new LevelStreamer(physicsmgr);
+                    lss >> levelStreamer->CHUNK_SIZE >> levelStreamer->LOAD_RADIUS >> levelStreamer->UNLOAD_RADIUS >> levelStreamer->MAX_RESIDENT_CHUNKS;
+                    levelStreamer->indexLevelFile(levelPath, ent.stream_offset);
+                    break;
+                }
                 if (strcmp(itype, "PUVL") == 0) {
                     float plane_thickness;
                     float plane_friction;
@@ -170,8 +573,7 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     glm::vec3 u, v, rcenter;
                     float ulen, vlen;
                     lss >> rcenter.x >> rcenter.y >> rcenter.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z >> ulen >> vlen;
-                    physicsmgr->gen_and_add_pcmesh(rcenter, u, v, ulen, vlen, plane_thickness, plane_friction);
-                    sb_visible_flags.push_back(true);
+                    tgt = placeLevelMesh(PrismPhysics::gen_pcmesh(rcenter, u, v, ulen, vlen, plane_thickness, plane_friction), slot);
                     continue;
                 }
                 if (strcmp(itype, "PNSP") == 0) {
@@ -184,8 +586,7 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     for (int i = 0; i < n; i++) {
                         lss >> points[i].x >> points[i].y >> points[i].z;
                     }
-                    physicsmgr->gen_and_add_pcmesh(points, plane_thickness, plane_friction);
-                    sb_visible_flags.push_back(true);
+                    tgt = placeLevelMesh(PrismPhysics::gen_pcmesh(points, plane_thickness, plane_friction), slot);
                     continue;
                 }
                 if (strcmp(itype, "CUVH") == 0) {
@@ -195,8 +596,7 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     glm::vec3 u, v, rcenter;
                     float ulen, vlen, tlen;
                     lss >> rcenter.x >> rcenter.y >> rcenter.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z >> ulen >> vlen >> tlen;
-                    physicsmgr->gen_and_add_pcmesh(rcenter, u, v, ulen, vlen, tlen, plane_thickness, plane_friction);
-                    sb_visible_flags.push_back(true);
+                    tgt = placeLevelMesh(PrismPhysics::gen_pcmesh(rcenter, u, v, ulen, vlen, tlen, plane_thickness, plane_friction), slot);
                     continue;
                 }
                 if (strcmp(itype, "CNPH") == 0) {
@@ -211,11 +611,11 @@ void LogicManager::parseCollDataFile(std::string cfname)
                         lss >> points[i].x >> points[i].y >> points[i].z;
                     }
                     lss >> h;
-                    physicsmgr->gen_and_add_pcmesh(points,glm::cross(points[2] - points[1], points[1] - points[0]), h, plane_thickness, plane_friction);
-                    sb_visible_flags.push_back(true);
+                    tgt = placeLevelMesh(PrismPhysics::gen_pcmesh(points,glm::cross(points[2] - points[1], points[1] - points[0]), h, plane_thickness, plane_friction), slot);
                     continue;
                 }
-                if (strcmp(itype, "LANI") == 0) {
+                if (strcmp(itype, "LANI") == 0 || strcmp(itype, "RANI") == 0) {
+                    bool rigid = (strcmp(itype, "RANI") == 0);
                     int n;
                     lss >> n;
 
@@ -233,6 +633,14 @@ void LogicManager::parseCollDataFile(std::string cfname)
                         tmp_bas.rotAxis = { 0,1,0 };
                         tmp_bas.initAngle = 0;
                         tmp_bas.finalAngle = 0;
+                        if (rigid) {
+                            float inia, fina;
+                            lss >> tmp_bas.rotAxis.x >> tmp_bas.rotAxis.y >> tmp_bas.rotAxis.z >> inia >> fina;
+                            lss >> tmp_bas.initScale.x >> tmp_bas.initScale.y >> tmp_bas.initScale.z;
+                            lss >> tmp_bas.finalScale.x >> tmp_bas.finalScale.y >> tmp_bas.finalScale.z;
+                            tmp_bas.initAngle = glm::radians(inia);
+                            tmp_bas.finalAngle = glm::radians(fina);
+                        }
 
                         tmp_bad.steps.push_back(tmp_bas);
                         tmp_bad.total_time += step_dur;
@@ -240,19 +648,21 @@ void LogicManager::parseCollDataFile(std::string cfname)
 
                     bool loop_state;
                     std::string loop_str, animname;
-                    lss >> loop_str >> animname;
+                    int blend_ms = 0;
+                    lss >> loop_str >> animname >> blend_ms;
                     loop_state = (loop_str == "LOOP");
 
                     tmp_bad.loop_anim = loop_state;
                     tmp_bad.name = animname;
+                    tmp_bad.blend_ms = std::max(blend_ms, 0);
 
-                    PolyCollMesh* lastmesh = physicsmgr->lmeshes->back();
+                    PolyCollMesh* lastmesh = physicsmgr->lmeshes->at(tgt);
                     lastmesh->anims[animname] = tmp_bad;
                     if (loop_state) {
                         lastmesh->running_anims.push_back(animname);
                     }
 
-                    lastmesh = physicsmgr->lmeshes_future->back();
+                    lastmesh = physicsmgr->lmeshes_future->at(tgt);
                     lastmesh->anims[animname] = tmp_bad;
                     if (loop_state) {
                         lastmesh->running_anims.push_back(animname);
@@ -260,41 +670,57 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     continue;
                 }
 
+                if (strcmp(itype, "AEVT") == 0) {
+                    std::string animname;
+                    AnimEvent tmp_aev;
+                    lss >> animname >> tmp_aev.time >> tmp_aev.name;
+                    physicsmgr->lmeshes->at(tgt)->anims[animname].events.push_back(tmp_aev);
+                    physicsmgr->lmeshes_future->at(tgt)->anims[animname].events.push_back(tmp_aev);
+                    continue;
+                }
+                if (strcmp(itype, "APAR") == 0) {
+                    int parent;
+                    lss >> parent;
+                    physicsmgr->lmeshes->at(tgt)->anim_parent = parent;
+                    physicsmgr->lmeshes_future->at(tgt)->anim_parent = parent;
+                    continue;
+                }
+
                 if (strcmp(itype, "HIDE") == 0) {
-                    sb_visible_flags[physicsmgr->lmeshes->size() - 1] = false;
+                    sb_visible_flags[tgt] = false;
                     continue;
                 }
                 if (strcmp(itype, "KILL") == 0) {
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav = "kill";
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav = "kill";
+                    physicsmgr->lmeshes->at(tgt)->coll_behav = "kill";
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav = "kill";
                     continue;
                 }
 
                 if (strcmp(itype, "RAOT") == 0) {
                     std::string animname;
                     lss >> animname;
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav = "animself";
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav_args.push_back(animname);
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->running_anims.clear();
+                    physicsmgr->lmeshes->at(tgt)->coll_behav = "animself";
+                    physicsmgr->lmeshes->at(tgt)->coll_behav_args.push_back(animname);
+                    physicsmgr->lmeshes->at(tgt)->running_anims.clear();
 
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav = "animself";
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav_args.push_back(animname);
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->running_anims.clear();
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav = "animself";
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav_args.push_back(animname);
+                    physicsmgr->lmeshes_future->at(tgt)->running_anims.clear();
                     continue;
                 }
                 if (strcmp(itype, "RRAT") == 0) {
                     int n;
                     std::string animname;
                     lss >> n >> animname;
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav = "animremote";
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav_args.push_back(animname);
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->coll_behav_args.push_back(std::to_string(n));
-                    physicsmgr->lmeshes->at(physicsmgr->lmeshes->size() - 1)->running_anims.clear();
-
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav = "animremote";
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav_args.push_back(animname);
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->coll_behav_args.push_back(std::to_string(n));
-                    physicsmgr->lmeshes_future->at(physicsmgr->lmeshes_future->size() - 1)->running_anims.clear();
+                    physicsmgr->lmeshes->at(tgt)->coll_behav = "animremote";
+                    physicsmgr->lmeshes->at(tgt)->coll_behav_args.push_back(animname);
+                    physicsmgr->lmeshes->at(tgt)->coll_behav_args.push_back(std::to_string(n));
+                    physicsmgr->lmeshes->at(tgt)->running_anims.clear();
+
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav = "animremote";
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav_args.push_back(animname);
+                    physicsmgr->lmeshes_future->at(tgt)->coll_behav_args.push_back(std::to_string(n));
+                    physicsmgr->lmeshes_future->at(tgt)->running_anims.clear();
                     continue;
                 }
 
@@ -306,7 +732,7 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     lss >> init_loc.x >> init_loc.y >> init_loc.z >> init_scale.x >> init_scale.y >> init_scale.z >> objPath >> texPath >> nmapPath >> semapPath;
 
                     ModelData tmpold;
-                    tmpold.id = "sbound-" + std::to_string(physicsmgr->lmeshes->size() - 1);
+                    tmpold.id = "sbound-" + std::to_string(tgt);
                     tmpold.modelFilePath = objPath;
                     tmpold.texFilePath = texPath;
                     tmpold.nmapFilePath = nmapPath;
@@ -337,35 +763,33 @@ void LogicManager::parseCollDataFile(std::string cfname)
                     continue;
                 }
                 if (strcmp(itype, "DLEN") == 0) {
-                    if (nslights.size() < MAX_NS_LIGHTS) {
-                        lss.seekg(4);
-                        glm::vec3 light_pos, light_dir, light_col;
-                        float fov, aspect, ldist;
-                        lss >> light_pos.x >> light_pos.y >> light_pos.z >> light_dir.x >> light_dir.y >> light_dir.z >> light_col.x >> light_col.y >> light_col.z >> ldist >> fov >> aspect;
-                        GPULight tmpl;
-                        tmpl.pos = glm::vec4(light_pos, 1);
-                        tmpl.dir = glm::vec4(light_dir, 0);
-                        tmpl.color = glm::vec4(light_col, 1);
-                        tmpl.props.y = ldist;
-                        tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG);
-                        tmpl.set_vp_mat(glm::radians(fov), aspect, 0.01f, 1000.0f);
-                        nslights.push_back(tmpl);
-                    }
+                    lss.seekg(4);
+                    glm::vec3 light_pos, light_dir, light_col;
+                    float fov, aspect, ldist;
+                    lss >> light_pos.x >> light_pos.y >> light_pos.z >> light_dir.x >> light_dir.y >> light_dir.z >> light_col.x >> light_col.y >> light_col.z >> ldist >> fov >> aspect;
+                    GPULight tmpl;
+                    tmpl.pos = glm::vec4(light_pos, 1);
+                    tmpl.dir = glm::vec4(light_dir, 0);
+                    tmpl.color = glm::vec4(light_col, 1);
+                    tmpl.props.y = ldist;
+                    tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG);
+                    tmpl.set_vp_mat(glm::radians(fov), aspect, 0.01f, 1000.0f);
+                    nslights.push_back(tmpl);
+                    nslightsChanged = true;
                     continue;
                 }
                 if (strcmp(itype, "PLEN") == 0) {
-                    if (nslights.size() < MAX_NS_LIGHTS) {
-                        lss.seekg(4);
-                        glm::vec3 light_pos, light_col;
-                        float ldist;
-                        lss >> light_pos.x >> light_pos.y >> light_pos.z >> light_col.x >> light_col.y >> light_col.z >> ldist;
-                        GPULight tmpl;
-                        tmpl.pos = glm::vec4(light_pos, 1);
-                        tmpl.color = glm::vec4(light_col, 1);
-                        tmpl.props.y = ldist;
-                        tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG);
-                        nslights.push_back(tmpl);
-                    }
+                    lss.seekg(4);
+                    glm::vec3 light_pos, light_col;
+                    float ldist;
+                    lss >> light_pos.x >> light_pos.y >> light_pos.z >> light_col.x >> light_col.y >> light_col.z >> ldist;
+                    GPULight tmpl;
+                    tmpl.pos = glm::vec4(light_pos, 1);
+                    tmpl.color = glm::vec4(light_col, 1);
+                    tmpl.props.y = ldist;
+                    tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG);
+                    nslights.push_back(tmpl);
+                    nslightsChanged = true;
                     continue;
                 }
                 if (strcmp(itype, "PLES") == 0) {
@@ -390,113 +814,72 @@ void LogicManager::parseCollDataFile(std::string cfname)
             }
         }
     }
+    if (ent.tag != "STRM" && !ent.is_light) {
+        // LANI/RAOT/RRAT edit the mesh after it was added
+        physicsmgr->compile_anims(tgt);
+        ent.slot = int(tgt);
+    }
 }
 
 void LogicManager::parseCollDataJson(std::string cfname)
 {
-    std::ifstream fr(cfname);
-    std::stringstream frss;
-    frss << fr.rdbuf();
+    std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+    std::ifstream fr(cfname, std::ios::binary);
+    if (!fr.is_open()) {
+        throw std::runtime_error("failed to open level file " + cfname + "!");
+    }
+    std::vector<char> jbuf((std::istreambuf_iterator<char>(fr)), std::istreambuf_iterator<char>());
+    jbuf.push_back('\0');
+
+    // parse in place and validate against the schema in the same pass
+    rapidjson::InsituStringStream jss(jbuf.data());
+    rapidjson::SchemaValidatingReader<rapidjson::kParseInsituFlag, rapidjson::InsituStringStream, rapidjson::UTF8<>> reader(jss, get_level_schema());
     rapidjson::Document frjson;
-    frjson.Parse(frss.str().c_str());
+    frjson.Populate(reader);
+    if (!reader.GetParseResult()) {
+        std::string where = cfname + ":" + json_error_location(jbuf, reader.GetParseResult().Offset());
+        if (!reader.IsValid()) {
+            rapidjson::StringBuffer dptr, sptr;
+            reader.GetInvalidDocumentPointer().StringifyUriFragment(dptr);
+            reader.GetInvalidSchemaPointer().StringifyUriFragment(sptr);
+            throw std::runtime_error(where + ": " + dptr.GetString() + " fails schema rule \"" + reader.GetInvalidSchemaKeyword() + "\" (" + sptr.GetString() + ")");
+        }
+        throw std::runtime_error(where + ": " + rapidjson::GetParseError_En(reader.GetParseResult().Code()));
+    }
+    std::chrono::steady_clock::time_point tparsed = std::chrono::steady_clock::now();
+
+    std::vector<rapidjson::Value*> gentries;
     for (uint32_t i = 0; i < frjson.Size(); i++) {
         rapidjson::Value& tmpgd = frjson[i];
-        if (tmpgd["type"].GetString() == "geometry") {
-            if (tmpgd["geo_type"].GetString() == "plane_uv") {
-                physicsmgr->gen_and_add_pcmesh(
-                    jlist_to_vec3(tmpgd["center"]),
-                    jlist_to_vec3(tmpgd["u"]),
-                    jlist_to_vec3(tmpgd["v"]),
-                    tmpgd["ulen"].GetFloat(),
-                    tmpgd["vlen"].GetFloat(),
-                    tmpgd["epsilon"].GetFloat(),
-                    tmpgd["friction"].GetFloat()
-                );
-            }
-            else if (tmpgd["geo_type"].GetString() == "plane_np") {
-                std::vector<glm::vec3> tfverts(tmpgd["tf_verts"].Size());
-                for (uint32_t j = 0; j < tmpgd["tf_verts"].Size(); j++) {
-                    tfverts[j] = jlist_to_vec3(tmpgd["tf_verts"][j]);
-                }
-                physicsmgr->gen_and_add_pcmesh(
-                    tfverts,
-                    tmpgd["epsilon"].GetFloat(),
-                    tmpgd["friction"].GetFloat()
-                );
-            }
-            else if (tmpgd["geo_type"].GetString() == "cylinder_uv") {
-                physicsmgr->gen_and_add_pcmesh(
-                    jlist_to_vec3(tmpgd["center"]),
-                    jlist_to_vec3(tmpgd["u"]),
-                    jlist_to_vec3(tmpgd["v"]),
-                    tmpgd["ulen"].GetFloat(),
-                    tmpgd["vlen"].GetFloat(),
-                    tmpgd["tlen"].GetFloat(),
-                    tmpgd["epsilon"].GetFloat(),
-                    tmpgd["friction"].GetFloat()
-                );
-            }
-            else if (tmpgd["geo_type"].GetString() == "cylinder_np") {
-                std::vector<glm::vec3> tfverts(tmpgd["tf_verts"].Size());
-                for (uint32_t j = 0; j < tmpgd["tf_verts"].Size(); j++) {
-                    tfverts[j] = jlist_to_vec3(tmpgd["tf_verts"][j]);
-                }
-                physicsmgr->gen_and_add_pcmesh(
-                    tfverts,
-                    glm::cross(tfverts[2] - tfverts[1], tfverts[1] - tfverts[0]),
-                    tmpgd["tlen"].GetFloat(),
-                    tmpgd["epsilon"].GetFloat(),
-                    tmpgd["friction"].GetFloat()
-                );
+        if (tmpgd["type"] == "geometry") {
+            check_json_fields(cfname, i, tmpgd, "geometry");
+            check_json_fields(cfname, i, tmpgd, tmpgd["geo_type"].GetString());
+            gentries.push_back(&tmpgd);
+        }
+        else {
+            check_json_fields(cfname, i, tmpgd, "light");
+            if (tmpgd["shadowcasting"].GetBool() && tmpgd.HasMember("shadow_type") && tmpgd["shadow_type"] == "directional") {
+                check_json_fields(cfname, i, tmpgd, "directional");
             }
+        }
+    }
 
-            PolyCollMesh* gen_pcm = physicsmgr->lmeshes->back();
-            PolyCollMesh* gen_pcm_future = physicsmgr->lmeshes->back();
+    // geometry entries don't depend on each other, build them on the idle physics workers
+    std::vector<PolyCollMesh*> built(gentries.size());
+    size_t gbatch = gentries.size() / 64 + 1;
+    for (size_t gs = 0; gs < gentries.size(); gs += gbatch) {
+        physicsmgr->thread_pool->add_task(&build_json_geometry_range, &gentries, &built, gs, std::min(gs + gbatch, gentries.size()));
+    }
+    physicsmgr->thread_pool->wait_till_done();
+    std::chrono::steady_clock::time_point tbuilt = std::chrono::steady_clock::now();
 
-            if (tmpgd.HasMember("collision_behaviour")) {
-                if (tmpgd["collision_behaviour"] == "kill") {
-                    gen_pcm->coll_behav = "kill";
-                    gen_pcm_future->coll_behav = "kill";
-                }
-                else if (tmpgd["collision_behaviour"] == "animate") {
-                    gen_pcm->coll_behav = "animremote";
-                    gen_pcm_future->coll_behav = "animremote";
-                    for (uint32_t cai = 0; cai < tmpgd["collision_behaviour_args"].Size(); cai++) {
-                        gen_pcm->coll_behav_args.push_back(tmpgd["collision_behaviour_args"][cai].GetString());
-                        gen_pcm_future->coll_behav_args.push_back(tmpgd["collision_behaviour_args"][cai].GetString());
-                    }
-                }
-            }
-            if (tmpgd.HasMember("hide")) {
-                sb_visible_flags[physicsmgr->lmeshes->size() - 1] = false;
-            }
-            if (tmpgd.HasMember("anims")) {
-                for (uint32_t k = 0; k < tmpgd["anims"].Size(); k++) {
-                    rapidjson::Value& tmpad = tmpgd["anims"][k];
-                    BoneAnimData tmp_bad;
-                    tmp_bad.name = tmpad["name"].GetString();
-                    if (tmpad.HasMember("loop") && tmpad["loop"].GetBool()) tmp_bad.loop_anim = true;
-                    tmp_bad.loop_anim = 
-                    tmp_bad.total_time = 0;
-                    for (uint32_t sti = 0; sti < tmpad["steps"].Size(); sti++) {
-                        rapidjson::Value& tmpst = tmpad["steps"][sti];
-                        BoneAnimStep tmp_bas;
-                        tmp_bas.stepduration_ms = tmpst["anim_time"].GetInt();
-                        tmp_bas.initPos = jlist_to_vec3(tmpst["init_pos"]);
-                        tmp_bas.finalPos = jlist_to_vec3(tmpst["final_pos"]);
-                        tmp_bad.steps.push_back(tmp_bas);
-                        tmp_bad.total_time += tmp_bas.stepduration_ms;
-                    }
+    size_t gi = 0;
+    for (uint32_t i = 0; i < frjson.Size(); i++) {
+        rapidjson::Value& tmpgd = frjson[i];
+        if (tmpgd["type"] == "geometry") {
+            physicsmgr->add_pcmesh(built[gi++]);
+            sb_visible_flags.push_back(!(tmpgd.HasMember("hide") && tmpgd["hide"].GetBool()));
 
-                    gen_pcm->anims[tmp_bad.name] = tmp_bad;
-                    gen_pcm_future->anims[tmp_bad.name] = tmp_bad;
-                    if (tmp_bad.loop_anim) {
-                        gen_pcm->running_anims.push_back(tmp_bad.name);
-                        gen_pcm_future->running_anims.push_back(tmp_bad.name);
-                    }
-                }
-                
-            }
             if (tmpgd.HasMember("display_model")) {
                 sb_visible_flags[physicsmgr->lmeshes->size() - 1] = false;
 
@@ -515,39 +898,46 @@ void LogicManager::parseCollDataJson(std::string cfname)
                 mobjects[tmpold.id] = tmpold;
             }
         }
-        else if (tmpgd["type"].GetString() == "light") {
+        else {
+            GPULight tmpl;
+            tmpl.pos = glm::vec4(jlist_to_vec3(tmpgd["position"]), 1);
+            tmpl.color = glm::vec4(jlist_to_vec3(tmpgd["color"]), 1);
+            if (tmpgd.HasMember("distance")) tmpl.props.y = tmpgd["distance"].GetFloat();
+            if (tmpgd.HasMember("direction")) tmpl.dir = glm::vec4(jlist_to_vec3(tmpgd["direction"]), 0);
             if (!tmpgd["shadowcasting"].GetBool()) {
-                GPULight tmpl;
-                tmpl.pos = glm::vec4(jlist_to_vec3(tmpgd["position"]), 1);
-                tmpl.color = glm::vec4(jlist_to_vec3(tmpgd["color"]), 1);
                 tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG);
                 nslights.push_back(tmpl);
+                nslightsChanged = true;
             }
             else {
-                GPULight tmpl;
-                tmpl.pos = glm::vec4(jlist_to_vec3(tmpgd["position"]), 1);
-                tmpl.color = glm::vec4(jlist_to_vec3(tmpgd["color"]), 1);
                 tmpl.flags.x = (PRISM_LIGHT_EMISSIVE_FLAG | PRISM_LIGHT_SHADOW_FLAG);
-                if (tmpgd["shadow_type"] == "directional") {
-                    tmpl.dir = glm::vec4(jlist_to_vec3(tmpgd["direction"]), 0);
+                if (tmpgd.HasMember("shadow_type") && tmpgd["shadow_type"] == "directional") {
                     tmpl.set_vp_mat(glm::radians(tmpgd["fov"].GetFloat()), tmpgd["aspect"].GetFloat(), 0.01f, 1000.0f);
-                    if (dlights.size() < 20) {
+                    if (dlights.size() < MAX_DIRECTIONAL_LIGHTS) {
                         dlights.push_back(tmpl);
                     }
                 }
-                else if (tmpgd["shadow_type"] == "point") {
-                    if (plights.size() < 8) {
+                else {
+                    if (plights.size() < MAX_POINT_LIGHTS) {
                         plights.push_back(tmpl);
                     }
                 }
             }
         }
     }
+    std::chrono::steady_clock::time_point tapplied = std::chrono::steady_clock::now();
+
+    std::cout << cfname << ": " << jbuf.size() / (1024 * 1024) << "MB, " << frjson.Size() << " entries, "
+        << "parse+validate " << std::chrono::duration<float, std::chrono::milliseconds::period>(tparsed - tstart).count() << "ms, "
+        << "build " << std::chrono::duration<float, std::chrono::milliseconds::period>(tbuilt - tparsed).count() << "ms, "
+        << "apply " << std::chrono::duration<float, std::chrono::milliseconds::period>(tapplied - tbuilt).count() << "ms\n";
 }
 
 void LogicManager::init()
 {
     physicsmgr = new PrismPhysics();
+    particles = new ParticleSystem(physicsmgr->thread_pool);
+    debrisBatch = particles->add_batch(ParticleParams());
     sunlightDir = currentCamEye;
 
     ModelData obama;
@@ -558,6 +948,7 @@ void LogicManager::init()
     obama.semapFilePath = "textures/ptex1_se.png";
     obama.objLRS.location = glm::vec3(0.0f, 0.5f, 0.1f);
     obama.objLRS.scale = glm::vec3{ 1.0f };
+    obama.initLRS = obama.objLRS;
 
     BoneAnimStep rotateprism;
     rotateprism.stepduration_ms = 2000;
@@ -592,18 +983,19 @@ void LogicManager::init()
 
     mobjects["light"] = light;
 
-    parseCollDataFile("levels/1.txt");
+    if (levelPath.size() > 5 && levelPath.substr(levelPath.size() - 5) == ".json") {
+        parseCollDataJson(levelPath);
+        hotReload = false;
+    }
+    else {
+        parseCollDataFile(levelPath);
+    }
 
     for (int sbi = 0; sbi < physicsmgr->lmeshes->size(); sbi++) {
-        if (mobjects.find("sbound-" + std::to_string(sbi)) == mobjects.end()) {
-            if (sb_visible_flags[sbi]) {
-                new_bp_meshes["sbound-" + std::to_string(sbi)] = (*(physicsmgr->lmeshes))[sbi]->gen_mesh();
-            }
-        }
-        else {
-            newObjQueue.push_back("sbound-" + std::to_string(sbi));
-        }
+        queueLevelMeshForRenderer(sbi);
     }
+    std::error_code ec;
+    levelWriteTime = std::filesystem::last_write_time(levelPath, ec);
     sbreg = std::regex("sbound-([0-9]+)");
     
     //add player
@@ -614,13 +1006,20 @@ void LogicManager::init()
     player_future = physicsmgr->dmeshes_future->at(0);
     in_air = true;
 
+    if (levelStreamer != NULL) {
+        levelStreamer->update(player->_center, true);
+    }
+
     ghook = new MaintainedMesh();
     gen_grapple_verts(player->_center, glm::vec3(0, 0, 0), ghook, true);
 
     audiomgr->add_aud_buffer("jump", "sounds/jump1.wav");
     audiomgr->add_aud_buffer("fall", "sounds/fall1.wav");
     audiomgr->add_aud_source("player");
-    audiomgr->add_aud_source("1");
+    for (size_t i = 0; i < ANIM_SOUND_SOURCES; i++) {
+        audiomgr->add_aud_source("anim" + std::to_string(i));
+    }
+    animSourceMesh.assign(ANIM_SOUND_SOURCES, SIZE_MAX);
     audiomgr->update_listener(player->_center, player->_vel, currentCamDir, currentCamUp);
 
     //thread_pool = new SimpleThreadPooler(2);
@@ -650,16 +1049,25 @@ void LogicManager::pushToRenderer(PrismRenderer* renderer, uint32_t frameNo)
 {
     rpush_mut.lock();
     renderer->currentScene.sunlightPosition = glm::vec4(sunlightDir, 1.0f);
-    for (int i = 0; i < nslights.size(); i++) {
-        renderer->lights[i] = nslights[i];
+    if (nslightsChanged) {
+        renderer->setClusteredLights(nslights);
+        nslightsChanged = false;
     }
     for (int i=0; i < plights.size(); i++) {
-        renderer->lights[renderer->MAX_NS_LIGHTS + i] = plights[i];
+        renderer->lights[i] = plights[i];
     }
     for (int i=0; i < dlights.size(); i++) {
-        renderer->lights[i + renderer->MAX_NS_LIGHTS + renderer->MAX_POINT_LIGHTS] = dlights[i];
+        renderer->lights[i + renderer->MAX_POINT_LIGHTS] = dlights[i];
     }
 
+    for (std::string it : removeObjQueue) {
+        renderer->removeRenderObj(it);
+    }
+    for (std::string it : unloadObjQueue) {
+        renderer->unloadRenderObj(it);
+    }
+    removeObjQueue.clear();
+    unloadObjQueue.clear();
     for (std::string it : newObjQueue) {
         mobjects[it].pushToRenderer(renderer);
     }
@@ -676,6 +1084,14 @@ void LogicManager::pushToRenderer(PrismRenderer* renderer, uint32_t frameNo)
     }
     newObjQueue.clear();
     new_bp_meshes.clear();
+    if (memoryReportPending) {
+        // the level's meshes and textures were uploaded above
+        renderer->printMemoryStats("level load");
+        memoryReportPending = false;
+    }
+    if (levelStreamer != NULL) {
+        levelStreamer->pushToRenderer(renderer);
+    }
 
     glm::mat4 view = glm::lookAt(
         currentCamEye,
@@ -708,7 +1124,7 @@ void LogicManager::pushToRenderer(PrismRenderer* renderer, uint32_t frameNo)
             if (std::regex_search(objid, m, sbreg)) {
                 int sbi = std::stoi(m[1].str());
                 if (sb_visible_flags[sbi]) {
-                    renderer->renderObjects[it].uboData.model = glm::translate(glm::mat4(1.0f), physicsmgr->lmeshes->at(sbi)->_center - physicsmgr->lmeshes->at(sbi)->_init_center);
+                    renderer->renderObjects[it].uboData.model = physicsmgr->lmeshes->at(sbi)->get_model_matrix();
                 }
             }
         }
@@ -720,16 +1136,25 @@ void LogicManager::pushToRenderer(PrismRenderer* renderer, uint32_t frameNo)
     if (grappled) {
         if (!ghir) {
             renderer->addMaintainedRenderObj("ghook", ghook, "textures/wall_tex1.png", "textures/wall_tex1_n.png", "textures/wall_tex1_se.png", "linear", glm::mat4(1));
+            ghidx = renderer->renderObjects.size() - 1;
         }
         //renderer->renderObjects[ghidx].shadowcasting = false;
-        renderer->renderObjects[ghidx].renderable = true;
-        renderer->refreshMeshVB("ghook", frameNo);
+        renderer->setRenderObjVisible(ghidx, true);
+        renderer->refreshMeshVB("ghook");
     }
     else {
         if (ghir) {
-            renderer->renderObjects[ghidx].renderable = false;
+            renderer->setRenderObjVisible(ghidx, false);
         }
     }
+
+    if (debrisType < 0 && particles->total_count() > 0) {
+        debrisType = renderer->addParticleType("debris", "models/obamaprisme.obj", "textures/wall_tex1.png", "textures/wall_tex1_n.png", "textures/wall_tex1_se.png", "linear");
+    }
+    if (debrisType >= 0) {
+        size_t count = particles->batches[debrisBatch].count();
+        particles->write_instances(debrisBatch, renderer->mapParticleInstances(debrisType, uint32_t(count)));
+    }
     rpush_mut.unlock();
 }
 
@@ -781,9 +1206,11 @@ void LogicManager::give_ungrappled_va(glm::vec3 inp_vel, bool ground_touch, bool
         player->controlled = true;
         player_future->controlled = true;
         if (ground_touch) {
-            player->_vel = 22.0f * glm::normalize(normalize_vec_in_dir(glm::vec3(inp_vel.x, 0, inp_vel.z), ground_normal, 0)) + glm::dot((*(physicsmgr->lmeshes))[ground_plane]->_vel, ground_normal) * ground_normal;
+            // no ground mesh right after streaming changed lmeshes, stand still relative to the world then
+            glm::vec3 ground_vel = ground_plane >= 0 && ground_plane < int(physicsmgr->lmeshes->size()) ? (*(physicsmgr->lmeshes))[ground_plane]->_vel : glm::vec3(0);
+            player->_vel = 22.0f * glm::normalize(normalize_vec_in_dir(glm::vec3(inp_vel.x, 0, inp_vel.z), ground_normal, 0)) + glm::dot(ground_vel, ground_normal) * ground_normal;
             if (do_jump) {
-                player->_vel.y = (*(physicsmgr->lmeshes))[ground_plane]->_vel.y + 50;
+                player->_vel.y = ground_vel.y + 50;
                 player->_acc.x = 0;
                 player->_acc.z = 0;
             }
@@ -838,6 +1265,23 @@ void LogicManager::computeLogic(std::chrono::system_clock::time_point curr_time,
         dlights[2].pos = glm::vec4(currentCamEye, 1.0);
         dlights[2].dir = glm::vec4(currentCamDir, 1.0);
     }
+    if (inputmgr->wasKeyPressed(GLFW_KEY_B)) {
+        inputmgr->clearKeyPressState(GLFW_KEY_B);
+        particles->burst(debrisBatch, currentCamEye + 5.0f * currentCamDir, currentCamDir, DEV_DEBRIS_BURST, 40, 8, 0.15f);
+    }
+
+    if (hotReload) {
+        checkLevelReload(gap);
+    }
+
+    if (levelStreamer != NULL) {
+        levelStreamer->update(player->_center);
+        // ground_plane is an index into lmeshes, don't carry it over a change
+        if (levelStreamer->lmeshes_changed) {
+            last_f_in_ground = false;
+            ground_plane = -1;
+        }
+    }
 
     bool ground_touch = false;
     for (int pli = 0; pli < physicsmgr->dl_ccache[0].size(); pli++) {
@@ -933,6 +1377,7 @@ void LogicManager::computeLogic(std::chrono::system_clock::time_point curr_time,
                 if (glm::length(grdir) > 1) {
                     grappled = true;
                     std::cout << "grappled\n";
+                    particles->burst(debrisBatch, grapple_point.displacement1, glm::normalize(player->_center - grapple_point.displacement1), GRAPPLE_DEBRIS, 15, 3, 0.1f);
                     give_grappled_va(inp_vel, glm::normalize(grdir), do_jump, true);
                     grapple_time = int(logicDeltaT * 1000);
                     gen_grapple_verts(player->_center, grapple_point.displacement1, ghook, false);
@@ -950,12 +1395,23 @@ void LogicManager::computeLogic(std::chrono::system_clock::time_point curr_time,
 
     physicsmgr->run_physics(int(logicDeltaT * 1000));
     //physicsmgr->run_physics(5);
+    if (particles->total_count() > 0) {
+        // the physics pool is idle until the next run_physics
+        particles->set_colliders(*physicsmgr->lmeshes);
+        particles->step(logicDeltaT);
+    }
+    for (FiredAnimEvent& fae : physicsmgr->take_anim_events()) {
+        onAnimEvent(fae.lmesh, fae.name);
+    }
 
     for (auto it = mobjects.begin(); it != mobjects.end(); it++) {
         std::smatch m;
         if (std::regex_search(it->first, m, sbreg)) {
             int sbi = std::stoi(m[1].str());
-            mobjects[it->second.id].objLRS.location = it->second.initLRS.location + ((*(physicsmgr->lmeshes))[sbi]->_center - (*(physicsmgr->lmeshes))[sbi]->_init_center);
+            PolyCollMesh* sbm = (*(physicsmgr->lmeshes))[sbi];
+            mobjects[it->second.id].objLRS.location = it->second.initLRS.location + (sbm->_center - sbm->_init_center);
+            mobjects[it->second.id].objLRS.rotate = glm::mat4_cast(sbm->_rot) * it->second.initLRS.rotate;
+            mobjects[it->second.id].objLRS.scale = it->second.initLRS.scale * sbm->_scale;
         }
     }
 
@@ -964,7 +1420,7 @@ void LogicManager::computeLogic(std::chrono::system_clock::time_point curr_time,
     }
 
     if (inputmgr->wasKeyPressed(GLFW_MOUSE_BUTTON_1)) {
-        print_vec(player->_center - (*(physicsmgr->lmeshes))[ground_plane]->_center);
+        if (ground_plane >= 0 && ground_plane < int(physicsmgr->lmeshes->size())) print_vec(player->_center - (*(physicsmgr->lmeshes))[ground_plane]->_center);
         std::cout << int(logicDeltaT * 1000) << ',' << ground_touch << ',' << last_f_in_ground << ',' << in_air << '\n';
     }
     currentCamEye = player->_center + glm::vec3(0, 2.5, 0);
@@ -994,5 +1450,7 @@ void LogicManager::stop()
 
 LogicManager::~LogicManager()
 {
+    delete levelStreamer;
+    delete particles;
     delete physicsmgr;
 }
@@ -6,25 +6,39 @@
 #include "ModelStructs.h"
 #include "CollisionStructs.h"
 #include "SimpleThreadPooler.h"
+#include "LevelStreamer.h"
+#include "ParticleSystem.h"
+#include "LevelReload.h"
 
 #include <regex>
-
+#include <filesystem>
 
 class LogicManager
 {
 public:
-	LogicManager(PrismInputs* ipmgr, PrismAudioManager* audman, int logicpolltime_ms=1);
+	LogicManager(PrismInputs* ipmgr, PrismAudioManager* audman, int logicpolltime_ms=1, std::string level_path="levels/1.txt");
 	~LogicManager();
 	void run();
 	void stop();
 	void parseCollDataFile(std::string cfname);
 	void parseCollDataJson(std::string cfname);
+	void reloadLevel();
 	void pushToRenderer(PrismRenderer* renderer, uint32_t frameNo);
+	// physics and particle step stats, set before run()
+	void setPrintStats(bool print_stats);
 private:
 	PrismInputs* inputmgr;
 	PrismPhysics* physicsmgr;
+	LevelStreamer* levelStreamer = NULL;
 	PrismAudioManager* audiomgr;
 	int logicPollTime = 1;
+	std::string levelPath;
+	bool hotReload = true;
+	int RELOAD_POLL_MS = 500;
+	int reloadPollTime = 0;
+	bool memoryReportPending = true;
+	std::filesystem::file_time_type levelWriteTime;
+	std::vector<LevelEntity> levelEntities;
 	bool shouldStop = false;
 	float langle = 0;
 
@@ -41,6 +55,8 @@ private:
 	float GRAPPLE_ACCELERATION = 35;
 	float GRAPPLE_INIT_VEL = 1;
 	float GRAPPLE_MIN_VEL = 1;
+	size_t GRAPPLE_DEBRIS = 2000;
+	size_t DEV_DEBRIS_BURST = 100000;
 
 	glm::vec3 sunlightDir = (glm::vec3(0.0f, 0.2f, 0.0f));
 	std::vector<bool> sb_visible_flags;
@@ -48,6 +64,15 @@ private:
 	collutils::PolyCollMesh* player;
 	collutils::PolyCollMesh* player_future;
 	MaintainedMesh* ghook;
+	// debris is simulated on the physics thread pool and drawn as one renderer particle type
+	ParticleSystem* particles;
+	size_t debrisBatch = 0;
+	int debrisType = -1;
+	// anim sounds play from a small pool of sources. A mesh reuses the source it last played from while no other
+	// mesh has taken it, so repeated sounds of one mesh don't cut off the others
+	size_t ANIM_SOUND_SOURCES = 8;
+	std::vector<size_t> animSourceMesh;
+	size_t animSourceNext = 0;
 	bool in_air = false;
 	bool last_f_in_ground = false;
 	bool have_double_jump = true;
@@ -60,17 +85,26 @@ private:
 	int ground_plane = -1;
 
 	std::unordered_map<std::string, ModelData> mobjects;
-	size_t MAX_NS_LIGHTS = 30;
 	size_t MAX_POINT_LIGHTS = 8;
 	size_t MAX_DIRECTIONAL_LIGHTS = 8;
+	// lights without shadows, any number of them. Handed to the renderer's clusterer when they change
 	std::vector<GPULight> nslights;
+	bool nslightsChanged = false;
 	std::vector<GPULight> plights;
 	std::vector<GPULight> dlights;
 	std::vector<std::string> newObjQueue;
+	std::vector<std::string> removeObjQueue;
+	std::vector<std::string> unloadObjQueue;
 	std::unordered_map<std::string, Mesh> new_bp_meshes;
 	SimpleThreadPooler* thread_pool;
 	
 	void init();
+	void addLevelEntity(LevelEntity& ent, int slot = -1);
+	size_t placeLevelMesh(PolyCollMesh* pcm, int slot);
+	void queueLevelMeshForRenderer(size_t sbi);
+	void dropLevelMeshFromRenderer(size_t sbi);
+	void checkLevelReload(std::chrono::milliseconds gap);
+	void onAnimEvent(size_t lmesh, std::string name);
 	void give_grappled_va(glm::vec3 inp_vel, glm::vec3 grdir, bool do_jump, bool just_grappled = false);
 	void give_ungrappled_va(glm::vec3 inp_vel, bool ground_touch, bool do_jump, bool just_ungrappled = false);
 	void computeLogic(std::chrono::system_clock::time_point curr_time, std::chrono::milliseconds gap);
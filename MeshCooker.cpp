@@ -0,0 +1,123 @@
+#include "MeshCooker.h"
+
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+
+// bump when the cached layout or the OBJ processing changes, older cache files are rebuilt
+static const uint32_t MESHCACHE_VERSION = 4;
+
+struct MeshCacheHeader {
+	char magic[4] = { 'P', 'M', 'S', 'H' };
+	uint32_t version = MESHCACHE_VERSION;
+	uint64_t source_hash = 0;
+	uint32_t vertex_size = sizeof(Vertex);
+	uint32_t vertex_count = 0;
+	uint32_t index_count = 0;
+	uint32_t index_size = 4;
+	uint32_t lod_count = 0;
+	glm::vec4 bounds = glm::vec4(0);
+};
+
+uint64_t meshcook::contentHash(std::string path)
+{
+	// FNV-1a over the whole file, reading it is cheap next to parsing it
+	std::ifstream fr(path, std::ios::binary);
+	if (!fr.is_open()) return 0;
+	uint64_t hash = 14695981039346656037ull;
+	std::vector<char> buf(1 << 16);
+	while (fr) {
+		fr.read(buf.data(), buf.size());
+		std::streamsize got = fr.gcount();
+		for (std::streamsize i = 0; i < got; i++) {
+			hash = (hash ^ uint8_t(buf[i])) * 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+std::string meshcook::cachePath(std::string path)
+{
+	std::string name = path;
+	for (char& c : name) {
+		if (c == '/' || c == '\\' || c == ':') c = '_';
+	}
+	return CACHE_DIR + "/" + name + ".pmsh";
+}
+
+bool meshcook::readCache(Mesh& mesh, std::string path)
+{
+	std::ifstream fr(cachePath(path), std::ios::binary);
+	if (!fr.is_open()) return false;
+
+	MeshCacheHeader want;
+	MeshCacheHeader head;
+	fr.read((char*)&head, sizeof(head));
+	if (!fr || memcmp(head.magic, want.magic, 4) != 0 || head.version != want.version || head.vertex_size != want.vertex_size
+		|| (head.index_size != 2 && head.index_size != 4) || head.lod_count > MAX_MESH_LODS) {
+		return false;
+	}
+	if (head.source_hash != contentHash(path)) return false;
+
+	// one bulk read per array, the vertices land where the upload reads them from
+	mesh._vertices.resize(head.vertex_count);
+	fr.read((char*)mesh._vertices.data(), sizeof(Vertex) * size_t(head.vertex_count));
+	mesh._indices.resize(head.index_count);
+	if (head.index_size == 2) {
+		std::vector<uint16_t> short_indices(head.index_count);
+		fr.read((char*)short_indices.data(), sizeof(uint16_t) * size_t(head.index_count));
+		for (size_t i = 0; i < short_indices.size(); i++) mesh._indices[i] = short_indices[i];
+	}
+	else {
+		fr.read((char*)mesh._indices.data(), sizeof(uint32_t) * size_t(head.index_count));
+	}
+	mesh._lods.resize(head.lod_count);
+	fr.read((char*)mesh._lods.data(), sizeof(MeshLod) * size_t(head.lod_count));
+	if (!fr) {
+		mesh._vertices.clear();
+		mesh._indices.clear();
+		mesh._lods.clear();
+		return false;
+	}
+	mesh._bounds = head.bounds;
+	return true;
+}
+
+void meshcook::writeCache(Mesh& mesh, std::string path)
+{
+	MeshCacheHeader head;
+	head.source_hash = contentHash(path);
+	head.vertex_count = uint32_t(mesh._vertices.size());
+	head.index_count = uint32_t(mesh._indices.size());
+	head.index_size = (mesh._vertices.size() <= 65536) ? 2 : 4;
+	head.lod_count = uint32_t(mesh._lods.size());
+	head.bounds = mesh._bounds;
+
+	std::error_code ec;
+	std::filesystem::create_directories(CACHE_DIR, ec);
+	// written under a temporary name so a crash never leaves a truncated cache file behind
+	std::string cpath = cachePath(path);
+	std::string tmppath = cpath + ".tmp";
+	{
+		std::ofstream fw(tmppath, std::ios::binary);
+		if (!fw.is_open()) return;
+		fw.write((char*)&head, sizeof(head));
+		fw.write((char*)mesh._vertices.data(), sizeof(Vertex) * mesh._vertices.size());
+		if (head.index_size == 2) {
+			std::vector<uint16_t> short_indices(mesh._indices.begin(), mesh._indices.end());
+			fw.write((char*)short_indices.data(), sizeof(uint16_t) * short_indices.size());
+		}
+		else {
+			fw.write((char*)mesh._indices.data(), sizeof(uint32_t) * mesh._indices.size());
+		}
+		fw.write((char*)mesh._lods.data(), sizeof(MeshLod) * mesh._lods.size());
+		if (!fw) {
+			fw.close();
+			std::filesystem::remove(tmppath, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmppath, cpath, ec);
+	if (ec) std::filesystem::remove(tmppath, ec);
+}
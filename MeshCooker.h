@@ -0,0 +1,18 @@
+#pragma once
+
+#include "vkstructs.h"
+
+#include <string>
+
+// cooked copies of OBJ meshes. A cache file holds the deduplicated vertices, the indices (16 bit when they fit),
+// the LOD table and the bounds, keyed on a content hash of the source so edited models are cooked again
+namespace meshcook {
+	// fills mesh from the cache, false when there is no valid cache file for the source
+	bool readCache(Mesh& mesh, std::string path);
+	void writeCache(Mesh& mesh, std::string path);
+
+	uint64_t contentHash(std::string path);
+	std::string cachePath(std::string path);
+
+	const std::string CACHE_DIR = "meshcache";
+}
@@ -0,0 +1,596 @@
+#include "MeshProcessing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <tuple>
+
+static void tangent_frames_range(std::vector<Vertex>* corners, bool face_normals, size_t tstart, size_t tend)
+{
+	Vertex* tri = corners->data() + tstart * 3;
+	for (size_t t = tstart; t < tend; t++, tri += 3) {
+		glm::vec3 e1 = tri[1].pos - tri[0].pos;
+		glm::vec3 e2 = tri[2].pos - tri[0].pos;
+		glm::vec2 duv1 = tri[1].texCoord - tri[0].texCoord;
+		glm::vec2 duv2 = tri[2].texCoord - tri[0].texCoord;
+		glm::vec3 fnormal = glm::cross(e1, e2);
+		float flen = glm::length(fnormal);
+		fnormal = (flen > 0.0f) ? fnormal / flen : glm::vec3(0, 1, 0);
+
+		float denom = 1.0f / ((duv1.x * duv2.y) - (duv2.x * duv1.y));
+		glm::vec3 tang = denom * ((duv2.y * e1) - (duv1.y * e2));
+		glm::vec3 bitang = denom * ((duv1.x * e2) - (duv2.x * e1));
+		float tlen = glm::length(tang), blen = glm::length(bitang);
+		if (!std::isfinite(tlen) || !std::isfinite(blen) || tlen == 0.0f || blen == 0.0f) {
+			// no usable UV gradient, any frame around the face normal will do
+			tang = (std::abs(fnormal.x) < 0.9f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+			tang = glm::normalize(tang - glm::dot(tang, fnormal) * fnormal);
+			bitang = glm::cross(fnormal, tang);
+		}
+		else {
+			tang /= tlen;
+			bitang /= blen;
+		}
+		for (int i = 0; i < 3; i++) {
+			tri[i].tangent = tang;
+			tri[i].bitangent = bitang;
+			if (face_normals) tri[i].normal = fnormal;
+		}
+	}
+}
+
+void meshproc::computeTangentFrames(std::vector<Vertex>& corners, bool face_normals, SimpleThreadPooler* pool)
+{
+	size_t tris = corners.size() / 3;
+	size_t job_tris = JOB_CORNERS / 3;
+	if (pool == NULL || tris <= job_tris) {
+		tangent_frames_range(&corners, face_normals, 0, tris);
+		return;
+	}
+	for (size_t ts = 0; ts < tris; ts += job_tris) {
+		pool->add_task(&tangent_frames_range, &corners, face_normals, ts, std::min(ts + job_tris, tris));
+	}
+	pool->wait_till_done();
+}
+
+static uint64_t hash_floats(uint64_t hash, const float* vals, int count)
+{
+	for (int i = 0; i < count; i++) {
+		// -0 and 0 compare equal, they have to hash equal too
+		float val = vals[i] + 0.0f;
+		uint32_t bits;
+		memcpy(&bits, &val, sizeof(bits));
+		hash = (hash ^ bits) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+static void weld_keys_range(const std::vector<Vertex>* corners, std::vector<std::pair<uint64_t, uint32_t>>* keys, size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++) {
+		const Vertex& vert = (*corners)[i];
+		uint64_t hash = 0xcbf29ce484222325ull;
+		hash = hash_floats(hash, &vert.pos.x, 3);
+		hash = hash_floats(hash, &vert.normal.x, 3);
+		hash = hash_floats(hash, &vert.tangent.x, 3);
+		hash = hash_floats(hash, &vert.bitangent.x, 3);
+		hash = hash_floats(hash, &vert.texCoord.x, 2);
+		(*keys)[i] = { hash, uint32_t(i) };
+	}
+}
+
+static void radix_sort_keys(std::vector<std::pair<uint64_t, uint32_t>>& keys)
+{
+	// LSD radix sort with 16 bit digits, stable so equal keys keep their corner order
+	std::vector<std::pair<uint64_t, uint32_t>> tmp(keys.size());
+	std::vector<uint32_t> counts(1 << 16);
+	for (int shift = 0; shift < 64; shift += 16) {
+		std::fill(counts.begin(), counts.end(), 0);
+		for (auto& key : keys) counts[(key.first >> shift) & 0xffff]++;
+		uint32_t sum = 0;
+		for (uint32_t& count : counts) {
+			uint32_t c = count;
+			count = sum;
+			sum += c;
+		}
+		for (auto& key : keys) tmp[counts[(key.first >> shift) & 0xffff]++] = key;
+		keys.swap(tmp);
+	}
+}
+
+void meshproc::weld(const std::vector<Vertex>& corners, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, SimpleThreadPooler* pool)
+{
+	size_t count = corners.size();
+	std::vector<std::pair<uint64_t, uint32_t>> keys(count);
+	if (pool == NULL || count <= JOB_CORNERS) {
+		weld_keys_range(&corners, &keys, 0, count);
+	}
+	else {
+		for (size_t cs = 0; cs < count; cs += JOB_CORNERS) {
+			pool->add_task(&weld_keys_range, &corners, &keys, cs, std::min(cs + JOB_CORNERS, count));
+		}
+		pool->wait_till_done();
+	}
+	radix_sort_keys(keys);
+
+	// corners with the same key are compared for real, a hash collision only costs a compare. Each corner points
+	// at the first corner equal to it, runs are in corner order so that is the first one found
+	std::vector<uint32_t> first(count);
+	std::vector<uint32_t> run_firsts;
+	for (size_t rs = 0; rs < count;) {
+		size_t re = rs + 1;
+		while (re < count && keys[re].first == keys[rs].first) re++;
+		run_firsts.clear();
+		for (size_t k = rs; k < re; k++) {
+			uint32_t ci = keys[k].second;
+			first[ci] = ci;
+			for (uint32_t fi : run_firsts) {
+				if (corners[fi] == corners[ci]) {
+					first[ci] = fi;
+					break;
+				}
+			}
+			if (first[ci] == ci) run_firsts.push_back(ci);
+		}
+		rs = re;
+	}
+
+	uint32_t base = uint32_t(vertices.size());
+	std::vector<uint32_t> remap(count);
+	indices.reserve(indices.size() + count);
+	for (size_t ci = 0; ci < count; ci++) {
+		if (first[ci] == ci) {
+			remap[ci] = uint32_t(vertices.size()) - base;
+			vertices.push_back(corners[ci]);
+		}
+		indices.push_back(base + remap[first[ci]]);
+	}
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): fans around a vertex while its triangles are likely still cached,
+// then moves to the neighbour that stays cached longest
+static void tipsify(std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size)
+{
+	size_t tri_count = indices.size() / 3;
+	std::vector<uint32_t> live(vertex_count, 0);
+	for (uint32_t vi : indices) live[vi]++;
+	std::vector<uint32_t> adj_start(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++) adj_start[v + 1] = adj_start[v] + live[v];
+	std::vector<uint32_t> adj(indices.size());
+	std::vector<uint32_t> fill(adj_start.begin(), adj_start.end() - 1);
+	for (size_t t = 0; t < tri_count; t++) {
+		for (int c = 0; c < 3; c++) adj[fill[indices[t * 3 + c]]++] = uint32_t(t);
+	}
+
+	std::vector<uint32_t> stamp(vertex_count, 0);
+	std::vector<bool> emitted(tri_count, false);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> out;
+	out.reserve(indices.size());
+	uint32_t time = cache_size + 1;
+	size_t cursor = 0;
+	int64_t fan = vertex_count > 0 ? 0 : -1;
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t a = adj_start[fan]; a < adj_start[fan + 1]; a++) {
+			uint32_t t = adj[a];
+			if (emitted[t]) continue;
+			for (int c = 0; c < 3; c++) {
+				uint32_t vi = indices[t * 3 + c];
+				out.push_back(vi);
+				dead_end.push_back(vi);
+				candidates.push_back(vi);
+				live[vi]--;
+				if (time - stamp[vi] > cache_size) stamp[vi] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		int64_t best = -1;
+		int64_t best_priority = -1;
+		for (uint32_t vi : candidates) {
+			if (live[vi] == 0) continue;
+			int64_t priority = 0;
+			if (time - stamp[vi] + 2 * live[vi] <= cache_size) priority = time - stamp[vi];
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = vi;
+			}
+		}
+		if (best < 0) {
+			while (!dead_end.empty() && best < 0) {
+				uint32_t vi = dead_end.back();
+				dead_end.pop_back();
+				if (live[vi] > 0) best = vi;
+			}
+			while (best < 0 && cursor < vertex_count) {
+				if (live[cursor] > 0) best = int64_t(cursor);
+				cursor++;
+			}
+		}
+		fan = best;
+	}
+	indices.swap(out);
+}
+
+void meshproc::optimizeTriangleOrder(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	size_t tri_count = indices.size() / 3;
+	if (tri_count == 0) return;
+	tipsify(indices, vertices.size(), VERTEX_CACHE_SIZE);
+
+	// clusters end where a triangle misses the cache with all three corners, reordering whole clusters keeps
+	// the reuse inside them. Clusters further out along their own normal are drawn first
+	std::vector<uint32_t> stamp(vertices.size(), 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	std::vector<size_t> cluster_start;
+	for (size_t t = 0; t < tri_count; t++) {
+		int misses = 0;
+		for (int c = 0; c < 3; c++) {
+			uint32_t vi = indices[t * 3 + c];
+			if (time - stamp[vi] > VERTEX_CACHE_SIZE) {
+				stamp[vi] = time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) cluster_start.push_back(t);
+	}
+	cluster_start.push_back(tri_count);
+	size_t cluster_count = cluster_start.size() - 1;
+	if (cluster_count < 2) return;
+
+	glm::vec3 mesh_center(0);
+	float mesh_area = 0;
+	std::vector<glm::vec3> cluster_center(cluster_count, glm::vec3(0)), cluster_normal(cluster_count, glm::vec3(0));
+	for (size_t ci = 0; ci < cluster_count; ci++) {
+		float cluster_area = 0;
+		for (size_t t = cluster_start[ci]; t < cluster_start[ci + 1]; t++) {
+			const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+			const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+			const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(n);
+			cluster_center[ci] += (p0 + p1 + p2) * (area / 3.0f);
+			cluster_normal[ci] += n;
+			cluster_area += area;
+		}
+		mesh_center += cluster_center[ci];
+		mesh_area += cluster_area;
+		cluster_center[ci] = (cluster_area > 0) ? cluster_center[ci] / cluster_area : vertices[indices[cluster_start[ci] * 3]].pos;
+		float nlen = glm::length(cluster_normal[ci]);
+		if (nlen > 0) cluster_normal[ci] /= nlen;
+	}
+	if (mesh_area > 0) mesh_center /= mesh_area;
+
+	std::vector<float> cluster_key(cluster_count);
+	std::vector<uint32_t> order(cluster_count);
+	for (size_t ci = 0; ci < cluster_count; ci++) {
+		cluster_key[ci] = glm::dot(cluster_center[ci] - mesh_center, cluster_normal[ci]);
+		order[ci] = uint32_t(ci);
+	}
+	std::stable_sort(order.begin(), order.end(), [&cluster_key](uint32_t a, uint32_t b) { return cluster_key[a] > cluster_key[b]; });
+
+	std::vector<uint32_t> out;
+	out.reserve(indices.size());
+	for (uint32_t ci : order) {
+		out.insert(out.end(), indices.begin() + cluster_start[ci] * 3, indices.begin() + cluster_start[ci + 1] * 3);
+	}
+	indices.swap(out);
+}
+
+void meshproc::optimizeVertexOrder(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+	std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+	std::vector<Vertex> out;
+	out.reserve(vertices.size());
+	for (uint32_t& vi : indices) {
+		if (remap[vi] == UINT32_MAX) {
+			remap[vi] = uint32_t(out.size());
+			out.push_back(vertices[vi]);
+		}
+		vi = remap[vi];
+	}
+	vertices.swap(out);
+}
+
+float meshproc::acmr(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size)
+{
+	if (indices.size() < 3) return 0;
+	std::vector<uint32_t> stamp(vertex_count, 0);
+	uint32_t time = cache_size + 1;
+	size_t misses = 0;
+	for (uint32_t vi : indices) {
+		if (time - stamp[vi] > cache_size) {
+			stamp[vi] = time++;
+			misses++;
+		}
+	}
+	return float(misses) / float(indices.size() / 3);
+}
+
+// symmetric plane quadric, area weighted. Divided by its weight it gives the mean squared distance to its planes
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0, c = 0;
+	double w = 0;
+
+	void add_plane(double nx, double ny, double nz, double d, double weight)
+	{
+		a00 += weight * nx * nx; a01 += weight * nx * ny; a02 += weight * nx * nz;
+		a11 += weight * ny * ny; a12 += weight * ny * nz; a22 += weight * nz * nz;
+		b0 += weight * nx * d; b1 += weight * ny * d; b2 += weight * nz * d;
+		c += weight * d * d;
+		w += weight;
+	}
+
+	void add(const Quadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c;
+		w += q.w;
+	}
+
+	double error(const glm::vec3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+			+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+		return (w > 0) ? std::max(e / w, 0.0) : 0.0;
+	}
+};
+
+struct EdgeCollapse {
+	double cost;
+	uint32_t from, to;
+};
+
+static uint32_t next_corner(uint32_t ci)
+{
+	return (ci % 3 == 2) ? ci - 2 : ci + 1;
+}
+
+void meshproc::simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<size_t>& target_index_counts,
+	std::vector<std::vector<uint32_t>>& levels, std::vector<float>& errors)
+{
+	levels.clear();
+	errors.clear();
+	size_t vcount = vertices.size();
+
+	// corners point at wedges, the first vertex of each distinct position and UV pair. Normals and tangents are
+	// rebuilt for the simplified triangles, only UV discontinuities are seams. Collapses work on position ids
+	std::vector<uint32_t> order(vcount);
+	for (uint32_t v = 0; v < vcount; v++) order[v] = v;
+	std::sort(order.begin(), order.end(), [&vertices](uint32_t a, uint32_t b) {
+		const Vertex& va = vertices[a];
+		const Vertex& vb = vertices[b];
+		return std::make_tuple(va.pos.x, va.pos.y, va.pos.z, va.texCoord.x, va.texCoord.y, a)
+			< std::make_tuple(vb.pos.x, vb.pos.y, vb.pos.z, vb.texCoord.x, vb.texCoord.y, b);
+	});
+	std::vector<uint32_t> wedge_of(vcount), pos_of(vcount);
+	std::vector<uint32_t> wedge_list, wedge_start;
+	std::vector<glm::vec3> pos;
+	for (size_t i = 0; i < vcount; i++) {
+		const Vertex& vert = vertices[order[i]];
+		bool new_pos = i == 0 || vert.pos != vertices[order[i - 1]].pos;
+		if (new_pos) {
+			wedge_start.push_back(uint32_t(wedge_list.size()));
+			pos.push_back(vert.pos);
+		}
+		if (new_pos || vert.texCoord != vertices[order[i - 1]].texCoord) wedge_list.push_back(order[i]);
+		wedge_of[order[i]] = wedge_list.back();
+		pos_of[order[i]] = uint32_t(pos.size() - 1);
+	}
+	wedge_start.push_back(uint32_t(wedge_list.size()));
+	size_t pcount = pos.size();
+
+	std::vector<uint32_t> corners;
+	corners.reserve(indices.size());
+	std::vector<Quadric> quadrics(pcount);
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		uint32_t w0 = wedge_of[indices[t * 3]], w1 = wedge_of[indices[t * 3 + 1]], w2 = wedge_of[indices[t * 3 + 2]];
+		uint32_t p0 = pos_of[w0], p1 = pos_of[w1], p2 = pos_of[w2];
+		if (p0 == p1 || p1 == p2 || p0 == p2) continue;
+		corners.push_back(w0);
+		corners.push_back(w1);
+		corners.push_back(w2);
+
+		glm::vec3 n = glm::cross(pos[p1] - pos[p0], pos[p2] - pos[p0]);
+		float nlen = glm::length(n);
+		if (nlen == 0.0f) continue;
+		n /= nlen;
+		Quadric q;
+		q.add_plane(n.x, n.y, n.z, -double(glm::dot(n, pos[p0])), 0.5 * nlen);
+		quadrics[p0].add(q);
+		quadrics[p1].add(q);
+		quadrics[p2].add(q);
+	}
+
+	std::vector<std::pair<uint64_t, uint32_t>> edges;
+	std::vector<uint8_t> locked(pcount), seam_edges(pcount), touched(pcount);
+	std::vector<uint32_t> fan_start(pcount + 1), fan;
+	std::vector<uint32_t> collapse_to(pcount, UINT32_MAX);
+	std::vector<uint32_t> wedge_remap(vcount);
+	std::vector<uint32_t> stamp(pcount, 0);
+	uint32_t stamp_time = 0;
+	std::vector<EdgeCollapse> collapses;
+	double max_error = 0;
+	size_t level_start_size = corners.size();
+	size_t ti = 0;
+
+	while (ti < target_index_counts.size()) {
+		if (corners.size() <= target_index_counts[ti]) {
+			levels.push_back(corners);
+			errors.push_back(float(std::sqrt(max_error)));
+			level_start_size = corners.size();
+			ti++;
+			continue;
+		}
+		size_t corner_count = corners.size();
+
+		// edges by position, two triangles per edge on a closed manifold. Each corner stands for the edge to the next
+		edges.resize(corner_count);
+		for (uint32_t ci = 0; ci < corner_count; ci++) {
+			uint32_t a = pos_of[corners[ci]], b = pos_of[corners[next_corner(ci)]];
+			edges[ci] = { (uint64_t(std::min(a, b)) << 32) | std::max(a, b), ci };
+		}
+		radix_sort_keys(edges);
+
+		// an edge is a seam when its two triangles have different wedges at either end. Borders, non-manifold edges
+		// and flipped neighbours lock their vertices, so do seam corners and ends, anything not on exactly 2 seam edges
+		auto edge_is_seam = [&](size_t ei) {
+			uint32_t c0 = edges[ei].second, c1 = edges[ei + 1].second;
+			return corners[c0] != corners[next_corner(c1)] || corners[next_corner(c0)] != corners[c1];
+		};
+		std::fill(locked.begin(), locked.end(), 0);
+		std::fill(seam_edges.begin(), seam_edges.end(), 0);
+		for (size_t rs = 0; rs < corner_count;) {
+			size_t re = rs + 1;
+			while (re < corner_count && edges[re].first == edges[rs].first) re++;
+			uint32_t a = uint32_t(edges[rs].first >> 32), b = uint32_t(edges[rs].first);
+			if (re - rs != 2 || pos_of[corners[edges[rs].second]] == pos_of[corners[edges[rs + 1].second]]) {
+				locked[a] = 1;
+				locked[b] = 1;
+			}
+			else if (edge_is_seam(rs)) {
+				seam_edges[a] = uint8_t(std::min(seam_edges[a] + 1, 3));
+				seam_edges[b] = uint8_t(std::min(seam_edges[b] + 1, 3));
+			}
+			rs = re;
+		}
+		for (size_t p = 0; p < pcount; p++) {
+			if (seam_edges[p] != 0 && seam_edges[p] != 2) locked[p] = 1;
+		}
+
+		std::fill(fan_start.begin(), fan_start.end(), 0);
+		for (uint32_t w : corners) fan_start[pos_of[w] + 1]++;
+		for (size_t p = 0; p < pcount; p++) fan_start[p + 1] += fan_start[p];
+		fan.resize(corner_count);
+		{
+			std::vector<uint32_t> fill(fan_start.begin(), fan_start.end() - 1);
+			for (uint32_t ci = 0; ci < corner_count; ci++) fan[fill[pos_of[corners[ci]]]++] = ci;
+		}
+
+		// the cheaper direction of every edge that may collapse, a vertex only moves onto its neighbour
+		collapses.clear();
+		for (size_t rs = 0; rs < corner_count;) {
+			size_t re = rs + 1;
+			while (re < corner_count && edges[re].first == edges[rs].first) re++;
+			if (re - rs == 2) {
+				uint32_t a = uint32_t(edges[rs].first >> 32), b = uint32_t(edges[rs].first);
+				bool seam = edge_is_seam(rs);
+				EdgeCollapse best = { -1.0, 0, 0 };
+				uint32_t ends[2][2] = { { a, b }, { b, a } };
+				for (auto& end : ends) {
+					uint32_t from = end[0], to = end[1];
+					if (locked[from] || (seam_edges[from] > 0 && !seam)) continue;
+					Quadric q = quadrics[from];
+					q.add(quadrics[to]);
+					double cost = q.error(pos[to]);
+					if (best.cost < 0 || cost < best.cost) best = { cost, from, to };
+				}
+				if (best.cost >= 0) collapses.push_back(best);
+			}
+			rs = re;
+		}
+		if (collapses.empty()) break;
+		std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& x, const EdgeCollapse& y) { return x.cost < y.cost; });
+
+		// each collapse takes about two triangles. Ones much costlier than the last one needed wait for a later pass,
+		// by then the collapses around them changed their cost
+		size_t tris_wanted = (corner_count - target_index_counts[ti]) / 3;
+		size_t needed = std::min(collapses.size(), tris_wanted / 2 + 1);
+		double cost_limit = collapses[needed - 1].cost * 1.5;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t removed = 0;
+		std::vector<EdgeCollapse> applied;
+		for (const EdgeCollapse& col : collapses) {
+			if (removed >= tris_wanted || col.cost > cost_limit) break;
+			if (touched[col.from] || touched[col.to]) continue;
+
+			// the two may only share the neighbours opposite their edge, more would pinch the surface
+			stamp_time += 2;
+			for (uint32_t fi = fan_start[col.from]; fi < fan_start[col.from + 1]; fi++) {
+				uint32_t t = fan[fi] / 3;
+				for (int c = 0; c < 3; c++) stamp[pos_of[corners[t * 3 + c]]] = stamp_time;
+			}
+			int shared = 0;
+			for (uint32_t fi = fan_start[col.to]; fi < fan_start[col.to + 1]; fi++) {
+				uint32_t t = fan[fi] / 3;
+				for (int c = 0; c < 3; c++) {
+					uint32_t p = pos_of[corners[t * 3 + c]];
+					if (p == col.from || p == col.to || stamp[p] != stamp_time) continue;
+					stamp[p] = stamp_time + 1;
+					shared++;
+				}
+			}
+			if (shared > 2) continue;
+
+			// no remaining triangle around from may flip, turn close to edge-on or collapse to a line
+			bool flips = false;
+			size_t gone = 0;
+			for (uint32_t fi = fan_start[col.from]; fi < fan_start[col.from + 1] && !flips; fi++) {
+				uint32_t t = fan[fi] / 3;
+				uint32_t p[3] = { pos_of[corners[t * 3]], pos_of[corners[t * 3 + 1]], pos_of[corners[t * 3 + 2]] };
+				if (p[0] == col.to || p[1] == col.to || p[2] == col.to) {
+					gone++;
+					continue;
+				}
+				glm::vec3 n_old = glm::cross(pos[p[1]] - pos[p[0]], pos[p[2]] - pos[p[0]]);
+				for (uint32_t& pi : p) {
+					if (pi == col.from) pi = col.to;
+				}
+				glm::vec3 n_new = glm::cross(pos[p[1]] - pos[p[0]], pos[p[2]] - pos[p[0]]);
+				flips = glm::dot(n_old, n_new) <= 0.25f * glm::length(n_old) * glm::length(n_new);
+			}
+			if (flips) continue;
+
+			// corners keep their side of a seam, each wedge of from goes to the wedge of to with the closest UV
+			for (uint32_t wi = wedge_start[col.from]; wi < wedge_start[col.from + 1]; wi++) {
+				uint32_t best = wedge_list[wedge_start[col.to]];
+				float best_dist = -1;
+				for (uint32_t wj = wedge_start[col.to]; wj < wedge_start[col.to + 1]; wj++) {
+					glm::vec2 duv = vertices[wedge_list[wj]].texCoord - vertices[wedge_list[wi]].texCoord;
+					float dist = glm::dot(duv, duv);
+					if (best_dist < 0 || dist < best_dist) {
+						best = wedge_list[wj];
+						best_dist = dist;
+					}
+				}
+				wedge_remap[wedge_list[wi]] = best;
+			}
+			collapse_to[col.from] = col.to;
+			quadrics[col.to].add(quadrics[col.from]);
+			max_error = std::max(max_error, col.cost);
+			touched[col.to] = 1;
+			for (uint32_t fi = fan_start[col.from]; fi < fan_start[col.from + 1]; fi++) {
+				uint32_t t = fan[fi] / 3;
+				for (int c = 0; c < 3; c++) touched[pos_of[corners[t * 3 + c]]] = 1;
+			}
+			removed += gone;
+			applied.push_back(col);
+		}
+		if (applied.empty()) break;
+
+		size_t kept = 0;
+		for (size_t t = 0; t < corner_count / 3; t++) {
+			uint32_t w[3];
+			for (int c = 0; c < 3; c++) {
+				w[c] = corners[t * 3 + c];
+				if (collapse_to[pos_of[w[c]]] != UINT32_MAX) w[c] = wedge_remap[w[c]];
+			}
+			if (pos_of[w[0]] == pos_of[w[1]] || pos_of[w[1]] == pos_of[w[2]] || pos_of[w[0]] == pos_of[w[2]]) continue;
+			for (int c = 0; c < 3; c++) corners[kept * 3 + c] = w[c];
+			kept++;
+		}
+		corners.resize(kept * 3);
+		for (const EdgeCollapse& col : applied) collapse_to[col.from] = UINT32_MAX;
+	}
+
+	// out of collapses before the next target, what was reached is still worth a level when it got smaller
+	if (ti < target_index_counts.size() && corners.size() < level_start_size) {
+		levels.push_back(corners);
+		errors.push_back(float(std::sqrt(max_error)));
+	}
+}
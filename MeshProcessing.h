@@ -0,0 +1,36 @@
+#pragma once
+
+#include "vkstructs.h"
+#include "SimpleThreadPooler.h"
+
+#include <vector>
+
+// what every mesh goes through between a triangle list and the buffers that get uploaded. Given a thread pool the
+// per-corner work is split into jobs on it, the pool has to be idle since the calls wait for it to finish
+namespace meshproc {
+	// fills the tangent frame of every corner of a triangle list (3 corners per triangle) from its positions and
+	// UVs. With face_normals the normals are replaced by the triangle's geometric normal
+	void computeTangentFrames(std::vector<Vertex>& corners, bool face_normals, SimpleThreadPooler* pool = NULL);
+	// merges corners that are equal, vertices come out in order of first use. Appends to vertices and indices
+	void weld(const std::vector<Vertex>& corners, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, SimpleThreadPooler* pool = NULL);
+
+	// reorders triangles for the post-transform vertex cache, then reorders clusters of them so triangles facing
+	// out of the mesh come first and cover what is behind them
+	void optimizeTriangleOrder(const std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	// renumbers vertices in order of first use so fetches walk the vertex buffers forwards, unused ones are dropped
+	void optimizeVertexOrder(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+	// average cache misses per triangle for a FIFO cache of cache_size entries, 3 is no reuse at all
+	float acmr(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = 16);
+
+	// quadric edge collapse (Garland and Heckbert 1997) down to each of the target index counts in turn, largest
+	// first. Vertices only ever move onto a neighbour, so every level indexes the input vertices. Borders and the
+	// corners of UV seams stay put, seams only collapse along themselves. Fills one index list per target that
+	// was reached and its error, the RMS distance to the planes of the input triangles it replaced in mesh units.
+	// When nothing more can collapse the last list stops short of its target and the later targets are left out
+	void simplify(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const std::vector<size_t>& target_index_counts,
+		std::vector<std::vector<uint32_t>>& levels, std::vector<float>& errors);
+
+	const uint32_t VERTEX_CACHE_SIZE = 16;
+	// corners per pool job
+	const size_t JOB_CORNERS = 1 << 16;
+}
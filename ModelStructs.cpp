@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <chrono>
+#include <algorithm>
 #include <iostream>
 
 static inline glm::mat4 makeTMatrix(glm::vec3 location, glm::mat4 rotate, glm::vec3 scale){
@@ -17,68 +18,74 @@ glm::mat4 LRS::getTMatrix()
 	return makeTMatrix(location, rotate, scale);
 }
 
-int BoneAnimData::getNextEventTime()
+AnimPose evalAnimTrack(const AnimTrack& trk, const AnimSegment* segs, int t, uint32_t* seg)
 {
-	return steps[curr_step].stepduration_ms - steps[curr_step].curr_time;
+	uint32_t si = *seg;
+	if (si >= trk.seg_count || (si > 0 && segs[si - 1].end_time >= t)) si = 0;
+	while (si + 1 < trk.seg_count && segs[si].end_time < t) si++;
+	*seg = si;
+
+	const AnimSegment& sg = segs[si];
+	float lt = 0.001f * float(t - sg.end_time + sg.duration);
+	AnimPose pose;
+	pose.location = sg.initPos + sg.vel * lt;
+	if (trk.rigid) {
+		pose.rotate = glm::angleAxis(sg.initAngle + sg.angleVel * lt, sg.rotAxis);
+		pose.scale = sg.initScale + sg.scaleVel * lt;
+	}
+	return pose;
 }
 
-glm::vec3 BoneAnimData::getNextVelHint()
+AnimPose mixAnimPose(const AnimPose& a, const AnimPose& b, float w)
 {
-	return (steps[curr_step].finalPos - steps[curr_step].initPos) * 1000.0f / float(steps[curr_step].stepduration_ms);
+	AnimPose pose;
+	pose.location = glm::mix(a.location, b.location, w);
+	pose.rotate = glm::slerp(a.rotate, b.rotate, w);
+	pose.scale = glm::mix(a.scale, b.scale, w);
+	return pose;
 }
 
-LRS BoneAnimData::transformAfterGap(int gap_ms)
+AnimTrack BoneAnimData::compileTrack(std::vector<AnimSegment>& segs, std::vector<AnimEvent>& evts)
 {
-	LRS animLRS;
-
-	while (gap_ms > 0) {
-		int step_rem = steps[curr_step].stepduration_ms - steps[curr_step].curr_time;
-		
-		if (gap_ms >= step_rem) {
-			int step_time = step_rem;
-			steps[curr_step].curr_time = 0;
+	AnimTrack trk;
+	trk.first_seg = uint32_t(segs.size());
+	trk.seg_count = uint32_t(steps.size());
+	trk.loop_anim = loop_anim;
+	trk.blend_ms = blend_ms;
 
-			float fract = float(step_time) / float(steps[curr_step].stepduration_ms);
-			//float prog = float(steps[curr_step].curr_time) / float(steps[curr_step].stepduration_ms);
-			animLRS.location = steps[curr_step].finalPos;
-			animLRS.rotate = glm::rotate(
-				glm::mat4(1),
-				(1 - fract) * steps[curr_step].initAngle + fract * steps[curr_step].finalAngle,
-				steps[curr_step].rotAxis);
-			animLRS.scale = (1 - fract) * steps[curr_step].initScale + fract * steps[curr_step].finalScale;
-
-			curr_step = (curr_step + 1) % steps.size();
-			if (curr_step > steps.size() - 1) {
-				curr_step = 0;
-				curr_time = 0;
-				break;
-			}
-			if (curr_step == 0 && !loop_anim) {
-				animLRS.anim_finished = true;
-				curr_time = 0;
-				break;
-			}
-			curr_time += step_time;
-			gap_ms -= step_time;
+	int end_time = 0;
+	for (BoneAnimStep& st : steps) {
+		AnimSegment seg;
+		seg.duration = std::max(st.stepduration_ms, 0);
+		end_time += seg.duration;
+		seg.end_time = end_time;
+		seg.initPos = st.initPos;
+		seg.rotAxis = (glm::length(st.rotAxis) > 0) ? glm::normalize(st.rotAxis) : glm::vec3(0, 1, 0);
+		seg.initAngle = st.initAngle;
+		seg.initScale = st.initScale;
+		if (seg.duration > 0) {
+			float inv_dur = 1000.0f / float(seg.duration);
+			seg.vel = (st.finalPos - st.initPos) * inv_dur;
+			seg.angleVel = (st.finalAngle - st.initAngle) * inv_dur;
+			seg.scaleVel = (st.finalScale - st.initScale) * inv_dur;
 		}
-		else {
-			int step_time = gap_ms;
-			steps[curr_step].curr_time += step_time;
-
-			float fract = float(step_time) / float(steps[curr_step].stepduration_ms);
-			float prog = float(steps[curr_step].curr_time) / float(steps[curr_step].stepduration_ms);
-			animLRS.location = (1 - prog) * steps[curr_step].initPos + prog * steps[curr_step].finalPos;
-			animLRS.rotate = glm::rotate(
-				glm::mat4(1),
-				(1 - fract) * steps[curr_step].initAngle + fract * steps[curr_step].finalAngle,
-				steps[curr_step].rotAxis);
-			animLRS.scale = (1 - fract) * steps[curr_step].initScale + fract * steps[curr_step].finalScale;
+		if (st.initAngle != 0 || st.finalAngle != 0 || st.initScale != glm::vec3(1.0f) || st.finalScale != glm::vec3(1.0f)) {
+			trk.rigid = true;
+		}
+		segs.push_back(seg);
+	}
+	trk.total_time = end_time;
 
-			curr_time += step_time;
-			gap_ms -= step_time;
+	trk.first_event = uint32_t(evts.size());
+	std::vector<AnimEvent> sorted_events = events;
+	std::stable_sort(sorted_events.begin(), sorted_events.end(), [](const AnimEvent& a, const AnimEvent& b) { return a.time < b.time; });
+	for (AnimEvent& ev : sorted_events) {
+		if (ev.time <= end_time) {
+			evts.push_back(ev);
+			trk.event_count++;
 		}
 	}
-	return animLRS;
+	return trk;
 }
 
 void ModelData::pushToRenderer(PrismRenderer* renderer)
@@ -88,12 +95,28 @@ void ModelData::pushToRenderer(PrismRenderer* renderer)
 
 void ModelData::updateAnim(std::string animName, int gap_ms)
 {
-	LRS animLRS = anims[animName].transformAfterGap(gap_ms);
-	objLRS.location += animLRS.location;
-	objLRS.rotate *= animLRS.rotate;
-	objLRS.scale = {
-		objLRS.scale.x * animLRS.scale.x,
-		objLRS.scale.y * animLRS.scale.y,
-		objLRS.scale.z * animLRS.scale.z
-	};
+	BoneAnimData& bad = anims[animName];
+	if (bad.track < 0) {
+		std::vector<AnimEvent> unused_events;
+		bad.track = int(anim_tracks.size());
+		anim_tracks.push_back(bad.compileTrack(anim_segs, unused_events));
+		bad.curr_time = 0;
+		bad.curr_step = 0;
+	}
+	AnimTrack& trk = anim_tracks[bad.track];
+	if (trk.total_time <= 0) return;
+
+	bad.curr_time += gap_ms;
+	if (bad.curr_time > trk.total_time) {
+		bad.curr_time = (trk.loop_anim) ? (bad.curr_time - 1) % trk.total_time + 1 : trk.total_time;
+	}
+	uint32_t seg = uint32_t(bad.curr_step);
+	AnimPose pose = evalAnimTrack(trk, &anim_segs[trk.first_seg], bad.curr_time, &seg);
+	bad.curr_step = int(seg);
+
+	// the pose is relative to initLRS, so the object doesn't drift however often this runs
+	objLRS.location = initLRS.location + pose.location;
+	objLRS.rotate = initLRS.rotate * glm::mat4_cast(pose.rotate);
+	objLRS.scale = initLRS.scale * pose.scale;
+	objLRS.anim_finished = !trk.loop_anim && bad.curr_time == trk.total_time;
 }
@@ -3,6 +3,7 @@
 
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <vector>
 #include <unordered_map>
@@ -31,6 +32,46 @@ struct BoneAnimStep {
 	glm::vec3 finalScale = glm::vec3(1.0f);
 };
 
+// rigid transform sampled from a track, rotation and scale are about the object's rest center
+struct AnimPose {
+	glm::vec3 location = glm::vec3(0.0f);
+	glm::quat rotate = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+struct AnimEvent {
+	int time = 0;
+	std::string name;
+};
+
+// one linear step of a compiled track, values at local time t(s) are init + rate * t
+struct AnimSegment {
+	int end_time = 0;
+	int duration = 0;
+	glm::vec3 initPos = glm::vec3(0.0f);
+	glm::vec3 vel = glm::vec3(0.0f);
+	glm::vec3 rotAxis = { 0.0f, 1.0f, 0.0f };
+	float initAngle = 0;
+	float angleVel = 0;
+	glm::vec3 initScale = glm::vec3(1.0f);
+	glm::vec3 scaleVel = glm::vec3(0.0f);
+};
+
+// a range of segments and events in shared arrays
+struct AnimTrack {
+	uint32_t first_seg = 0;
+	uint32_t seg_count = 0;
+	uint32_t first_event = 0;
+	uint32_t event_count = 0;
+	int total_time = 0;
+	int blend_ms = 0;
+	bool loop_anim = true;
+	bool rigid = false;
+};
+
+AnimPose evalAnimTrack(const AnimTrack& trk, const AnimSegment* segs, int t, uint32_t* seg);
+AnimPose mixAnimPose(const AnimPose& a, const AnimPose& b, float w);
+
 class BoneAnimData {
 public:
 	std::string name;
@@ -39,10 +80,11 @@ public:
 	int total_time = 0;
 	int curr_step = 0;
 	bool loop_anim = true;
+	int blend_ms = 0;
+	std::vector<AnimEvent> events;
+	int track = -1;
 
-	LRS transformAfterGap(int gap_ms);
-	int getNextEventTime();
-	glm::vec3 getNextVelHint();
+	AnimTrack compileTrack(std::vector<AnimSegment>& segs, std::vector<AnimEvent>& evts);
 };
 
 class ModelData
@@ -57,6 +99,8 @@ public:
 	LRS objLRS;
 	std::unordered_map<std::string, BoneAnimData> anims;
 	std::vector<std::string> running_anims;
+	std::vector<AnimSegment> anim_segs;
+	std::vector<AnimTrack> anim_tracks;
 
 	void pushToRenderer(PrismRenderer* renderer);
 	void updateAnim(std::string animName, int gap_ms);
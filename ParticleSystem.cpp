@@ -0,0 +1,359 @@
+#include "ParticleSystem.h"
+#include "PrismPhysics.h"
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PRISM_PARTICLES_SSE
+#endif
+
+// every per particle array, compaction moves them together
+static std::vector<float> ParticleBatch::* const PARTICLE_FIELDS[] = {
+	&ParticleBatch::px, &ParticleBatch::py, &ParticleBatch::pz,
+	&ParticleBatch::vx, &ParticleBatch::vy, &ParticleBatch::vz,
+	&ParticleBatch::angle, &ParticleBatch::spin, &ParticleBatch::life,
+	&ParticleBatch::ax, &ParticleBatch::ay, &ParticleBatch::az, &ParticleBatch::scale
+};
+
+ParticleSystem::ParticleSystem(SimpleThreadPooler* pool)
+{
+	thread_pool = pool;
+	rng.seed(31);
+}
+
+size_t ParticleSystem::add_batch(ParticleParams params)
+{
+	ParticleBatch batch;
+	batch.params = params;
+	batches.push_back(batch);
+	return batches.size() - 1;
+}
+
+void ParticleSystem::emit(size_t batch, glm::vec3 pos, glm::vec3 vel, float life, float scale, glm::vec3 spin_axis, float spin)
+{
+	ParticleBatch& b = batches[batch];
+	glm::vec3 axis = glm::normalize(spin_axis);
+	b.px.push_back(pos.x);
+	b.py.push_back(pos.y);
+	b.pz.push_back(pos.z);
+	b.vx.push_back(vel.x);
+	b.vy.push_back(vel.y);
+	b.vz.push_back(vel.z);
+	b.angle.push_back(0);
+	b.spin.push_back(spin);
+	b.life.push_back(life);
+	b.ax.push_back(axis.x);
+	b.ay.push_back(axis.y);
+	b.az.push_back(axis.z);
+	b.scale.push_back(scale);
+}
+
+void ParticleSystem::burst(size_t batch, glm::vec3 pos, glm::vec3 normal, size_t count, float speed, float life, float scale)
+{
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> vary(0.5f, 1.0f);
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 dir = glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.001f * normal;
+		if (glm::dot(dir, normal) < 0) dir -= 2 * glm::dot(dir, normal) * normal;
+		glm::vec3 axis = glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0, 0.001f, 0);
+		emit(batch, pos, glm::normalize(dir) * speed * vary(rng), life * (vary(rng) + 0.25f), scale * vary(rng), axis, 10.0f * unit(rng));
+	}
+}
+
+void ParticleSystem::set_colliders(const std::vector<PolyCollMesh*>& meshes)
+{
+	// face planes are kept as the physics maintains them, only turned to face away from the mesh
+	colliders.clear();
+	collider_planes.clear();
+	for (PolyCollMesh* pm : meshes) {
+		if (pm->faces_size == 0 || pm->verts_size == 0) continue;
+		ParticleCollider col;
+		col.epsilon = pm->face_epsilon;
+		col.bmin = pm->verts[0];
+		col.bmax = pm->verts[0];
+		glm::vec3 center = glm::vec3(0);
+		for (size_t v = 0; v < pm->verts_size; v++) {
+			col.bmin = glm::min(col.bmin, pm->verts[v]);
+			col.bmax = glm::max(col.bmax, pm->verts[v]);
+			center += pm->verts[v];
+		}
+		center /= float(pm->verts_size);
+		col.bmin -= glm::vec3(col.epsilon);
+		col.bmax += glm::vec3(col.epsilon);
+		col.first_plane = uint32_t(collider_planes.size());
+		col.plane_count = uint32_t(pm->faces_size);
+		for (size_t f = 0; f < pm->faces_size; f++) {
+			glm::vec4 eq = pm->faces[f].equation;
+			if (pm->faces_size > 1 && glm::dot(glm::vec3(eq), center) + eq.w > 0) eq = -eq;
+			collider_planes.push_back(eq);
+		}
+		colliders.push_back(col);
+	}
+	build_grid();
+}
+
+void ParticleSystem::build_grid()
+{
+	grid_w = 0;
+	grid_h = 0;
+	grid_start.clear();
+	grid_colliders.clear();
+	if (colliders.empty()) return;
+	glm::vec3 bmin = colliders[0].bmin, bmax = colliders[0].bmax;
+	for (const ParticleCollider& col : colliders) {
+		bmin = glm::min(bmin, col.bmin);
+		bmax = glm::max(bmax, col.bmax);
+	}
+	float side = std::max(std::max(bmax.x - bmin.x, bmax.z - bmin.z), 1e-3f) / GRID_SIDE;
+	grid_origin = glm::vec2(bmin.x, bmin.z);
+	grid_scale = 1.0f / side;
+	grid_w = std::min(std::max(uint32_t(std::ceil((bmax.x - bmin.x) * grid_scale)), 1u), GRID_SIDE);
+	grid_h = std::min(std::max(uint32_t(std::ceil((bmax.z - bmin.z) * grid_scale)), 1u), GRID_SIDE);
+
+	// counted, then filled, every collider goes into each column its bounds overlap
+	auto column = [this](float v, float origin, uint32_t n) {
+		return uint32_t(std::min(std::max((v - origin) * grid_scale, 0.0f), float(n - 1)));
+	};
+	grid_start.assign(size_t(grid_w) * grid_h + 1, 0);
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t c = 0; c < colliders.size(); c++) {
+			const ParticleCollider& col = colliders[c];
+			uint32_t x0 = column(col.bmin.x, grid_origin.x, grid_w), x1 = column(col.bmax.x, grid_origin.x, grid_w);
+			uint32_t z0 = column(col.bmin.z, grid_origin.y, grid_h), z1 = column(col.bmax.z, grid_origin.y, grid_h);
+			for (uint32_t z = z0; z <= z1; z++) {
+				for (uint32_t x = x0; x <= x1; x++) {
+					if (pass == 0) grid_start[size_t(z) * grid_w + x + 1]++;
+					else grid_colliders[grid_start[size_t(z) * grid_w + x]++] = c;
+				}
+			}
+		}
+		if (pass == 0) {
+			for (size_t i = 1; i < grid_start.size(); i++) grid_start[i] += grid_start[i - 1];
+			grid_colliders.resize(grid_start.back());
+		}
+	}
+	// the fill pass moved every start onto the next column's
+	for (size_t i = grid_start.size() - 1; i > 0; i--) grid_start[i] = grid_start[i - 1];
+	grid_start[0] = 0;
+}
+
+size_t ParticleSystem::chunk_size(size_t count)
+{
+	// the pool's task ring holds 1000 tasks, bigger batches get bigger chunks
+	size_t chunk = std::max(STEP_CHUNK, (count / 256 + 3) & ~size_t(3));
+	return chunk;
+}
+
+void ParticleSystem::step(float dt)
+{
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	size_t stepped = 0;
+	for (ParticleBatch& b : batches) {
+		size_t n = b.count();
+		if (n == 0) continue;
+		size_t chunk = chunk_size(n);
+		chunk_tests.assign((n + chunk - 1) / chunk, 0);
+		for (size_t c = 0; c < chunk_tests.size(); c++) {
+			thread_pool->add_task(&ParticleSystem::step_range, this, &b, c * chunk, std::min((c + 1) * chunk, n), dt, &chunk_tests[c]);
+		}
+		thread_pool->wait_till_done();
+		for (size_t tests : chunk_tests) stats_collider_tests += tests;
+		stepped += n;
+	}
+	std::chrono::steady_clock::time_point tstepped = std::chrono::steady_clock::now();
+	for (ParticleBatch& b : batches) compact(b);
+
+	if (print_step_stats && stepped > 0) {
+		std::chrono::steady_clock::time_point tend = std::chrono::steady_clock::now();
+		stats_step_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tend - tstart).count();
+		stats_compact_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tend - tstepped).count();
+		stats_particles += stepped;
+		if (++stats_steps == STATS_INTERVAL_STEPS) {
+			std::cout << "particles: " << stats_particles / stats_steps << " per step, avg step " << stats_step_ms / stats_steps << "ms (compact "
+				<< stats_compact_ms / stats_steps << "ms), " << float(stats_particles) / std::max(stats_step_ms, 0.001f) / 1000 << "M particles/s, "
+				<< float(stats_collider_tests) / stats_particles << " collider tests per particle" << (use_simd ? "\n" : " (scalar)\n");
+			stats_steps = 0;
+			stats_step_ms = 0;
+			stats_compact_ms = 0;
+			stats_particles = 0;
+			stats_collider_tests = 0;
+		}
+	}
+}
+
+void ParticleSystem::step_range(ParticleSystem* ps, ParticleBatch* batch, size_t start, size_t end, float dt, size_t* tests)
+{
+	integrate_range(batch, start, end, dt, ps->use_simd);
+	if (batch->params.collide && ps->grid_w > 0) {
+		*tests = collide_range(ps, batch, start, end, dt);
+	}
+}
+
+void ParticleSystem::integrate_range(ParticleBatch* batch, size_t start, size_t end, float dt, bool simd)
+{
+	// semi-implicit Euler, drag is a damping factor per step
+	const ParticleParams& pp = batch->params;
+	float damp = std::max(0.0f, 1.0f - pp.drag * dt);
+	glm::vec3 dv = pp.gravity * dt;
+	float* px = batch->px.data();
+	float* py = batch->py.data();
+	float* pz = batch->pz.data();
+	float* vx = batch->vx.data();
+	float* vy = batch->vy.data();
+	float* vz = batch->vz.data();
+	float* angle = batch->angle.data();
+	float* spin = batch->spin.data();
+	float* life = batch->life.data();
+	size_t i = start;
+#ifdef PRISM_PARTICLES_SSE
+	if (simd) {
+		__m128 vdt = _mm_set1_ps(dt);
+		__m128 vdamp = _mm_set1_ps(damp);
+		__m128 dvx = _mm_set1_ps(dv.x);
+		__m128 dvy = _mm_set1_ps(dv.y);
+		__m128 dvz = _mm_set1_ps(dv.z);
+		for (; i + 4 <= end; i += 4) {
+			__m128 x = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vx + i), dvx), vdamp);
+			__m128 y = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vy + i), dvy), vdamp);
+			__m128 z = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(vz + i), dvz), vdamp);
+			_mm_storeu_ps(vx + i, x);
+			_mm_storeu_ps(vy + i, y);
+			_mm_storeu_ps(vz + i, z);
+			_mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(x, vdt)));
+			_mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(y, vdt)));
+			_mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(z, vdt)));
+			_mm_storeu_ps(angle + i, _mm_add_ps(_mm_loadu_ps(angle + i), _mm_mul_ps(_mm_loadu_ps(spin + i), vdt)));
+			_mm_storeu_ps(life + i, _mm_sub_ps(_mm_loadu_ps(life + i), vdt));
+		}
+	}
+#endif
+	for (; i < end; i++) {
+		vx[i] = (vx[i] + dv.x) * damp;
+		vy[i] = (vy[i] + dv.y) * damp;
+		vz[i] = (vz[i] + dv.z) * damp;
+		px[i] += vx[i] * dt;
+		py[i] += vy[i] * dt;
+		pz[i] += vz[i] * dt;
+		angle[i] += spin[i] * dt;
+		life[i] -= dt;
+	}
+}
+
+size_t ParticleSystem::collide_range(ParticleSystem* ps, ParticleBatch* batch, size_t start, size_t end, float dt)
+{
+	// particles only test the colliders listed in their grid column
+	const ParticleParams& pp = batch->params;
+	size_t tests = 0;
+	for (size_t i = start; i < end; i++) {
+		glm::vec3 p = glm::vec3(batch->px[i], batch->py[i], batch->pz[i]);
+		glm::vec3 v = glm::vec3(batch->vx[i], batch->vy[i], batch->vz[i]);
+		float gx = (p.x - ps->grid_origin.x) * ps->grid_scale, gz = (p.z - ps->grid_origin.y) * ps->grid_scale;
+		if (!(gx >= 0 && gz >= 0 && gx < float(ps->grid_w) && gz < float(ps->grid_h))) continue;
+		size_t cell = size_t(gz) * ps->grid_w + size_t(gx);
+		// where the step started, v is already the velocity it moved with
+		glm::vec3 prev = p - v * dt;
+		bool hit = false;
+		for (uint32_t gi = ps->grid_start[cell]; gi < ps->grid_start[cell + 1]; gi++) {
+			const ParticleCollider& col = ps->colliders[ps->grid_colliders[gi]];
+			const glm::vec4* planes = &ps->collider_planes[col.first_plane];
+			glm::vec3 n;
+			float depth;
+			if (col.plane_count == 1) {
+				// a slab is thinner than a fast particle moves in a step, its bounds are tested against the whole move
+				if (glm::any(glm::greaterThan(col.bmin, glm::max(p, prev))) || glm::any(glm::lessThan(col.bmax, glm::min(p, prev)))) continue;
+				tests++;
+				float d = glm::dot(glm::vec3(planes[0]), p) + planes[0].w;
+				float dprev = d - glm::dot(glm::vec3(planes[0]), v) * dt;
+				if (std::abs(d) >= col.epsilon) {
+					// passed through it within the step, a hit only where it crossed inside the face
+					if ((d < 0) == (dprev < 0)) continue;
+					glm::vec3 cross = prev + (p - prev) * (dprev / (dprev - d));
+					if (glm::any(glm::greaterThan(col.bmin, cross)) || glm::any(glm::lessThan(col.bmax, cross))) continue;
+				}
+				// pushed out on the side the particle came from
+				float side = (dprev >= 0) ? 1.0f : -1.0f;
+				n = glm::vec3(planes[0]) * side;
+				depth = col.epsilon - d * side;
+			}
+			else {
+				if (glm::any(glm::greaterThan(col.bmin, p)) || glm::any(glm::lessThan(col.bmax, p))) continue;
+				tests++;
+				// inside the hull grown by epsilon, pushed out through the nearest face
+				float nearest = -FLT_MAX;
+				uint32_t nearest_face = 0;
+				for (uint32_t f = 0; f < col.plane_count; f++) {
+					float d = glm::dot(glm::vec3(planes[f]), p) + planes[f].w;
+					if (d > nearest) {
+						nearest = d;
+						nearest_face = f;
+					}
+				}
+				if (nearest >= col.epsilon) continue;
+				n = glm::vec3(planes[nearest_face]);
+				depth = col.epsilon - nearest;
+			}
+			p += n * depth;
+			float vn = glm::dot(v, n);
+			if (vn < 0) {
+				v = (v - vn * n) * (1.0f - pp.friction) - vn * pp.restitution * n;
+			}
+			hit = true;
+		}
+		if (!hit) continue;
+		batch->px[i] = p.x;
+		batch->py[i] = p.y;
+		batch->pz[i] = p.z;
+		batch->vx[i] = v.x;
+		batch->vy[i] = v.y;
+		batch->vz[i] = v.z;
+	}
+	return tests;
+}
+
+void ParticleSystem::compact(ParticleBatch& batch)
+{
+	// dead particles are swapped with the last live one, the draw doesn't care about order
+	size_t n = batch.count();
+	for (size_t i = 0; i < n;) {
+		if (batch.life[i] > 0) {
+			i++;
+			continue;
+		}
+		n--;
+		for (std::vector<float> ParticleBatch::* field : PARTICLE_FIELDS) (batch.*field)[i] = (batch.*field)[n];
+	}
+	if (n == batch.count()) return;
+	for (std::vector<float> ParticleBatch::* field : PARTICLE_FIELDS) (batch.*field).resize(n);
+}
+
+void ParticleSystem::write_instances(size_t batch, GPUParticleInstance* out)
+{
+	// out is mapped GPU memory, each chunk writes its part front to back
+	ParticleBatch& b = batches[batch];
+	size_t n = b.count();
+	size_t chunk = chunk_size(n);
+	for (size_t start = 0; start < n; start += chunk) {
+		thread_pool->add_task(&ParticleSystem::write_range, &b, out, start, std::min(start + chunk, n));
+	}
+	thread_pool->wait_till_done();
+}
+
+void ParticleSystem::write_range(ParticleBatch* batch, GPUParticleInstance* out, size_t start, size_t end)
+{
+	for (size_t i = start; i < end; i++) {
+		out[i].posScale = glm::vec4(batch->px[i], batch->py[i], batch->pz[i], batch->scale[i]);
+		out[i].axisAngle = glm::vec4(batch->ax[i], batch->ay[i], batch->az[i], batch->angle[i]);
+	}
+}
+
+size_t ParticleSystem::total_count()
+{
+	size_t total = 0;
+	for (ParticleBatch& b : batches) total += b.count();
+	return total;
+}
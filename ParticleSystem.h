@@ -0,0 +1,93 @@
+#pragma once
+#include "CollisionStructs.h"
+#include "SimpleThreadPooler.h"
+
+#include <random>
+
+using namespace collutils;
+
+// how the particles of a batch move, shared by all of them
+struct ParticleParams {
+	glm::vec3 gravity = glm::vec3(0, -30.0f, 0);
+	// fraction of the velocity lost per second
+	float drag = 0.2f;
+	// normal velocity kept and tangential velocity lost when bouncing off a level mesh
+	float restitution = 0.3f;
+	float friction = 0.2f;
+	bool collide = true;
+};
+
+// one particle type, drawn by the renderer's particle type of the same index. Kept structure-of-arrays so
+// the integration loads 4 particles into each SSE register
+struct ParticleBatch {
+	ParticleParams params;
+	std::vector<float> px, py, pz;
+	std::vector<float> vx, vy, vz;
+	std::vector<float> angle, spin, life;
+	// spin axis and uniform scale, fixed for the particle's life
+	std::vector<float> ax, ay, az, scale;
+
+	size_t count() const { return px.size(); }
+};
+
+// a level mesh as particles see it: its bounds and outward face planes. A mesh with a single face is a slab
+// epsilon thick on both sides of it
+struct ParticleCollider {
+	glm::vec3 bmin, bmax;
+	uint32_t first_plane = 0;
+	uint32_t plane_count = 0;
+	float epsilon = 0;
+};
+
+class ParticleSystem
+{
+public:
+	// particles per step task, a multiple of 4
+	size_t STEP_CHUNK = 16384;
+	// the scalar loop is kept for the benchmark's comparison
+	bool use_simd = true;
+	bool print_step_stats = false;
+	int STATS_INTERVAL_STEPS = 1000;
+
+	std::vector<ParticleBatch> batches;
+
+	ParticleSystem(SimpleThreadPooler* pool);
+	size_t add_batch(ParticleParams params);
+	void emit(size_t batch, glm::vec3 pos, glm::vec3 vel, float life, float scale, glm::vec3 spin_axis, float spin);
+	// count particles thrown out of pos into the hemisphere around normal
+	void burst(size_t batch, glm::vec3 pos, glm::vec3 normal, size_t count, float speed, float life, float scale);
+	// snapshots the meshes' bounds and planes and bins them into the column grid, call it after they moved and
+	// before step
+	void set_colliders(const std::vector<PolyCollMesh*>& meshes);
+	void step(float dt);
+	void write_instances(size_t batch, GPUParticleInstance* out);
+	size_t total_count();
+
+private:
+	SimpleThreadPooler* thread_pool;
+	std::minstd_rand rng;
+	std::vector<ParticleCollider> colliders;
+	std::vector<glm::vec4> collider_planes;
+	// the broadphase, square columns over the xz plane listing the colliders whose bounds reach into them. The
+	// longer side of the level gets GRID_SIDE columns
+	const uint32_t GRID_SIDE = 64;
+	glm::vec2 grid_origin = glm::vec2(0);
+	float grid_scale = 0;
+	uint32_t grid_w = 0, grid_h = 0;
+	std::vector<uint32_t> grid_start, grid_colliders;
+
+	int stats_steps = 0;
+	float stats_step_ms = 0;
+	float stats_compact_ms = 0;
+	size_t stats_particles = 0;
+	size_t stats_collider_tests = 0;
+	std::vector<size_t> chunk_tests;
+
+	size_t chunk_size(size_t count);
+	void build_grid();
+	static void step_range(ParticleSystem* ps, ParticleBatch* batch, size_t start, size_t end, float dt, size_t* tests);
+	static void integrate_range(ParticleBatch* batch, size_t start, size_t end, float dt, bool simd);
+	static size_t collide_range(ParticleSystem* ps, ParticleBatch* batch, size_t start, size_t end, float dt);
+	static void write_range(ParticleBatch* batch, GPUParticleInstance* out, size_t start, size_t end);
+	void compact(ParticleBatch& batch);
+};
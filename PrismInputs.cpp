@@ -14,6 +14,7 @@ PrismInputs::PrismInputs()
 		GLFW_KEY_F,
 		GLFW_KEY_G,
 		GLFW_KEY_H,
+		GLFW_KEY_B,
 		GLFW_KEY_Q,
 		GLFW_KEY_SPACE,
 		GLFW_KEY_LEFT_CONTROL,
@@ -1,5 +1,9 @@
 #include "PrismPhysics.h"
 
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
 void move_mesh_out_plane(PolyCollMesh* pm1, glm::vec4 plane_eq, float epsilon) {
 	float move_dist = epsilon;
 	for (int i = 0; i < pm1->verts_size; i++) {
@@ -47,23 +51,203 @@ void PrismPhysics::add_pcmesh(PolyCollMesh* pcmesh, bool dynm)
 		dl_ccache.resize(dl_ccache.size() + 1);
 		dl_ccache[dl_ccache.size() - 1] = std::vector<CollCache>(lmeshes->size());
 		for (int i = 0; i < lmeshes->size(); i++) {
-			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*dmeshes)[dl_ccache.size() - 1], (*lmeshes)[i]);
+			if (lmesh_inactive[i]) continue;
+			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*lmeshes)[i], (*dmeshes)[dl_ccache.size() - 1]);
 		}
 	}
 	else {
 		lmeshes->push_back(pcmesh);
 		lmeshes_future->push_back(pmf);
+		lmesh_inactive.push_back(false);
+		compile_mesh_anims(pcmesh, pmf);
 		for (int i = 0; i < dmeshes->size(); i++) {
 			dl_ccache[i].resize(lmeshes->size());
-			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*dmeshes)[i], (*lmeshes)[lmeshes->size() - 1]);
+			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*lmeshes)[lmeshes->size() - 1], (*dmeshes)[i]);
 		}
 	}
 	new_mesh_lock.unlock();
 }
 
-void PrismPhysics::gen_and_add_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float tlen, float face_thickness, float face_friction, bool dynm)
+void PrismPhysics::remove_pcmesh(PolyCollMesh* pcmesh)
+{
+	new_mesh_lock.lock();
+	for (size_t i = 0; i < lmeshes->size(); i++) {
+		if ((*lmeshes)[i] == pcmesh) {
+			release_mesh_anims((*lmeshes_future)[i]);
+			delete (*lmeshes)[i];
+			delete (*lmeshes_future)[i];
+			lmeshes->erase(lmeshes->begin() + i);
+			lmeshes_future->erase(lmeshes_future->begin() + i);
+			lmesh_inactive.erase(lmesh_inactive.begin() + i);
+			for (size_t j = 0; j < dl_ccache.size(); j++) {
+				dl_ccache[j].erase(dl_ccache[j].begin() + i);
+			}
+			if (anim_children.size() > 0) {
+				anim_children_dirty = true;
+			}
+			if (anim_dead_segs * 2 > anim_segs.size()) compact_anims();
+			break;
+		}
+	}
+	new_mesh_lock.unlock();
+}
+
+void PrismPhysics::replace_pcmesh(size_t idx, PolyCollMesh* pcmesh)
+{
+	new_mesh_lock.lock();
+	release_mesh_anims((*lmeshes_future)[idx]);
+	delete (*lmeshes)[idx];
+	delete (*lmeshes_future)[idx];
+	(*lmeshes)[idx] = pcmesh;
+	(*lmeshes_future)[idx] = new PolyCollMesh(pcmesh);
+	lmesh_inactive[idx] = false;
+	compile_mesh_anims((*lmeshes)[idx], (*lmeshes_future)[idx]);
+	for (int i = 0; i < dmeshes->size(); i++) {
+		dl_ccache[i][idx] = get_sep_plane((*lmeshes)[idx], (*dmeshes)[i]);
+	}
+	if (anim_dead_segs * 2 > anim_segs.size()) compact_anims();
+	new_mesh_lock.unlock();
+}
+
+void PrismPhysics::deactivate_pcmesh(size_t idx)
+{
+	new_mesh_lock.lock();
+	release_mesh_anims((*lmeshes_future)[idx]);
+	delete (*lmeshes)[idx];
+	delete (*lmeshes_future)[idx];
+	(*lmeshes)[idx] = new PolyCollMesh();
+	(*lmeshes_future)[idx] = new PolyCollMesh();
+	lmesh_inactive[idx] = true;
+	if (anim_children.size() > 0) {
+		anim_children_dirty = true;
+	}
+	if (anim_dead_segs * 2 > anim_segs.size()) compact_anims();
+	new_mesh_lock.unlock();
+}
+
+void PrismPhysics::compile_anims(size_t idx)
 {
 	new_mesh_lock.lock();
+	compile_mesh_anims((*lmeshes)[idx], (*lmeshes_future)[idx]);
+	new_mesh_lock.unlock();
+}
+
+void PrismPhysics::compile_mesh_anims(PolyCollMesh* pm, PolyCollMesh* pm_future)
+{
+	for (auto& it : pm_future->anims) {
+		if (it.second.track < 0 && it.second.steps.size() > 0) {
+			AnimTrack trk = it.second.compileTrack(anim_segs, anim_events);
+			if (trk.total_time > 0) {
+				it.second.track = int(anim_tracks.size());
+				anim_tracks.push_back(trk);
+			}
+		}
+		pm->anims[it.first].track = it.second.track;
+	}
+	int running = (pm_future->running_anims.size() > 0) ? find_anim(pm_future, pm_future->running_anims[0]) : -1;
+	start_anim(pm, running);
+	start_anim(pm_future, running);
+	pm->anim_parent = pm_future->anim_parent;
+	if (pm_future->anim_parent >= 0 || anim_children.size() > 0) {
+		anim_children_dirty = true;
+	}
+}
+
+void PrismPhysics::release_mesh_anims(PolyCollMesh* pm_future)
+{
+	for (auto& it : pm_future->anims) {
+		if (it.second.track >= 0) anim_dead_segs += anim_tracks[it.second.track].seg_count;
+	}
+}
+
+void PrismPhysics::compact_anims()
+{
+	// copies the tracks the meshes still use to the front, in mesh order, and renumbers them
+	std::vector<AnimSegment> segs;
+	std::vector<AnimTrack> tracks;
+	std::vector<AnimEvent> events;
+	std::vector<int> remap(anim_tracks.size(), -1);
+	for (size_t i = 0; i < lmeshes_future->size(); i++) {
+		PolyCollMesh* pm = (*lmeshes)[i];
+		PolyCollMesh* pmf = (*lmeshes_future)[i];
+		for (auto& it : pmf->anims) {
+			int old = it.second.track;
+			if (old < 0) continue;
+			if (remap[old] < 0) {
+				AnimTrack trk = anim_tracks[old];
+				segs.insert(segs.end(), anim_segs.begin() + trk.first_seg, anim_segs.begin() + trk.first_seg + trk.seg_count);
+				events.insert(events.end(), anim_events.begin() + trk.first_event, anim_events.begin() + trk.first_event + trk.event_count);
+				trk.first_seg = uint32_t(segs.size() - trk.seg_count);
+				trk.first_event = uint32_t(events.size() - trk.event_count);
+				remap[old] = int(tracks.size());
+				tracks.push_back(trk);
+			}
+			it.second.track = remap[old];
+			pm->anims[it.first].track = remap[old];
+		}
+		if (pmf->running_anim >= 0) pmf->running_anim = remap[pmf->running_anim];
+		if (pm->running_anim >= 0) pm->running_anim = remap[pm->running_anim];
+	}
+	anim_segs.swap(segs);
+	anim_tracks.swap(tracks);
+	anim_events.swap(events);
+	anim_dead_segs = 0;
+}
+
+void PrismPhysics::sort_anim_children()
+{
+	std::vector<std::pair<size_t, size_t>> depth_idx;
+	for (size_t i = 0; i < lmeshes_future->size(); i++) {
+		int parent = (*lmeshes_future)[i]->anim_parent;
+		if (parent < 0) continue;
+		if (parent >= int(lmeshes_future->size()) || parent == int(i)) {
+			std::cout << "lmesh " << i << " has an invalid anim parent " << parent << ", ignoring it\n";
+			(*lmeshes_future)[i]->anim_parent = -1;
+			(*lmeshes)[i]->anim_parent = -1;
+			continue;
+		}
+		size_t depth = 0;
+		while (parent >= 0 && parent < int(lmeshes_future->size()) && depth <= lmeshes_future->size()) {
+			parent = (*lmeshes_future)[parent]->anim_parent;
+			depth++;
+		}
+		depth_idx.push_back({ depth, i });
+	}
+	std::stable_sort(depth_idx.begin(), depth_idx.end());
+	anim_children.clear();
+	for (auto& di : depth_idx) {
+		anim_children.push_back(di.second);
+	}
+	anim_children_dirty = false;
+}
+
+int PrismPhysics::find_anim(PolyCollMesh* pm, std::string anim_name)
+{
+	auto it = pm->anims.find(anim_name);
+	return (it == pm->anims.end()) ? -1 : it->second.track;
+}
+
+void PrismPhysics::start_anim(PolyCollMesh* pm, int track)
+{
+	pm->running_anim = track;
+	pm->anim_time = 0;
+	pm->anim_seg = 0;
+	pm->anim_event = 0;
+	pm->anim_blend_left = (track >= 0) ? anim_tracks[track].blend_ms : 0;
+	pm->anim_blend_from = pm->get_pose();
+}
+
+std::vector<FiredAnimEvent> PrismPhysics::take_anim_events()
+{
+	std::vector<FiredAnimEvent> out;
+	anim_event_lock.lock();
+	out.swap(fired_anim_events);
+	anim_event_lock.unlock();
+	return out;
+}
+
+PolyCollMesh* PrismPhysics::gen_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float tlen, float face_thickness, float face_friction)
+{
 	PolyCollMesh* pm1 = new PolyCollMesh();
 	pm1->_center = ccenter;
 	pm1->_init_center = ccenter;
@@ -131,36 +315,16 @@ void PrismPhysics::gen_and_add_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec
 		pm1->faces[i].process_plane(&pm1->verts);
 	}
 
-	PolyCollMesh* pm2 = new PolyCollMesh(pm1);
+	return pm1;
+}
 
-	if (dynm) {
-		dmeshes->push_back(pm1);
-		dmeshes_future->push_back(pm2);
-		dd_ccache.resize(dd_ccache.size() + 1);
-		dd_ccache[dd_ccache.size() - 1] = std::vector<CollCache>(dmeshes->size() - 1);
-		for (int i = 0; i < dmeshes->size() - 1; i++) {
-			dd_ccache[dd_ccache.size() - 1][i] = get_sep_plane((*dmeshes)[dd_ccache.size() - 1], (*dmeshes)[i]);
-		}
-		dl_ccache.resize(dl_ccache.size() + 1);
-		dl_ccache[dl_ccache.size() - 1] = std::vector<CollCache>(lmeshes->size());
-		for (int i = 0; i < lmeshes->size(); i++) {
-			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*lmeshes)[i], (*dmeshes)[dl_ccache.size() - 1]);
-		}
-	}
-	else {
-		lmeshes->push_back(pm1);
-		lmeshes_future->push_back(pm2);
-		for (int i = 0; i < dmeshes->size(); i++) {
-			dl_ccache[i].resize(lmeshes->size());
-			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*lmeshes)[lmeshes->size() - 1], (*dmeshes)[i]);
-		}
-	}
-	new_mesh_lock.unlock();
+void PrismPhysics::gen_and_add_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float tlen, float face_thickness, float face_friction, bool dynm)
+{
+	add_pcmesh(gen_pcmesh(ccenter, uax, vax, ulen, vlen, tlen, face_thickness, face_friction), dynm);
 }
 
-void PrismPhysics::gen_and_add_pcmesh(glm::vec3 pcenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float face_thickness, float face_friction, bool dynm)
+PolyCollMesh* PrismPhysics::gen_pcmesh(glm::vec3 pcenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float face_thickness, float face_friction)
 {
-	new_mesh_lock.lock();
 	PolyCollMesh* pm1 = new PolyCollMesh();
 
 	pm1->face_epsilon = face_thickness;
@@ -204,36 +368,16 @@ void PrismPhysics::gen_and_add_pcmesh(glm::vec3 pcenter, glm::vec3 uax, glm::vec
 	pm1->_center /= float(pm1->verts_size);
 	pm1->_init_center = pm1->_center;
 
-	PolyCollMesh* pm2 = new PolyCollMesh(pm1);
+	return pm1;
+}
 
-	if (dynm) {
-		dmeshes->push_back(pm1);
-		dmeshes_future->push_back(pm2);
-		dd_ccache.resize(dd_ccache.size() + 1);
-		dd_ccache[dd_ccache.size() - 1] = std::vector<CollCache>(dmeshes->size() - 1);
-		for (int i = 0; i < dmeshes->size() - 1; i++) {
-			dd_ccache[dd_ccache.size() - 1][i] = get_sep_plane((*dmeshes)[dd_ccache.size() - 1], (*dmeshes)[i]);
-		}
-		dl_ccache.resize(dl_ccache.size() + 1);
-		dl_ccache[dl_ccache.size() - 1] = std::vector<CollCache>(lmeshes->size());
-		for (int i = 0; i < lmeshes->size(); i++) {
-			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*lmeshes)[i], (*dmeshes)[dl_ccache.size() - 1]);
-		}
-	}
-	else {
-		lmeshes->push_back(pm1);
-		lmeshes_future->push_back(pm2);
-		for (int i = 0; i < dmeshes->size(); i++) {
-			dl_ccache[i].resize(lmeshes->size());
-			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*lmeshes)[lmeshes->size() - 1], (*dmeshes)[i]);
-		}
-	}
-	new_mesh_lock.unlock();
+void PrismPhysics::gen_and_add_pcmesh(glm::vec3 pcenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float face_thickness, float face_friction, bool dynm)
+{
+	add_pcmesh(gen_pcmesh(pcenter, uax, vax, ulen, vlen, face_thickness, face_friction), dynm);
 }
 
-void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> top_face_points, glm::vec3 cylinder_depth_dir, float cylinder_depth, float face_thickness, float face_friction, bool dynm)
+PolyCollMesh* PrismPhysics::gen_pcmesh(std::vector<glm::vec3> top_face_points, glm::vec3 cylinder_depth_dir, float cylinder_depth, float face_thickness, float face_friction)
 {
-	new_mesh_lock.lock();
 	PolyCollMesh* pm1 = new PolyCollMesh();
 
 	pm1->face_epsilon = face_thickness;
@@ -289,36 +433,16 @@ void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> top_face_points, gl
 	pm1->_center /= float(pm1->verts_size);
 	pm1->_init_center = pm1->_center;
 
-	PolyCollMesh* pm2 = new PolyCollMesh(pm1);
+	return pm1;
+}
 
-	if (dynm) {
-		dmeshes->push_back(pm1);
-		dmeshes_future->push_back(pm2);
-		dd_ccache.resize(dd_ccache.size() + 1);
-		dd_ccache[dd_ccache.size() - 1] = std::vector<CollCache>(dmeshes->size() - 1);
-		for (int i = 0; i < dmeshes->size() - 1; i++) {
-			dd_ccache[dd_ccache.size() - 1][i] = get_sep_plane((*dmeshes)[dd_ccache.size() - 1], (*dmeshes)[i]);
-		}
-		dl_ccache.resize(dl_ccache.size() + 1);
-		dl_ccache[dl_ccache.size() - 1] = std::vector<CollCache>(lmeshes->size());
-		for (int i = 0; i < lmeshes->size(); i++) {
-			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*lmeshes)[i], (*dmeshes)[dl_ccache.size() - 1]);
-		}
-	}
-	else {
-		lmeshes->push_back(pm1);
-		lmeshes_future->push_back(pm2);
-		for (int i = 0; i < dmeshes->size(); i++) {
-			dl_ccache[i].resize(lmeshes->size());
-			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*lmeshes)[lmeshes->size() - 1], (*dmeshes)[i]);
-		}
-	}
-	new_mesh_lock.unlock();
+void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> top_face_points, glm::vec3 cylinder_depth_dir, float cylinder_depth, float face_thickness, float face_friction, bool dynm)
+{
+	add_pcmesh(gen_pcmesh(top_face_points, cylinder_depth_dir, cylinder_depth, face_thickness, face_friction), dynm);
 }
 
-void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> plane_points, float face_thickness, float face_friction, bool dynm)
+PolyCollMesh* PrismPhysics::gen_pcmesh(std::vector<glm::vec3> plane_points, float face_thickness, float face_friction)
 {
-	new_mesh_lock.lock();
 	PolyCollMesh* pm1 = new PolyCollMesh();
 
 	pm1->face_epsilon = face_thickness;
@@ -349,31 +473,12 @@ void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> plane_points, float
 	pm1->_center /= float(pm1->verts_size);
 	pm1->_init_center = pm1->_center;
 
-	PolyCollMesh* pm2 = new PolyCollMesh(pm1);
+	return pm1;
+}
 
-	if (dynm) {
-		dmeshes->push_back(pm1);
-		dmeshes_future->push_back(pm2);
-		dd_ccache.resize(dd_ccache.size() + 1);
-		dd_ccache[dd_ccache.size() - 1] = std::vector<CollCache>(dmeshes->size() - 1);
-		for (int i = 0; i < dmeshes->size() - 1; i++) {
-			dd_ccache[dd_ccache.size() - 1][i] = get_sep_plane((*dmeshes)[dd_ccache.size() - 1], (*dmeshes)[i]);
-		}
-		dl_ccache.resize(dl_ccache.size() + 1);
-		dl_ccache[dl_ccache.size() - 1] = std::vector<CollCache>(lmeshes->size());
-		for (int i = 0; i < lmeshes->size(); i++) {
-			dl_ccache[dl_ccache.size() - 1][i] = get_sep_plane((*lmeshes)[i], (*dmeshes)[dl_ccache.size() - 1]);
-		}
-	}
-	else {
-		lmeshes->push_back(pm1);
-		lmeshes_future->push_back(pm2);
-		for (int i = 0; i < dmeshes->size(); i++) {
-			dl_ccache[i].resize(lmeshes->size());
-			dl_ccache[i][lmeshes->size() - 1] = get_sep_plane((*lmeshes)[lmeshes->size() - 1], (*dmeshes)[i]);
-		}
-	}
-	new_mesh_lock.unlock();
+void PrismPhysics::gen_and_add_pcmesh(std::vector<glm::vec3> plane_points, float face_thickness, float face_friction, bool dynm)
+{
+	add_pcmesh(gen_pcmesh(plane_points, face_thickness, face_friction), dynm);
 }
 
 CollCache PrismPhysics::get_sep_plane(PolyCollMesh* pm1, PolyCollMesh* pm2)
@@ -455,13 +560,90 @@ void PrismPhysics::run_physics(int rt_ms)
 
 void PrismPhysics::advance_mesh_one_step(PolyCollMesh* pm)
 {
-	if (pm->running_anims.size() == 0) {
-		glm::vec3 ldisp = (pm->_bvel * 0.001f) + (0.5f * 0.001f * 0.001f * pm->_bacc);
-		pm->apply_displacement(ldisp);
-		pm->_bvel += pm->_bacc * 0.001f;
+	if (pm->_bvel == glm::vec3(0) && pm->_bacc == glm::vec3(0)) return;
+	glm::vec3 ldisp = (pm->_bvel * 0.001f) + (0.5f * 0.001f * 0.001f * pm->_bacc);
+	pm->apply_displacement(ldisp);
+	pm->_bvel += pm->_bacc * 0.001f;
+}
+
+AnimPose PrismPhysics::step_anim(size_t idx, PolyCollMesh* pm, glm::vec3* vel)
+{
+	const AnimTrack& trk = anim_tracks[pm->running_anim];
+	const AnimSegment* segs = &anim_segs[trk.first_seg];
+	int t = ++pm->anim_time;
+	AnimPose pose = evalAnimTrack(trk, segs, t, &pm->anim_seg);
+	uint32_t si = pm->anim_seg;
+
+	while (pm->anim_event < trk.event_count && anim_events[trk.first_event + pm->anim_event].time <= t) {
+		anim_event_lock.lock();
+		fired_anim_events.push_back({ idx, anim_events[trk.first_event + pm->anim_event].name });
+		anim_event_lock.unlock();
+		pm->anim_event++;
 	}
-	else {
-		pm->updateAnim(pm->running_anims[0], 1);
+
+	if (pm->anim_blend_left > 0) {
+		pose = mixAnimPose(pm->anim_blend_from, pose, 1.0f - float(pm->anim_blend_left) / float(trk.blend_ms));
+		pm->anim_blend_left--;
+	}
+
+	// velocity hint is the one of the step the next tick lands in
+	*vel = segs[si].vel;
+	if (t == trk.total_time) {
+		pm->anim_time = 0;
+		pm->anim_seg = 0;
+		pm->anim_event = 0;
+		if (!trk.loop_anim) {
+			pm->running_anim = -1;
+			*vel = glm::vec3(0);
+		}
+		else {
+			*vel = segs[0].vel;
+		}
+	}
+	else if (t == segs[si].end_time) {
+		si++;
+		while (segs[si].duration == 0) si++;
+		pm->anim_seg = si;
+		*vel = segs[si].vel;
+	}
+	return pose;
+}
+
+void PrismPhysics::advance_anim_child(size_t idx)
+{
+	PolyCollMesh* pm = (*lmeshes_future)[idx];
+	PolyCollMesh* parent = (*lmeshes_future)[pm->anim_parent];
+
+	AnimPose local;
+	local.location = pm->_init_center;
+	glm::vec3 lvel = glm::vec3(0);
+	if (pm->running_anim >= 0) {
+		local = step_anim(idx, pm, &lvel);
+	}
+
+	AnimPose world;
+	world.location = parent->_center + parent->_rot * (local.location - parent->_init_center);
+	world.rotate = parent->_rot * local.rotate;
+	world.scale = local.scale;
+	pm->apply_pose(world);
+	pm->_vel = parent->_vel + parent->_rot * lvel;
+	pm->_bvel = pm->_vel;
+}
+
+void PrismPhysics::advance_lmesh_range(PrismPhysics* phy, size_t lstart, size_t lend)
+{
+	for (size_t i = lstart; i < lend; i++) {
+		PolyCollMesh* pm = (*phy->lmeshes_future)[i];
+		if (pm->anim_parent >= 0 || phy->lmesh_inactive[i]) continue;
+		if (pm->running_anim >= 0) {
+			glm::vec3 avel;
+			pm->apply_pose(phy->step_anim(i, pm, &avel));
+			pm->_vel = avel;
+			pm->_bvel = avel;
+		}
+		else {
+			advance_mesh_one_step(pm);
+		}
 	}
 }
 
@@ -679,8 +861,11 @@ glm::vec3 apply_dbounds_acc(glm::vec3 vec_to_bound, std::vector<DynBound> dbound
 void PrismPhysics::run_physics_one_step()
 {
 	new_mesh_lock.lock();
-	for (size_t i = 0; i < lmeshes->size(); i++) {
-		thread_pool->add_task(&advance_mesh_one_step, lmeshes_future->at(i));
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	// batched so big levels don't overrun the pooler's task ring
+	size_t lbatch = lmeshes_future->size() / 64 + 1;
+	for (size_t ls = 0; ls < lmeshes_future->size(); ls += lbatch) {
+		thread_pool->add_task(&advance_lmesh_range, this, ls, std::min(ls + lbatch, lmeshes_future->size()));
 	}
 
 	std::vector<std::vector<DynBound>> dbounds = std::vector<std::vector<DynBound>>(dmeshes->size());
@@ -688,12 +873,20 @@ void PrismPhysics::run_physics_one_step()
 	
 	thread_pool->wait_till_done();
 
+	// children need their parent's pose of this step
+	if (anim_children_dirty) sort_anim_children();
+	for (size_t ci : anim_children) {
+		advance_anim_child(ci);
+	}
+	std::chrono::steady_clock::time_point tanim = std::chrono::steady_clock::now();
+
 	for (size_t i = 0; i < dmeshes->size(); i++) {
 		(*dmeshes_future)[i]->_bvel = (*dmeshes_future)[i]->_vel;
 		(*dmeshes_future)[i]->_bacc = (*dmeshes_future)[i]->_acc;
 		advance_mesh_one_step((*dmeshes_future)[i]);
 		(*dmeshes_future)[i]->_vel = (*dmeshes_future)[i]->_bvel;
 		for (int j = 0; j < lmeshes->size(); j++) {
+			if (lmesh_inactive[j]) continue;
 			CollCache tmp_cc = dl_ccache[i][j];
 			bool spl_invalid = false;
 			glm::vec4 tmp_spl;
@@ -739,8 +932,8 @@ void PrismPhysics::run_physics_one_step()
 						fric_dbounds[i].push_back(tmp_db);
 					}
 					else if (lmeshes_future->at(j)->coll_behav == "animself") {
-						if (lmeshes_future->at(j)->coll_behav_args.size() > 0 && lmeshes_future->at(j)->running_anims.size() == 0) {
-							lmeshes_future->at(j)->running_anims.push_back(lmeshes_future->at(j)->coll_behav_args[0]);
+						if (lmeshes_future->at(j)->coll_behav_args.size() > 0 && lmeshes_future->at(j)->running_anim < 0) {
+							start_anim(lmeshes_future->at(j), find_anim(lmeshes_future->at(j), lmeshes_future->at(j)->coll_behav_args[0]));
 						}
 						DynBound tmp_db;
 						tmp_db._plane = (glm::dot(glm::vec4((*dmeshes)[i]->_center, 1), tmp_cc.sep_plane) > 0) ? tmp_cc.sep_plane : -tmp_cc.sep_plane;
@@ -758,8 +951,8 @@ void PrismPhysics::run_physics_one_step()
 					else if (lmeshes_future->at(j)->coll_behav == "animremote") {
 						if (lmeshes_future->at(j)->coll_behav_args.size() > 1) {
 							int emi = stoi(lmeshes_future->at(j)->coll_behav_args[1]);
-							if (lmeshes_future->at(emi)->running_anims.size() == 0) {
-								lmeshes_future->at(emi)->running_anims.push_back(lmeshes_future->at(j)->coll_behav_args[0]);
+							if (lmeshes_future->at(emi)->running_anim < 0) {
+								start_anim(lmeshes_future->at(emi), find_anim(lmeshes_future->at(emi), lmeshes_future->at(j)->coll_behav_args[0]));
 							}
 						}
 						DynBound tmp_db;
@@ -791,6 +984,7 @@ void PrismPhysics::run_physics_one_step()
 							dd_ccache[0][i] = get_sep_plane(dmeshes->at(0), dmeshes->at(i));
 						}
 						for (int i = 0; i < lmeshes->size(); i++) {
+							if (lmesh_inactive[i]) continue;
 							dl_ccache[0][i] = get_sep_plane(lmeshes->at(i), dmeshes->at(0));
 						}
 						break;
@@ -871,12 +1065,31 @@ void PrismPhysics::run_physics_one_step()
 	}
 
 	for (int i = 0; i < lmeshes->size(); i++) {
-		(*(*lmeshes)[i]) = (*(*lmeshes_future)[i]);
+		if (lmesh_inactive[i]) continue;
+		(*lmeshes)[i]->copy_motion_state((*lmeshes_future)[i]);
 	}
 	for (int i = 0; i < dmeshes->size(); i++) {
 		(*(*dmeshes)[i]) = (*(*dmeshes_future)[i]);
 	}
 
+	if (print_step_stats) {
+		std::chrono::steady_clock::time_point tend = std::chrono::steady_clock::now();
+		stats_anim_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tanim - tstart).count();
+		stats_step_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tend - tstart).count();
+		if (++stats_steps == STATS_INTERVAL_STEPS) {
+			stats_animated = 0;
+			for (int i = 0; i < lmeshes->size(); i++) {
+				if ((*lmeshes)[i]->running_anim >= 0 || (*lmeshes)[i]->anim_parent >= 0) stats_animated++;
+			}
+			std::cout << "physics: " << lmeshes->size() << " lmeshes, " << stats_animated << " animated, avg step "
+				<< stats_step_ms / stats_steps << "ms (lmesh advance " << stats_anim_ms / stats_steps << "ms, "
+				<< stats_anim_ms / stats_steps * 1000.0f / float(std::max<size_t>(stats_animated, 1)) << "ms per 1k animated)\n";
+			stats_steps = 0;
+			stats_anim_ms = 0;
+			stats_step_ms = 0;
+		}
+	}
+
 	new_mesh_lock.unlock();
 }
 
@@ -886,6 +1099,7 @@ CollPoint PrismPhysics::find_ray_first_coll(glm::vec3 raystart, glm::vec3 raydir
 	cpt.time = 100000;
 	cpt.time = 100000;
 	for (int i = 0; i < lmeshes->size(); i++) {
+		if (lmesh_inactive[i]) continue;
 		CollPoint tmp = lmeshes->at(i)->find_ray_first_coll(raystart, raydir);
 		if (tmp.will_collide && tmp.time < cpt.time) {
 			cpt.will_collide = true;
@@ -4,6 +4,13 @@
 #include <mutex>
 
 using namespace collutils;
+
+// the name is copied out, anim_events is compacted while the logic thread still holds fired events
+struct FiredAnimEvent {
+	size_t lmesh;
+	std::string name;
+};
+
 class PrismPhysics
 {
 public:
@@ -11,18 +18,44 @@ public:
 	std::vector<PolyCollMesh*>* dmeshes_future;
 	std::vector<PolyCollMesh*>* lmeshes;
 	std::vector<PolyCollMesh*>* lmeshes_future;
+	// slots of removed level meshes. They keep an empty mesh so the other slots don't shift, and are left out
+	// of stepping, collision and the separating plane caches until replace_pcmesh fills them again
+	std::vector<bool> lmesh_inactive;
 
 	std::vector<std::vector<CollCache>> dd_ccache;
 	std::vector<std::vector<CollCache>> dl_ccache;
 
 	std::mutex new_mesh_lock;
 
+	// compiled anims of all lmeshes, PolyCollMesh::running_anim indexes anim_tracks
+	std::vector<AnimSegment> anim_segs;
+	std::vector<AnimTrack> anim_tracks;
+	std::vector<AnimEvent> anim_events;
+
+	bool print_step_stats = false;
+	int STATS_INTERVAL_STEPS = 5000;
+
 	SimpleThreadPooler* thread_pool;
 
 	PrismPhysics();
 	~PrismPhysics();
 
 	void add_pcmesh(PolyCollMesh* pcmesh, bool dynm=false);
+	void remove_pcmesh(PolyCollMesh* pcmesh);
+	void replace_pcmesh(size_t idx, PolyCollMesh* pcmesh);
+	void deactivate_pcmesh(size_t idx);
+	void compile_anims(size_t idx);
+	static int find_anim(PolyCollMesh* pm, std::string anim_name);
+	void start_anim(PolyCollMesh* pm, int track);
+	std::vector<FiredAnimEvent> take_anim_events();
+	//cube
+	static PolyCollMesh* gen_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float tlen, float face_thickness, float face_friction);
+	//plane
+	static PolyCollMesh* gen_pcmesh(glm::vec3 pcenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float face_thickness, float face_friction);
+	//cylinder
+	static PolyCollMesh* gen_pcmesh(std::vector<glm::vec3> top_face_points, glm::vec3 cylinder_depth_dir, float cylinder_depth, float face_thickness, float face_friction);
+	//plane
+	static PolyCollMesh* gen_pcmesh(std::vector<glm::vec3> plane_points, float face_thickness, float face_friction);
 	//cube
 	void gen_and_add_pcmesh(glm::vec3 ccenter, glm::vec3 uax, glm::vec3 vax, float ulen, float vlen, float tlen, float face_thickness, float face_friction, bool dynm=false);
 	//plane
@@ -37,7 +70,27 @@ public:
 	CollPoint find_ray_first_coll(glm::vec3 raystart, glm::vec3 raydir);
 
 private:
+	int stats_steps = 0;
+	float stats_anim_ms = 0;
+	float stats_step_ms = 0;
+	size_t stats_animated = 0;
+
+	std::mutex anim_event_lock;
+	std::vector<FiredAnimEvent> fired_anim_events;
+	// lmeshes with an anim_parent, parents before children
+	std::vector<size_t> anim_children;
+	bool anim_children_dirty = false;
+	// segments of tracks no mesh uses anymore, compacted away once they are half of anim_segs
+	size_t anim_dead_segs = 0;
+
+	void compile_mesh_anims(PolyCollMesh* pm, PolyCollMesh* pm_future);
+	void release_mesh_anims(PolyCollMesh* pm_future);
+	void compact_anims();
+	void sort_anim_children();
 	static void advance_mesh_one_step(PolyCollMesh* pm);
+	static void advance_lmesh_range(PrismPhysics* phy, size_t lstart, size_t lend);
+	AnimPose step_anim(size_t idx, PolyCollMesh* pm, glm::vec3* vel);
+	void advance_anim_child(size_t idx);
 	void run_physics_one_step();
 };
 
@@ -2,6 +2,9 @@
 
 #include <set>
 #include <iostream>
+#include <algorithm>
+#include <limits>
+#include <tuple>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -9,8 +12,56 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-static void delegate_gen_final_cmd_bufs(PrismRenderer* renderer, uint32_t frameNo) {
-	renderer->genFinalCmdBuffers(frameNo);
+static void delegate_record_secondary_cmds(PrismRenderer* renderer, size_t frameNo, uint32_t worker) {
+	renderer->recordSecondaryCmds(frameNo, worker);
+}
+
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t len) {
+	// FNV-1a
+	const uint8_t* bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ bytes[i]) * 1099511628211ull;
+	}
+	return h;
+}
+
+static uint32_t alloc_range(std::map<uint32_t, uint32_t>& freeRanges, uint32_t count) {
+	// first fit, UINT32_MAX when no free range is big enough
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); it++) {
+		if (it->second < count) continue;
+		uint32_t offset = it->first;
+		uint32_t left = it->second - count;
+		freeRanges.erase(it);
+		if (left > 0) freeRanges[offset + count] = left;
+		return offset;
+	}
+	return UINT32_MAX;
+}
+
+static void free_range(std::map<uint32_t, uint32_t>& freeRanges, uint32_t offset, uint32_t count) {
+	// merges with the free ranges on either side
+	auto next = freeRanges.lower_bound(offset);
+	if (next != freeRanges.end() && offset + count == next->first) {
+		count += next->second;
+		next = freeRanges.erase(next);
+	}
+	if (next != freeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			prev->second += count;
+			return;
+		}
+	}
+	freeRanges[offset] = count;
+}
+
+static float lod_scale(const glm::mat4& viewproj, uint32_t height) {
+	// the y row of a perspective viewproj is the view's up axis scaled by the projection, its w row the view depth
+	return 0.5f * float(height) * glm::length(glm::vec3(viewproj[0][1], viewproj[1][1], viewproj[2][1]));
+}
+
+static void delegate_cull_views(PrismRenderer* renderer, uint32_t worker) {
+	renderer->cullViewRange(worker);
 }
 
 void PrismRenderer::getVkInstance()
@@ -22,7 +73,7 @@ void PrismRenderer::getVkInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "Prism Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_2;
 
 	instance = vkutils::createVKInstance(
 		appInfo,
@@ -59,12 +110,35 @@ void PrismRenderer::getVkLogicalDevice()
 	}
 
 	//Struct to create logical device
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	// indirect draws start at their objects in the instance buffer through firstInstance, without
+	// drawIndirectFirstInstance the draws stay direct
+	supports_indirect_first_instance = supportedFeatures.drawIndirectFirstInstance;
+	supports_multi_draw_indirect = supportedFeatures.multiDrawIndirect;
+
 	VkPhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+
+	// uploads signal a timeline semaphore per batch
+	VkPhysicalDeviceVulkan12Features supportedFeatures12{};
+	supportedFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures2{};
+	supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures2.pNext = &supportedFeatures12;
+	vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+	if (!supportedFeatures12.timelineSemaphore) throw std::runtime_error("timeline semaphores are not supported!");
+
+	VkPhysicalDeviceVulkan12Features deviceFeatures12{};
+	deviceFeatures12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	deviceFeatures12.timelineSemaphore = VK_TRUE;
 
 	VkPhysicalDeviceVulkan11Features deviceFeatures11{};
 	deviceFeatures11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
 	deviceFeatures11.shaderDrawParameters = VK_TRUE;
+	deviceFeatures11.pNext = &deviceFeatures12;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -172,7 +246,7 @@ void PrismRenderer::createDescriptorPool() {
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 40;
+	poolInfo.maxSets = 48;
 
 	if (vkCreateDescriptorPool(device, &poolInfo, NULL, &descriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
@@ -188,13 +262,12 @@ void PrismRenderer::makeBasicDSetLayouts()
 {
 	addDsetLayout("vert_uniform", 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
 	addDsetLayout("vert_storage", 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
+	addDsetLayout("frag_storage", 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
 	addDsetLayout("frag_uniform", 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
 	addDsetLayout("frag_sampler_1", 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
 	addDsetLayout("frag_sampler_3", 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, VK_SHADER_STAGE_FRAGMENT_BIT);
 	addDsetLayout("frag_sampler_5", 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, VK_SHADER_STAGE_FRAGMENT_BIT);
 	addDsetLayout("vert_frag_uniform", 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT);
-	addDsetLayout("frag_plight_sampler", 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(MAX_POINT_LIGHTS), VK_SHADER_STAGE_FRAGMENT_BIT);
-	addDsetLayout("frag_dlight_sampler", 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, uint32_t(MAX_DIRECTIONAL_LIGHTS), VK_SHADER_STAGE_FRAGMENT_BIT);
 }
 
 void PrismRenderer::makeBasicCmdPools()
@@ -207,6 +280,25 @@ void PrismRenderer::makeBasicCmdPools()
 		if (vkCreateCommandPool(device, &poolInfo, NULL, &frameDatas[i].commandPool) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create command pool!");
 		}
+		frameDatas[i].acquireCmdBuffer = vkutils::createCmdBuffer(device, frameDatas[i].commandPool);
+		frameDatas[i].particleCmdBuffer = vkutils::createCmdBuffer(device, frameDatas[i].commandPool, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		frameDatas[i].particlesDirty = true;
+
+		frameDatas[i].workerCmdPools.resize(RENDERER_THREADS);
+		frameDatas[i].passCmdBuffers.assign(gbufferPassSlot() + 1, {});
+		frameDatas[i].passCmdCounts.assign(gbufferPassSlot() + 1, 0);
+		frameDatas[i].passDrawLists.assign(gbufferPassSlot() + 1, {});
+		frameDatas[i].shadowTileGenerations.assign(gbufferPassSlot(), 0);
+		frameDatas[i].shadowRender.assign(gbufferPassSlot(), false);
+		for (uint32_t w = 0; w < RENDERER_THREADS; w++) {
+			VkCommandPoolCreateInfo workerPoolInfo{};
+			workerPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			workerPoolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+			workerPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			if (vkCreateCommandPool(device, &workerPoolInfo, NULL, &frameDatas[i].workerCmdPools[w]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create command pool!");
+			}
+		}
 	}
 
 	VkCommandPoolCreateInfo poolInfo{};
@@ -234,180 +326,68 @@ void PrismRenderer::createDepthImage()
 	);
 }
 
-void PrismRenderer::makeDLightMaps()
-{
-	lights.resize(MAX_NS_LIGHTS + MAX_DIRECTIONAL_LIGHTS + MAX_POINT_LIGHTS);
-	for (uint32_t i = 0; i < frameDatas.size(); i++) {
-		for (uint32_t j = 0; j < MAX_DIRECTIONAL_LIGHTS; j++) {
-			GPUImage gimg = vkutils::createGPUImage(
-				device,
-				physicalDevice,
-				dlight_smap_extent.width, dlight_smap_extent.height,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_TILING_OPTIMAL,
-				VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				VK_IMAGE_VIEW_TYPE_2D,
-				VK_IMAGE_ASPECT_COLOR_BIT
-			);
-			vkutils::transitionImageLayout(
-				device,
-				uploadCmdPool,
-				transferQueue,
-				gimg._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-			);
-			frameDatas[i].shadow_dir_maps.push_back(gimg);
-		}
-		frameDatas[i].shadow_dir_dset = vkutils::createImageDSet(
-			device,
-			descriptorPool,
-			dSetLayouts["frag_dlight_sampler"],
-			frameDatas[i].shadow_dir_maps,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			texSamplers["linear_clamped"]
-		);
-		frameDatas[i].dShadowMapTemp = vkutils::createGPUImage(
-			device,
-			physicalDevice,
-			dlight_smap_extent.width, dlight_smap_extent.height,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			VK_IMAGE_VIEW_TYPE_2D,
-			VK_IMAGE_ASPECT_COLOR_BIT
-		);
-		vkutils::transitionImageLayout(
-			device,
-			uploadCmdPool,
-			transferQueue,
-			frameDatas[i].dShadowMapTemp._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-		);
-		frameDatas[i].dShadowDepthImage = vkutils::createGPUImage(
-			device,
-			physicalDevice,
-			dlight_smap_extent.width, dlight_smap_extent.height,
-			depthFormat,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			VK_IMAGE_VIEW_TYPE_2D,
-			VK_IMAGE_ASPECT_DEPTH_BIT
-		);
-		vkutils::transitionImageLayout(
-			device,
-			uploadCmdPool,
-			transferQueue,
-			frameDatas[i].dShadowDepthImage._image,
-			depthFormat,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 }
-		);
-	}
-}
+void PrismRenderer::makeShadowAtlas()
+{
+	lights.resize(MAX_DIRECTIONAL_LIGHTS + MAX_POINT_LIGHTS);
+	shadowAtlas = new ShadowAtlas(shadow_atlas_size, shadow_min_tile);
+	atlasSignatures.assign(gbufferPassSlot(), 0);
+	atlasRects.assign(gbufferPassSlot(), glm::vec4(0));
 
-void PrismRenderer::makePLightMaps()
-{
-	//lights.resize(MAX_POINT_LIGHTS);
-	for (uint32_t i = 0; i < frameDatas.size(); i++) {
-		for (uint32_t j = 0; j < MAX_POINT_LIGHTS; j++) {
-			GPUImage gimg = vkutils::createGPUImage(
-				device,
-				physicalDevice,
-				plight_smap_extent.width, plight_smap_extent.height,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_TILING_OPTIMAL,
-				(uint32_t)6,
-				VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT,
-				VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-				VK_IMAGE_VIEW_TYPE_CUBE,
-				VK_IMAGE_ASPECT_COLOR_BIT
-			);
-			vkutils::transitionImageLayout(
-				device,
-				uploadCmdPool,
-				transferQueue,
-				gimg._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 6 }
-			);
-			frameDatas[i].shadow_cube_maps.push_back(gimg);
-		}
-		frameDatas[i].shadow_cube_dset = vkutils::createImageDSet(
-			device,
-			descriptorPool,
-			dSetLayouts["frag_plight_sampler"],
-			frameDatas[i].shadow_cube_maps,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			texSamplers["linear"]
-		);
-		frameDatas[i].pShadowMapTemp = vkutils::createGPUImage(
-			device,
-			physicalDevice,
-			plight_smap_extent.width, plight_smap_extent.height,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			VK_IMAGE_VIEW_TYPE_2D,
-			VK_IMAGE_ASPECT_COLOR_BIT
-		);
-		vkutils::transitionImageLayout(
-			device,
-			uploadCmdPool,
-			transferQueue,
-			frameDatas[i].pShadowMapTemp._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
-		);
-		frameDatas[i].pShadowDepthImage = vkutils::createGPUImage(
-			device,
-			physicalDevice,
-			plight_smap_extent.width, plight_smap_extent.height,
-			depthFormat,
-			VK_IMAGE_TILING_OPTIMAL,
-			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			VK_IMAGE_VIEW_TYPE_2D,
-			VK_IMAGE_ASPECT_DEPTH_BIT
-		);
-		vkutils::transitionImageLayout(
-			device,
-			uploadCmdPool,
-			transferQueue,
-			frameDatas[i].pShadowDepthImage._image,
-			depthFormat,
-			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 }
-		);
-	}
+	// one map for all shadow passes and frames in flight, the shadow render pass keeps it in shader read layout
+	shadowAtlasImage = vkutils::createGPUImage(
+		device,
+		physicalDevice,
+		shadow_atlas_size, shadow_atlas_size,
+		VK_FORMAT_R32_SFLOAT,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_IMAGE_VIEW_TYPE_2D,
+		VK_IMAGE_ASPECT_COLOR_BIT
+	);
+	vkutils::transitionImageLayout(
+		device,
+		uploadCmdPool,
+		transferQueue,
+		shadowAtlasImage._image,
+		VK_FORMAT_R32_SFLOAT,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+	);
+	shadowAtlasDset = vkutils::createImageDSet(
+		device,
+		descriptorPool,
+		dSetLayouts["frag_sampler_1"],
+		{ shadowAtlasImage },
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		texSamplers["linear_clamped"]
+	);
+	shadowAtlasDepth = vkutils::createGPUImage(
+		device,
+		physicalDevice,
+		shadow_atlas_size, shadow_atlas_size,
+		depthFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		VK_IMAGE_VIEW_TYPE_2D,
+		VK_IMAGE_ASPECT_DEPTH_BIT
+	);
+	vkutils::transitionImageLayout(
+		device,
+		uploadCmdPool,
+		transferQueue,
+		shadowAtlasDepth._image,
+		depthFormat,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		{ VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 }
+	);
 }
 
 void PrismRenderer::createShadowRenderPass() {
@@ -418,8 +398,10 @@ void PrismRenderer::createShadowRenderPass() {
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	// the pass writes straight into its tile of the sampled atlas. Only the render area is cleared and the
+	// contents are kept, the other tiles are cached maps
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;
@@ -445,6 +427,25 @@ void PrismRenderer::createShadowRenderPass() {
 	subpass.pColorAttachments = &colorAttachmentRef;
 	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+	// shadow passes run back to back on one atlas and depth image, and the previous frame may still be sampling it.
+	// Its lighting passes read any texel of the atlas from any pixel, so the dependency can't be by region
+	VkSubpassDependency subpassDependencies[2] = { {} };
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dependencyFlags = 0;
+
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	subpassDependencies[1].dependencyFlags = 0;
+
 	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 
 	VkRenderPassCreateInfo renderPassInfo{};
@@ -453,10 +454,11 @@ void PrismRenderer::createShadowRenderPass() {
 	renderPassInfo.pAttachments = attachments.data();
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-
+	renderPassInfo.dependencyCount = 2;
+	renderPassInfo.pDependencies = subpassDependencies;
 
 	if (vkCreateRenderPass(device, &renderPassInfo, NULL, &shadowRenderPass) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create shadow cube render pass!");
+		throw std::runtime_error("failed to create shadow render pass!");
 	}
 }
 
@@ -683,13 +685,23 @@ void PrismRenderer::makeBasicDSets()
 		frameDatas[i].setBuffers["light"] = vkutils::createSetBuffer(
 			device,
 			physicalDevice,
-			sizeof(GPULight) * (MAX_NS_LIGHTS + MAX_DIRECTIONAL_LIGHTS + MAX_POINT_LIGHTS),
+			sizeof(GPULight) * (MAX_DIRECTIONAL_LIGHTS + MAX_POINT_LIGHTS),
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			descriptorPool,
 			dSetLayouts["vert_frag_uniform"],
 			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
 		);
+		frameDatas[i].setBuffers["shadow_atlas"] = vkutils::createSetBuffer(
+			device,
+			physicalDevice,
+			sizeof(glm::vec4) * gbufferPassSlot(),
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			descriptorPool,
+			dSetLayouts["frag_uniform"],
+			VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+		);
 		frameDatas[i].setBuffers["camera"] = vkutils::createSetBuffer(
 			device,
 			physicalDevice,
@@ -710,6 +722,28 @@ void PrismRenderer::makeBasicDSets()
 			dSetLayouts["vert_storage"],
 			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
 		);
+		frameDatas[i].setBuffers["cluster_light"] = vkutils::createSetBuffer(
+			device,
+			physicalDevice,
+			sizeof(GPULight) * MAX_CLUSTERED_LIGHTS,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			descriptorPool,
+			dSetLayouts["frag_storage"],
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+		);
+		// LIGHT_CLUSTER_COUNT ranges followed by the light indices they point into
+		frameDatas[i].setBuffers["cluster"] = vkutils::createSetBuffer(
+			device,
+			physicalDevice,
+			sizeof(glm::uvec2) * LIGHT_CLUSTER_COUNT + sizeof(uint32_t) * MAX_CLUSTER_INDICES,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			descriptorPool,
+			dSetLayouts["frag_storage"],
+			VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+		);
+		frameDatas[i].clusterLightsVersion = 0;
 		frameDatas[i].positionDset = vkutils::createImageDSet(
 			device,
 			descriptorPool,
@@ -737,7 +771,7 @@ void PrismRenderer::makeBasicDSets()
 	}
 }
 
-void PrismRenderer::addSimplePipeline(std::string name, VkRenderPass rPass, std::unordered_map<VkShaderStageFlagBits, std::string> stage_shader_map, std::vector<std::string> reqDSetLayouts, VkOffset2D scissorOffset, VkExtent2D scissorExtent, uint32_t VPWidth, uint32_t VPHeight, bool invert_VP_Y, std::vector<VkPushConstantRange> pushConstantRanges)
+void PrismRenderer::addSimplePipeline(std::string name, VkRenderPass rPass, std::unordered_map<VkShaderStageFlagBits, std::string> stage_shader_map, std::vector<std::string> reqDSetLayouts, VkOffset2D scissorOffset, VkExtent2D scissorExtent, uint32_t VPWidth, uint32_t VPHeight, bool invert_VP_Y, std::vector<VkPushConstantRange> pushConstantRanges, bool position_only, bool dynamic_viewport, bool object_instances)
 {
 	GPUPipeline gPipeline;
 	std::vector<VkShaderModule> shaders;
@@ -753,13 +787,17 @@ void PrismRenderer::addSimplePipeline(std::string name, VkRenderPass rPass, std:
 		shaderStageInfos.push_back(shaderStageInfo);
 	}
 
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	auto bindingDescriptions = PackedVertex::getBindingDescriptions(position_only);
+	auto attributeDescriptions = PackedVertex::getAttributeDescriptions(position_only);
+	if (object_instances) {
+		bindingDescriptions.push_back(GPUObjectInstance::getBindingDescription());
+		attributeDescriptions.push_back(GPUObjectInstance::getAttributeDescription());
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexBindingDescriptionCount = uint32_t(bindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = uint32_t(attributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -856,7 +894,13 @@ void PrismRenderer::addSimplePipeline(std::string name, VkRenderPass rPass, std:
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = NULL; // Optional
+	// with a dynamic viewport the baked one above is ignored, recorders set both before drawing
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+	pipelineInfo.pDynamicState = dynamic_viewport ? &dynamicState : NULL;
 	pipelineInfo.layout = gPipeline._pipelineLayout;
 	pipelineInfo.renderPass = rPass;
 	pipelineInfo.subpass = 0;
@@ -870,40 +914,30 @@ void PrismRenderer::addSimplePipeline(std::string name, VkRenderPass rPass, std:
 	for (VkShaderModule smod : shaders) vkDestroyShaderModule(device, smod, NULL);
 }
 
-void PrismRenderer::makeDLightShadowPipeline()
+void PrismRenderer::makeShadowPipeline()
 {
+	// directional maps and cube faces differ only in their tile, which the secondaries set as viewport and scissor
 	addSimplePipeline(
-		"dlight_smap",
+		"light_smap",
 		shadowRenderPass,
 		{ {VK_SHADER_STAGE_VERTEX_BIT , "shaders/light_smap.vert.spv"}, {VK_SHADER_STAGE_FRAGMENT_BIT , "shaders/light_smap.frag.spv"} },
 		{ "vert_frag_uniform", "vert_storage" },
-		{ 0, 0 }, dlight_smap_extent,
-		dlight_smap_extent.width, dlight_smap_extent.height,
+		{ 0, 0 }, { shadow_atlas_size, shadow_atlas_size },
+		shadow_atlas_size, shadow_atlas_size,
+		true,
+		{ {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)} },
 		true,
-		{ {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)} }
-	);
-}
-
-void PrismRenderer::makePLightShadowPipeline()
-{
-	addSimplePipeline(
-		"plight_smap",
-		shadowRenderPass,
-		{ {VK_SHADER_STAGE_VERTEX_BIT , "shaders/light_smap.vert.spv"}, {VK_SHADER_STAGE_FRAGMENT_BIT , "shaders/light_smap.frag.spv"} },
-		{ "vert_frag_uniform", "vert_storage" },
-		{ 0, 0 }, plight_smap_extent,
-		plight_smap_extent.width, plight_smap_extent.height,
 		true,
-		{ {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)} }
+		true
 	);
 }
 
-void PrismRenderer::makeGbufferPipeline() {
+void PrismRenderer::makeGbufferPipeline(std::string name, std::string vertShaderPath, bool particle_instances) {
 	GPUPipeline gPipeline;
 	VkShaderModule shaders[2];
 	VkPipelineShaderStageCreateInfo shaderStageInfos[2] = { {} };
 
-	shaders[0] = vkutils::createShader(device, "shaders/gbuffer.vert.spv");
+	shaders[0] = vkutils::createShader(device, vertShaderPath);
 	shaders[1] = vkutils::createShader(device, "shaders/gbuffer.frag.spv");
 	
 	shaderStageInfos[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -923,13 +957,24 @@ void PrismRenderer::makeGbufferPipeline() {
 	shaderStageInfos[1].flags = 0;
 
 
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	auto bindingDescriptions = PackedVertex::getBindingDescriptions(false);
+	auto attributeDescriptions = PackedVertex::getAttributeDescriptions(false);
+	if (particle_instances) {
+		// particles read their transform from a per instance stream instead of the object buffer
+		auto instanceAttributes = GPUParticleInstance::getAttributeDescriptions();
+		bindingDescriptions.push_back(GPUParticleInstance::getBindingDescription());
+		attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributes.begin(), instanceAttributes.end());
+	}
+	else {
+		// objects read their index from the instance buffer, so draws of one mesh can instance over several
+		bindingDescriptions.push_back(GPUObjectInstance::getBindingDescription());
+		attributeDescriptions.push_back(GPUObjectInstance::getAttributeDescription());
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexBindingDescriptionCount = uint32_t(bindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = uint32_t(attributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -1033,7 +1078,7 @@ void PrismRenderer::makeGbufferPipeline() {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
 
-	pipelines["gbuffer"] = gPipeline;
+	pipelines[name] = gPipeline;
 
 	for (VkShaderModule smod : shaders) vkDestroyShaderModule(device, smod, NULL);
 }
@@ -1247,8 +1292,10 @@ void PrismRenderer::makeFinalPipeline()
 	pipelineSetLayouts.push_back(dSetLayouts["frag_uniform"]);
 	pipelineSetLayouts.push_back(dSetLayouts["frag_sampler_5"]);
 	pipelineSetLayouts.push_back(dSetLayouts["vert_frag_uniform"]);
-	pipelineSetLayouts.push_back(dSetLayouts["frag_plight_sampler"]);
-	pipelineSetLayouts.push_back(dSetLayouts["frag_dlight_sampler"]);
+	pipelineSetLayouts.push_back(dSetLayouts["frag_sampler_1"]);
+	pipelineSetLayouts.push_back(dSetLayouts["frag_uniform"]);
+	pipelineSetLayouts.push_back(dSetLayouts["frag_storage"]);
+	pipelineSetLayouts.push_back(dSetLayouts["frag_storage"]);
 
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = uint32_t(pipelineSetLayouts.size());
@@ -1286,24 +1333,15 @@ void PrismRenderer::makeFinalPipeline()
 
 void PrismRenderer::createShadowFrameBuffers()
 {
-	for (size_t i = 0; i < frameDatas.size(); i++) {
-		std::vector<GPUImage> sfbattachments = { frameDatas[i].pShadowMapTemp, frameDatas[i].pShadowDepthImage };
-		frameDatas[i].pShadowFrameBuffer = vkutils::createFrameBuffer(
-			device,
-			shadowRenderPass,
-			sfbattachments,
-			plight_smap_extent.width, plight_smap_extent.height,
-			1
-		);
-		sfbattachments = { frameDatas[i].dShadowMapTemp, frameDatas[i].dShadowDepthImage };
-		frameDatas[i].dShadowFrameBuffer = vkutils::createFrameBuffer(
-			device,
-			shadowRenderPass,
-			sfbattachments,
-			dlight_smap_extent.width, dlight_smap_extent.height,
-			1
-		);
-	}
+	// every shadow pass renders into this one, with its tile as render area
+	std::vector<GPUImage> sfbattachments = { shadowAtlasImage, shadowAtlasDepth };
+	shadowAtlasFrameBuffer = vkutils::createFrameBuffer(
+		device,
+		shadowRenderPass,
+		sfbattachments,
+		shadow_atlas_size, shadow_atlas_size,
+		1
+	);
 }
 
 void PrismRenderer::createGbufferFrameBuffers()
@@ -1457,243 +1495,662 @@ void PrismRenderer::createFinalFrameBuffers()
 
 void PrismRenderer::makeIndirectCmdBuffer()
 {
+	// host visible and mapped for good, the workers write the commands of the passes they record and the object
+	// indices the commands instance over. One command per particle type follows the passes' commands
+	VkDeviceSize cmdsSize = ((gbufferPassSlot() + 1) * MAX_OBJECTS + MAX_PARTICLE_TYPES) * sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize instancesSize = (gbufferPassSlot() + 1) * MAX_OBJECTS * sizeof(GPUObjectInstance);
+	for (size_t i = 0; i < frameDatas.size(); i++) {
+		frameDatas[i].indirectBuffer = vkutils::createBuffer(
+			device,
+			physicalDevice,
+			cmdsSize,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		frameDatas[i].indirectCmds = (VkDrawIndexedIndirectCommand*)frameDatas[i].indirectBuffer._mapped;
+		frameDatas[i].instanceBuffer = vkutils::createBuffer(
+			device,
+			physicalDevice,
+			instancesSize,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		frameDatas[i].instanceObjs = (uint32_t*)frameDatas[i].instanceBuffer._mapped;
+	}
 }
 
-void PrismRenderer::addDLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
+void PrismRenderer::makeDynamicMeshPool()
 {
-	std::vector<VkClearValue> clearValues = std::vector<VkClearValue>(2);
-	clearValues[0].color = { 1.0f, 1.0f, 1.0f, 1.0f };
-	clearValues[1].depthStencil = { 1.0f, 0 };
-
-	GPUPipeline dLightPipeline = pipelines["dlight_smap"];
-
-	for (size_t lidx = 0; lidx < MAX_DIRECTIONAL_LIGHTS; lidx++) {
-		if (!(lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + lidx].flags.x & 1)) continue;
-		GPULightPC tlpc;
-		tlpc.idx.x = int(MAX_NS_LIGHTS + MAX_POINT_LIGHTS + lidx);
-		tlpc.viewproj = glm::mat4(1);
-
-		vkutils::beginRenderPass(shadowRenderPass, frameDatas[frameNo].dShadowFrameBuffer, dlight_smap_extent, cmdBuffer, clearValues);
-		dLightPipeline.bindPipeline(cmdBuffer);
-		dLightPipeline.bindPipelineDSets(
-			cmdBuffer,
-			{ frameDatas[frameNo].setBuffers["light"]._dSet, frameDatas[frameNo].setBuffers["object"]._dSet },
-			{ { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)}, &tlpc } }
-		);
-		size_t robjCount = renderObjects.size();
-		for (size_t ro_idx = 0; ro_idx < robjCount; ro_idx++) {
-			RenderObject robj = renderObjects[ro_idx];
-			if (!robj.renderable || !robj.shadowcasting) continue;
+	// host visible and mapped for good, maintained meshes write their dirty vertices straight into the copy the
+	// frame being built draws. Indices don't change after registration and have a single copy
+	uint32_t pool_vertices = DYNAMIC_POOL_VERTICES * MAX_FRAMES_IN_FLIGHT;
+	VkDeviceSize pool_bytes = (sizeof(glm::vec3) + sizeof(PackedVertex)) * VkDeviceSize(pool_vertices) + sizeof(uint32_t) * VkDeviceSize(DYNAMIC_POOL_INDICES);
+
+	// device local memory the CPU can map spares the GPU reading vertices over the bus, but not every device has
+	// it, and without resizable BAR it is a 256MB window the driver uses too. Then the copies stay in host memory
+	const VkMemoryPropertyFlags mappable_vram = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+	VkPhysicalDeviceMemoryProperties memProps;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProps);
+	dynamic_pool_device_local = false;
+	for (uint32_t i = 0; i < memProps.memoryTypeCount; i++) {
+		const VkMemoryType& type = memProps.memoryTypes[i];
+		if ((type.propertyFlags & mappable_vram) == mappable_vram && memProps.memoryHeaps[type.heapIndex].size >= 4 * pool_bytes) {
+			dynamic_pool_device_local = true;
+			break;
+		}
+	}
+	VkMemoryPropertyFlags pool_props = dynamic_pool_device_local ? mappable_vram
+		: VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	std::cout << "renderer: maintained meshes in " << (dynamic_pool_device_local ? "device local" : "host") << " memory\n";
 
-			VkBuffer vertexBuffers[] = { (robj.maintained_mesh) ? robj.mmesh->_vertexBuffer[frameNo]._buffer : robj.mesh->_vertexBuffer._buffer };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(cmdBuffer, 0, 1, vertexBuffers, offsets);
-			vkCmdBindIndexBuffer(cmdBuffer, (robj.maintained_mesh) ? robj.mmesh->_indexBuffer[frameNo]._buffer : robj.mesh->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+	dynamicPool._vertexBuffer = vkutils::createBuffer(
+		device, physicalDevice,
+		sizeof(glm::vec3) * pool_vertices,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		pool_props
+	);
+	dynamicPool._attribBuffer = vkutils::createBuffer(
+		device, physicalDevice,
+		sizeof(PackedVertex) * pool_vertices,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		pool_props
+	);
+	dynamicPool._indexBuffer = vkutils::createBuffer(
+		device, physicalDevice,
+		sizeof(uint32_t) * DYNAMIC_POOL_INDICES,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		pool_props
+	);
+	// vertex ranges are handed out in the first frame's copy, the others sit _frameVertices apart
+	dynamicPool._freeVertices[0] = DYNAMIC_POOL_VERTICES;
+	dynamicPool._freeIndices[0] = DYNAMIC_POOL_INDICES;
+	dynamicPool._frameVertices = DYNAMIC_POOL_VERTICES;
+}
 
-			robj.drawMesh(cmdBuffer, ro_idx);
-		}
-		vkCmdEndRenderPass(cmdBuffer);
+void PrismRenderer::writeDynamicVertices(MaintainedMesh* mesh, size_t frameNo, uint32_t first, uint32_t end)
+{
+	// device local memory isn't necessarily coherent, only the written ranges are flushed
+	VkDeviceSize base = VkDeviceSize(frameNo) * dynamicPool._frameVertices + uint32_t(mesh->_vertexOffset) + first;
+	glm::vec3* positions = (glm::vec3*)dynamicPool._vertexBuffer._mapped + base;
+	PackedVertex* attribs = (PackedVertex*)dynamicPool._attribBuffer._mapped + base;
+	for (uint32_t i = first; i < end; i++) {
+		positions[i - first] = mesh->_vertices[i].pos;
+		attribs[i - first] = PackedVertex::pack(mesh->_vertices[i]);
+	}
+	vkutils::flushBuffer(device, dynamicPool._vertexBuffer, sizeof(glm::vec3) * base, sizeof(glm::vec3) * (end - first));
+	vkutils::flushBuffer(device, dynamicPool._attribBuffer, sizeof(PackedVertex) * base, sizeof(PackedVertex) * (end - first));
+	stats_dynamic_bytes += (sizeof(glm::vec3) + sizeof(PackedVertex)) * (end - first);
+}
 
-		vkutils::transitionImageLayout(
-			cmdBuffer,
-			frameDatas[frameNo].shadow_dir_maps[lidx]._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
-		);
-		vkutils::transitionImageLayout(
-			cmdBuffer,
-			frameDatas[frameNo].dShadowMapTemp._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
-		);
+static void split_vertex_streams(const std::vector<Vertex>& vertices, std::vector<glm::vec3>& positions, std::vector<PackedVertex>& attribs)
+{
+	positions.resize(vertices.size());
+	attribs.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		positions[i] = vertices[i].pos;
+		attribs[i] = PackedVertex::pack(vertices[i]);
+	}
+}
 
-		VkImageCopy copyRegion = {};
-		copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.srcSubresource.baseArrayLayer = 0;
-		copyRegion.srcSubresource.mipLevel = 0;
-		copyRegion.srcSubresource.layerCount = 1;
-		copyRegion.srcOffset = { 0, 0, 0 };
-
-		copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.dstSubresource.baseArrayLayer = 0;
-		copyRegion.dstSubresource.mipLevel = 0;
-		copyRegion.dstSubresource.layerCount = 1;
-		copyRegion.dstOffset = { 0, 0, 0 };
-
-		copyRegion.extent.width = dlight_smap_extent.width;
-		copyRegion.extent.height = dlight_smap_extent.height;
-		copyRegion.extent.depth = 1;
-
-		vkCmdCopyImage(
-			cmdBuffer,
-			frameDatas[frameNo].dShadowMapTemp._image,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			frameDatas[frameNo].shadow_dir_maps[lidx]._image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&copyRegion
+void PrismRenderer::uploadPooledMesh(Mesh& mesh)
+{
+	uint32_t vcount = uint32_t(mesh._vertices.size());
+	uint32_t icount = uint32_t(mesh._indices.size());
+	uint32_t voffset = UINT32_MAX, ioffset = UINT32_MAX;
+	size_t pidx = 0;
+	for (; pidx < meshPools.size(); pidx++) {
+		voffset = alloc_range(meshPools[pidx]._freeVertices, vcount);
+		if (voffset == UINT32_MAX) continue;
+		ioffset = alloc_range(meshPools[pidx]._freeIndices, icount);
+		if (ioffset != UINT32_MAX) break;
+		free_range(meshPools[pidx]._freeVertices, voffset, vcount);
+	}
+	if (pidx == meshPools.size()) {
+		GPUMeshPool pool;
+		uint32_t pool_vertices = std::max(MESH_POOL_VERTICES, vcount);
+		uint32_t pool_indices = std::max(MESH_POOL_INDICES, icount);
+		// the transfer queue writes new ranges while the graphics queue draws from the others, so the pools are
+		// shared between the two families instead of going through an ownership transfer per mesh
+		std::vector<uint32_t> poolFamilies = { queueFamilyIndices.graphicsFamily.value(), queueFamilyIndices.transferFamily.value() };
+		pool._vertexBuffer = vkutils::createBuffer(
+			device, physicalDevice,
+			sizeof(glm::vec3) * pool_vertices,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			poolFamilies
 		);
-
-		vkutils::transitionImageLayout(
-			cmdBuffer,
-			frameDatas[frameNo].shadow_dir_maps[lidx]._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+		pool._attribBuffer = vkutils::createBuffer(
+			device, physicalDevice,
+			sizeof(PackedVertex) * pool_vertices,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			poolFamilies
 		);
-		vkutils::transitionImageLayout(
-			cmdBuffer,
-			frameDatas[frameNo].dShadowMapTemp._image,
-			VK_FORMAT_R32_SFLOAT,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-			VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+		pool._indexBuffer = vkutils::createBuffer(
+			device, physicalDevice,
+			sizeof(uint32_t) * pool_indices,
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			poolFamilies
 		);
-	}
-
+		pool._freeVertices[0] = pool_vertices;
+		pool._freeIndices[0] = pool_indices;
+		meshPools.push_back(pool);
+		voffset = alloc_range(meshPools[pidx]._freeVertices, vcount);
+		ioffset = alloc_range(meshPools[pidx]._freeIndices, icount);
+	}
+
+	mesh._pool = int32_t(pidx);
+	mesh._vertexOffset = int32_t(voffset);
+	mesh._firstIndex = ioffset;
+	mesh._vertexBuffer = meshPools[pidx]._vertexBuffer;
+	mesh._attribBuffer = meshPools[pidx]._attribBuffer;
+	mesh._indexBuffer = meshPools[pidx]._indexBuffer;
+	std::vector<glm::vec3> positions;
+	std::vector<PackedVertex> attribs;
+	split_vertex_streams(mesh._vertices, positions, attribs);
+	uploader->uploadToBuffer(mesh._vertexBuffer, sizeof(glm::vec3) * VkDeviceSize(voffset), sizeof(glm::vec3) * vcount, positions.data());
+	uploader->uploadToBuffer(mesh._attribBuffer, sizeof(PackedVertex) * VkDeviceSize(voffset), sizeof(PackedVertex) * vcount, attribs.data());
+	mesh._uploadTicket = uploader->uploadToBuffer(mesh._indexBuffer, sizeof(uint32_t) * VkDeviceSize(ioffset), sizeof(uint32_t) * icount, mesh._indices.data());
 }
 
-void PrismRenderer::addPLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
+void PrismRenderer::freePooledMesh(Mesh& mesh)
 {
-	std::vector<VkClearValue> clearValues = std::vector<VkClearValue>(2);
-	clearValues[0].color = { 1.0f, 1.0f, 1.0f, 1.0f };
-	clearValues[1].depthStencil = { 1.0f, 0 };
+	if (mesh._pool < 0) return;
+	free_range(meshPools[mesh._pool]._freeVertices, uint32_t(mesh._vertexOffset), uint32_t(mesh._vertices.size()));
+	free_range(meshPools[mesh._pool]._freeIndices, mesh._firstIndex, uint32_t(mesh._indices.size()));
+	mesh._pool = -1;
+}
+
+size_t PrismRenderer::plightPassSlot(size_t lidx, uint32_t face)
+{
+	// pass slots: one per directional light, then the 6 faces of each point light, then the gbuffer
+	return MAX_DIRECTIONAL_LIGHTS + lidx * 6 + face;
+}
+
+size_t PrismRenderer::gbufferPassSlot()
+{
+	return MAX_DIRECTIONAL_LIGHTS + MAX_POINT_LIGHTS * 6;
+}
+
+void PrismRenderer::updateShadowAtlas()
+{
+	// a light of range r seen from d away covers about height * r / d pixels of the screen, its map gets about
+	// as many texels. Point lights ask the same for all six faces
+	glm::vec3 camPos = glm::vec3(currentCamera.camPos);
+	std::vector<ShadowTileRequest> requests;
+	auto request = [&](size_t slot, const GPULight& light, uint32_t maxSize) {
+		float range = light.props.y;
+		float desired = float(maxSize);
+		if (range > 0) desired = float(swapChainExtent.height) * range / std::max(glm::length(glm::vec3(light.pos) - camPos) - range, 1.0f);
+		const ShadowTile* tile = shadowAtlas->tile(uint32_t(slot));
+		requests.push_back({ uint32_t(slot), desired, ShadowAtlas::pickSize(desired, tile ? tile->size : 0, shadow_min_tile, maxSize) });
+	};
+	for (size_t lidx = 0; lidx < MAX_DIRECTIONAL_LIGHTS; lidx++) {
+		if (lights[MAX_POINT_LIGHTS + lidx].flags.x & 1) request(lidx, lights[MAX_POINT_LIGHTS + lidx], dlight_smap_extent.width);
+	}
+	for (size_t lidx = 0; lidx < MAX_POINT_LIGHTS; lidx++) {
+		if (!(lights[lidx].flags.x & 1)) continue;
+		for (uint32_t face = 0; face < 6; face++) request(plightPassSlot(lidx, face), lights[lidx], plight_smap_extent.width);
+	}
+	shadowAtlas->budget = shadow_atlas_budget;
+	shadowAtlas->update(requests);
+
+	float size = float(shadowAtlas->atlasSize);
+	for (size_t slot = 0; slot < atlasRects.size(); slot++) {
+		const ShadowTile* tile = shadowAtlas->tile(uint32_t(slot));
+		atlasRects[slot] = tile ? glm::vec4(tile->x / size, tile->y / size, tile->size / size, tile->size / size) : glm::vec4(0);
+	}
+	if (print_record_stats) {
+		stats_atlas_moved += shadowAtlas->movedTiles;
+		stats_atlas_repacks += shadowAtlas->repacked;
+		stats_atlas_texels += shadowAtlas->usedTexels();
+	}
+}
+
+VkRect2D PrismRenderer::shadowTileArea(size_t passSlot)
+{
+	const ShadowTile* tile = shadowAtlas->tile(uint32_t(passSlot));
+	if (!tile) return VkRect2D{};
+	return VkRect2D{ { int32_t(tile->x), int32_t(tile->y) }, { tile->size, tile->size } };
+}
+
+void PrismRenderer::buildRenderList()
+{
+	// called with spawn_mut held, whenever an object was added, removed or had its flags changed
+	size_t robjCount = renderObjects.size();
+	renderList.resize(robjCount);
+	for (size_t ro_idx = 0; ro_idx < robjCount; ro_idx++) {
+		const RenderObject& robj = renderObjects[ro_idx];
+		RenderListItem& item = renderList[ro_idx];
+		item.vertexBuffer = robj.maintained_mesh ? dynamicPool._vertexBuffer._buffer : robj.mesh->_vertexBuffer._buffer;
+		item.attribBuffer = robj.maintained_mesh ? dynamicPool._attribBuffer._buffer : robj.mesh->_attribBuffer._buffer;
+		item.indexBuffer = robj.maintained_mesh ? dynamicPool._indexBuffer._buffer : robj.mesh->_indexBuffer._buffer;
+		item.texDSet = robj.texmaps->_dSet;
+		if (robj.maintained_mesh || robj.mesh->_lods.empty()) {
+			item.lodCount = 1;
+			item.lods[0].firstIndex = robj.maintained_mesh ? robj.mmesh->_firstIndex : robj.mesh->_firstIndex;
+			item.lods[0].indexCount = uint32_t(robj.maintained_mesh ? robj.mmesh->_indices.size() : robj.mesh->_indices.size());
+			item.lods[0].error = 0;
+		}
+		else {
+			item.lodCount = uint32_t(std::min(robj.mesh->_lods.size(), size_t(MAX_MESH_LODS)));
+			for (uint32_t l = 0; l < item.lodCount; l++) {
+				item.lods[l] = robj.mesh->_lods[l];
+				item.lods[l].firstIndex += robj.mesh->_firstIndex;
+			}
+		}
+		item.vertexOffset = robj.maintained_mesh ? robj.mmesh->_vertexOffset : robj.mesh->_vertexOffset;
+		item.frameVertices = robj.maintained_mesh ? dynamicPool._frameVertices : 0;
+		item.pool = robj.maintained_mesh ? -1 : robj.mesh->_pool;
+		item.objIdx = uint32_t(ro_idx);
+		// objects whose mesh or textures are still uploading stay out of every pass
+		bool uploaded = robj.texmaps->_uploadTicket <= acquiredTicket && (robj.maintained_mesh || robj.mesh->_uploadTicket <= acquiredTicket);
+		item.renderable = robj.renderable && uploaded;
+		item.shadowcasting = robj.shadowcasting && uploaded;
+		// maintained meshes are rewritten every frame and have no bounds, they always pass
+		item.bounds = robj.maintained_mesh ? glm::vec4(0, 0, 0, std::numeric_limits<float>::infinity()) : robj.mesh->_bounds;
+	}
+
+	// draw lists are compacted in this order, so objects sharing a mesh pool and texture set come out next to each
+	// other and are drawn with one bind and one indirect draw. Within that, objects of the same mesh are adjacent
+	// and become instances of one draw per LOD
+	drawOrder.resize(robjCount);
+	for (uint32_t ro_idx = 0; ro_idx < robjCount; ro_idx++) drawOrder[ro_idx] = ro_idx;
+	std::sort(drawOrder.begin(), drawOrder.end(), [this](uint32_t a, uint32_t b) {
+		const RenderListItem& ra = renderList[a];
+		const RenderListItem& rb = renderList[b];
+		return std::make_tuple(ra.pool, uintptr_t(ra.texDSet), ra.vertexOffset, a) < std::make_tuple(rb.pool, uintptr_t(rb.texDSet), rb.vertexOffset, b);
+	});
+	renderListDirty = false;
+}
 
-	GPUPipeline pLightPipeline = pipelines["plight_smap"];
-	// 90 degree proj mat
-	glm::mat4 projMatrix = glm::perspective(glm::radians(90.0f), float(plight_smap_extent.width) / float(plight_smap_extent.height), 0.01f, 1000.0f);
+void PrismRenderer::cullObjects()
+{
+	size_t robjCount = renderObjects.size();
+	if (renderListDirty || renderList.size() != robjCount) buildRenderList();
 
+	// world space bounding spheres in SoA form so the plane tests in cullViewRange vectorize over objects
+	cullCX.resize(robjCount);
+	cullCY.resize(robjCount);
+	cullCZ.resize(robjCount);
+	cullR.resize(robjCount);
+	for (size_t ro_idx = 0; ro_idx < robjCount; ro_idx++) {
+		const glm::vec4& bounds = renderList[ro_idx].bounds;
+		const glm::mat4& model = renderObjects[ro_idx].uboData.model;
+		glm::vec4 wcenter = model * glm::vec4(glm::vec3(bounds), 1.0f);
+		float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		cullCX[ro_idx] = wcenter.x;
+		cullCY[ro_idx] = wcenter.y;
+		cullCZ[ro_idx] = wcenter.z;
+		cullR[ro_idx] = bounds.w * scale;
+	}
+
+	cullViews.clear();
+	passDrawLists.resize(gbufferPassSlot() + 1);
+	passSignatures.resize(gbufferPassSlot());
+	CullView view;
+	view.shadow_pass = true;
+	// shadow passes draw into their atlas tile, LODs are picked for the tile's resolution
+	for (size_t lidx = 0; lidx < MAX_DIRECTIONAL_LIGHTS; lidx++) {
+		if (!(lights[MAX_POINT_LIGHTS + lidx].flags.x & 1) || !shadowAtlas->tile(uint32_t(lidx))) continue;
+		view.passSlot = uint32_t(lidx);
+		view.viewproj = lights[MAX_POINT_LIGHTS + lidx].viewproj;
+		view.lodScale = mesh_lods ? lod_scale(view.viewproj, shadowAtlas->tile(uint32_t(lidx))->size) / shadow_lod_bias : 0.0f;
+		cullViews.push_back(view);
+	}
 	for (uint32_t lidx = 0; lidx < MAX_POINT_LIGHTS; lidx++) {
-		if (!(lights[MAX_NS_LIGHTS + lidx].flags.x & 1)) continue;
+		if (!(lights[lidx].flags.x & 1)) continue;
 		for (uint32_t face = 0; face < 6; face++) {
-			glm::mat4 viewMatrix = glm::mat4(1);
-
-			switch (face)
-			{
-			case 0: // POSITIVE_X
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-				break;
-			case 1:	// NEGATIVE_X
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-				break;
-			case 2:	// POSITIVE_Y
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-				break;
-			case 3:	// NEGATIVE_Y
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-				break;
-			case 4:	// POSITIVE_Z
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-				break;
-			case 5:	// NEGATIVE_Z
-				viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-				break;
+			const ShadowTile* tile = shadowAtlas->tile(uint32_t(plightPassSlot(lidx, face)));
+			if (!tile) continue;
+			view.passSlot = uint32_t(plightPassSlot(lidx, face));
+			view.viewproj = cubeFaceViewProj(face) * lights[lidx].viewproj;
+			view.lodScale = mesh_lods ? lod_scale(view.viewproj, tile->size) / shadow_lod_bias : 0.0f;
+			cullViews.push_back(view);
+		}
+	}
+	view.passSlot = uint32_t(gbufferPassSlot());
+	view.shadow_pass = false;
+	view.viewproj = currentCamera.viewproj;
+	view.lodScale = mesh_lods ? lod_scale(view.viewproj, swapChainExtent.height) : 0.0f;
+	cullViews.push_back(view);
+
+	cullMasks.resize(RENDERER_THREADS);
+	for (uint32_t w = 0; w < RENDERER_THREADS; w++) {
+		renderer_tpool->add_task(&delegate_cull_views, this, w);
+	}
+	renderer_tpool->wait_till_done();
+}
+
+void PrismRenderer::cullViewRange(uint32_t worker)
+{
+	std::vector<uint8_t>& visible = cullMasks[worker];
+	size_t robjCount = cullR.size();
+	visible.resize(robjCount);
+	const float* cx = cullCX.data();
+	const float* cy = cullCY.data();
+	const float* cz = cullCZ.data();
+	const float* cr = cullR.data();
+
+	for (size_t vi = worker; vi < cullViews.size(); vi += RENDERER_THREADS) {
+		const CullView& view = cullViews[vi];
+		std::fill(visible.begin(), visible.end(), uint8_t(1));
+		if (frustum_culling) {
+			// Gribb/Hartmann planes from the rows of viewproj. The near plane is the -1..1 depth one,
+			// which also holds for the 0..1 projections, just a bit looser
+			glm::mat4 rows = glm::transpose(view.viewproj);
+			glm::vec4 planes[6] = { rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] + rows[2], rows[3] - rows[2] };
+			for (glm::vec4 plane : planes) {
+				plane /= glm::length(glm::vec3(plane));
+				uint8_t* vis = visible.data();
+				for (size_t i = 0; i < robjCount; i++) {
+					vis[i] &= uint8_t(plane.x * cx[i] + plane.y * cy[i] + plane.z * cz[i] + plane.w >= -cr[i]);
+				}
 			}
-			GPULightPC tlpc;
-			tlpc.idx.x = lidx;
-			tlpc.viewproj = projMatrix * viewMatrix;
-			vkutils::beginRenderPass(shadowRenderPass, frameDatas[frameNo].pShadowFrameBuffer, plight_smap_extent, cmdBuffer, clearValues);
-			pLightPipeline.bindPipeline(cmdBuffer);
-			pLightPipeline.bindPipelineDSets(
-				cmdBuffer,
-				{ frameDatas[frameNo].setBuffers["light"]._dSet, frameDatas[frameNo].setBuffers["object"]._dSet },
-				{ { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)}, &tlpc } }
-			);
-			size_t robjCount = renderObjects.size();
-			for (size_t ro_idx = 0; ro_idx < robjCount; ro_idx++) {
-				RenderObject robj = renderObjects[ro_idx];
-				if (!robj.renderable || !robj.shadowcasting) continue;
-
-				VkBuffer vertexBuffers[] = { (robj.maintained_mesh) ? robj.mmesh->_vertexBuffer[frameNo]._buffer : robj.mesh->_vertexBuffer._buffer };
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(cmdBuffer, 0, 1, vertexBuffers, offsets);
-				vkCmdBindIndexBuffer(cmdBuffer, (robj.maintained_mesh) ? robj.mmesh->_indexBuffer[frameNo]._buffer :robj.mesh->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-				robj.drawMesh(cmdBuffer, ro_idx);
+		}
+
+		// the coarsest LOD whose error, projected at the near side of the bounding sphere, stays under
+		// lod_pixel_error. Objects the view is inside of stay at LOD 0
+		glm::vec4 wrow(view.viewproj[0][3], view.viewproj[1][3], view.viewproj[2][3], view.viewproj[3][3]);
+		std::vector<uint32_t>& drawList = passDrawLists[view.passSlot];
+		drawList.clear();
+		for (uint32_t ro_idx : drawOrder) {
+			const RenderListItem& item = renderList[ro_idx];
+			if (!visible[ro_idx] || !item.renderable || (view.shadow_pass && !item.shadowcasting)) continue;
+			uint32_t lod = 0;
+			if (item.lodCount > 1 && view.lodScale > 0) {
+				float depth = wrow.x * cx[ro_idx] + wrow.y * cy[ro_idx] + wrow.z * cz[ro_idx] + wrow.w - cr[ro_idx];
+				if (depth > 0) {
+					lod = pickMeshLod(item.lods, item.lodCount, view.lodScale * cr[ro_idx] / (item.bounds.w * depth), lod_pixel_error);
+				}
 			}
-			vkCmdEndRenderPass(cmdBuffer);
+			drawList.push_back(ro_idx | (lod << DRAW_LOD_SHIFT));
+		}
 
-			VkImageSubresourceRange cubeFaceSubresourceRange = {};
-			cubeFaceSubresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			cubeFaceSubresourceRange.baseMipLevel = 0;
-			cubeFaceSubresourceRange.levelCount = 1;
-			cubeFaceSubresourceRange.baseArrayLayer = face;
-			cubeFaceSubresourceRange.layerCount = 1;
-			vkutils::transitionImageLayout(
-				cmdBuffer,
-				frameDatas[frameNo].shadow_cube_maps[lidx]._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				cubeFaceSubresourceRange
-			);
-			vkutils::transitionImageLayout(
-				cmdBuffer,
-				frameDatas[frameNo].pShadowMapTemp._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
-			);
+		if (view.shadow_pass) {
+			// everything a shadow map depends on: its atlas tile, the light's view, and the mesh and transform of each
+			// caster in it. Maintained meshes are rewritten every frame, a map with one in it is never reused
+			uint64_t sig = hash_bytes(14695981039346656037ull, &view.viewproj, sizeof(glm::mat4));
+			sig = hash_bytes(sig, &shadowAtlas->tile(view.passSlot)->generation, sizeof(uint64_t));
+			for (uint32_t draw : drawList) {
+				uint32_t ro_idx = draw & DRAW_OBJ_MASK;
+				const RenderListItem& item = renderList[ro_idx];
+				const MeshLod& lod = item.lods[draw >> DRAW_LOD_SHIFT];
+				sig = hash_bytes(sig, &draw, sizeof(uint32_t));
+				sig = hash_bytes(sig, &item.vertexBuffer, sizeof(VkBuffer));
+				sig = hash_bytes(sig, &lod.firstIndex, sizeof(uint32_t));
+				sig = hash_bytes(sig, &lod.indexCount, sizeof(uint32_t));
+				sig = hash_bytes(sig, &renderObjects[ro_idx].uboData.model, sizeof(glm::mat4));
+				if (item.pool < 0) sig = hash_bytes(sig, &frameCount, sizeof(frameCount));
+			}
+			passSignatures[view.passSlot] = sig;
+		}
+	}
+}
 
-			VkImageCopy copyRegion = {};
-			copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			copyRegion.srcSubresource.baseArrayLayer = 0;
-			copyRegion.srcSubresource.mipLevel = 0;
-			copyRegion.srcSubresource.layerCount = 1;
-			copyRegion.srcOffset = { 0, 0, 0 };
-
-			copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			copyRegion.dstSubresource.baseArrayLayer = face;
-			copyRegion.dstSubresource.mipLevel = 0;
-			copyRegion.dstSubresource.layerCount = 1;
-			copyRegion.dstOffset = { 0, 0, 0 };
-
-			copyRegion.extent.width = plight_smap_extent.width;
-			copyRegion.extent.height = plight_smap_extent.height;
-			copyRegion.extent.depth = 1;
-
-			vkCmdCopyImage(
-				cmdBuffer,
-				frameDatas[frameNo].pShadowMapTemp._image,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				frameDatas[frameNo].shadow_cube_maps[lidx]._image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				1,
-				&copyRegion
-			);
+void PrismRenderer::markObjectPassesDirty(bool shadow_passes)
+{
+	// called with spawn_mut held. Every frame in flight has its own secondaries, each re-records its copy when it comes up
+	for (GPUFrameData& fdata : frameDatas) {
+		size_t first_slot = shadow_passes ? 0 : gbufferPassSlot();
+		for (size_t slot = first_slot; slot < fdata.passDirty.size(); slot++) fdata.passDirty[slot] = true;
+	}
+	renderListDirty = true;
+}
 
-			vkutils::transitionImageLayout(
-				cmdBuffer,
-				frameDatas[frameNo].shadow_cube_maps[lidx]._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				cubeFaceSubresourceRange
-			);
-			vkutils::transitionImageLayout(
-				cmdBuffer,
-				frameDatas[frameNo].pShadowMapTemp._image,
-				VK_FORMAT_R32_SFLOAT,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-				VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+void PrismRenderer::queueSecondaryJobs(SecondaryCmdJob passJob, size_t frameNo)
+{
+	// buffer k of a slot is allocated from and always recorded on worker (slot + k) % RENDERER_THREADS,
+	// allocating here keeps the workers off each other's pools
+	GPUFrameData& fdata = frameDatas[frameNo];
+	std::vector<VkCommandBuffer>& slotCmds = fdata.passCmdBuffers[passJob.passSlot];
+	fdata.passDrawLists[passJob.passSlot] = passDrawLists[passJob.passSlot];
+	passJob.drawList = &fdata.passDrawLists[passJob.passSlot];
+	size_t drawCount = passJob.drawList->size();
+	size_t k = 0;
+	for (size_t draw_start = 0; draw_start < drawCount; draw_start += SECONDARY_CMD_OBJECTS, k++) {
+		passJob.worker = uint32_t((passJob.passSlot + k) % RENDERER_THREADS);
+		if (k == slotCmds.size()) {
+			slotCmds.push_back(vkutils::createCmdBuffer(device, fdata.workerCmdPools[passJob.worker], VK_COMMAND_BUFFER_LEVEL_SECONDARY));
+		}
+		passJob.cmdBuffer = slotCmds[k];
+		passJob.draw_start = draw_start;
+		passJob.draw_end = std::min(draw_start + SECONDARY_CMD_OBJECTS, drawCount);
+		secondaryJobs.push_back(passJob);
+	}
+	fdata.passCmdCounts[passJob.passSlot] = k;
+	fdata.passDirty[passJob.passSlot] = false;
+	fdata.primaryDirty = true;
+	rerecordedPasses++;
+}
+
+void PrismRenderer::queueRecordJobs(size_t frameNo)
+{
+	// only dirty passes of shadow maps rendered this frame are queued. Pipelines and dsets are looked up here
+	// so the workers only read the jobs
+	GPUFrameData& fdata = frameDatas[frameNo];
+	secondaryJobs.clear();
+
+	// the frames in flight share the atlas. A tile is only rendered again when what it depends on changed since
+	// any frame last rendered it, the previous frame's reads are ordered before it by the shadow render pass
+	std::vector<bool> shadowRender(gbufferPassSlot(), false);
+	shadowPassesRendered = 0;
+	shadowPassesEnabled = 0;
+	for (const CullView& view : cullViews) {
+		if (!view.shadow_pass) continue;
+		shadowPassesEnabled++;
+		if (passSignatures[view.passSlot] == atlasSignatures[view.passSlot]) continue;
+		atlasSignatures[view.passSlot] = passSignatures[view.passSlot];
+		shadowRender[view.passSlot] = true;
+		shadowPassesRendered++;
+	}
+	if (shadowRender != fdata.shadowRender) {
+		// the primary has a render pass per rendered shadow map
+		fdata.shadowRender = shadowRender;
+		fdata.primaryDirty = true;
+	}
+	// camera and light movement only matter once they change what a pass draws, or where in the atlas it draws
+	for (const CullView& view : cullViews) {
+		if (passDrawLists[view.passSlot] != fdata.passDrawLists[view.passSlot]) fdata.passDirty[view.passSlot] = true;
+		if (!view.shadow_pass) continue;
+		uint64_t generation = shadowAtlas->tile(view.passSlot)->generation;
+		if (generation != fdata.shadowTileGenerations[view.passSlot]) {
+			fdata.shadowTileGenerations[view.passSlot] = generation;
+			fdata.passDirty[view.passSlot] = true;
+		}
+	}
+
+	SecondaryCmdJob shadowJob;
+	shadowJob.renderPass = shadowRenderPass;
+	shadowJob.frameBuffer = shadowAtlasFrameBuffer;
+	shadowJob.pipeline = pipelines["light_smap"];
+	shadowJob.shadow_pass = true;
+	shadowJob.dSets = { fdata.setBuffers["light"]._dSet, fdata.setBuffers["object"]._dSet };
+
+	for (size_t lidx = 0; lidx < MAX_DIRECTIONAL_LIGHTS; lidx++) {
+		if (!shadowRender[lidx] || !fdata.passDirty[lidx]) continue;
+		shadowJob.area = shadowTileArea(lidx);
+		shadowJob.passSlot = uint32_t(lidx);
+		shadowJob.lightPC.idx.x = int(MAX_POINT_LIGHTS + lidx);
+		shadowJob.lightPC.viewproj = glm::mat4(1);
+		queueSecondaryJobs(shadowJob, frameNo);
+	}
+
+	for (uint32_t lidx = 0; lidx < MAX_POINT_LIGHTS; lidx++) {
+		for (uint32_t face = 0; face < 6; face++) {
+			if (!shadowRender[plightPassSlot(lidx, face)] || !fdata.passDirty[plightPassSlot(lidx, face)]) continue;
+			shadowJob.area = shadowTileArea(plightPassSlot(lidx, face));
+			shadowJob.passSlot = uint32_t(plightPassSlot(lidx, face));
+			shadowJob.lightPC.idx.x = lidx;
+			shadowJob.lightPC.viewproj = cubeFaceViewProj(face);
+			queueSecondaryJobs(shadowJob, frameNo);
+		}
+	}
+
+	if (fdata.passDirty[gbufferPassSlot()]) {
+		SecondaryCmdJob gbufferJob;
+		gbufferJob.passSlot = uint32_t(gbufferPassSlot());
+		gbufferJob.renderPass = gbufferRenderPass;
+		gbufferJob.frameBuffer = fdata.gbufferFrameBuffer;
+		gbufferJob.pipeline = pipelines["gbuffer"];
+		gbufferJob.dSets = { fdata.setBuffers["camera"]._dSet, fdata.setBuffers["object"]._dSet };
+		queueSecondaryJobs(gbufferJob, frameNo);
+	}
+}
+
+void PrismRenderer::recordSecondaryCmds(size_t frameNo, uint32_t worker)
+{
+	// the frame's fence has been waited on, so its secondaries are free to re-record. The pools have
+	// RESET_COMMAND_BUFFER_BIT, beginning a buffer resets it
+	for (SecondaryCmdJob& job : secondaryJobs) {
+		if (job.worker != worker) continue;
+
+		VkCommandBufferInheritanceInfo inheritanceInfo{};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = job.renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = job.frameBuffer;
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+		if (vkBeginCommandBuffer(job.cmdBuffer, &beginInfo) != VK_SUCCESS) throw std::runtime_error("failed to begin recording command buffer!");
+
+		job.pipeline.bindPipeline(job.cmdBuffer);
+		if (job.shadow_pass) {
+			// the atlas is rendered upside down like the separate maps were, the viewport starts at the tile's bottom
+			VkViewport viewport = { float(job.area.offset.x), float(job.area.offset.y + int32_t(job.area.extent.height)), float(job.area.extent.width), -float(job.area.extent.height), 0.0f, 1.0f };
+			vkCmdSetViewport(job.cmdBuffer, 0, 1, &viewport);
+			vkCmdSetScissor(job.cmdBuffer, 0, 1, &job.area);
+			job.pipeline.bindPipelineDSets(
+				job.cmdBuffer,
+				job.dSets,
+				{ { {VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPULightPC)}, &job.lightPC } }
 			);
 		}
+		DrawRecordTarget target;
+		target.items = renderList.data();
+		target.instanceBuffer = frameDatas[frameNo].instanceBuffer._buffer;
+		target.indirectBuffer = frameDatas[frameNo].indirectBuffer._buffer;
+		target.slotCmds = frameDatas[frameNo].indirectCmds + job.passSlot * MAX_OBJECTS;
+		target.slotObjs = frameDatas[frameNo].instanceObjs + job.passSlot * MAX_OBJECTS;
+		target.slotCmdsOffset = job.passSlot * MAX_OBJECTS * sizeof(VkDrawIndexedIndirectCommand);
+		target.slotBase = uint32_t(job.passSlot * MAX_OBJECTS);
+		target.frameNo = frameNo;
+		target.indirect = indirect_drawing && supports_indirect_first_instance;
+		target.multiDrawIndirect = supports_multi_draw_indirect;
+		DrawRecordStats stats = recordDrawRange(job, target);
+		workerDraws[worker] += stats.draws;
+		workerDrawCalls[worker] += stats.drawCalls;
+		workerShadowFetchBytes[worker] += stats.shadowFetchBytes;
+		if (vkEndCommandBuffer(job.cmdBuffer) != VK_SUCCESS) throw std::runtime_error("failed to record command buffer!");
+	}
+}
+
+void PrismRenderer::executePassCmds(VkCommandBuffer cmdBuffer, size_t frameNo, size_t passSlot)
+{
+	// a pass with no objects has no secondaries, vkCmdExecuteCommands needs at least one
+	size_t count = frameDatas[frameNo].passCmdCounts[passSlot];
+	if (count == 0) return;
+	vkCmdExecuteCommands(cmdBuffer, uint32_t(count), frameDatas[frameNo].passCmdBuffers[passSlot].data());
+}
+
+void PrismRenderer::updateParticleCmds(size_t frameNo)
+{
+	// instance counts change every frame and only go into the indirect commands after the passes' ones, the
+	// secondary is re-recorded when a type was added or an instance buffer was replaced. Every type draws from
+	// the same command slot, so it is always indirect, with one draw and firstInstance 0 that needs no features
+	if (particleTypes.empty()) return;
+	GPUFrameData& fdata = frameDatas[frameNo];
+	VkDrawIndexedIndirectCommand* typeCmds = fdata.indirectCmds + (gbufferPassSlot() + 1) * MAX_OBJECTS;
+	for (size_t t = 0; t < particleTypes.size(); t++) {
+		const GPUParticleType& ptype = particleTypes[t];
+		const Mesh* mesh = ptype.mesh;
+		// a type whose mesh or textures are still uploading draws no instances
+		bool uploaded = ptype.texmaps->_uploadTicket <= acquiredTicket && mesh->_uploadTicket <= acquiredTicket;
+		uint32_t instances = uploaded ? ptype.counts[frameNo] : 0;
+		if (mesh->_lods.empty()) {
+			typeCmds[t] = { uint32_t(mesh->_indices.size()), instances, mesh->_firstIndex, mesh->_vertexOffset, 0 };
+		}
+		else {
+			typeCmds[t] = { mesh->_lods[0].indexCount, instances, mesh->_firstIndex + mesh->_lods[0].firstIndex, mesh->_vertexOffset, 0 };
+		}
+		if (print_record_stats) {
+			stats_particles += instances;
+			stats_particle_draws++;
+		}
+	}
+	if (fdata.particlesDirty) recordParticleCmds(frameNo);
+}
+
+void PrismRenderer::recordParticleCmds(size_t frameNo)
+{
+	GPUFrameData& fdata = frameDatas[frameNo];
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = gbufferRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = fdata.gbufferFrameBuffer;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+	if (vkBeginCommandBuffer(fdata.particleCmdBuffer, &beginInfo) != VK_SUCCESS) throw std::runtime_error("failed to begin recording command buffer!");
+
+	// the particle pipeline shares the gbuffer layout, the object buffer is bound but not read
+	GPUPipeline pipeline = pipelines["particle"];
+	pipeline.bindPipeline(fdata.particleCmdBuffer);
+	uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize typeCmdsOffset = (gbufferPassSlot() + 1) * MAX_OBJECTS * sizeof(VkDrawIndexedIndirectCommand);
+	for (size_t t = 0; t < particleTypes.size(); t++) {
+		const GPUParticleType& ptype = particleTypes[t];
+		VkBuffer vertexBuffers[] = { ptype.mesh->_vertexBuffer._buffer, ptype.mesh->_attribBuffer._buffer, ptype.instanceBuffers[frameNo]._buffer };
+		VkDeviceSize offsets[] = { 0, 0, 0 };
+		vkCmdBindVertexBuffers(fdata.particleCmdBuffer, 0, 3, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(fdata.particleCmdBuffer, ptype.mesh->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+		VkDescriptorSet dSets[] = { fdata.setBuffers["camera"]._dSet, fdata.setBuffers["object"]._dSet, ptype.texmaps->_dSet };
+		vkCmdBindDescriptorSets(fdata.particleCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline._pipelineLayout, 0, 3, dSets, 0, NULL);
+		vkCmdDrawIndexedIndirect(fdata.particleCmdBuffer, fdata.indirectBuffer._buffer, typeCmdsOffset + t * stride, 1, stride);
+	}
+	if (vkEndCommandBuffer(fdata.particleCmdBuffer) != VK_SUCCESS) throw std::runtime_error("failed to record command buffer!");
+	fdata.particlesDirty = false;
+	fdata.primaryDirty = true;
+}
+
+void PrismRenderer::addDLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
+{
+	std::vector<VkClearValue> clearValues = std::vector<VkClearValue>(2);
+	clearValues[0].color = { 1.0f, 1.0f, 1.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	for (size_t lidx = 0; lidx < MAX_DIRECTIONAL_LIGHTS; lidx++) {
+		if (!frameDatas[frameNo].shadowRender[lidx]) continue;
+
+		VkRect2D area = shadowTileArea(lidx);
+		vkutils::beginRenderPass(shadowRenderPass, shadowAtlasFrameBuffer, area.extent, cmdBuffer, clearValues, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, area.offset);
+		executePassCmds(cmdBuffer, frameNo, lidx);
+		vkCmdEndRenderPass(cmdBuffer);
+	}
+
+}
+
+void PrismRenderer::addPLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
+{
+	std::vector<VkClearValue> clearValues = std::vector<VkClearValue>(2);
+	clearValues[0].color = { 1.0f, 1.0f, 1.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	for (uint32_t lidx = 0; lidx < MAX_POINT_LIGHTS; lidx++) {
+		for (uint32_t face = 0; face < 6; face++) {
+			if (!frameDatas[frameNo].shadowRender[plightPassSlot(lidx, face)]) continue;
+			VkRect2D area = shadowTileArea(plightPassSlot(lidx, face));
+			vkutils::beginRenderPass(shadowRenderPass, shadowAtlasFrameBuffer, area.extent, cmdBuffer, clearValues, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS, area.offset);
+			executePassCmds(cmdBuffer, frameNo, plightPassSlot(lidx, face));
+			vkCmdEndRenderPass(cmdBuffer);
+		}
 	}
 }
 
@@ -1706,32 +2163,9 @@ void PrismRenderer::addGbufferCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
 	clearValues[3].color = { 0.0f, 0.0f, 0.0f, 1.0f };
 	clearValues[4].depthStencil = { 1.0f, 0 };
 
-	vkutils::beginRenderPass(gbufferRenderPass, frameDatas[frameNo].gbufferFrameBuffer, swapChainExtent, cmdBuffer, clearValues);
-
-	size_t robjCount = renderObjects.size();
-
-	GPUPipeline gbuffer_pipeline = pipelines["gbuffer"];
-	gbuffer_pipeline.bindPipeline(cmdBuffer);
-
-	for (size_t ro_idx = 0; ro_idx < robjCount; ro_idx++) {
-		RenderObject robj = renderObjects[ro_idx];
-		if (!robj.renderable) continue;
-
-		VkBuffer vertexBuffers[] = { (robj.maintained_mesh) ? robj.mmesh->_vertexBuffer[frameNo]._buffer : robj.mesh->_vertexBuffer._buffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(cmdBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(cmdBuffer, (robj.maintained_mesh) ? robj.mmesh->_indexBuffer[frameNo]._buffer : robj.mesh->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
-		gbuffer_pipeline.bindPipelineDSets(
-			cmdBuffer,
-			{
-				frameDatas[frameNo].setBuffers["camera"]._dSet,
-				frameDatas[frameNo].setBuffers["object"]._dSet,
-				robj.texmaps->_dSet,
-			},
-			{}
-		);
-		robj.drawMesh(cmdBuffer, ro_idx);
-	}
+	vkutils::beginRenderPass(gbufferRenderPass, frameDatas[frameNo].gbufferFrameBuffer, swapChainExtent, cmdBuffer, clearValues, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	executePassCmds(cmdBuffer, frameNo, gbufferPassSlot());
+	if (particleTypes.size() > 0) vkCmdExecuteCommands(cmdBuffer, 1, &frameDatas[frameNo].particleCmdBuffer);
 	vkCmdEndRenderPass(cmdBuffer);
 }
 
@@ -1778,8 +2212,10 @@ void PrismRenderer::addFinalMeshCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
 			frameDatas[frameNo].setBuffers["scene"]._dSet,
 			frameDatas[frameNo].finalComposeDset,
 			frameDatas[frameNo].setBuffers["light"]._dSet,
-			frameDatas[frameNo].shadow_cube_dset,
-			frameDatas[frameNo].shadow_dir_dset,
+			shadowAtlasDset,
+			frameDatas[frameNo].setBuffers["shadow_atlas"]._dSet,
+			frameDatas[frameNo].setBuffers["cluster_light"]._dSet,
+			frameDatas[frameNo].setBuffers["cluster"]._dSet,
 		},
 		{}
 	);
@@ -1791,40 +2227,62 @@ void PrismRenderer::addFinalMeshCmds(VkCommandBuffer cmdBuffer, size_t frameNo)
 void PrismRenderer::createFinalCmdBuffers() {
 	for (size_t i = 0; i < frameDatas.size(); i++) {
 		frameDatas[i].commandBuffer = vkutils::createCmdBuffer(device, frameDatas[i].commandPool);
-
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // Optional
-		beginInfo.pInheritanceInfo = NULL; // Optional
-		if (vkBeginCommandBuffer(frameDatas[i].commandBuffer, &beginInfo) != VK_SUCCESS) throw std::runtime_error("failed to begin recording command buffer!");
-		addDLightCmds(frameDatas[i].commandBuffer, i);
-		addPLightCmds(frameDatas[i].commandBuffer, i);
-		addGbufferCmds(frameDatas[i].commandBuffer, i);
-		addAmbientCmds(frameDatas[i].commandBuffer, i);
-		addFinalMeshCmds(frameDatas[i].commandBuffer, i);
-		if (vkEndCommandBuffer(frameDatas[i].commandBuffer) != VK_SUCCESS) throw std::runtime_error("failed to record command buffer!");
 	}
+	refreshFinalCmdBuffers();
 }
 
 void PrismRenderer::refreshFinalCmdBuffers() {
-	for (size_t i = 0; i < frameDatas.size(); i++) {
-		if (vkResetCommandBuffer(frameDatas[i].commandBuffer, 0) != VK_SUCCESS) throw std::runtime_error("failed to reset command buffers!");
-
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT; // Optional
-		beginInfo.pInheritanceInfo = NULL; // Optional
-		if (vkBeginCommandBuffer(frameDatas[i].commandBuffer, &beginInfo) != VK_SUCCESS) throw std::runtime_error("failed to begin recording command buffer!");
-		addDLightCmds(frameDatas[i].commandBuffer, i);
-		addPLightCmds(frameDatas[i].commandBuffer, i);
-		addGbufferCmds(frameDatas[i].commandBuffer, i);
-		addAmbientCmds(frameDatas[i].commandBuffer, i);
-		addFinalMeshCmds(frameDatas[i].commandBuffer, i);
-		if (vkEndCommandBuffer(frameDatas[i].commandBuffer) != VK_SUCCESS) throw std::runtime_error("failed to record command buffer!");
+	// framebuffers, pipelines or dsets changed, every frame re-records everything before its next submit
+	for (GPUFrameData& fdata : frameDatas) {
+		fdata.passDirty.assign(gbufferPassSlot() + 1, true);
+		fdata.shadowTileGenerations.assign(gbufferPassSlot(), 0);
+		fdata.particlesDirty = true;
+		fdata.primaryDirty = true;
 	}
 }
 
 void PrismRenderer::genFinalCmdBuffers(size_t frameNo) {
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+
+	// object transforms are in the object SSBO, so the recorded buffers stay valid until an object, its
+	// visibility, a light's shadow flag or a pass's culled draw list changes. Only the dirty passes are re-recorded, into secondaries
+	// on the renderer workers. The primary begins the passes, executes them and records the copies and
+	// fullscreen passes, it is re-recorded whenever one of its secondaries is
+	rerecordedPasses = 0;
+	cullObjects();
+	std::chrono::steady_clock::time_point tculled = std::chrono::steady_clock::now();
+	if (print_record_stats) {
+		stats_cull_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tculled - tstart).count();
+		stats_cull_tests += renderObjects.size() * cullViews.size();
+		for (const CullView& view : cullViews) stats_cull_draws += passDrawLists[view.passSlot].size();
+	}
+	queueRecordJobs(frameNo);
+	if (print_record_stats) {
+		// triangles of the passes the GPU renders this frame, shadow maps that are reused submit none
+		for (const CullView& view : cullViews) {
+			if (view.shadow_pass && !frameDatas[frameNo].shadowRender[view.passSlot]) continue;
+			for (uint32_t draw : passDrawLists[view.passSlot]) {
+				const RenderListItem& item = renderList[draw & DRAW_OBJ_MASK];
+				size_t tris = item.lods[draw >> DRAW_LOD_SHIFT].indexCount / 3;
+				(view.shadow_pass ? stats_shadow_tris : stats_gbuffer_tris) += tris;
+				stats_full_tris += item.lods[0].indexCount / 3;
+				stats_lod_draws[draw >> DRAW_LOD_SHIFT]++;
+			}
+		}
+	}
+	updateParticleCmds(frameNo);
+	if (!frameDatas[frameNo].primaryDirty) return;
+
+	workerDraws.assign(RENDERER_THREADS, 0);
+	workerDrawCalls.assign(RENDERER_THREADS, 0);
+	workerShadowFetchBytes.assign(RENDERER_THREADS, 0);
+
+	for (uint32_t w = 0; w < RENDERER_THREADS && secondaryJobs.size() > 0; w++) {
+		renderer_tpool->add_task(&delegate_record_secondary_cmds, this, frameNo, w);
+	}
+	renderer_tpool->wait_till_done();
+	std::chrono::steady_clock::time_point tsecondary = std::chrono::steady_clock::now();
+
 	if (vkResetCommandBuffer(frameDatas[frameNo].commandBuffer, 0) != VK_SUCCESS) throw std::runtime_error("failed to reset command buffers!");
 
 	VkCommandBufferBeginInfo beginInfo{};
@@ -1839,6 +2297,18 @@ void PrismRenderer::genFinalCmdBuffers(size_t frameNo) {
 	addAmbientCmds(frameDatas[frameNo].commandBuffer, frameNo);
 	addFinalMeshCmds(frameDatas[frameNo].commandBuffer, frameNo);
 	if (vkEndCommandBuffer(frameDatas[frameNo].commandBuffer) != VK_SUCCESS) throw std::runtime_error("failed to record command buffer!");
+	frameDatas[frameNo].primaryDirty = false;
+
+	if (print_record_stats) {
+		std::chrono::steady_clock::time_point tend = std::chrono::steady_clock::now();
+		stats_secondary_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tsecondary - tculled).count();
+		stats_primary_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(tend - tsecondary).count();
+		for (uint32_t w = 0; w < RENDERER_THREADS; w++) {
+			stats_draws += workerDraws[w];
+			stats_draw_calls += workerDrawCalls[w];
+			stats_shadow_fetch_bytes += workerShadowFetchBytes[w];
+		}
+	}
 }
 
 void PrismRenderer::createSyncObjects() {
@@ -1884,7 +2354,7 @@ void PrismRenderer::createBasicSamplers()
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
 	VkSampler basicTexSampler;
 	if (vkCreateSampler(device, &samplerInfo, nullptr, &basicTexSampler) != VK_SUCCESS) throw std::runtime_error("failed to create texture sampler!");
@@ -1925,16 +2395,18 @@ void PrismRenderer::initVulkan()
 	getVkInstance();
 	createSurface();
 	getVkLogicalDevice();
+	uploader = new GPUUploader(device, physicalDevice, transferQueue, queueFamilyIndices.transferFamily.value(), queueFamilyIndices.graphicsFamily.value());
 
 	createSwapChain(vkutils::querySwapChainSupport(physicalDevice, surface));
 	makeBasicCmdPools();
+	makeIndirectCmdBuffer();
+	makeDynamicMeshPool();
 	createDescriptorPool();
 	makeBasicDSetLayouts();
 	createBasicSamplers();
 
 	createDepthImage();
-	makeDLightMaps();
-	makePLightMaps();
+	makeShadowAtlas();
 
 	createShadowRenderPass();
 	createGbufferRenderPass();
@@ -1948,9 +2420,9 @@ void PrismRenderer::initVulkan()
 
 	makeBasicDSets();
 
-	makeDLightShadowPipeline();
-	makePLightShadowPipeline();
+	makeShadowPipeline();
 	makeGbufferPipeline();
+	makeGbufferPipeline("particle", "shaders/particle.vert.spv", true);
 	makeAmbientPipeline();
 	makeFinalPipeline();
 
@@ -1984,12 +2456,14 @@ void PrismRenderer::recreateSwapChain()
 		createAmbientFrameBuffers();
 		createFinalFrameBuffers();
 		makeGbufferPipeline();
+		makeGbufferPipeline("particle", "shaders/particle.vert.spv", true);
 		makeAmbientPipeline();
 		makeFinalPipeline();
 		createFinalCmdBuffers();
 	}
 	else{
 		makeBasicCmdPools();
+		makeIndirectCmdBuffer();
 		createDepthImage();
 		createFinalFrameBuffers();
 		createGbufferFrameBuffers();
@@ -1997,15 +2471,16 @@ void PrismRenderer::recreateSwapChain()
 		createShadowFrameBuffers();
 		makeBasicDSets();
 		makeGbufferPipeline();
+		makeGbufferPipeline("particle", "shaders/particle.vert.spv", true);
 		makeAmbientPipeline();
 		makeFinalPipeline();
-		makePLightShadowPipeline();
+		makeShadowPipeline();
 		createFinalCmdBuffers();
 		imagesInFlight.resize(frameDatas.size(), VK_NULL_HANDLE);
 	}
 }
 
-void PrismRenderer::updateUBOs(uint32_t curr_img)
+void PrismRenderer::updateUBOs(uint32_t frameNo)
 {
 	std::chrono::steady_clock::time_point currentFrameTime;
 
@@ -2025,43 +2500,64 @@ void PrismRenderer::updateUBOs(uint32_t curr_img)
 		lastFrameTime = currentFrameTime;
 	}
 
-	uboUpdateCallback(framedeltat, this, curr_img);
-
-	void* tscenedata;
-	vkMapMemory(device, frameDatas[curr_img].setBuffers["scene"]._gBuffer._bufferMemory, 0, sizeof(currentScene), 0, &tscenedata);
-	memcpy(tscenedata, &currentScene, sizeof(GPUSceneData));
-	vkUnmapMemory(device, frameDatas[curr_img].setBuffers["scene"]._gBuffer._bufferMemory);
+	uboUpdateCallback(framedeltat, this, frameNo);
+	std::chrono::steady_clock::time_point tubo = std::chrono::steady_clock::now();
+	if (print_record_stats) {
+		// spawns happen in the callback, with uploads queued instead of waited on it should stay flat
+		stats_worst_frame_ms = std::max(stats_worst_frame_ms, framedeltat * 1000.0f);
+		stats_worst_callback_ms = std::max(stats_worst_callback_ms, std::chrono::duration<float, std::chrono::milliseconds::period>(tubo - currentFrameTime).count());
+	}
 
-	void* camdata;
-	vkMapMemory(device, frameDatas[curr_img].setBuffers["camera"]._gBuffer._bufferMemory, 0, sizeof(currentCamera), 0, &camdata);
-	memcpy(camdata, &currentCamera, sizeof(GPUCameraData));
-	vkUnmapMemory(device, frameDatas[curr_img].setBuffers["camera"]._gBuffer._bufferMemory);
+	// every frame in flight has its own set buffers. They are picked by the frame like its command buffers, not by
+	// the swapchain image, drawFrame waited on the frame's fence so they are free to write
+	GPUFrameData& fdata = frameDatas[frameNo];
+	memcpy(fdata.setBuffers["scene"]._gBuffer._mapped, &currentScene, sizeof(GPUSceneData));
+	memcpy(fdata.setBuffers["camera"]._gBuffer._mapped, &currentCamera, sizeof(GPUCameraData));
 
-	for (size_t pli = 0; pli < MAX_POINT_LIGHTS; pli++) lights[MAX_NS_LIGHTS + pli].viewproj = glm::translate(glm::mat4(1.0f), -glm::vec3(lights[MAX_NS_LIGHTS + pli].pos));
+	for (size_t pli = 0; pli < MAX_POINT_LIGHTS; pli++) lights[pli].viewproj = glm::translate(glm::mat4(1.0f), -glm::vec3(lights[pli].pos));
 	for (size_t pli = 0; pli < MAX_DIRECTIONAL_LIGHTS; pli++) {
-		lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + pli].viewproj = lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + pli].proj * glm::lookAt(
-			glm::vec3(lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + pli].pos),
-			glm::vec3(lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + pli].pos + glm::normalize(lights[MAX_NS_LIGHTS + MAX_POINT_LIGHTS + pli].dir)),
+		lights[MAX_POINT_LIGHTS + pli].viewproj = lights[MAX_POINT_LIGHTS + pli].proj * glm::lookAt(
+			glm::vec3(lights[MAX_POINT_LIGHTS + pli].pos),
+			glm::vec3(lights[MAX_POINT_LIGHTS + pli].pos + glm::normalize(lights[MAX_POINT_LIGHTS + pli].dir)),
 			glm::vec3(0, 1, 0)
 		);
 	}
 
-	void* scubedata;
-	vkMapMemory(device, frameDatas[curr_img].setBuffers["light"]._gBuffer._bufferMemory, 0, sizeof(GPULight) * lights.size(), 0, &scubedata);
-	memcpy(scubedata, lights.data(), lights.size() * sizeof(GPULight));
-	vkUnmapMemory(device, frameDatas[curr_img].setBuffers["light"]._gBuffer._bufferMemory);
-
-	size_t objCount = renderObjects.size();
-	std::vector<GPUObjectData> objubo;
+	memcpy(fdata.setBuffers["light"]._gBuffer._mapped, lights.data(), lights.size() * sizeof(GPULight));
+
+	// tiles are placed before culling, shadow views without one are skipped this frame
+	updateShadowAtlas();
+	memcpy(fdata.setBuffers["shadow_atlas"]._gBuffer._mapped, atlasRects.data(), atlasRects.size() * sizeof(glm::vec4));
+
+	// lights without shadows are binned against this frame's camera, the shader walks its fragment's cluster
+	std::chrono::steady_clock::time_point tcluster = std::chrono::steady_clock::now();
+	if (fdata.clusterLightsVersion != clusteredLightsVersion) {
+		memcpy(fdata.setBuffers["cluster_light"]._gBuffer._mapped, clusteredLights.data(), clusteredLights.size() * sizeof(GPULight));
+		fdata.clusterLightsVersion = clusteredLightsVersion;
+	}
+	ClusterView cview;
+	cview.viewproj = currentCamera.viewproj;
+	cview.camPos = glm::vec3(currentCamera.camPos);
+	cview.camDir = glm::normalize(glm::vec3(currentCamera.camDir));
+	cview.farPlane = currentCamera.projprops.y;
+	lightClusterer->bin(cview, clusteredLights.data(), clusteredLights.size());
+	char* clusterData = (char*)fdata.setBuffers["cluster"]._gBuffer._mapped;
+	memcpy(clusterData, lightClusterer->ranges.data(), sizeof(glm::uvec2) * LIGHT_CLUSTER_COUNT);
+	memcpy(clusterData + sizeof(glm::uvec2) * LIGHT_CLUSTER_COUNT, lightClusterer->indices.data(), sizeof(uint32_t) * lightClusterer->indices.size());
+	if (print_record_stats) {
+		stats_cluster_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - tcluster).count();
+		stats_cluster_indices += lightClusterer->indices.size();
+		stats_cluster_dropped += lightClusterer->droppedIndices;
+	}
+
+	// the object buffer holds MAX_OBJECTS transforms
+	size_t objCount = std::min(renderObjects.size(), MAX_OBJECTS);
+	GPUObjectData* objdata = (GPUObjectData*)fdata.setBuffers["object"]._gBuffer._mapped;
 	for (size_t i = 0; i < objCount; i++) {
-		objubo.push_back(renderObjects[i].uboData);
+		objdata[i] = renderObjects[i].uboData;
 	}
-
-	if (objCount > 0) {
-		void* objdata;
-		vkMapMemory(device, frameDatas[curr_img].setBuffers["object"]._gBuffer._bufferMemory, 0, sizeof(objubo) * objCount, 0, &objdata);
-		memcpy(objdata, objubo.data(), sizeof(GPUObjectData) * objCount);
-		vkUnmapMemory(device, frameDatas[curr_img].setBuffers["object"]._gBuffer._bufferMemory);
+	if (print_record_stats) {
+		stats_ubo_ms += std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - tubo).count();
 	}
 
 	if (refresh_cmd_buffers) {
@@ -2095,29 +2591,123 @@ void PrismRenderer::drawFrame() {
 	// Mark the image as now being in use by this frame
 	imagesInFlight[imageIndex] = frameDatas[currentFrame].renderFence;
 
+	freeRetiredMeshes();
+
 	spawn_mut.unlock();
 
-	updateUBOs(imageIndex);
+	updateUBOs(currentFrame);
 	
 	//inputmgr.clearMOffset();
 
 	spawn_mut.lock();
 
+	finishTextureLoads();
+	// what this frame's spawns queued goes out as one batch. Finished batches are acquired at the start of this
+	// frame's submit and their objects join the draw lists from this frame on
+	uploader->submit();
+	uint64_t uploaded = uploader->completedTicket();
+	bool acquiring = false;
+	if (uploaded > acquiredTicket) {
+		VkCommandBuffer acquireCmd = frameDatas[currentFrame].acquireCmdBuffer;
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(acquireCmd, &beginInfo);
+		acquiring = uploader->recordAcquires(acquireCmd, uploaded);
+		vkEndCommandBuffer(acquireCmd);
+		acquiredTicket = uploaded;
+		markObjectPassesDirty(true);
+	}
+
 	genFinalCmdBuffers(currentFrame);
-	//delegate_gen_final_cmd_bufs(this, currentFrame);
-	//renderer_tpool->add_task(&delegate_gen_final_cmd_bufs, this, currentFrame);;
-	//renderer_tpool->wait_till_done();
+	if (print_record_stats) {
+		stats_rerecorded_passes += rerecordedPasses;
+		stats_shadow_rendered += shadowPassesRendered;
+		stats_shadow_enabled += shadowPassesEnabled;
+		if (++stats_frames == STATS_INTERVAL_FRAMES) {
+			std::cout << "renderer: " << renderObjects.size() << " objects, " << float(stats_rerecorded_passes) / stats_frames << " passes re-recorded per frame, avg record "
+				<< (stats_secondary_ms + stats_primary_ms) / stats_frames << "ms (secondaries " << stats_secondary_ms / stats_frames << "ms on "
+				<< RENDERER_THREADS << " workers, primary " << stats_primary_ms / stats_frames << "ms)\n";
+			std::cout << "renderer: culling avg " << stats_cull_ms / stats_frames << "ms, "
+				<< float(stats_cull_tests) / std::max(stats_cull_ms, 0.001f) << " object-views/ms, "
+				<< stats_cull_draws / stats_frames << " of " << stats_cull_tests / stats_frames << " draws kept ("
+				<< (stats_cull_tests - stats_cull_draws) / stats_frames << " saved per frame)\n";
+			std::cout << "renderer: " << float(stats_shadow_rendered) / stats_frames << " of " << float(stats_shadow_enabled) / stats_frames
+				<< " shadow passes rendered per frame, " << float(stats_shadow_fetch_bytes) / std::max(stats_shadow_rendered, size_t(1)) / 1024
+				<< "KB of positions fetched per shadow pass\n";
+			std::cout << "renderer: " << (stats_gbuffer_tris + stats_shadow_tris) / stats_frames << " triangles submitted per frame (gbuffer "
+				<< stats_gbuffer_tris / stats_frames << ", shadow " << stats_shadow_tris / stats_frames << "), " << stats_full_tris / stats_frames
+				<< " at LOD 0, draws per LOD";
+			for (uint32_t l = 0; l < MAX_MESH_LODS; l++) std::cout << " " << stats_lod_draws[l] / stats_frames;
+			std::cout << (mesh_lods ? "\n" : " (LODs off)\n");
+			std::cout << "renderer: updateUBOs avg " << stats_ubo_ms / stats_frames << "ms for " << renderObjects.size() << " object transforms\n";
+			std::cout << "renderer: re-recorded passes drew " << stats_draws / stats_frames << " objects in "
+				<< stats_draw_calls / stats_frames << " draw calls per frame" << (indirect_drawing && supports_indirect_first_instance ? " (indirect)\n" : "\n");
+			std::cout << "renderer: " << stats_particles / stats_frames << " particles in " << float(stats_particle_draws) / stats_frames
+				<< " instanced draws per frame\n";
+			std::cout << "renderer: light clustering avg " << stats_cluster_ms / stats_frames << "ms for " << clusteredLights.size() << " lights, "
+				<< float(stats_cluster_indices) / stats_frames / LIGHT_CLUSTER_COUNT << " lights per cluster, "
+				<< stats_cluster_dropped / stats_frames << " dropped per frame\n";
+			std::cout << "renderer: shadow atlas " << float(stats_atlas_texels) / stats_frames / (size_t(shadow_atlas_size) * shadow_atlas_size) * 100
+				<< "% used, " << float(stats_atlas_moved) / stats_frames << " tiles moved and " << stats_atlas_repacks << " repacks per "
+				<< stats_frames << " frames\n";
+			std::cout << "renderer: worst frame " << stats_worst_frame_ms << "ms (worst frame callback " << stats_worst_callback_ms << "ms), uploaded "
+				<< float(uploader->stats_bytes) / (1024 * 1024) << "MB in " << uploader->stats_batches << " batches, "
+				<< uploader->stats_ring_waits << " staging ring waits, maintained meshes wrote "
+				<< float(stats_dynamic_bytes) / stats_frames / 1024 << "KB per frame\n";
+			stats_frames = 0;
+			stats_rerecorded_passes = 0;
+			stats_shadow_rendered = 0;
+			stats_shadow_enabled = 0;
+			stats_cull_ms = 0;
+			stats_cull_tests = 0;
+			stats_cull_draws = 0;
+			stats_secondary_ms = 0;
+			stats_primary_ms = 0;
+			stats_draws = 0;
+			stats_ubo_ms = 0;
+			stats_draw_calls = 0;
+			stats_shadow_fetch_bytes = 0;
+			stats_dynamic_bytes = 0;
+			stats_particles = 0;
+			stats_particle_draws = 0;
+			stats_cluster_ms = 0;
+			stats_cluster_indices = 0;
+			stats_cluster_dropped = 0;
+			stats_atlas_moved = 0;
+			stats_atlas_repacks = 0;
+			stats_atlas_texels = 0;
+			stats_gbuffer_tris = 0;
+			stats_shadow_tris = 0;
+			stats_full_tris = 0;
+			std::fill(stats_lod_draws, stats_lod_draws + MAX_MESH_LODS, 0);
+			stats_worst_frame_ms = 0;
+			stats_worst_callback_ms = 0;
+			uploader->stats_bytes = 0;
+			uploader->stats_batches = 0;
+			uploader->stats_ring_waits = 0;
+		}
+	}
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = { frameDatas[currentFrame].presentSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
+	// the frame also waits on the upload timeline for the batches it draws from, that orders the copies and the
+	// release barriers before the acquires. The value given for the binary semaphore is ignored
+	VkSemaphore waitSemaphores[] = { frameDatas[currentFrame].presentSemaphore, uploader->timeline };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+	uint64_t waitValues[] = { 0, acquiredTicket };
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = 2;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = 2;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &frameDatas[currentFrame].commandBuffer;
+	VkCommandBuffer cmdBuffers[] = { frameDatas[currentFrame].acquireCmdBuffer, frameDatas[currentFrame].commandBuffer };
+	submitInfo.commandBufferCount = acquiring ? 2 : 1;
+	submitInfo.pCommandBuffers = acquiring ? cmdBuffers : &frameDatas[currentFrame].commandBuffer;
 
 	VkSemaphore signalSemaphores[] = { frameDatas[currentFrame].renderSemaphore };
 	submitInfo.signalSemaphoreCount = 1;
@@ -2153,6 +2743,24 @@ void PrismRenderer::drawFrame() {
 	}
 
 	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	frameCount++;
+}
+
+void PrismRenderer::freeRetiredMeshes(bool force_all)
+{
+	// a retired mesh can still be referenced by command buffers of the frames in flight
+	size_t kept = 0;
+	for (size_t i = 0; i < retired_meshes.size(); i++) {
+		// its range can't be reused before the upload into it finished either
+		bool uploaded = retired_meshes[i].first._uploadTicket <= acquiredTicket;
+		if (force_all || (uploaded && retired_meshes[i].second + MAX_FRAMES_IN_FLIGHT <= frameCount)) {
+			freePooledMesh(retired_meshes[i].first);
+		}
+		else {
+			retired_meshes[kept++] = retired_meshes[i];
+		}
+	}
+	retired_meshes.resize(kept);
 }
 
 void PrismRenderer::mainLoop()
@@ -2167,133 +2775,233 @@ void PrismRenderer::mainLoop()
 
 void PrismRenderer::run()
 {
-	//renderer_tpool->run();
 	mainLoop();
 	cleanup();
 }
 
 Mesh* PrismRenderer::addMesh(std::string meshFilePath)
 {
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
 	Mesh tmesh;
-	tmesh.load_from_obj(meshFilePath.c_str());
-	tmesh._vertexBuffer = vkutils::createBuffer(
-		device, physicalDevice,
-		sizeof(Vertex) * tmesh._vertices.size(), tmesh._vertices.data(),
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		uploadCmdPool,
-		transferQueue
-	);
-	tmesh._indexBuffer = vkutils::createBuffer(
-		device, physicalDevice,
-		sizeof(uint32_t) * tmesh._indices.size(), tmesh._indices.data(),
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		uploadCmdPool,
-		transferQueue
-	);
+	bool cached = meshcook::readCache(tmesh, meshFilePath);
+	float acmr_loaded = 0, acmr_optimized = 0;
+	if (!cached) {
+		// spawns run with the renderer workers idle, they only cull and record later in the frame
+		tmesh.load_from_obj(meshFilePath.c_str(), renderer_tpool);
+		acmr_loaded = meshproc::acmr(tmesh._indices, tmesh._vertices.size());
+		tmesh.optimize_order();
+		acmr_optimized = meshproc::acmr(tmesh._indices, tmesh._vertices.size());
+		tmesh.build_lods();
+		tmesh.compute_bounds();
+		meshcook::writeCache(tmesh, meshFilePath);
+	}
+	std::cout << meshFilePath << ": " << (tmesh._lods.empty() ? tmesh._indices.size() : tmesh._lods[0].indexCount) / 3 << " triangles, "
+		<< (cached ? "read from cache" : "cooked") << " in "
+		<< std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - tstart).count() << "ms";
+	if (!cached) std::cout << ", ACMR " << acmr_loaded << " -> " << acmr_optimized;
+	for (size_t l = 1; l < tmesh._lods.size(); l++) {
+		std::cout << (l == 1 ? ", LODs " : " / ") << tmesh._lods[l].indexCount / 3 << " (error " << tmesh._lods[l].error << ")";
+	}
+	std::cout << "\n";
+	uploadPooledMesh(tmesh);
 	meshes[meshFilePath] = tmesh;
 	return &meshes[meshFilePath];
 }
 
-void PrismRenderer::refreshMeshVB(std::string id, int fno)
+void PrismRenderer::printMemoryStats(std::string label)
+{
+	vkutils::getAllocator(device, physicalDevice)->printStats(label);
+	size_t vertex_count = 0;
+	for (auto& it : meshes) vertex_count += it.second._vertices.size();
+	for (auto& it : maintained_meshes) vertex_count += it.second->_vertices.size() * MAX_FRAMES_IN_FLIGHT;
+	std::cout << label << ": " << vertex_count << " vertices, " << float(vertex_count * sizeof(glm::vec3)) / (1024 * 1024) << "MB positions + "
+		<< float(vertex_count * sizeof(PackedVertex)) / (1024 * 1024) << "MB packed attributes ("
+		<< float(vertex_count * (sizeof(glm::vec3) + sizeof(PackedVertex))) / (1024 * 1024) << "MB, was "
+		<< float(vertex_count * 68) / (1024 * 1024) << "MB with the old 68 byte vertex)\n";
+}
+
+void PrismRenderer::refreshMeshVB(std::string id)
 {
 	auto meshit = maintained_meshes.find(id);
 	if (meshit != maintained_meshes.end()) {
 		MaintainedMesh* tmesh = meshit->second;
-		void* tmesh_vbt;
-		vkMapMemory(device, tmesh->_vertexBuffer[fno]._bufferMemory, 0, sizeof(Vertex) * tmesh->_vertices.size(), 0, &tmesh_vbt);
-		memcpy(tmesh_vbt, tmesh->_vertices.data(), sizeof(Vertex) * tmesh->_vertices.size());
-		vkUnmapMemory(device, tmesh->_vertexBuffer[fno]._bufferMemory);
+		// currentFrame's fence was waited on, its copy isn't read by the gpu anymore
+		std::pair<uint32_t, uint32_t>& dirty = tmesh->_dirty[currentFrame];
+		if (dirty.first == dirty.second) return;
+		writeDynamicVertices(tmesh, currentFrame, dirty.first, dirty.second);
+		dirty = { 0, 0 };
+	}
+}
 
-		void* tmesh_ibt;
-		vkMapMemory(device, tmesh->_indexBuffer[fno]._bufferMemory, 0, sizeof(uint32_t) * tmesh->_indices.size(), 0, &tmesh_ibt);
-		memcpy(tmesh_ibt, tmesh->_indices.data(), sizeof(uint32_t) * tmesh->_indices.size());
-		vkUnmapMemory(device, tmesh->_indexBuffer[fno]._bufferMemory);
+int PrismRenderer::addParticleType(
+	std::string id,
+	std::string meshFilePath,
+	std::string texFilePath,
+	std::string nMapFilePath,
+	std::string esMapFilePath,
+	std::string texSamplerType
+) {
+	spawn_mut.lock();
+	if (particleTypes.size() == MAX_PARTICLE_TYPES) {
+		spawn_mut.unlock();
+		throw std::runtime_error("too many particle types!");
 	}
+	GPUParticleType ptype;
+	ptype.id = id;
+	auto meshit = meshes.find(meshFilePath);
+	if (meshit == meshes.end()) ptype.mesh = addMesh(meshFilePath);
+	else ptype.mesh = &(*meshit).second;
+	ptype.texmaps = loadObjTextures(texFilePath, nMapFilePath, esMapFilePath, texSamplerType);
+
+	// host visible and mapped for good, a copy per frame in flight
+	const uint32_t initial_capacity = 1024;
+	for (size_t fno = 0; fno < MAX_FRAMES_IN_FLIGHT; fno++) {
+		ptype.instanceBuffers.push_back(vkutils::createBuffer(
+			device,
+			physicalDevice,
+			sizeof(GPUParticleInstance) * initial_capacity,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		));
+	}
+	ptype.capacities.assign(MAX_FRAMES_IN_FLIGHT, initial_capacity);
+	ptype.counts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+	particleTypes.push_back(ptype);
+	for (GPUFrameData& fdata : frameDatas) fdata.particlesDirty = true;
+	spawn_mut.unlock();
+	return int(particleTypes.size() - 1);
 }
 
-GPUImage PrismRenderer::loadSingleTexture(std::string texPath, VkFormat imgFormat)
+GPUParticleInstance* PrismRenderer::mapParticleInstances(size_t type, uint32_t count)
 {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(texPath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
+	spawn_mut.lock();
+	GPUParticleType& ptype = particleTypes[type];
+	// currentFrame's fence was waited on, its buffer isn't read by the gpu anymore and can be replaced
+	if (count > ptype.capacities[currentFrame]) {
+		uint32_t capacity = std::max(count, ptype.capacities[currentFrame] + ptype.capacities[currentFrame] / 2);
+		vkutils::destroyBuffer(device, ptype.instanceBuffers[currentFrame]);
+		ptype.instanceBuffers[currentFrame] = vkutils::createBuffer(
+			device,
+			physicalDevice,
+			sizeof(GPUParticleInstance) * VkDeviceSize(capacity),
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+		);
+		ptype.capacities[currentFrame] = capacity;
+		frameDatas[currentFrame].particlesDirty = true;
+	}
+	ptype.counts[currentFrame] = count;
+	GPUParticleInstance* instances = (GPUParticleInstance*)ptype.instanceBuffers[currentFrame]._mapped;
+	spawn_mut.unlock();
+	return instances;
+}
 
-	if (!pixels) throw std::runtime_error("failed to load texture image!");
+void PrismRenderer::setClusteredLights(const std::vector<GPULight>& lights)
+{
+	clusteredLights = lights;
+	if (clusteredLights.size() > MAX_CLUSTERED_LIGHTS) {
+		std::cout << "renderer: " << clusteredLights.size() << " lights without shadows, only the first " << MAX_CLUSTERED_LIGHTS << " are drawn\n";
+		clusteredLights.resize(MAX_CLUSTERED_LIGHTS);
+	}
+	clusteredLightsVersion++;
+}
 
+GPUImage PrismRenderer::loadSingleTexture(CookedTexture* ctex, uint64_t& ticket)
+{
+	VkFormat imgFormat = ctex->srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
 	GPUImage tmp_gimg;
 	tmp_gimg = vkutils::createGPUImage(
 		device,
 		physicalDevice,
-		texWidth, texHeight,
+		ctex->width, ctex->height,
 		imgFormat,
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		VK_IMAGE_VIEW_TYPE_2D,
-		VK_IMAGE_ASPECT_COLOR_BIT
-	);
-	vkutils::transitionImageLayout(
-		device,
-		uploadCmdPool,
-		transferQueue,
-		tmp_gimg._image,
-		imgFormat,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT
-	);
-	vkutils::copyDataToImage(
-		device,
-		physicalDevice,
-		uploadCmdPool,
-		transferQueue,
-		imageSize,
-		pixels,
-		tmp_gimg,
-		{ 0, 0, 0 },
-		{ (uint32_t)texWidth, (uint32_t)texHeight, 1 }
-	);
-	stbi_image_free(pixels);
-	vkutils::transitionImageLayout(
-		device,
-		frameDatas[currentFrame % MAX_FRAMES_IN_FLIGHT].commandPool,
-		graphicsQueue,
-		tmp_gimg._image,
-		imgFormat,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		ctex->mipLevels
 	);
+	// the mip chain is copied into the staging ring here, the image is in SHADER_READ_ONLY_OPTIMAL once the ticket is acquired
+	ticket = uploader->uploadToImage(tmp_gimg, imgFormat, { ctex->width, ctex->height, 1 }, ctex->mipLevels, ctex->pixels.size(), ctex->pixels.data());
 	return tmp_gimg;
 }
 
+void PrismRenderer::finishTextureLoads()
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < pendingTextures.size(); i++) {
+		std::vector<CookedTexture*>& ctexs = pendingTextures[i].second;
+		bool cooked = true;
+		for (CookedTexture* ctex : ctexs) cooked = cooked && ctex->done;
+		if (!cooked) {
+			pendingTextures[kept++] = pendingTextures[i];
+			continue;
+		}
+
+		GPUTextureSet* gts = pendingTextures[i].first;
+		uint64_t ticket = 0;
+		for (CookedTexture* ctex : ctexs) {
+			if (ctex->failed) throw std::runtime_error("failed to load texture image " + ctex->path + "!");
+			// tickets only grow, the last one covers all three
+			gts->_gImages.push_back(loadSingleTexture(ctex, ticket));
+			stats_tex_loaded++;
+			if (ctex->from_cache) stats_tex_cached++;
+			stats_tex_cook_ms += ctex->cook_ms;
+			delete ctex;
+		}
+		gts->_dSet = vkutils::createImageDSet(
+			device,
+			descriptorPool,
+			dSetLayouts["frag_sampler_3"],
+			gts->_gImages,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			texSamplers["linear"]
+		);
+		gts->_uploadTicket = ticket;
+	}
+	bool drained = kept == 0 && pendingTextures.size() > 0;
+	pendingTextures.resize(kept);
+
+	if (drained) {
+		std::chrono::steady_clock::time_point tnow = std::chrono::steady_clock::now();
+		std::cout << "textures: " << stats_tex_loaded << " loaded in "
+			<< std::chrono::duration<float, std::chrono::milliseconds::period>(tnow - textureLoadStart).count() << "ms ("
+			<< stats_tex_cached << " from cache), cook avg " << stats_tex_cook_ms / stats_tex_loaded << "ms on "
+			<< TEXTURE_THREADS << " workers\n";
+		stats_tex_loaded = 0;
+		stats_tex_cached = 0;
+		stats_tex_cook_ms = 0;
+	}
+}
+
 GPUTextureSet* PrismRenderer::loadObjTextures(
 	std::string colorTexPath,
 	std::string normalTexPath,
 	std::string esTexPath,
 	std::string texSamplerType
 ) {
-	auto texit = textures.find(colorTexPath + "_" + normalTexPath + "_" + esTexPath);
+	std::string texKey = colorTexPath + "_" + normalTexPath + "_" + esTexPath;
+	auto texit = textures.find(texKey);
 	if (texit == textures.end()) {
-		GPUTextureSet gts;
-		gts._gImages.push_back(loadSingleTexture(colorTexPath));
-		gts._gImages.push_back(loadSingleTexture(normalTexPath, VK_FORMAT_R8G8B8A8_UNORM));
-		gts._gImages.push_back(loadSingleTexture(esTexPath, VK_FORMAT_R8G8B8A8_UNORM));
-		gts._dSet = vkutils::createImageDSet(
-			device,
-			descriptorPool,
-			dSetLayouts["frag_sampler_3"],
-			gts._gImages,
-			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			texSamplers["linear"]
-		);
+		// objects using the set stay hidden until finishTextureLoads gives it a real ticket
+		GPUTextureSet& gts = textures[texKey];
+		gts._uploadTicket = UINT64_MAX;
+
+		std::vector<CookedTexture*> ctexs;
+		for (std::string texPath : { colorTexPath, normalTexPath, esTexPath }) {
+			CookedTexture* ctex = new CookedTexture();
+			ctex->path = texPath;
+			ctexs.push_back(ctex);
+		}
+		ctexs[0]->srgb = true;
+		for (CookedTexture* ctex : ctexs) texture_tpool->add_task(&texcook::cook, ctex);
 
-		textures[colorTexPath + "_" + normalTexPath + "_" + esTexPath] = gts;
+		if (pendingTextures.size() == 0) textureLoadStart = std::chrono::steady_clock::now();
+		pendingTextures.push_back({ &gts, ctexs });
+		return &gts;
 	}
-	return &textures[colorTexPath + "_" + normalTexPath + "_" + esTexPath];
+	return &texit->second;
 }
 
 void PrismRenderer::addRenderObj(
@@ -2321,6 +3029,8 @@ void PrismRenderer::addRenderObj(
 	robj.texmaps = loadObjTextures(texFilePath, nMapFilePath, esMapFilePath, texSamplerType);
 
 	renderObjects.push_back(robj);
+	// appended objects only add draws, shadow passes stay as they are if it doesn't cast shadows
+	markObjectPassesDirty(robj.shadowcasting);
 
 	spawn_mut.unlock();
 }
@@ -2345,22 +3055,8 @@ void PrismRenderer::addRenderObj(
 
 	auto meshit = meshes.find(id);
 	if (meshit == meshes.end()) {
-		meshData._vertexBuffer = vkutils::createBuffer(
-			device, physicalDevice,
-			sizeof(Vertex) * meshData._vertices.size(), meshData._vertices.data(),
-			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			uploadCmdPool,
-			transferQueue
-		);
-		meshData._indexBuffer = vkutils::createBuffer(
-			device, physicalDevice,
-			sizeof(uint32_t) * meshData._indices.size(), meshData._indices.data(),
-			VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			uploadCmdPool,
-			transferQueue
-		);
+		meshData.compute_bounds();
+		uploadPooledMesh(meshData);
 		meshes[id] = meshData;
 		meshit = meshes.find(id);
 	}
@@ -2369,6 +3065,8 @@ void PrismRenderer::addRenderObj(
 	robj.texmaps = loadObjTextures(texFilePath, nMapFilePath, esMapFilePath, texSamplerType);
 
 	renderObjects.push_back(robj);
+	// appended objects only add draws, shadow passes stay as they are if it doesn't cast shadows
+	markObjectPassesDirty(robj.shadowcasting);
 
 	spawn_mut.unlock();
 }
@@ -2394,24 +3092,22 @@ void PrismRenderer::addMaintainedRenderObj(
 
 	auto meshit = maintained_meshes.find(id);
 	if (meshit == maintained_meshes.end()) {
-		for (int i = 0; i < 3; i++) {
-			meshData->_vertexBuffer[i] = vkutils::createBuffer(
-				device, physicalDevice,
-				sizeof(Vertex) * meshData->_vertices.size(), meshData->_vertices.data(),
-				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-				uploadCmdPool,
-				transferQueue
-			);
-			meshData->_indexBuffer[i] = vkutils::createBuffer(
-				device, physicalDevice,
-				sizeof(uint32_t) * meshData->_indices.size(), meshData->_indices.data(),
-				VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-				uploadCmdPool,
-				transferQueue
-			);
+		// vertex and index counts are fixed from here on, only the vertex data changes
+		uint32_t vcount = uint32_t(meshData->_vertices.size());
+		uint32_t icount = uint32_t(meshData->_indices.size());
+		uint32_t voffset = alloc_range(dynamicPool._freeVertices, vcount);
+		uint32_t ioffset = (voffset == UINT32_MAX) ? UINT32_MAX : alloc_range(dynamicPool._freeIndices, icount);
+		if (ioffset == UINT32_MAX) {
+			if (voffset != UINT32_MAX) free_range(dynamicPool._freeVertices, voffset, vcount);
+			spawn_mut.unlock();
+			throw std::runtime_error("dynamic mesh pool is full, can't add maintained mesh " + id + "!");
 		}
+		meshData->_vertexOffset = int32_t(voffset);
+		meshData->_firstIndex = ioffset;
+		memcpy((uint32_t*)dynamicPool._indexBuffer._mapped + ioffset, meshData->_indices.data(), sizeof(uint32_t) * icount);
+		vkutils::flushBuffer(device, dynamicPool._indexBuffer, sizeof(uint32_t) * VkDeviceSize(ioffset), sizeof(uint32_t) * icount);
+		for (size_t fno = 0; fno < MAX_FRAMES_IN_FLIGHT; fno++) writeDynamicVertices(meshData, fno, 0, vcount);
+		meshData->_dirty.assign(MAX_FRAMES_IN_FLIGHT, { 0, 0 });
 		maintained_meshes[id] = meshData;
 		meshit = maintained_meshes.find(id);
 	}
@@ -2420,6 +3116,8 @@ void PrismRenderer::addMaintainedRenderObj(
 	robj.texmaps = loadObjTextures(texFilePath, nMapFilePath, esMapFilePath, texSamplerType);
 
 	renderObjects.push_back(robj);
+	// appended objects only add draws, shadow passes stay as they are if it doesn't cast shadows
+	markObjectPassesDirty(robj.shadowcasting);
 
 	spawn_mut.unlock();
 }
@@ -2429,7 +3127,9 @@ void PrismRenderer::removeRenderObj(std::string id)
 	spawn_mut.lock();
 	for (auto it = renderObjects.begin(); it != renderObjects.end(); it++) {
 		if (it->id == id) {
+			// later objects move down an index, every pass instances over their old ones
 			renderObjects.erase(it);
+			markObjectPassesDirty(true);
 			break;
 		}
 	}
@@ -2440,6 +3140,16 @@ void PrismRenderer::removeRenderObj(size_t idx)
 {
 	spawn_mut.lock();
 	renderObjects.erase(renderObjects.begin() + idx);
+	markObjectPassesDirty(true);
+	spawn_mut.unlock();
+}
+
+void PrismRenderer::setRenderObjVisible(size_t idx, bool renderable)
+{
+	if (renderObjects[idx].renderable == renderable) return;
+	spawn_mut.lock();
+	renderObjects[idx].renderable = renderable;
+	markObjectPassesDirty(renderObjects[idx].shadowcasting);
 	spawn_mut.unlock();
 }
 
@@ -2448,7 +3158,9 @@ void PrismRenderer::hideRenderObj(std::string id)
 	spawn_mut.lock();
 	for (auto it = renderObjects.begin(); it != renderObjects.end(); it++) {
 		if (it->id == id) {
+			// later objects move down an index, every pass instances over their old ones
 			renderObjects.erase(it);
+			markObjectPassesDirty(true);
 			break;
 		}
 	}
@@ -2460,16 +3172,39 @@ void PrismRenderer::removeMaintainedRenderObj(std::string id)
 	spawn_mut.lock();
 	for (auto it = renderObjects.begin(); it != renderObjects.end(); it++) {
 		if (it->id == id) {
+			// later objects move down an index, every pass instances over their old ones
 			renderObjects.erase(it);
+			markObjectPassesDirty(true);
 			break;
 		}
 	}
 	spawn_mut.unlock();
 }
 
+void PrismRenderer::unloadRenderObj(std::string id)
+{
+	spawn_mut.lock();
+	for (auto it = renderObjects.begin(); it != renderObjects.end(); it++) {
+		if (it->id == id) {
+			// later objects move down an index, every pass instances over their old ones
+			renderObjects.erase(it);
+			markObjectPassesDirty(true);
+			break;
+		}
+	}
+	auto meshit = meshes.find(id);
+	if (meshit != meshes.end()) {
+		retired_meshes.push_back(std::make_pair(meshit->second, frameCount));
+		meshes.erase(meshit);
+	}
+	spawn_mut.unlock();
+}
+
 void PrismRenderer::cleanupSwapChain(bool destroy_only_swapchain)
 {
 	vkutils::destroyGPUImage(device, depthImage);
+	// the atlas outlives the swapchain, its framebuffer is recreated along with the others
+	vkDestroyFramebuffer(device, shadowAtlasFrameBuffer, NULL);
 	if (destroy_only_swapchain)
 		for (GPUFrameData fdata : frameDatas) {
 			//vkutils::destroyGPUImage(device, fdata.swapChainImage);
@@ -2480,26 +3215,19 @@ void PrismRenderer::cleanupSwapChain(bool destroy_only_swapchain)
 		for (GPUFrameData fdata : frameDatas) {
 			//vkutils::destroyGPUImage(device, fdata.swapChainImage, true);
 			vkDestroyImageView(device, fdata.swapChainImage._imageView, NULL);
-			vkutils::destroyGPUImage(device, fdata.pShadowMapTemp);
-			vkutils::destroyGPUImage(device, fdata.dShadowMapTemp);
-			vkutils::destroyGPUImage(device, fdata.pShadowDepthImage);
-			vkutils::destroyGPUImage(device, fdata.dShadowDepthImage);
 			vkutils::destroyGPUImage(device, fdata.colorImage);
 			vkutils::destroyGPUImage(device, fdata.positionImage);
 			vkutils::destroyGPUImage(device, fdata.normalImage);
 			vkutils::destroyGPUImage(device, fdata.seImage);
-			for (GPUImage t : fdata.shadow_cube_maps) vkutils::destroyGPUImage(device, t);
-			for (GPUImage t : fdata.shadow_dir_maps) vkutils::destroyGPUImage(device, t);
-			fdata.shadow_cube_maps.clear();
-			fdata.shadow_dir_maps.clear();
 			vkDestroyFramebuffer(device, fdata.swapChainFrameBuffer, NULL);
-			vkDestroyFramebuffer(device, fdata.pShadowFrameBuffer, NULL);
-			vkDestroyFramebuffer(device, fdata.dShadowFrameBuffer, NULL);
 			vkFreeCommandBuffers(device, fdata.commandPool, 1, &fdata.commandBuffer);
 			vkDestroySemaphore(device, fdata.renderSemaphore, NULL);
 			vkDestroySemaphore(device, fdata.presentSemaphore, NULL);
 			vkDestroyFence(device, fdata.renderFence, NULL);
 			vkDestroyCommandPool(device, fdata.commandPool, NULL);
+			for (VkCommandPool wpool : fdata.workerCmdPools) vkDestroyCommandPool(device, wpool, NULL);
+			vkutils::destroyBuffer(device, fdata.indirectBuffer);
+			vkutils::destroyBuffer(device, fdata.instanceBuffer);
 			for (auto t : fdata.setBuffers) vkutils::destroySetBuffer(device, descriptorPool, t.second);
 			fdata.setBuffers.clear();
 		}
@@ -2508,7 +3236,17 @@ void PrismRenderer::cleanupSwapChain(bool destroy_only_swapchain)
 
 void PrismRenderer::cleanup()
 {
+	delete lightClusterer;
+	delete renderer_tpool;
+	delete texture_tpool;
+	for (auto& pending : pendingTextures) {
+		for (CookedTexture* ctex : pending.second) delete ctex;
+	}
+	pendingTextures.clear();
 	cleanupSwapChain(false);
+	vkutils::destroyGPUImage(device, shadowAtlasImage);
+	vkutils::destroyGPUImage(device, shadowAtlasDepth);
+	delete shadowAtlas;
 
 	for (auto it : dSetLayouts) vkDestroyDescriptorSetLayout(device, it.second, NULL);
 	dSetLayouts.clear();
@@ -2526,22 +3264,28 @@ void PrismRenderer::cleanup()
 		vkDestroyPipelineLayout(device, it.second._pipelineLayout, NULL);
 	}
 	pipelines.clear();
-	for (auto it : meshes) {
-		vkutils::destroyBuffer(device, it.second._vertexBuffer);
-		vkutils::destroyBuffer(device, it.second._indexBuffer);
-	}
 	meshes.clear();
-	for (auto it : maintained_meshes) {
-		for (int i = 0; i < 3; i++) {
-			vkutils::destroyBuffer(device, it.second->_vertexBuffer[i]);
-			vkutils::destroyBuffer(device, it.second->_indexBuffer[i]);
-		}
-	}
+	freeRetiredMeshes(true);
+	for (GPUMeshPool& pool : meshPools) {
+		vkutils::destroyBuffer(device, pool._vertexBuffer);
+		vkutils::destroyBuffer(device, pool._attribBuffer);
+		vkutils::destroyBuffer(device, pool._indexBuffer);
+	}
+	meshPools.clear();
+	for (GPUParticleType& ptype : particleTypes) {
+		for (GPUBuffer& buffer : ptype.instanceBuffers) vkutils::destroyBuffer(device, buffer);
+	}
+	particleTypes.clear();
+	vkutils::destroyBuffer(device, dynamicPool._vertexBuffer);
+	vkutils::destroyBuffer(device, dynamicPool._attribBuffer);
+	vkutils::destroyBuffer(device, dynamicPool._indexBuffer);
 	maintained_meshes.clear();
 	vkDestroyCommandPool(device, uploadCmdPool, NULL);
 	vkDestroyRenderPass(device, shadowRenderPass, NULL);
 	vkDestroyRenderPass(device, ambientRenderPass, NULL);
 	vkDestroyRenderPass(device, finalRenderPass , NULL);
+	delete uploader;
+	vkutils::destroyAllocator();
 	vkDestroyDevice(device, NULL);
 	if (enableValidationLayers) vkutils::DestroyDebugUtilsMessengerEXT(instance, debugMessenger, NULL);
 	vkDestroySurfaceKHR(instance, surface, NULL);
@@ -2566,7 +3310,13 @@ PrismRenderer::PrismRenderer(GLFWwindow* glfwWindow, void (*nextFrameCallback) (
 	"VK_EXT_shader_viewport_index_layer"
 	};
 
-	//renderer_tpool = new SimpleThreadPooler(RENDERER_THREADS);
+	// started before initVulkan, createFinalCmdBuffers already records on the workers
+	renderer_tpool = new SimpleThreadPooler(RENDERER_THREADS);
+	renderer_tpool->run();
+	lightClusterer = new LightClusterer(renderer_tpool, RENDERER_THREADS);
+	lightClusterer->max_indices = MAX_CLUSTER_INDICES;
+	texture_tpool = new SimpleThreadPooler(TEXTURE_THREADS);
+	texture_tpool->run();
 
 	initVulkan();
 }
@@ -1,7 +1,14 @@
 #pragma once
 
 #include "vkutils.h"
+#include "GPUUploader.h"
+#include "TextureCooker.h"
+#include "MeshCooker.h"
+#include "MeshProcessing.h"
 #include "SimpleThreadPooler.h"
+#include "LightClusters.h"
+#include "ShadowAtlas.h"
+#include "DrawRecorder.h"
 
 #include <mutex>
 #include <vector>
@@ -9,15 +16,23 @@
 class PrismRenderer
 {
 public:
-	const size_t MAX_OBJECTS = 1000;
-	const size_t MAX_NS_LIGHTS = 30;
+	const size_t MAX_OBJECTS = 10000;
 	const size_t MAX_POINT_LIGHTS = 8;
 	const size_t MAX_DIRECTIONAL_LIGHTS = 8;
+	// lights without shadows live in their own storage buffer and are binned into view clusters every frame
+	const size_t MAX_CLUSTERED_LIGHTS = 8192;
+	const size_t MAX_CLUSTER_INDICES = 1 << 20;
+	const size_t MAX_PARTICLE_TYPES = 16;
 
 	bool framebufferResized = false;
 	VkExtent2D swapChainExtent = { 1280, 720 };
+	// the largest tiles a cube face and a directional map get in the shadow atlas. Lights get smaller tiles as
+	// they cover less of the screen, and all of them shrink when the atlas budget is exceeded
 	VkExtent2D plight_smap_extent = { 1024, 1024 };
 	VkExtent2D dlight_smap_extent = { 1 << 11, 1 << 11};
+	uint32_t shadow_atlas_size = 1 << 12;
+	uint32_t shadow_min_tile = 64;
+	float shadow_atlas_budget = 1.0f;
 
 	GPUSceneData currentScene;
 	GPUCameraData currentCamera;
@@ -31,6 +46,22 @@ public:
 	std::mutex spawn_mut;
 
 	bool refresh_cmd_buffers = false;
+	// passes whose secondaries were re-recorded by the last frame, 0 when its command buffers were reused
+	uint32_t rerecordedPasses = 0;
+	// shadow passes (directional maps and cube faces) rendered by the last frame, the rest reused their cached map
+	uint32_t shadowPassesRendered = 0;
+	uint32_t shadowPassesEnabled = 0;
+	bool frustum_culling = true;
+	// draw runs of pooled meshes with vkCmdDrawIndexedIndirect, needs drawIndirectFirstInstance. Objects sharing a
+	// mesh and LOD are instanced either way
+	bool indirect_drawing = true;
+	// meshes with LODs are drawn at the coarsest one whose error covers at most lod_pixel_error pixels of the pass.
+	// Shadow passes allow shadow_lod_bias times that, their maps are filtered and mostly seen from afar
+	bool mesh_lods = true;
+	float lod_pixel_error = 1.0f;
+	float shadow_lod_bias = 4.0f;
+	bool print_record_stats = false;
+	int STATS_INTERVAL_FRAMES = 1000;
 
 	PrismRenderer(GLFWwindow* glfwWindow, void(*nextFrameCallback)(float framedeltat, PrismRenderer* renderer, uint32_t frameNo));
 	void (*uboUpdateCallback) (float framedeltat, PrismRenderer* renderer, uint32_t frameNo);
@@ -68,12 +99,33 @@ public:
 		bool include_in_final_render = true,
 		bool include_in_shadow_map = true
 	);
-	void refreshMeshVB(std::string id, int fno);
+	// writes the vertices marked dirty since the frame being built last drew the mesh to that frame's copy.
+	// Call it every frame while the mesh changes, the other copies catch up as their frames come around
+	void refreshMeshVB(std::string id);
+	// particle types are drawn with one instanced draw each and don't take object slots. Returns the type index
+	int addParticleType(
+		std::string id,
+		std::string meshFilePath,
+		std::string texFilePath,
+		std::string nMapFilePath,
+		std::string esMapFilePath,
+		std::string texSamplerType
+	);
+	// the frame being built's instance buffer for the type, grown to hold count instances. Write all of them
+	// every frame, the other frames' buffers are untouched
+	GPUParticleInstance* mapParticleInstances(size_t type, uint32_t count);
+	// replaces the lights without shadows, each frame's buffer is refreshed when its frame comes around
+	void setClusteredLights(const std::vector<GPULight>& lights);
+	void printMemoryStats(std::string label);
 	void removeRenderObj(std::string id);
 	void removeRenderObj(size_t idx);
 	void hideRenderObj(std::string id);
+	void setRenderObjVisible(size_t idx, bool renderable);
 	void removeMaintainedRenderObj(std::string id);
+	void unloadRenderObj(std::string id);
 	void genFinalCmdBuffers(size_t frameNo);
+	void recordSecondaryCmds(size_t frameNo, uint32_t worker);
+	void cullViewRange(uint32_t worker);
 private:
 #ifdef NDEBUG
 	const bool enableValidationLayers = false;
@@ -101,6 +153,7 @@ private:
 	std::unordered_map<std::string, VkDescriptorSetLayout> dSetLayouts;
 	std::unordered_map<std::string, GPUPipeline> pipelines;
 	std::unordered_map<std::string, Mesh> meshes;
+	std::vector<std::pair<Mesh, size_t>> retired_meshes;
 	std::unordered_map<std::string, MaintainedMesh*> maintained_meshes;
 	std::unordered_map<std::string, GPUTextureSet> textures;
 	std::unordered_map<std::string, VkSampler> texSamplers;
@@ -109,6 +162,7 @@ private:
 
 	std::vector<GPUFrameData> frameDatas;
 	size_t currentFrame = 0;
+	size_t frameCount = 0;
 	bool time_refresh = true;
 	std::chrono::steady_clock::time_point startTime;
 	std::chrono::steady_clock::time_point lastFrameTime;
@@ -117,19 +171,105 @@ private:
 	GPUImage depthImage;
 
 	VkCommandPool uploadCmdPool;
+	// mesh and texture uploads go out in one batch per frame, objects are drawn once acquiredTicket reached their batch
+	GPUUploader* uploader = NULL;
+	uint64_t acquiredTicket = 0;
 	std::vector<VkFence> imagesInFlight;
 
 	uint32_t RENDERER_THREADS = 3;
 	SimpleThreadPooler* renderer_tpool;
+	std::vector<GPULight> clusteredLights;
+	// every shadow pass renders into its tile of one atlas shared by the frames in flight. A tile is only rendered
+	// again when its signature (what it shows and where it is) changed since it was last rendered
+	ShadowAtlas* shadowAtlas = NULL;
+	GPUImage shadowAtlasImage;
+	GPUImage shadowAtlasDepth;
+	VkFramebuffer shadowAtlasFrameBuffer;
+	VkDescriptorSet shadowAtlasDset;
+	std::vector<uint64_t> atlasSignatures;
+	// per shadow pass slot, its tile's offset and size in atlas uv, zero for slots without a tile
+	std::vector<glm::vec4> atlasRects;
+	uint64_t clusteredLightsVersion = 0;
+	LightClusterer* lightClusterer = NULL;
 	std::mutex cpool_mtx;
 
+	// texture files are decoded and mipmapped (or read back from the cache) on these workers. A set's images
+	// are created and uploaded by finishTextureLoads once all three of its maps are cooked
+	uint32_t TEXTURE_THREADS = 2;
+	SimpleThreadPooler* texture_tpool;
+	std::vector<std::pair<GPUTextureSet*, std::vector<CookedTexture*>>> pendingTextures;
+	std::chrono::steady_clock::time_point textureLoadStart;
+	size_t stats_tex_loaded = 0;
+	size_t stats_tex_cached = 0;
+	float stats_tex_cook_ms = 0;
+
+	// objects per secondary command buffer, a pass is split into this many draws per worker job
+	size_t SECONDARY_CMD_OBJECTS = 256;
+	std::vector<SecondaryCmdJob> secondaryJobs;
+
+	// culled draw lists of the current frame per pass slot, the frames in flight keep the ones they recorded
+	std::vector<CullView> cullViews;
+	std::vector<std::vector<uint32_t>> passDrawLists;
+	std::vector<uint64_t> passSignatures;
+	std::vector<float> cullCX, cullCY, cullCZ, cullR;
+	std::vector<std::vector<uint8_t>> cullMasks;
+	// what recording needs of each object, indexed like renderObjects and rebuilt when the objects change.
+	// drawOrder sorts them so draws sharing a mesh pool, texture set and mesh are adjacent in every draw list
+	std::vector<RenderListItem> renderList;
+	std::vector<uint32_t> drawOrder;
+	bool renderListDirty = true;
+
+	// static meshes are sub-allocated from these, a mesh bigger than the pool size gets a pool of its own
+	const uint32_t MESH_POOL_VERTICES = 1 << 18;
+	const uint32_t MESH_POOL_INDICES = 1 << 20;
+	std::vector<GPUMeshPool> meshPools;
+	// maintained meshes live here, host visible with a vertex copy per frame in flight
+	const uint32_t DYNAMIC_POOL_VERTICES = 1 << 16;
+	const uint32_t DYNAMIC_POOL_INDICES = 1 << 18;
+	GPUMeshPool dynamicPool;
+	// picked at init, see makeDynamicMeshPool
+	bool dynamic_pool_device_local = false;
+	std::vector<GPUParticleType> particleTypes;
+	bool supports_indirect_first_instance = false;
+	bool supports_multi_draw_indirect = false;
+	// objects and draw calls recorded per worker, for the stats
+	std::vector<size_t> workerDraws, workerDrawCalls, workerShadowFetchBytes;
+
+	int stats_frames = 0;
+	size_t stats_rerecorded_passes = 0;
+	size_t stats_shadow_rendered = 0;
+	size_t stats_shadow_enabled = 0;
+	float stats_cull_ms = 0;
+	size_t stats_cull_tests = 0;
+	size_t stats_cull_draws = 0;
+	float stats_secondary_ms = 0;
+	float stats_primary_ms = 0;
+	size_t stats_draws = 0;
+	float stats_ubo_ms = 0;
+	size_t stats_draw_calls = 0;
+	size_t stats_shadow_fetch_bytes = 0;
+	size_t stats_dynamic_bytes = 0;
+	size_t stats_particles = 0;
+	size_t stats_particle_draws = 0;
+	size_t stats_atlas_moved = 0;
+	size_t stats_atlas_repacks = 0;
+	size_t stats_atlas_texels = 0;
+	float stats_cluster_ms = 0;
+	size_t stats_cluster_indices = 0;
+	size_t stats_cluster_dropped = 0;
+	size_t stats_gbuffer_tris = 0;
+	size_t stats_shadow_tris = 0;
+	size_t stats_full_tris = 0;
+	size_t stats_lod_draws[MAX_MESH_LODS] = {};
+	float stats_worst_frame_ms = 0;
+	float stats_worst_callback_ms = 0;
+
 	void getVkInstance();
 	void createSurface();
 	void getVkLogicalDevice();
 	void createSwapChain(SwapChainSupportDetails swapChainSupport);
 	void makeBasicCmdPools();
-	void makeDLightMaps();
-	void makePLightMaps();
+	void makeShadowAtlas();
 	void createDepthImage();
 	void createShadowRenderPass();
 	void createGbufferRenderPass();
@@ -148,21 +288,39 @@ private:
 		VkExtent2D scissorExtent,
 		uint32_t VPWidth, uint32_t VPHeight,
 		bool invert_VP_Y = true,
-		std::vector<VkPushConstantRange> pushConstantRanges = {}
+		std::vector<VkPushConstantRange> pushConstantRanges = {},
+		bool position_only = false,
+		bool dynamic_viewport = false,
+		bool object_instances = false
 	);
 	void makeFinalPipeline();
 	void makeAmbientPipeline();
-	void makeGbufferPipeline();
-	void makeDLightShadowPipeline();
-	void makePLightShadowPipeline();
+	void makeGbufferPipeline(std::string name = "gbuffer", std::string vertShaderPath = "shaders/gbuffer.vert.spv", bool particle_instances = false);
+	void makeShadowPipeline();
 	void createFinalFrameBuffers();
 	void createAmbientFrameBuffers();
 	void createGbufferFrameBuffers();
 	void createShadowFrameBuffers();
 
 	void makeIndirectCmdBuffer();
+	void makeDynamicMeshPool();
+	void writeDynamicVertices(MaintainedMesh* mesh, size_t frameNo, uint32_t first, uint32_t end);
+	void uploadPooledMesh(Mesh& mesh);
+	void freePooledMesh(Mesh& mesh);
+	size_t plightPassSlot(size_t lidx, uint32_t face);
+	size_t gbufferPassSlot();
+	void updateShadowAtlas();
+	VkRect2D shadowTileArea(size_t passSlot);
+	void buildRenderList();
+	void cullObjects();
+	void markObjectPassesDirty(bool shadow_passes);
+	void queueSecondaryJobs(SecondaryCmdJob passJob, size_t frameNo);
+	void queueRecordJobs(size_t frameNo);
+	void executePassCmds(VkCommandBuffer cmdBuffer, size_t frameNo, size_t passSlot);
 	void addDLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo);
 	void addPLightCmds(VkCommandBuffer cmdBuffer, size_t frameNo);
+	void updateParticleCmds(size_t frameNo);
+	void recordParticleCmds(size_t frameNo);
 	void addGbufferCmds(VkCommandBuffer cmdBuffer, size_t frameNo);
 	void addAmbientCmds(VkCommandBuffer cmdBuffer, size_t frameNo);
 	void addFinalMeshCmds(VkCommandBuffer cmdBuffer, size_t frameNo);
@@ -172,13 +330,15 @@ private:
 
 	void initVulkan();
 	void recreateSwapChain();
-	void updateUBOs(uint32_t curr_img);
+	void updateUBOs(uint32_t frameNo);
+	void freeRetiredMeshes(bool force_all = false);
 	void drawFrame();
 	void mainLoop();
 
 	void createBasicSamplers();
 	Mesh* addMesh(std::string meshFilePath);
-	GPUImage loadSingleTexture(std::string texPath, VkFormat imgFormat=VK_FORMAT_R8G8B8A8_SRGB);
+	GPUImage loadSingleTexture(CookedTexture* ctex, uint64_t& ticket);
+	void finishTextureLoads();
 	GPUTextureSet* loadObjTextures(
 		std::string colorTexPath,
 		std::string normalTexPath,
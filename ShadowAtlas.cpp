@@ -0,0 +1,201 @@
+#include "ShadowAtlas.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+ShadowAtlas::ShadowAtlas(uint32_t size, uint32_t min_tile)
+{
+	atlasSize = size;
+	minTile = min_tile;
+	reset();
+}
+
+uint32_t ShadowAtlas::levelOf(uint32_t size) const
+{
+	uint32_t level = 0;
+	while ((atlasSize >> level) > size) level++;
+	return level;
+}
+
+void ShadowAtlas::reset()
+{
+	freeBlocks.assign(levelOf(minTile) + 1, {});
+	freeBlocks[0].push_back(glm::uvec2(0));
+}
+
+bool ShadowAtlas::allocate(uint32_t level, glm::uvec2& pos)
+{
+	// the smallest free block that holds the tile, split down to its size. The other quarters of every split
+	// go to the free lists
+	int from = int(level);
+	while (from >= 0 && freeBlocks[from].empty()) from--;
+	if (from < 0) return false;
+	pos = freeBlocks[from].back();
+	freeBlocks[from].pop_back();
+	for (uint32_t l = uint32_t(from) + 1; l <= level; l++) {
+		uint32_t edge = atlasSize >> l;
+		freeBlocks[l].push_back(pos + glm::uvec2(edge, edge));
+		freeBlocks[l].push_back(pos + glm::uvec2(0, edge));
+		freeBlocks[l].push_back(pos + glm::uvec2(edge, 0));
+	}
+	return true;
+}
+
+void ShadowAtlas::release(uint32_t level, glm::uvec2 pos)
+{
+	// merged with its three siblings for as long as they are all free
+	while (level > 0) {
+		uint32_t edge = atlasSize >> level;
+		glm::uvec2 parent = glm::uvec2(pos.x & ~(2 * edge - 1), pos.y & ~(2 * edge - 1));
+		std::vector<glm::uvec2>& blocks = freeBlocks[level];
+		size_t found = 0;
+		for (const glm::uvec2& b : blocks) {
+			if (b != pos && (b.x & ~(2 * edge - 1)) == parent.x && (b.y & ~(2 * edge - 1)) == parent.y) found++;
+		}
+		if (found < 3) break;
+		blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [&](const glm::uvec2& b) {
+			return (b.x & ~(2 * edge - 1)) == parent.x && (b.y & ~(2 * edge - 1)) == parent.y;
+		}), blocks.end());
+		pos = parent;
+		level--;
+	}
+	freeBlocks[level].push_back(pos);
+}
+
+bool ShadowAtlas::place(const ShadowTileRequest& request, const ShadowTile* previous)
+{
+	glm::uvec2 pos;
+	if (!allocate(levelOf(request.size), pos)) return false;
+	ShadowTile tile;
+	tile.x = pos.x;
+	tile.y = pos.y;
+	tile.size = request.size;
+	if (previous && previous->x == tile.x && previous->y == tile.y && previous->size == tile.size) {
+		tile.generation = previous->generation;
+	}
+	else {
+		tile.generation = nextGeneration++;
+		movedTiles++;
+	}
+	tiles[request.key] = tile;
+	return true;
+}
+
+void ShadowAtlas::update(const std::vector<ShadowTileRequest>& requests)
+{
+	std::vector<ShadowTileRequest> sized = requests;
+	size_t total = 0;
+	for (ShadowTileRequest& request : sized) {
+		uint32_t size = minTile;
+		while (size < atlasSize && size < request.size) size *= 2;
+		request.size = size;
+		total += size_t(size) * size;
+	}
+
+	// the tile with the most texels per importance gives half its edge back until everything fits
+	size_t budgetTexels = size_t(double(budget) * atlasSize * atlasSize);
+	while (total > budgetTexels) {
+		int shrink = -1;
+		float most = 0;
+		for (size_t i = 0; i < sized.size(); i++) {
+			if (sized[i].size <= minTile) continue;
+			float texels = float(sized[i].size) * sized[i].size / std::max(sized[i].importance, 1e-6f);
+			if (shrink < 0 || texels > most) {
+				shrink = int(i);
+				most = texels;
+			}
+		}
+		if (shrink < 0) break;
+		total -= size_t(sized[shrink].size) * sized[shrink].size * 3 / 4;
+		sized[shrink].size /= 2;
+	}
+
+	movedTiles = 0;
+	repacked = false;
+	unplacedTiles = 0;
+	std::unordered_map<uint32_t, uint32_t> wanted;
+	for (const ShadowTileRequest& request : sized) wanted[request.key] = request.size;
+	for (auto it = tiles.begin(); it != tiles.end();) {
+		auto w = wanted.find(it->first);
+		if (w == wanted.end() || w->second != it->second.size) {
+			release(levelOf(it->second.size), glm::uvec2(it->second.x, it->second.y));
+			it = tiles.erase(it);
+		}
+		else it++;
+	}
+
+	// largest first, ties by key so the same requests always pack the same way
+	std::sort(sized.begin(), sized.end(), [](const ShadowTileRequest& a, const ShadowTileRequest& b) {
+		return a.size != b.size ? a.size > b.size : a.key < b.key;
+	});
+	bool placed = true;
+	for (const ShadowTileRequest& request : sized) {
+		if (tiles.count(request.key)) continue;
+		if (!place(request, NULL)) {
+			placed = false;
+			break;
+		}
+	}
+	if (placed) return;
+
+	std::unordered_map<uint32_t, ShadowTile> previous;
+	previous.swap(tiles);
+	reset();
+	repacked = true;
+	movedTiles = 0;
+	for (const ShadowTileRequest& request : sized) {
+		auto it = previous.find(request.key);
+		if (!place(request, it == previous.end() ? NULL : &it->second)) unplacedTiles++;
+	}
+}
+
+const ShadowTile* ShadowAtlas::tile(uint32_t key) const
+{
+	auto it = tiles.find(key);
+	return it == tiles.end() ? NULL : &it->second;
+}
+
+size_t ShadowAtlas::usedTexels() const
+{
+	size_t texels = 0;
+	for (auto& it : tiles) texels += size_t(it.second.size) * it.second.size;
+	return texels;
+}
+
+uint32_t ShadowAtlas::pickSize(float desired, uint32_t current, uint32_t minTile, uint32_t maxTile)
+{
+	if (current > 0 && desired > current * 0.35f && desired <= current * 1.15f) return std::min(std::max(current, minTile), maxTile);
+	uint32_t size = minTile;
+	while (size < maxTile && float(size) < desired) size *= 2;
+	return size;
+}
+
+glm::mat4 cubeFaceViewProj(uint32_t face)
+{
+	// 90 degree proj mat, face tiles are square
+	glm::mat4 projMatrix = glm::perspective(glm::radians(90.0f), 1.0f, 0.01f, 1000.0f);
+	glm::mat4 viewMatrix = glm::mat4(1);
+
+	switch (face)
+	{
+	case 0: // POSITIVE_X
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		break;
+	case 1:	// NEGATIVE_X
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		break;
+	case 2:	// POSITIVE_Y
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		break;
+	case 3:	// NEGATIVE_Y
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+		break;
+	case 4:	// POSITIVE_Z
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		break;
+	case 5:	// NEGATIVE_Z
+		viewMatrix = glm::lookAt(glm::vec3(0), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		break;
+	}
+	return projMatrix * viewMatrix;
+}
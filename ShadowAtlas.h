@@ -0,0 +1,65 @@
+#pragma once
+
+#include "vkstructs.h"
+
+#include <vector>
+#include <unordered_map>
+
+// what a shadow pass would like from the atlas. size is the tile edge in texels, importance decides who
+// gives texels back first when the requests don't fit the budget
+struct ShadowTileRequest {
+	uint32_t key;
+	float importance;
+	uint32_t size;
+};
+
+// a square of the atlas. generation changes whenever the tile moves or is resized, what was rendered into
+// it before is gone then
+struct ShadowTile {
+	uint32_t x = 0, y = 0;
+	uint32_t size = 0;
+	uint64_t generation = 0;
+};
+
+// power of two tiles in a square atlas, placed by a quadtree buddy allocator. Tiles that keep their size keep
+// their place so their cached contents stay valid. When the free space is too fragmented for a new tile,
+// everything is repacked largest first, which always fits once the sizes are within the budget
+class ShadowAtlas
+{
+public:
+	uint32_t atlasSize;
+	uint32_t minTile;
+	// fraction of the atlas the tiles may cover
+	float budget = 1.0f;
+
+	std::unordered_map<uint32_t, ShadowTile> tiles;
+	// what the last update did: tiles given a new place, whether everything was repacked and requests left out
+	size_t movedTiles = 0;
+	bool repacked = false;
+	size_t unplacedTiles = 0;
+
+	ShadowAtlas(uint32_t size, uint32_t min_tile);
+	// shrinks the requests to the budget and places them, tiles of keys that aren't requested anymore are freed
+	void update(const std::vector<ShadowTileRequest>& requests);
+	const ShadowTile* tile(uint32_t key) const;
+	size_t usedTexels() const;
+
+	// tile edge for a pass that would like desired texels. Stays at current while the wish is near it, so tiles
+	// don't bounce between two sizes (and get rendered again) as the camera moves
+	static uint32_t pickSize(float desired, uint32_t current, uint32_t minTile, uint32_t maxTile);
+
+private:
+	uint64_t nextGeneration = 1;
+	// free blocks per level, level 0 is the whole atlas and every level halves the edge
+	std::vector<std::vector<glm::uvec2>> freeBlocks;
+
+	uint32_t levelOf(uint32_t size) const;
+	bool allocate(uint32_t level, glm::uvec2& pos);
+	void release(uint32_t level, glm::uvec2 pos);
+	void reset();
+	bool place(const ShadowTileRequest& request, const ShadowTile* previous);
+};
+
+// view and projection of a point light's face pass, relative to the light. finalimage.frag picks the face by the
+// major axis of the light to fragment direction and projects into the face's tile with the same axes
+glm::mat4 cubeFaceViewProj(uint32_t face);
@@ -4,8 +4,7 @@
 SimpleThreadPooler::SimpleThreadPooler(uint32_t max_threads)
 {
 	thread_limit = max_threads;
-	_wthreads.resize(thread_limit);
-	_thread_running.resize(thread_limit);
+	_wthreads.resize(thread_limit, NULL);
 	_rem_tasks.resize(MAX_TASKS);
 }
 
@@ -24,19 +23,19 @@ SimpleThreadPooler::~SimpleThreadPooler()
 
 void SimpleThreadPooler::do_work(size_t tid)
 {
-	while (!stop_work) {
-		at_lock.lock();
-		if (rti != rtj) {
-			std::function<void()> t = _rem_tasks[rti];
-			rti = (rti + 1) % MAX_TASKS;
-			_thread_running[tid] = true;
-			at_lock.unlock();
-			t();
-		}
-		else {
-			_thread_running[tid] = false;
-			at_lock.unlock();
-		}
+	std::unique_lock<std::mutex> lock(at_lock);
+	while (true) {
+		work_cv.wait(lock, [this] { return stop_work || rti != rtj; });
+		// stop() waits for the ring to drain first, so stopping never drops a task
+		if (rti == rtj) return;
+		std::function<void()> t = std::move(_rem_tasks[rti]);
+		rti = (rti + 1) % MAX_TASKS;
+		busy_threads++;
+		lock.unlock();
+		t();
+		lock.lock();
+		busy_threads--;
+		if (busy_threads == 0 && rti == rtj) done_cv.notify_all();
 	}
 }
 
@@ -51,11 +50,15 @@ void SimpleThreadPooler::run()
 void SimpleThreadPooler::stop()
 {
 	wait_till_done();
+	at_lock.lock();
 	stop_work = true;
+	at_lock.unlock();
+	work_cv.notify_all();
 	for (uint32_t i = 0; i < thread_limit; i++) {
 		if (_wthreads[i] != NULL && _wthreads[i]->joinable()) {
 			_wthreads[i]->join();
 			delete _wthreads[i];
+			_wthreads[i] = NULL;
 		}
 	}
 
@@ -63,17 +66,6 @@ void SimpleThreadPooler::stop()
 
 void SimpleThreadPooler::wait_till_done()
 {
-	while (true) {
-		at_lock.lock();
-		bool is_empty = rti == rtj;
-		if (is_empty) {
-			for (size_t i = 0; i < thread_limit; i++) {
-				if (_thread_running[i]) is_empty = false;
-			}
-		}
-		at_lock.unlock();
-		if (is_empty) {
-			return;
-		}
-	}
+	std::unique_lock<std::mutex> lock(at_lock);
+	done_cv.wait(lock, [this] { return rti == rtj && busy_threads == 0; });
 }
@@ -3,6 +3,7 @@
 #include <queue>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <functional>
 
@@ -17,7 +18,7 @@ public:
 		_rem_tasks[rtj] = std::function<void()>([f, args...]{ f(args...); });
 		rtj = (rtj + 1) % MAX_TASKS;
 		at_lock.unlock();
-		
+		work_cv.notify_one();
 	};
 	void do_work(size_t tid);
 	void run();
@@ -27,9 +28,14 @@ private:
 	uint32_t MAX_TASKS = 1000;
 	uint32_t thread_limit;
 	std::vector<std::thread*> _wthreads;
-	std::vector<bool> _thread_running;
 	std::vector<std::function<void()>> _rem_tasks;
 	uint32_t rti = 0, rtj = 0;
+	// workers running a task, guarded by at_lock like the ring
+	uint32_t busy_threads = 0;
 	std::mutex at_lock;
+	// idle workers sleep on work_cv until a task is queued or the pool stops, wait_till_done sleeps on done_cv
+	// until the ring is empty and no task is running
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
 	std::atomic_bool stop_work = false;
 };
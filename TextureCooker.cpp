@@ -0,0 +1,184 @@
+#include "TextureCooker.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+
+#include <stb_image.h>
+
+// bump when the cached layout or the filtering changes, older cache files are rebuilt
+static const uint32_t TEXCACHE_VERSION = 1;
+
+struct TexCacheHeader {
+	char magic[4] = { 'P', 'T', 'E', 'X' };
+	uint32_t version = TEXCACHE_VERSION;
+	uint64_t source_size = 0;
+	int64_t source_time = 0;
+	uint32_t width = 0, height = 0, mipLevels = 0;
+	uint32_t srgb = 0;
+};
+
+static bool source_stamp(std::string path, uint64_t& size, int64_t& time) {
+	std::error_code ec;
+	size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	time = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+	return !ec;
+}
+
+static bool read_cache(CookedTexture* tex) {
+	TexCacheHeader want;
+	if (!source_stamp(tex->path, want.source_size, want.source_time)) return false;
+	std::ifstream fr(texcook::cachePath(tex->path), std::ios::binary);
+	if (!fr.is_open()) return false;
+
+	TexCacheHeader head;
+	fr.read((char*)&head, sizeof(head));
+	if (!fr || memcmp(head.magic, want.magic, 4) != 0 || head.version != want.version || head.source_size != want.source_size
+		|| head.source_time != want.source_time || head.srgb != uint32_t(tex->srgb)) {
+		return false;
+	}
+	size_t bytes = 0;
+	for (uint32_t i = 0; i < head.mipLevels; i++) {
+		bytes += size_t(std::max(1u, head.width >> i)) * std::max(1u, head.height >> i) * 4;
+	}
+	tex->pixels.resize(bytes);
+	fr.read((char*)tex->pixels.data(), bytes);
+	if (!fr) return false;
+	tex->width = head.width;
+	tex->height = head.height;
+	tex->mipLevels = head.mipLevels;
+	return true;
+}
+
+static void write_cache(CookedTexture* tex) {
+	TexCacheHeader head;
+	if (!source_stamp(tex->path, head.source_size, head.source_time)) return;
+	head.width = tex->width;
+	head.height = tex->height;
+	head.mipLevels = tex->mipLevels;
+	head.srgb = uint32_t(tex->srgb);
+
+	// written under a name of its own and renamed, another worker may be cooking the same file
+	std::error_code ec;
+	std::filesystem::create_directories(texcook::CACHE_DIR, ec);
+	std::string cpath = texcook::cachePath(tex->path);
+	std::string tmppath = cpath + "." + std::to_string(uintptr_t(tex)) + ".tmp";
+	{
+		std::ofstream fw(tmppath, std::ios::binary);
+		if (!fw.is_open()) return;
+		fw.write((const char*)&head, sizeof(head));
+		fw.write((const char*)tex->pixels.data(), tex->pixels.size());
+		if (!fw) {
+			fw.close();
+			std::filesystem::remove(tmppath, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmppath, cpath, ec);
+	if (ec) std::filesystem::remove(tmppath, ec);
+}
+
+std::string texcook::cachePath(std::string path)
+{
+	std::string name = path;
+	for (char& c : name) {
+		if (c == '/' || c == '\\' || c == ':') c = '_';
+	}
+	return CACHE_DIR + "/" + name + ".ptex";
+}
+
+uint32_t texcook::mipCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	while ((width | height) >> levels) levels++;
+	return levels;
+}
+
+struct SrgbTables {
+	uint16_t to_linear[256];
+	uint8_t to_srgb[65536];
+
+	SrgbTables() {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			float l = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			to_linear[i] = uint16_t(std::lround(l * 65535.0f));
+		}
+		for (int i = 0; i < 65536; i++) {
+			float l = i / 65535.0f;
+			float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = uint8_t(std::lround(std::clamp(c, 0.0f, 1.0f) * 255.0f));
+		}
+	}
+};
+
+void texcook::generateMips(std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, bool srgb)
+{
+	static const SrgbTables tables;
+	uint32_t levels = mipCount(width, height);
+	size_t total = 0;
+	for (uint32_t i = 0; i < levels; i++) total += size_t(std::max(1u, width >> i)) * std::max(1u, height >> i) * 4;
+	pixels.resize(total);
+
+	// 2x2 box filter, odd edges repeat their last row/column. The channel loop has no branches so it vectorizes
+	size_t src_off = 0;
+	uint32_t sw = width, sh = height;
+	for (uint32_t lvl = 1; lvl < levels; lvl++) {
+		uint32_t dw = std::max(1u, sw >> 1), dh = std::max(1u, sh >> 1);
+		size_t dst_off = src_off + size_t(sw) * sh * 4;
+		const uint8_t* src = pixels.data() + src_off;
+		uint8_t* dst = pixels.data() + dst_off;
+		for (uint32_t y = 0; y < dh; y++) {
+			const uint8_t* row0 = src + size_t(std::min(2 * y, sh - 1)) * sw * 4;
+			const uint8_t* row1 = src + size_t(std::min(2 * y + 1, sh - 1)) * sw * 4;
+			for (uint32_t x = 0; x < dw; x++) {
+				uint32_t x0 = std::min(2 * x, sw - 1) * 4, x1 = std::min(2 * x + 1, sw - 1) * 4;
+				uint8_t* out = dst + (size_t(y) * dw + x) * 4;
+				if (srgb) {
+					for (int c = 0; c < 3; c++) {
+						uint32_t sum = uint32_t(tables.to_linear[row0[x0 + c]]) + tables.to_linear[row0[x1 + c]]
+							+ tables.to_linear[row1[x0 + c]] + tables.to_linear[row1[x1 + c]];
+						out[c] = tables.to_srgb[(sum + 2) >> 2];
+					}
+					out[3] = uint8_t((uint32_t(row0[x0 + 3]) + row0[x1 + 3] + row1[x0 + 3] + row1[x1 + 3] + 2) >> 2);
+				}
+				else {
+					for (int c = 0; c < 4; c++) {
+						out[c] = uint8_t((uint32_t(row0[x0 + c]) + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+					}
+				}
+			}
+		}
+		src_off = dst_off;
+		sw = dw;
+		sh = dh;
+	}
+}
+
+void texcook::cook(CookedTexture* tex)
+{
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	tex->from_cache = read_cache(tex);
+	if (!tex->from_cache) {
+		int texWidth, texHeight, texChannels;
+		stbi_uc* pixels = stbi_load(tex->path.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (!pixels) {
+			tex->failed = true;
+			tex->done = true;
+			return;
+		}
+		tex->width = uint32_t(texWidth);
+		tex->height = uint32_t(texHeight);
+		tex->mipLevels = mipCount(tex->width, tex->height);
+		tex->pixels.assign(pixels, pixels + size_t(texWidth) * texHeight * 4);
+		stbi_image_free(pixels);
+		generateMips(tex->pixels, tex->width, tex->height, tex->srgb);
+		write_cache(tex);
+	}
+	tex->cook_ms = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - tstart).count();
+	tex->done = true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// a texture decoded and mipmapped off the render thread. pixels holds every level in RGBA8, tightly packed and
+// largest first. Level i is max(1, width >> i) by max(1, height >> i)
+struct CookedTexture {
+	std::string path;
+	bool srgb = false;
+	uint32_t width = 0, height = 0, mipLevels = 0;
+	std::vector<uint8_t> pixels;
+	bool from_cache = false;
+	bool failed = false;
+	float cook_ms = 0;
+	std::atomic_bool done = false;
+};
+
+namespace texcook {
+	// reads the texture's cached mip chain, or decodes it, builds the mips and writes the cache. Runs on a texture worker
+	void cook(CookedTexture* tex);
+
+	uint32_t mipCount(uint32_t width, uint32_t height);
+	// appends the levels below the width x height level 0 in pixels, sRGB textures are filtered in linear space
+	void generateMips(std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, bool srgb);
+	std::string cachePath(std::string path);
+
+	const std::string CACHE_DIR = "texcache";
+}
@@ -0,0 +1,51 @@
+import random
+import sys
+
+# Generates a level with a grid of looping animated platforms for timing the physics step.
+# Usage: python gen_anim_level.py [platform_count] [out_file] [lani|rani]
+# rani platforms also spin and pulse in scale, which takes the rigid transform path instead of a translation.
+# Run it with prism --stats <out_file>, the physics prints the average step and lmesh advance times
+# and the advance cost per 1k animated objects.
+# The level also works as a draw recording benchmark: --stats also has the renderer print the average time
+# spent recording the secondaries on the renderer workers and the primary, the culling throughput in
+# object-views/ms and how many draws culling saved. Any level works for the draws saved count, add --no-culling
+# to compare against no culling. It also prints how many of the enabled shadow passes were rendered, maps whose
+# light and casters didn't change are reused, and how many draw calls the re-recorded passes took. Add
+# --no-indirect to compare against one draw per object.
+
+SPACING = 12
+
+HEADER = """# Animated platform benchmark level, generated by gen_anim_level.py
+#
+"""
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    out = sys.argv[2] if len(sys.argv) > 2 else "anim_bench.txt"
+    rigid = len(sys.argv) > 3 and sys.argv[3] == "rani"
+    random.seed(29)
+    side = int(n ** 0.5) + 1
+    with open(out, 'w', newline='\r\n') as fw:
+        fw.write(HEADER)
+        fw.write("DLES 10 40 10  0 -1 0.01  5 5 5  150 120 1\n")
+        fw.write("PUVL 0.1 100  0 0 0  0 0 1  1 0 0  %d %d #floor\n\n" % (side * SPACING * 2, side * SPACING * 2))
+        for i in range(n):
+            x = (i % side - side // 2) * SPACING
+            z = (i // side - side // 2) * SPACING
+            y = random.uniform(2, 8)
+            h = random.uniform(1, 6)
+            t1 = random.randint(500, 3000)
+            t2 = random.randint(500, 3000)
+            fw.write("CUVH 0.1 100  %d %.2f %d  0 0 1  1 0 0  4 4 0.5\n" % (x, y, z))
+            if rigid:
+                fw.write("RANI 2  %d  %d %.2f %d  %d %.2f %d  0 1 0  0 180  1 1 1  1.5 1 1.5"
+                         "  %d  %d %.2f %d  %d %.2f %d  0 1 0  180 360  1.5 1 1.5  1 1 1  LOOP spin\n"
+                         % (t1, x, y, z, x, y + h, z, t2, x, y + h, z, x, y, z))
+            else:
+                fw.write("LANI 2  %d  %d %.2f %d  %d %.2f %d  %d  %d %.2f %d  %d %.2f %d  LOOP bob\n"
+                         % (t1, x, y, z, x, y + h, z, t2, x, y + h, z, x, y, z))
+
+
+if __name__ == "__main__":
+    main()
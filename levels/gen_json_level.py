@@ -0,0 +1,55 @@
+import json
+import random
+import sys
+
+# Generates a big JSON level for timing LogicManager::parseCollDataJson.
+# Usage: python gen_json_level.py [size_in_mb] [out_file]
+# Run prism <out_file>, the parser prints parse/build/apply times.
+
+
+def vec3(x, y, z):
+    return [round(x, 3), round(y, 3), round(z, 3)]
+
+
+def make_entry(i):
+    x = (i % 200) * 12.0 - 1200
+    z = (i // 200) * 12.0 - 1200
+    kind = i % 4
+    entry = {"type": "geometry", "epsilon": 0.1, "friction": 100}
+    if kind == 0:
+        entry.update({"geo_type": "plane_uv", "center": vec3(x, 0, z), "u": vec3(0, 0, 1), "v": vec3(1, 0, 0), "ulen": 10, "vlen": 10})
+    elif kind == 1:
+        entry.update({"geo_type": "cylinder_uv", "center": vec3(x, 2, z), "u": vec3(0, 0, 1), "v": vec3(1, 0, 0),
+                      "ulen": random.uniform(2, 8), "vlen": random.uniform(2, 8), "tlen": random.uniform(1, 4)})
+    elif kind == 2:
+        entry.update({"geo_type": "plane_np", "tf_verts": [vec3(x, 0, z), vec3(x + 5, 0, z), vec3(x + 5, 0, z - 5), vec3(x, 0, z - 5)]})
+    else:
+        entry.update({"geo_type": "cylinder_np", "tf_verts": [vec3(x, 4, z), vec3(x + 4, 4, z), vec3(x + 4, 4, z - 4), vec3(x, 4, z - 4)],
+                      "tlen": 1})
+        entry["anims"] = [{"name": "bob", "loop": True, "steps": [
+            {"anim_time": 2000, "init_pos": vec3(0, 0, 0), "final_pos": vec3(0, 3, 0)},
+            {"anim_time": 2000, "init_pos": vec3(0, 3, 0), "final_pos": vec3(0, 0, 0)}]}]
+    return entry
+
+
+def main():
+    size_mb = float(sys.argv[1]) if len(sys.argv) > 1 else 50
+    out = sys.argv[2] if len(sys.argv) > 2 else "bench_level.json"
+    random.seed(27)
+    written = 0
+    with open(out, 'w') as fw:
+        fw.write('[\n')
+        fw.write(json.dumps({"type": "light", "position": [5, 10, 20], "direction": [0, 0, -1], "color": [5, 5, 5],
+                             "distance": 150, "shadowcasting": True, "shadow_type": "directional", "fov": 90, "aspect": 1}))
+        i = 0
+        while written < size_mb * 1024 * 1024:
+            line = ',\n' + json.dumps(make_entry(i))
+            fw.write(line)
+            written += len(line)
+            i += 1
+        fw.write('\n]\n')
+    print("wrote %d entries to %s" % (i, out))
+
+
+if __name__ == "__main__":
+    main()
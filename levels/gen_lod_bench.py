@@ -0,0 +1,37 @@
+import sys
+
+# Generates a level with rows of models reaching far from the spawn, for counting the triangles LODs save.
+# Usage: python gen_lod_bench.py [model_count] [obj_file] [level_file]
+# Generate the dense mesh with gen_mesh_bench.py first, or pass any OBJ. The renderer prints each mesh's LOD
+# triangle counts when it cooks it. Run it with prism --stats <level_file>, the renderer prints the
+# triangles submitted per frame to the gbuffer and the rendered shadow maps, what they would be at LOD 0 and the
+# draws per LOD. Add --no-lods to compare, lod_pixel_error and shadow_lod_bias tune the selection.
+
+SPACING = 8
+
+HEADER = """# LOD benchmark level, generated by gen_lod_bench.py
+#
+"""
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 400
+    obj = sys.argv[2] if len(sys.argv) > 2 else "models/dense_bench.obj"
+    out = sys.argv[3] if len(sys.argv) > 3 else "levels/lod_bench.txt"
+    cols = 10
+    rows = (n + cols - 1) // cols
+    with open(out, 'w', newline='\r\n') as fw:
+        fw.write(HEADER)
+        fw.write("DLES 10 40 10  0 -1 0.01  5 5 5  300 120 1\n")
+        fw.write("PLES 0 6 -10  5 5 5  60\n")
+        fw.write("PUVL 0.1 100  0 0 %d  0 0 1  1 0 0  %d %d\n\n" % (-rows * SPACING // 2, rows * SPACING + 20, cols * SPACING + 20))
+        for i in range(n):
+            x = (i % cols - cols // 2) * SPACING
+            z = -(i // cols) * SPACING - 10
+            fw.write("CUVH 0.1 100  %d 1 %d  0 0 1  1 0 0  2 2 2\n" % (x, z))
+            fw.write("MDLO %d 2 %d  4 4 4 %s textures/basic_tile.png textures/flat_nmap.png textures/basic_tile_se.png\n" % (x, z, obj))
+    print("wrote %d models in %d rows to %s" % (n, rows, out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+import math
+import sys
+
+# Generates a dense synthetic OBJ and a level showing it next to viking_room.obj, for timing mesh loads.
+# Usage: python gen_mesh_bench.py [triangle_count] [obj_file] [level_file]
+# Run prism <level_file> twice: the first run parses the OBJs and writes meshcache/, the second reads the
+# cooked meshes back. The renderer prints the triangle count and load time of every mesh, delete meshcache/ to
+# time a cold load again.
+
+HEADER = """# Mesh load benchmark level, generated by gen_mesh_bench.py
+#
+"""
+
+
+def main():
+    tris = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    obj_out = sys.argv[2] if len(sys.argv) > 2 else "models/dense_bench.obj"
+    level_out = sys.argv[3] if len(sys.argv) > 3 else "levels/mesh_bench.txt"
+    # a wavy grid, two triangles per cell
+    side = int(math.sqrt(tris / 2)) + 1
+    with open(obj_out, 'w') as fw:
+        fw.write("# %d x %d grid, generated by gen_mesh_bench.py\n" % (side, side))
+        for z in range(side + 1):
+            for x in range(side + 1):
+                fw.write("v %.4f %.4f %.4f\n" % (x / side - 0.5, 0.05 * math.sin(x * 0.3) * math.cos(z * 0.3), z / side - 0.5))
+        for z in range(side + 1):
+            for x in range(side + 1):
+                fw.write("vt %.4f %.4f\n" % (x / side, z / side))
+        fw.write("vn 0 1 0\n")
+        for z in range(side):
+            for x in range(side):
+                a = z * (side + 1) + x + 1
+                b = a + 1
+                c = a + side + 1
+                d = c + 1
+                fw.write("f %d/%d/1 %d/%d/1 %d/%d/1\n" % (a, a, c, c, b, b))
+                fw.write("f %d/%d/1 %d/%d/1 %d/%d/1\n" % (b, b, c, c, d, d))
+    with open(level_out, 'w', newline='\r\n') as fw:
+        fw.write(HEADER)
+        fw.write("DLES 10 40 10  0 -1 0.01  5 5 5  150 120 1\n")
+        fw.write("PUVL 0.1 100  0 0 0  0 0 1  1 0 0  200 200\n")
+        fw.write("CUVH 0.1 100  -10 1 0  0 0 1  1 0 0  2 2 2\n")
+        fw.write("MDLO -10 2 0  1 1 1 models/viking_room.obj textures/viking_room.png textures/flat_nmap.png textures/basic_tile_se.png\n")
+        fw.write("CUVH 0.1 100  10 1 0  0 0 1  1 0 0  2 2 2\n")
+        fw.write("MDLO 10 2 0  10 10 10 %s textures/basic_tile.png textures/flat_nmap.png textures/basic_tile_se.png\n" % obj_out)
+    print("wrote %d triangles to %s and the level to %s" % (side * side * 2, obj_out, level_out))
+
+
+if __name__ == "__main__":
+    main()
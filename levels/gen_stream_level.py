@@ -0,0 +1,56 @@
+import random
+import sys
+
+# Generates a large streamed level: a grid of floor tiles with a few platforms and pits per chunk.
+# Usage: python gen_stream_level.py [chunks_per_side] [out_file]
+# Run prism <out_file>, levels/stream_test.txt is this level with the defaults.
+
+CHUNK_SIZE = 64
+LOAD_RADIUS = 2
+UNLOAD_RADIUS = 3
+MAX_RESIDENT_CHUNKS = 25
+
+HEADER = """# Streamed test level, generated by gen_stream_level.py
+#
+#STRM - Everything after this line is split into square chunks on the XZ plane by geometry center and
+#       loaded/evicted around the player. Only geometry lines (PUVL, PNSP, CUVH, CNPH) and HIDE/KILL are allowed after it.
+# Structure - STRM <chunk_size> <load_radius_in_chunks> <unload_radius_in_chunks> <max_resident_chunks>
+#
+"""
+
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 40
+    out = sys.argv[2] if len(sys.argv) > 2 else "stream_test.txt"
+    random.seed(427)
+    half = n // 2
+    with open(out, 'w', newline='\r\n') as fw:
+        fw.write(HEADER)
+        fw.write("DLES 10 40 10  0 -1 0.01  5 5 5  150 120 1\n")
+        fw.write("PLEN 10 10 10  2 2 2  60\n\n")
+        fw.write("STRM %d %d %d %d\n" % (CHUNK_SIZE, LOAD_RADIUS, UNLOAD_RADIUS, MAX_RESIDENT_CHUNKS))
+        for cx in range(-half, n - half):
+            for cz in range(-half, n - half):
+                x0 = cx * CHUNK_SIZE
+                z0 = cz * CHUNK_SIZE
+                cxm = x0 + CHUNK_SIZE / 2
+                czm = z0 + CHUNK_SIZE / 2
+                fw.write("# chunk %d %d\n" % (cx, cz))
+                # keep the spawn chunk flat
+                if (cx, cz) != (0, 0) and random.random() < 0.1:
+                    # pit: floor tile lowered with a kill plane under it
+                    fw.write("PUVL 0.1 100  %g -20 %g  0 0 1  1 0 0  %d %d\n" % (cxm, czm, CHUNK_SIZE, CHUNK_SIZE))
+                    fw.write("KILL\n")
+                else:
+                    fw.write("PUVL 0.1 100  %g 0 %g  0 0 1  1 0 0  %d %d\n" % (cxm, czm, CHUNK_SIZE, CHUNK_SIZE))
+                for i in range(random.randint(1, 3)):
+                    px = x0 + random.uniform(8, CHUNK_SIZE - 8)
+                    pz = z0 + random.uniform(8, CHUNK_SIZE - 8)
+                    h = random.uniform(2, 12)
+                    w = random.uniform(4, 12)
+                    d = random.uniform(4, 12)
+                    fw.write("CUVH 0.1 100  %.2f %.2f %.2f  0 0 1  1 0 0  %.2f %.2f %.2f\n" % (px, h / 2, pz, d, w, h))
+
+
+if __name__ == "__main__":
+    main()
@@ -44,44 +44,68 @@ void nextFrameCallBack(float framedeltat, PrismRenderer* renderer, uint32_t fram
     if (appComps.logicmgr != NULL) appComps.logicmgr->pushToRenderer(renderer, frameNo);
 }
 
-int main() {
-    // Resolution suggestion
-    int WIDTH = 1280;
-    int HEIGHT = 720;
-    glfwInit();
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Prism", NULL, NULL);
-    std::cout << "Windows init complete" << std::endl;
-
-    // Init input manager and renderer
-    PrismInputs inputmgr = PrismInputs();
-    appComps.inputmgr = &inputmgr;
-    std::cout << "input manager init complete" << std::endl;
-    PrismRenderer renderer = PrismRenderer(window, nextFrameCallBack);
-    appComps.renderer = &renderer;
-    std::cout << "renderer init complete" << std::endl;
-    PrismAudioManager audman = PrismAudioManager();
-    appComps.audman = &audman;
-    std::cout << "audio manager init complete" << std::endl;
-    LogicManager logicmgr = LogicManager(&inputmgr, &audman, 1);
-    appComps.logicmgr = &logicmgr;
-    std::cout << "logic manager init complete" << std::endl;
-
-    // Give addresses of renderer and input manager, so callbacks can use them
-    glfwSetWindowUserPointer(window, &appComps);
-
-    // Setup callbacks
-    glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    if (glfwRawMouseMotionSupported()) {
-        std::cout << "Raw mouse Input Supported!! Using raw input" << std::endl;
-        glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+int main(int argc, char** argv) {
+    // prism [--stats] [--no-culling] [--no-indirect] [--no-lods] [level]. --stats prints the renderer's record
+    // stats and the physics and particle step stats, the --no options are the baselines they compare against.
+    // The streaming, JSON and benchmark levels are loaded the same way
+    std::string level_path = "levels/1.txt";
+    bool print_stats = false, culling = true, indirect = true, lods = true;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stats") print_stats = true;
+        else if (arg == "--no-culling") culling = false;
+        else if (arg == "--no-indirect") indirect = false;
+        else if (arg == "--no-lods") lods = false;
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "unknown option " << arg << ", usage: prism [--stats] [--no-culling] [--no-indirect] [--no-lods] [level]" << std::endl;
+            return EXIT_FAILURE;
+        }
+        else level_path = arg;
     }
-    glfwSetCursorPosCallback(window, mpos_callback);
-    glfwSetMouseButtonCallback(window, mbut_callback);
-    glfwSetKeyCallback(window, key_callback);
-    
+
+    // a level that fails to load or validate throws from the LogicManager constructor, print it like the others
     try {
+        // Resolution suggestion
+        int WIDTH = 1280;
+        int HEIGHT = 720;
+        glfwInit();
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Prism", NULL, NULL);
+        std::cout << "Windows init complete" << std::endl;
+
+        // Init input manager and renderer
+        PrismInputs inputmgr = PrismInputs();
+        appComps.inputmgr = &inputmgr;
+        std::cout << "input manager init complete" << std::endl;
+        PrismRenderer renderer = PrismRenderer(window, nextFrameCallBack);
+        appComps.renderer = &renderer;
+        renderer.print_record_stats = print_stats;
+        renderer.frustum_culling = culling;
+        renderer.indirect_drawing = indirect;
+        renderer.mesh_lods = lods;
+        std::cout << "renderer init complete" << std::endl;
+        PrismAudioManager audman = PrismAudioManager();
+        appComps.audman = &audman;
+        std::cout << "audio manager init complete" << std::endl;
+        LogicManager logicmgr = LogicManager(&inputmgr, &audman, 1, level_path);
+        appComps.logicmgr = &logicmgr;
+        logicmgr.setPrintStats(print_stats);
+        std::cout << "logic manager init complete" << std::endl;
+
+        // Give addresses of renderer and input manager, so callbacks can use them
+        glfwSetWindowUserPointer(window, &appComps);
+
+        // Setup callbacks
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        if (glfwRawMouseMotionSupported()) {
+            std::cout << "Raw mouse Input Supported!! Using raw input" << std::endl;
+            glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+        }
+        glfwSetCursorPosCallback(window, mpos_callback);
+        glfwSetMouseButtonCallback(window, mbut_callback);
+        glfwSetKeyCallback(window, key_callback);
+
         std::thread render_thread(&PrismRenderer::run, &renderer);
         std::thread logic_thread(&LogicManager::run, &logicmgr);
 
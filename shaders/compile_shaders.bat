@@ -3,6 +3,9 @@ glslc light_smap.frag -o light_smap.frag.spv
 
 glslc gbuffer.vert -o gbuffer.vert.spv
 glslc gbuffer.frag -o gbuffer.frag.spv
+glslc particle.vert -o particle.vert.spv
+glslc final_mesh.vert -o final_mesh.vert.spv
+glslc final_mesh.frag -o final_mesh.frag.spv
 
 glslc screensize.vert -o screensize.vert.spv
 glslc ambient.frag -o ambient.frag.spv
@@ -1,8 +1,13 @@
 #version 460
 #extension GL_KHR_vulkan_glsl: enable
-#define MAX_NS_LIGHTS 30
 #define MAX_PLIGHTS 8
 #define MAX_DLIGHTS 8
+// same as LightClusters.h
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y * LIGHT_CLUSTER_Z)
+#define LIGHT_CLUSTER_NEAR 1.0
 #define MAX_PLIGHT_SHADOW_DISTANCE 200.0
 #define MAX_DLIGHT_SHADOW_DISTANCE 200.0
 #define MAX_PLIGHT_SHADOW_FALLOFF_DISTANCE 60.0
@@ -67,9 +72,14 @@ layout(set = 1, binding = 0) uniform GPUSceneData {
 	vec4 sunlightColor;
 } sceneData;
 layout(set = 2, binding = 0) uniform sampler2D texMaps[5];
-layout(std140, set = 3, binding = 0) uniform LightBuffer {GPULight lights[MAX_NS_LIGHTS + MAX_PLIGHTS + MAX_DLIGHTS];} lightBuffer;
-layout(set = 4, binding = 0) uniform samplerCube shadowCubes[MAX_PLIGHTS];
-layout(set = 5, binding = 0) uniform sampler2D shadowMaps[MAX_DLIGHTS];
+layout(std140, set = 3, binding = 0) uniform LightBuffer {GPULight lights[MAX_PLIGHTS + MAX_DLIGHTS];} lightBuffer;
+// every shadow pass has a tile of the atlas, rects are offset and size in atlas uv. Directional lights have
+// the first MAX_DLIGHTS slots, then six faces per point light
+layout(set = 4, binding = 0) uniform sampler2D shadowAtlas;
+layout(std140, set = 5, binding = 0) uniform ShadowAtlasRects {vec4 rects[MAX_DLIGHTS + 6*MAX_PLIGHTS];} atlas;
+// non-shadow lights, only the ones in the fragment's cluster are shaded
+layout(std430, set = 6, binding = 0) readonly buffer ClusterLightBuffer {GPULight lights[];} clusterLights;
+layout(std430, set = 7, binding = 0) readonly buffer ClusterBuffer {uvec2 ranges[LIGHT_CLUSTER_COUNT]; uint indices[];} clusters;
 
 
 //Pre Calculated sin and cos values for smap blur
@@ -78,6 +88,30 @@ float smap_sines[] = {0.0, 0.13052619222005157, 0.25881904510252074, 0.382683432
 //float smap_cosines[] = {1.0, 0.9978589232386035, 0.9914448613738104, 0.9807852804032304, 0.9659258262890683, 0.9469301294951057, 0.9238795325112867, 0.8968727415326884, 0.8660254037844387, 0.8314696123025452, 0.7933533402912352, 0.7518398074789774, 0.7071067811865476, 0.6593458151000688, 0.6087614290087207, 0.5555702330196024, 0.5000000000000001, 0.44228869021900125, 0.38268343236508984, 0.3214394653031617, 0.25881904510252074, 0.19509032201612833, 0.1305261922200517, 0.06540312923014327};
 float smap_cosines[] = {1.0, 0.9914448613738104, 0.9659258262890683, 0.9238795325112867, 0.8660254037844387, 0.7933533402912352, 0.7071067811865476, 0.6087614290087207, 0.5000000000000001, 0.38268343236508984, 0.25881904510252074, 0.1305261922200517};
 
+// the cube faces' view axes, as cubeFaceViewProj in ShadowAtlas.cpp looks at them
+const vec3 cube_forward[6] = {vec3(-1, 0, 0), vec3(1, 0, 0), vec3(0, -1, 0), vec3(0, 1, 0), vec3(0, 0, -1), vec3(0, 0, 1)};
+const vec3 cube_side[6] = {vec3(0, 0, 1), vec3(0, 0, -1), vec3(-1, 0, 0), vec3(-1, 0, 0), vec3(-1, 0, 0), vec3(1, 0, 0)};
+const vec3 cube_up[6] = {vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0)};
+
+// distance stored in a slot's tile, uv outside the tile is clamped to its edge texels so filtering doesn't
+// read the neighbours. Slots without a tile read as unshadowed
+float atlas_depth(int slot, vec2 uv){
+	vec4 rect = atlas.rects[slot];
+	if (rect.z == 0) return 1e30;
+	vec2 half_texel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+	return texture(shadowAtlas, clamp(rect.xy + uv * rect.zw, rect.xy + half_texel, rect.xy + rect.zw - half_texel)).r;
+}
+
+// v points from the fragment to the light like a cube map lookup did, the face is picked by the major axis
+// of the way back and the direction projected like the face's pass did
+float cube_atlas_depth(int lidx, vec3 v){
+	vec3 d = -v;
+	vec3 ad = abs(d);
+	int face = ad.x >= ad.y && ad.x >= ad.z ? (d.x < 0 ? 0 : 1) : (ad.y >= ad.z ? (d.y < 0 ? 2 : 3) : (d.z < 0 ? 4 : 5));
+	vec2 ndc = vec2(dot(cube_side[face], d), dot(cube_up[face], d)) / dot(cube_forward[face], d);
+	return atlas_depth(MAX_DLIGHTS + lidx*6 + face, vec2(ndc.x*0.5 + 0.5, -ndc.y*0.5 + 0.5));
+}
+
 vec3 norm_vec_in_dir(vec3 v, vec3 dir, float val){
 	if (length(dir) == 0) return v;
 	vec3 ndir = normalize(dir);
@@ -107,7 +141,7 @@ float compute_soft_shadow(int lidx, vec3 light_vec){
 	v2 = cross(lvn, v1);
 	//v1 = cross(lvn, v2);
 	float light_samples = 0;
-	float sharp_depth = texture(shadowCubes[lidx], light_vec).r;
+	float sharp_depth = cube_atlas_depth(lidx, light_vec);
 	if(sharp_depth*SCUBE_SOFT_MUL_EPSILON >= lvl){light_samples += 1;}
 	vec3 sample_vec;
 	float brad = max(SCUBE_SOFT_BLUR_EPSILON*(1-sharp_depth/lvl), SCUBE_BLUR_EPSILON*lvl);
@@ -116,14 +150,14 @@ float compute_soft_shadow(int lidx, vec3 light_vec){
 	for (int i = 0; i < SCUBE_SOFT_BLUR_SAMPLES; i++){
 		sample_vec = v1*cos(i*theta) + v2*sin(i*theta);
 		sample_vec *= brad;
-		if(texture(shadowCubes[lidx], light_vec + sample_vec).r*SCUBE_SOFT_MUL_EPSILON + SCUBE_SOFT_ADD_EPSILON >= lvl){light_samples += sample_weight;}
-		if(texture(shadowCubes[lidx], light_vec - sample_vec).r*SCUBE_SOFT_MUL_EPSILON + SCUBE_SOFT_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(lidx, light_vec + sample_vec)*SCUBE_SOFT_MUL_EPSILON + SCUBE_SOFT_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(lidx, light_vec - sample_vec)*SCUBE_SOFT_MUL_EPSILON + SCUBE_SOFT_ADD_EPSILON >= lvl){light_samples += sample_weight;}
 	}
 	return SHADOW_DARKNESS + SHADOW_BRIGHTNESS*(light_samples/(1 + 2*SCUBE_SOFT_BLUR_SAMPLES*sample_weight));
 }
 
 float compute_shadow(int lidx, vec3 light_vec){
-	int midx = lidx - MAX_NS_LIGHTS;
+	int midx = lidx;
 	vec3 v1, v2;
 
 	float lvl = length(light_vec);
@@ -136,19 +170,19 @@ float compute_shadow(int lidx, vec3 light_vec){
 	v2 = cross(lvn, v1);
 	//v1 = cross(lvn, v2);
 	float light_samples = 0;
-	if(texture(shadowCubes[midx], light_vec).r*SCUBE_MUL_EPSILON >= lvl){light_samples += 1;}
+	if(cube_atlas_depth(midx, light_vec)*SCUBE_MUL_EPSILON >= lvl){light_samples += 1;}
 	vec3 sample_vec;
 	float brad = SCUBE_BLUR_EPSILON*lvl;
 	float sample_weight = SCUBE_BLUR_FALLOFF/(SCUBE_BLUR_SCALING+1);
 	for (int i = 0; i < SMAP_BLUR_SAMPLES; i++){
 		sample_vec = v1*smap_cosines[i] + v2*smap_sines[i];
 		sample_vec *= brad;
-		if(texture(shadowCubes[midx], light_vec + sample_vec).r*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
-		if(texture(shadowCubes[midx], light_vec - sample_vec).r*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(midx, light_vec + sample_vec)*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(midx, light_vec - sample_vec)*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
 		sample_vec = v1*smap_cosines[i] - v2*smap_sines[i];
 		sample_vec *= brad;
-		if(texture(shadowCubes[midx], light_vec + sample_vec).r*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
-		if(texture(shadowCubes[midx], light_vec - sample_vec).r*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(midx, light_vec + sample_vec)*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
+		if(cube_atlas_depth(midx, light_vec - sample_vec)*SCUBE_MUL_EPSILON + SCUBE_ADD_EPSILON >= lvl){light_samples += sample_weight;}
 	}
 	return SHADOW_DARKNESS + SHADOW_BRIGHTNESS*(light_samples/(1 + 4*SCUBE_BLUR_SAMPLES*sample_weight));
 }
@@ -165,11 +199,11 @@ float compute_map_shadow(int lidx, vec3 light_vec, vec4 ppos, vec4 normal){
 	vec4 smuvn = smuv/smuv.w;
 	if (smuvn.z <-1.0 || smuvn.z > 1.0 || smuvn.w < 0.0) return SHADOW_DARKNESS + fader;
 
-	int midx = lidx - MAX_PLIGHTS - MAX_NS_LIGHTS;
+	int midx = lidx - MAX_PLIGHTS;
 	int light_samples = 0;
 	int center_samples = 0;
 	vec2 csample = vec2(smuvn.x/2.0 + 0.5f, -smuvn.y/2.0 + 0.5f);
-	float cdist = texture(shadowMaps[midx], csample).r;
+	float cdist = atlas_depth(midx, csample);
 	if(cdist*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){center_samples = 1;}
 	vec2 sample_vec;
 	float brad = max(0.00008, SMAP_BLUR_EPSILON*(1 - cdist/lvl));
@@ -178,17 +212,49 @@ float compute_map_shadow(int lidx, vec3 light_vec, vec4 ppos, vec4 normal){
 	float sample_weight = SMAP_BLUR_FALLOFF/(SMAP_BLUR_SCALING*brad+1);
 	for (int i = 0; i < SMAP_BLUR_SAMPLES; i++){
 		sample_vec = v1.xy*smap_cosines[i] + v2.xy*smap_sines[i];
-		if(texture(shadowMaps[midx], csample + sample_vec).r*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
-		if(texture(shadowMaps[midx], csample - sample_vec).r*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
+		if(atlas_depth(midx, csample + sample_vec)*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
+		if(atlas_depth(midx, csample - sample_vec)*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
 		sample_vec = v1.xy*smap_cosines[i] - v2.xy*smap_sines[i];
-		if(texture(shadowMaps[midx], csample + sample_vec).r*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
-		if(texture(shadowMaps[midx], csample - sample_vec).r*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
+		if(atlas_depth(midx, csample + sample_vec)*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
+		if(atlas_depth(midx, csample - sample_vec)*SMAP_MUL_EPSILON + SMAP_ADD_EPSILON >= lvl){light_samples += 1;}
 	}
 	float sprob = ((center_samples + light_samples*sample_weight)/(1 + 4*SMAP_BLUR_SAMPLES*sample_weight));
 	
 	return (SHADOW_DARKNESS) + (SHADOW_BRIGHTNESS - fader)*sprob;
 }
 
+uint cluster_index(vec3 pos){
+	vec4 clip = camData.viewproj * vec4(pos, 1.0);
+	vec2 tile = clamp(floor((clip.xy / clip.w * 0.5 + 0.5) * vec2(LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y)), vec2(0), vec2(LIGHT_CLUSTER_X - 1, LIGHT_CLUSTER_Y - 1));
+	float depth = max(dot(pos - camData.camPos.xyz, normalize(camData.camDir.xyz)), LIGHT_CLUSTER_NEAR);
+	float slice = clamp(floor(log(depth / LIGHT_CLUSTER_NEAR) / log(camData.projprops.y / LIGHT_CLUSTER_NEAR) * LIGHT_CLUSTER_Z), 0, LIGHT_CLUSTER_Z - 1);
+	return (uint(slice) * LIGHT_CLUSTER_Y + uint(tile.y)) * LIGHT_CLUSTER_X + uint(tile.x);
+}
+
+// diffuse and specular of a light that reaches the fragment, map lights only light what their map covers
+vec4 light_shade(GPULight light, vec4 fragPos, vec4 normTex, vec4 seTex, bool map_light){
+	vec3 lightVec = light.pos.xyz - fragPos.xyz;
+	vec3 lightVecN = normalize(lightVec);
+	vec4 diffuse = vec4(0);
+	float lcomp = max(dot(normTex.xyz,lightVecN), 0);
+	float ldist = light.props.y;
+	if (ldist >= length(lightVec)){
+		lcomp = lcomp * (1 - (length(lightVec)/ldist));
+		diffuse = 1 * lcomp * lcomp * light.color;
+		if (map_light){
+			vec4 smuv = light.viewproj * vec4(fragPos.xyz, 1.0f);
+			vec4 smuvn = smuv/smuv.w;
+			if (smuvn.z <-1.0 || smuvn.z > 1.0 || smuvn.w < 0.0 || smuvn.x > 1 || smuvn.x < -1 || smuvn.y > 1 || smuvn.y < -1) diffuse = vec4(0); 
+		}
+	}
+
+	vec3 viewDir = normalize(camData.camPos.xyz - fragPos.xyz);
+	vec3 reflectDir = reflect(-lightVecN, normTex.xyz);  
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32)/pow(length(lightVec), 2);
+	vec4 specular = 10 * seTex.x * spec * light.color;
+	return diffuse + specular;
+}
+
 void main() {
     vec4 texColor = texture(texMaps[0], inUV);
     vec4 fragPos = texture(texMaps[1], inUV);
@@ -203,54 +269,26 @@ void main() {
 	vec4 ambTex = texture(texMaps[4], movedUV);
 
 	vec4 overall_shade = vec4(0,0,0,0);
-	for (int i = 0; i < MAX_NS_LIGHTS + MAX_PLIGHTS + MAX_DLIGHTS; i++){
-		vec4 diffuse = vec4(0);
-		vec4 specular = vec4(0);
+	for (int i = 0; i < MAX_PLIGHTS + MAX_DLIGHTS; i++){
+		if (!bool((lightBuffer.lights[i].flags.x >> 1) & 1)) continue;
 		float shadow = 1;
 		vec3 lightVec = lightBuffer.lights[i].pos.xyz - fragPos.xyz;
-		vec3 lightVecN = normalize(lightVec);
-
-		bool valid_ls = false;
-
 		if (bool(lightBuffer.lights[i].flags.x & 1)){
-			valid_ls = true;
-			if (i >= MAX_NS_LIGHTS && i < MAX_NS_LIGHTS + MAX_PLIGHTS){
+			if (i < MAX_PLIGHTS){
 				shadow = compute_shadow(i, lightVec);
 			}
-			else if(i >= MAX_NS_LIGHTS + MAX_PLIGHTS){
+			else{
 				shadow = compute_map_shadow(i, lightVec, vec4(fragPos.xyz, 1.0f), normTex);
 			}
 		}
-
 		shadow = SHADOW_MIN_BRIGHTNESS + (1 - SHADOW_MIN_BRIGHTNESS)*shadow;
+		overall_shade = overall_shade + light_shade(lightBuffer.lights[i], fragPos, normTex, seTex, i >= MAX_PLIGHTS) * shadow;
+	}
 
-		if (bool((lightBuffer.lights[i].flags.x >> 1) & 1)){
-			valid_ls = true;
-			float lcomp = max(dot(normTex.xyz,lightVecN), 0);
-			float ldist = lightBuffer.lights[i].props.y;
-			if (ldist < length(lightVec) ){
-				diffuse = vec4(0);
-			}
-			else{
-				lcomp = lcomp * (1 - (length(lightVec)/ldist));
-				diffuse = 1 * lcomp * lcomp * lightBuffer.lights[i].color;
-				if (i >= MAX_NS_LIGHTS + MAX_PLIGHTS){
-					vec4 smuv = lightBuffer.lights[i].viewproj * vec4(fragPos.xyz, 1.0f);
-					vec4 smuvn = smuv/smuv.w;
-					if (smuvn.z <-1.0 || smuvn.z > 1.0 || smuvn.w < 0.0 || smuvn.x > 1 || smuvn.x < -1 || smuvn.y > 1 || smuvn.y < -1) diffuse = vec4(0); 
-				}
-			}
-
-			vec3 viewDir = normalize(camData.camPos.xyz - fragPos.xyz);
-			vec3 reflectDir = reflect(-lightVecN, normTex.xyz);  
-			float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32)/pow(length(lightVec), 2);
-			specular = 10 * seTex.x * spec * lightBuffer.lights[i].color;
-		}
-
-		if (valid_ls){
-			vec4 light_shade = (diffuse + specular) * shadow;
-			overall_shade = overall_shade + light_shade;
-		}
+	// lights without shadows are binned on the cpu, only the ones whose range reaches the cluster are in its list
+	uvec2 crange = clusters.ranges[cluster_index(fragPos.xyz)];
+	for (uint ci = crange.x; ci < crange.x + crange.y; ci++){
+		overall_shade = overall_shade + light_shade(clusterLights.lights[clusters.indices[ci]], fragPos, normTex, seTex, false);
 	}
     
 	
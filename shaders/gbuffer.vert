@@ -14,12 +14,14 @@ struct ObjectData{
 
 layout(std140, set = 1, binding = 0) readonly buffer ObjectBuffer{ ObjectData objects[];} objectBuffer;
 
+// binding 0 is the position stream, binding 1 the packed attributes. Normal and tangent are 10-10-10-2 UNORM
+// mapped from [-1, 1], the tangent's w says whether the bitangent is cross(normal, tangent) or flipped
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inTangent;
-layout(location = 3) in vec3 inBitangent;
-layout(location = 4) in vec3 inColor;
-layout(location = 5) in vec2 inTexCoord;
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec4 inTangent;
+layout(location = 3) in vec2 inTexCoord;
+// binding 3, one object index per instance from the frame's instance buffer
+layout(location = 4) in uint inObjIdx;
 
 layout(location = 0) out vec3 fragPosition;
 layout(location = 1) out vec3 fragColor;
@@ -29,13 +31,15 @@ layout(location = 4) out vec3 fragBitangent;
 layout(location = 5) out vec2 fragTexCoord;
 
 void main() {
-	mat4 transformMatrix = camData.viewproj * objectBuffer.objects[gl_BaseInstance].model;
+	vec3 normal = inNormal.xyz * 2.0 - 1.0;
+	vec3 tangent = inTangent.xyz * 2.0 - 1.0;
+	vec3 bitangent = cross(normal, tangent) * (inTangent.w > 0.5 ? 1.0 : -1.0);
+	mat4 transformMatrix = camData.viewproj * objectBuffer.objects[inObjIdx].model;
 	gl_Position =  transformMatrix * vec4(inPosition, 1.0);
-	fragPosition = (objectBuffer.objects[gl_BaseInstance].model * vec4(inPosition, 1.0)).xyz;
-	fragColor = inColor;
-	fragNormal = normalize(vec3(objectBuffer.objects[gl_BaseInstance].model * vec4(inNormal, 0.0)));
-	fragTangent = normalize(vec3(objectBuffer.objects[gl_BaseInstance].model * vec4(inTangent, 0.0)));
-	fragBitangent = normalize(vec3(objectBuffer.objects[gl_BaseInstance].model * vec4(inBitangent, 0.0)));
-	//fragBitangent = normalize(vec3(objectBuffer.objects[gl_BaseInstance].model * vec4(cross(inNormal, inTangent), 0.0)));
+	fragPosition = (objectBuffer.objects[inObjIdx].model * vec4(inPosition, 1.0)).xyz;
+	fragColor = vec3(1.0);
+	fragNormal = normalize(vec3(objectBuffer.objects[inObjIdx].model * vec4(normal, 0.0)));
+	fragTangent = normalize(vec3(objectBuffer.objects[inObjIdx].model * vec4(tangent, 0.0)));
+	fragBitangent = normalize(vec3(objectBuffer.objects[inObjIdx].model * vec4(bitangent, 0.0)));
 	fragTexCoord = inTexCoord;
 }
\ No newline at end of file
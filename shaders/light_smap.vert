@@ -1,5 +1,4 @@
 #version 460
-#define MAX_NS_LIGHTS 30
 #define MAX_PLIGHTS 8
 #define MAX_DLIGHTS 8
 
@@ -13,7 +12,7 @@ struct GPULight {
     ivec4 flags;
 };
 
-layout(std140, set = 0, binding = 0) uniform LightBuffer { GPULight lights[MAX_NS_LIGHTS + MAX_PLIGHTS + MAX_DLIGHTS]; } lightBuffer;
+layout(std140, set = 0, binding = 0) uniform LightBuffer { GPULight lights[MAX_PLIGHTS + MAX_DLIGHTS]; } lightBuffer;
 
 layout(push_constant) uniform lpconst {
     ivec4 idx;
@@ -28,19 +27,16 @@ layout(std140,set = 1, binding = 0) readonly buffer ObjectBuffer{
 	ObjectData objects[];
 } objectBuffer;
 
+// shadow pipelines only bind the position stream and the per instance object index
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inTangent;
-layout(location = 3) in vec3 inBitangent;
-layout(location = 4) in vec3 inColor;
-layout(location = 5) in vec2 inTexCoord;
+layout(location = 4) in uint inObjIdx;
 
 layout(location = 0) out vec4 fragPos;
 layout(location = 1) out vec4 lightPos;
 
 void main() {
     lightPos = lightBuffer.lights[lightPC.idx.x].pos;
-    fragPos = objectBuffer.objects[gl_BaseInstance].model * vec4(inPosition, 1.0f);
+    fragPos = objectBuffer.objects[inObjIdx].model * vec4(inPosition, 1.0f);
     vec4 cpos = lightPC.viewproj * lightBuffer.lights[lightPC.idx.x].viewproj * fragPos;
     gl_Position = cpos;
 }
\ No newline at end of file
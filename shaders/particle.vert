@@ -0,0 +1,44 @@
+#version 460
+
+layout(set = 0, binding = 0) uniform GPUCameraData {
+	vec4 camPos;
+	vec4 camDir;
+	vec4 projprops;
+	mat4 viewproj;
+} camData;
+
+// same streams as gbuffer.vert, the transform comes from the per instance binding instead of the object buffer
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec4 inTangent;
+layout(location = 3) in vec2 inTexCoord;
+// xyz position, w uniform scale
+layout(location = 4) in vec4 inPosScale;
+// xyz unit spin axis, w angle around it
+layout(location = 5) in vec4 inAxisAngle;
+
+layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragColor;
+layout(location = 2) out vec3 fragNormal;
+layout(location = 3) out vec3 fragTangent;
+layout(location = 4) out vec3 fragBitangent;
+layout(location = 5) out vec2 fragTexCoord;
+
+vec3 spin(vec3 v, vec3 k, float c, float s) {
+	return v * c + cross(k, v) * s + k * dot(k, v) * (1.0 - c);
+}
+
+void main() {
+	vec3 normal = inNormal.xyz * 2.0 - 1.0;
+	vec3 tangent = inTangent.xyz * 2.0 - 1.0;
+	vec3 bitangent = cross(normal, tangent) * (inTangent.w > 0.5 ? 1.0 : -1.0);
+	float c = cos(inAxisAngle.w);
+	float s = sin(inAxisAngle.w);
+	fragPosition = spin(inPosition, inAxisAngle.xyz, c, s) * inPosScale.w + inPosScale.xyz;
+	gl_Position = camData.viewproj * vec4(fragPosition, 1.0);
+	fragColor = vec3(1.0);
+	fragNormal = normalize(spin(normal, inAxisAngle.xyz, c, s));
+	fragTangent = normalize(spin(tangent, inAxisAngle.xyz, c, s));
+	fragBitangent = normalize(spin(bitangent, inAxisAngle.xyz, c, s));
+	fragTexCoord = inTexCoord;
+}
@@ -0,0 +1,340 @@
+#include "test_common.h"
+#include "DrawRecorder.h"
+#include "SimpleThreadPooler.h"
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+
+// recording is built into this test on its own, these stand in for the driver. A command buffer handle points at
+// a MockCmdBuffer that logs what was recorded into it, so workers recording their own buffers don't share anything.
+// Draws are logged with the texture set bound when they were recorded
+struct MockDraw {
+	VkDescriptorSet texDSet;
+	VkDrawIndexedIndirectCommand cmd;
+};
+
+struct MockIndirectDraw {
+	VkDescriptorSet texDSet;
+	VkDeviceSize offset;
+	uint32_t count;
+};
+
+struct MockCmdBuffer {
+	size_t vertexBinds = 0;
+	size_t indexBinds = 0;
+	size_t dsetBinds = 0;
+	VkDescriptorSet texDSet = VK_NULL_HANDLE;
+	std::vector<MockDraw> direct;
+	std::vector<MockIndirectDraw> indirect;
+
+	VkCommandBuffer handle() { return reinterpret_cast<VkCommandBuffer>(this); }
+};
+
+static MockCmdBuffer& mock(VkCommandBuffer cmdBuffer)
+{
+	return *reinterpret_cast<MockCmdBuffer*>(cmdBuffer);
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdBindVertexBuffers(VkCommandBuffer commandBuffer, uint32_t firstBinding, uint32_t bindingCount, const VkBuffer* pBuffers, const VkDeviceSize* pOffsets)
+{
+	mock(commandBuffer).vertexBinds++;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdBindIndexBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, VkIndexType indexType)
+{
+	mock(commandBuffer).indexBinds++;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdBindDescriptorSets(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipelineBindPoint, VkPipelineLayout layout, uint32_t firstSet, uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets, uint32_t dynamicOffsetCount, const uint32_t* pDynamicOffsets)
+{
+	MockCmdBuffer& buffer = mock(commandBuffer);
+	buffer.dsetBinds++;
+	if (firstSet + descriptorSetCount > 2) buffer.texDSet = pDescriptorSets[2 - firstSet];
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexed(VkCommandBuffer commandBuffer, uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance)
+{
+	MockCmdBuffer& buffer = mock(commandBuffer);
+	buffer.direct.push_back({ buffer.texDSet, { indexCount, instanceCount, firstIndex, vertexOffset, firstInstance } });
+}
+
+VKAPI_ATTR void VKAPI_CALL vkCmdDrawIndexedIndirect(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+{
+	MockCmdBuffer& cmds = mock(commandBuffer);
+	cmds.indirect.push_back({ cmds.texDSet, offset, drawCount });
+}
+
+// recording 10k objects into 256 object secondaries on three workers, like the renderer does for a dirty pass
+#ifdef NDEBUG
+const double RECORD_BUDGET_MS = 5.0;
+#else
+const double RECORD_BUDGET_MS = 40.0;
+#endif
+// recording 10k draws in one range on one thread, even when nearly every draw is a mesh of its own
+#ifdef NDEBUG
+const double DRAWS_BUDGET_MS = 5.0;
+#else
+const double DRAWS_BUDGET_MS = 40.0;
+#endif
+const uint32_t WORKERS = 3;
+const size_t SECONDARY_CMD_OBJECTS = 256;
+const size_t PASS_SLOT = 2;
+const size_t MAX_OBJECTS = 10000;
+
+template <typename T>
+static T fake_handle(uint64_t id)
+{
+	return (T)(uintptr_t)id;
+}
+
+// a render list over mesh_count meshes in two pools and tex_sets texture sets, with maintained meshes at the end.
+// Objects get random meshes, texture sets and LODs, the draw list is sorted the way buildRenderList sorts it
+struct TestScene {
+	std::vector<RenderListItem> items;
+	std::vector<uint32_t> drawList;
+	std::vector<VkDrawIndexedIndirectCommand> cmds;
+	std::vector<uint32_t> objs;
+};
+
+static TestScene make_scene(size_t objects, size_t maintained, uint32_t mesh_count, uint32_t tex_sets, std::minstd_rand& rng)
+{
+	TestScene scene;
+	scene.items.resize(objects + maintained);
+	for (size_t i = 0; i < scene.items.size(); i++) {
+		RenderListItem& item = scene.items[i];
+		item = RenderListItem{};
+		bool dynamic = i >= objects;
+		uint32_t mesh = dynamic ? uint32_t(i) : uint32_t(rng() % mesh_count);
+		item.pool = dynamic ? -1 : int32_t(mesh % 2);
+		item.vertexBuffer = fake_handle<VkBuffer>(dynamic ? 100 : 10 + item.pool);
+		item.attribBuffer = fake_handle<VkBuffer>(dynamic ? 101 : 20 + item.pool);
+		item.indexBuffer = fake_handle<VkBuffer>(dynamic ? 102 : 30 + item.pool);
+		item.texDSet = fake_handle<VkDescriptorSet>(200 + rng() % tex_sets);
+		item.lodCount = dynamic ? 1 : 1 + mesh % MAX_MESH_LODS;
+		for (uint32_t l = 0; l < item.lodCount; l++) {
+			item.lods[l].firstIndex = mesh * 4096 + l * 1024;
+			item.lods[l].indexCount = 900 >> l;
+		}
+		item.vertexOffset = int32_t(mesh * 1000);
+		item.frameVertices = dynamic ? 500 : 0;
+		item.objIdx = uint32_t(i);
+	}
+	std::vector<uint32_t> order(scene.items.size());
+	for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&scene](uint32_t a, uint32_t b) {
+		const RenderListItem& ra = scene.items[a];
+		const RenderListItem& rb = scene.items[b];
+		return std::make_tuple(ra.pool, uintptr_t(ra.texDSet), ra.vertexOffset, a) < std::make_tuple(rb.pool, uintptr_t(rb.texDSet), rb.vertexOffset, b);
+	});
+	for (uint32_t i : order) scene.drawList.push_back(i | ((rng() % scene.items[i].lodCount) << DRAW_LOD_SHIFT));
+	scene.cmds.resize(MAX_OBJECTS * (PASS_SLOT + 1));
+	scene.objs.resize(MAX_OBJECTS * (PASS_SLOT + 1));
+	return scene;
+}
+
+static DrawRecordTarget scene_target(TestScene& scene, bool indirect, bool multi_draw)
+{
+	DrawRecordTarget target;
+	target.items = scene.items.data();
+	target.instanceBuffer = fake_handle<VkBuffer>(1);
+	target.indirectBuffer = fake_handle<VkBuffer>(2);
+	target.slotCmds = scene.cmds.data() + PASS_SLOT * MAX_OBJECTS;
+	target.slotObjs = scene.objs.data() + PASS_SLOT * MAX_OBJECTS;
+	target.slotCmdsOffset = PASS_SLOT * MAX_OBJECTS * sizeof(VkDrawIndexedIndirectCommand);
+	target.slotBase = uint32_t(PASS_SLOT * MAX_OBJECTS);
+	target.frameNo = 1;
+	target.indirect = indirect;
+	target.multiDrawIndirect = multi_draw;
+	return target;
+}
+
+static SecondaryCmdJob pass_job(const TestScene& scene, bool shadow_pass)
+{
+	SecondaryCmdJob job;
+	job.passSlot = uint32_t(PASS_SLOT);
+	job.shadow_pass = shadow_pass;
+	job.dSets = { fake_handle<VkDescriptorSet>(300), fake_handle<VkDescriptorSet>(301) };
+	job.drawList = &scene.drawList;
+	return job;
+}
+
+// records the draw list in SECONDARY_CMD_OBJECTS ranges, one mock buffer each, on the pool's workers if one is given
+static DrawRecordStats record_pass(TestScene& scene, const DrawRecordTarget& target, bool shadow_pass, std::vector<MockCmdBuffer>& buffers, SimpleThreadPooler* pool = NULL)
+{
+	SecondaryCmdJob job = pass_job(scene, shadow_pass);
+	size_t ranges = (scene.drawList.size() + SECONDARY_CMD_OBJECTS - 1) / SECONDARY_CMD_OBJECTS;
+	buffers.assign(ranges, MockCmdBuffer{});
+	std::vector<DrawRecordStats> stats(ranges);
+	for (size_t k = 0; k < ranges; k++) {
+		job.cmdBuffer = buffers[k].handle();
+		job.draw_start = k * SECONDARY_CMD_OBJECTS;
+		job.draw_end = std::min(job.draw_start + SECONDARY_CMD_OBJECTS, scene.drawList.size());
+		if (pool) pool->add_task([job, &target, &stats, k]() { stats[k] = recordDrawRange(job, target); });
+		else stats[k] = recordDrawRange(job, target);
+	}
+	if (pool) pool->wait_till_done();
+	DrawRecordStats total;
+	for (const DrawRecordStats& s : stats) {
+		total.draws += s.draws;
+		total.drawCalls += s.drawCalls;
+		total.shadowFetchBytes += s.shadowFetchBytes;
+	}
+	return total;
+}
+
+// object, first index, index count, vertex offset and texture set of every object instance the recorded draws draw
+typedef std::tuple<uint32_t, uint32_t, uint32_t, int32_t, VkDescriptorSet> DrawnObject;
+
+static void add_drawn(std::vector<DrawnObject>& drawn, const TestScene& scene, const VkDrawIndexedIndirectCommand& cmd, VkDescriptorSet texDSet)
+{
+	for (uint32_t i = 0; i < cmd.instanceCount; i++) {
+		drawn.push_back({ scene.objs[cmd.firstInstance + i], cmd.firstIndex, cmd.indexCount, cmd.vertexOffset, texDSet });
+	}
+}
+
+static std::vector<DrawnObject> drawn_objects(const TestScene& scene, const std::vector<MockCmdBuffer>& buffers, size_t& calls)
+{
+	std::vector<DrawnObject> drawn;
+	calls = 0;
+	for (const MockCmdBuffer& buffer : buffers) {
+		for (const MockDraw& draw : buffer.direct) add_drawn(drawn, scene, draw.cmd, draw.texDSet);
+		for (const MockIndirectDraw& draw : buffer.indirect) {
+			size_t first = size_t(draw.offset / sizeof(VkDrawIndexedIndirectCommand));
+			for (uint32_t c = 0; c < draw.count; c++) add_drawn(drawn, scene, scene.cmds[first + c], draw.texDSet);
+		}
+		calls += buffer.direct.size() + buffer.indirect.size();
+	}
+	std::sort(drawn.begin(), drawn.end());
+	return drawn;
+}
+
+// shadow passes bind no texture sets
+static std::vector<DrawnObject> expected_objects(const TestScene& scene, const DrawRecordTarget& target, bool shadow_pass)
+{
+	std::vector<DrawnObject> expected;
+	for (uint32_t draw : scene.drawList) {
+		const RenderListItem& item = scene.items[draw & DRAW_OBJ_MASK];
+		const MeshLod& lod = item.lods[draw >> DRAW_LOD_SHIFT];
+		expected.push_back({ item.objIdx, lod.firstIndex, lod.indexCount, item.vertexOffset + int32_t(target.frameNo * item.frameVertices), shadow_pass ? VK_NULL_HANDLE : item.texDSet });
+	}
+	std::sort(expected.begin(), expected.end());
+	return expected;
+}
+
+static void test_every_object_drawn()
+{
+	// every mode draws every entry once at its LOD, instanced per mesh and LOD over the instance entries
+	std::minstd_rand rng(5);
+	TestScene scene = make_scene(3000, 20, 40, 6, rng);
+	const bool modes[3][2] = { { true, true }, { true, false }, { false, false } };
+	size_t mode_calls[3];
+	for (int m = 0; m < 3; m++) {
+		DrawRecordTarget target = scene_target(scene, modes[m][0], modes[m][1]);
+		std::vector<MockCmdBuffer> buffers;
+		DrawRecordStats stats = record_pass(scene, target, false, buffers);
+		size_t calls;
+		std::vector<DrawnObject> drawn = drawn_objects(scene, buffers, calls);
+		CHECK(drawn == expected_objects(scene, target, false));
+		CHECK(stats.draws == scene.drawList.size());
+		CHECK(stats.drawCalls == calls);
+		CHECK(stats.shadowFetchBytes == 0);
+		mode_calls[m] = calls;
+		// binds only happen when the vertex buffer or texture set changes, at most once per run
+		size_t binds = 0;
+		for (const MockCmdBuffer& buffer : buffers) {
+			CHECK(buffer.vertexBinds == buffer.indexBinds + 1);
+			binds += buffer.dsetBinds;
+		}
+		CHECK(binds < scene.drawList.size() / 10);
+	}
+	// a multi draw per run, an indirect draw or a direct one per mesh and LOD
+	CHECK(mode_calls[0] < mode_calls[1]);
+	CHECK(mode_calls[1] == mode_calls[2]);
+	CHECK(mode_calls[2] < scene.drawList.size() / 2);
+}
+
+static void test_shadow_pass()
+{
+	// shadow passes bind no texture sets and count the positions their indices fetch
+	std::minstd_rand rng(6);
+	TestScene scene = make_scene(1000, 4, 30, 6, rng);
+	DrawRecordTarget target = scene_target(scene, true, true);
+	std::vector<MockCmdBuffer> buffers;
+	DrawRecordStats stats = record_pass(scene, target, true, buffers);
+	size_t fetch = 0;
+	for (uint32_t draw : scene.drawList) fetch += scene.items[draw & DRAW_OBJ_MASK].lods[draw >> DRAW_LOD_SHIFT].indexCount * sizeof(glm::vec3);
+	CHECK(stats.shadowFetchBytes == fetch);
+	size_t calls;
+	CHECK(drawn_objects(scene, buffers, calls) == expected_objects(scene, target, true));
+	for (const MockCmdBuffer& buffer : buffers) CHECK(buffer.dsetBinds == 0);
+}
+
+static void test_parallel_record()
+{
+	// the same 10k object pass recorded on one thread and on the workers, each range into its own buffer
+	std::minstd_rand rng(7);
+	TestScene scene = make_scene(MAX_OBJECTS - 16, 16, 500, 32, rng);
+	DrawRecordTarget target = scene_target(scene, true, true);
+	SimpleThreadPooler pool(WORKERS);
+	pool.run();
+	const int iterations = 20;
+	double ms[2];
+	std::vector<MockCmdBuffer> buffers[2];
+	for (int run = 0; run < 2; run++) {
+		SimpleThreadPooler* workers = run == 0 ? &pool : NULL;
+		record_pass(scene, target, false, buffers[run], workers);
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++) record_pass(scene, target, false, buffers[run], workers);
+		ms[run] = ms_since(start) / iterations;
+	}
+	size_t calls[2];
+	CHECK(drawn_objects(scene, buffers[0], calls[0]) == expected_objects(scene, target, false));
+	CHECK(drawn_objects(scene, buffers[1], calls[1]) == expected_objects(scene, target, false));
+	CHECK(calls[0] == calls[1]);
+	std::cout << scene.drawList.size() << " objects recorded into " << buffers[0].size() << " secondaries in " << ms[0] << " ms on "
+		<< WORKERS << " workers (" << ms[1] << " ms on one thread), " << calls[0] << " draw calls\n";
+	CHECK(ms[0] < RECORD_BUDGET_MS);
+}
+
+static void test_record_time()
+{
+	// time per 10k draws for each way of drawing, on a scene that instances well and on one with about as many
+	// meshes as objects
+	const char* mode_names[3] = { "multi draw indirect", "indirect", "direct" };
+	const bool modes[3][2] = { { true, true }, { true, false }, { false, false } };
+	const uint32_t mesh_counts[2] = { 200, uint32_t(MAX_OBJECTS) };
+	const int iterations = 20;
+	for (uint32_t meshes : mesh_counts) {
+		std::minstd_rand rng(8);
+		TestScene scene = make_scene(MAX_OBJECTS, 0, meshes, 16, rng);
+		SecondaryCmdJob job = pass_job(scene, false);
+		MockCmdBuffer buffer;
+		job.cmdBuffer = buffer.handle();
+		job.draw_end = scene.drawList.size();
+		for (int m = 0; m < 3; m++) {
+			DrawRecordTarget target = scene_target(scene, modes[m][0], modes[m][1]);
+			DrawRecordStats stats = recordDrawRange(job, target);
+			auto start = std::chrono::steady_clock::now();
+			for (int it = 0; it < iterations; it++) {
+				buffer = MockCmdBuffer{};
+				job.cmdBuffer = buffer.handle();
+				stats = recordDrawRange(job, target);
+			}
+			float ms = ms_since(start) / iterations;
+			std::cout << meshes << " meshes, " << mode_names[m] << ": " << ms * 10000.0f / stats.draws << " ms per 10k draws, "
+				<< stats.drawCalls << " draw calls\n";
+			CHECK(stats.draws == MAX_OBJECTS);
+			CHECK(ms < DRAWS_BUDGET_MS);
+		}
+	}
+}
+
+int main()
+{
+	test_every_object_drawn();
+	test_shadow_pass();
+	test_parallel_record();
+	test_record_time();
+	return test_result("draw_record_test");
+}
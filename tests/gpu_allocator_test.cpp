@@ -0,0 +1,288 @@
+#include "test_common.h"
+#include "GPUAllocator.h"
+
+#include <map>
+#include <stdexcept>
+
+// the allocator is built into this test on its own, these stand in for the driver. Every allocation gets host memory
+// behind it so mapped ranges can be written, fail_above makes allocations bigger than it fail like a full heap would
+static std::map<VkDeviceMemory, std::vector<char>> mock_memory;
+static uint64_t mock_next_handle = 1;
+static VkDeviceSize fail_above = ~VkDeviceSize(0);
+static size_t mock_allocs = 0;
+static size_t mock_maps = 0;
+
+VKAPI_ATTR VkResult VKAPI_CALL vkAllocateMemory(VkDevice device, const VkMemoryAllocateInfo* pAllocateInfo, const VkAllocationCallbacks* pAllocator, VkDeviceMemory* pMemory)
+{
+	if (pAllocateInfo->allocationSize > fail_above) return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	*pMemory = (VkDeviceMemory)(mock_next_handle++);
+	mock_memory[*pMemory].resize(size_t(pAllocateInfo->allocationSize));
+	mock_allocs++;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkFreeMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks* pAllocator)
+{
+	mock_memory.erase(memory);
+}
+
+VKAPI_ATTR VkResult VKAPI_CALL vkMapMemory(VkDevice device, VkDeviceMemory memory, VkDeviceSize offset, VkDeviceSize size, VkMemoryMapFlags flags, void** ppData)
+{
+	*ppData = mock_memory[memory].data() + offset;
+	mock_maps++;
+	return VK_SUCCESS;
+}
+
+VKAPI_ATTR void VKAPI_CALL vkUnmapMemory(VkDevice device, VkDeviceMemory memory)
+{
+	mock_maps--;
+}
+
+// a discrete GPU's usual types: device local, host visible and coherent for uploads, host cached for readback
+static VkPhysicalDeviceMemoryProperties mock_mem_props()
+{
+	VkPhysicalDeviceMemoryProperties props{};
+	props.memoryHeapCount = 2;
+	props.memoryHeaps[0] = { VkDeviceSize(1) << 33, VK_MEMORY_HEAP_DEVICE_LOCAL_BIT };
+	props.memoryHeaps[1] = { VkDeviceSize(1) << 34, 0 };
+	props.memoryTypeCount = 3;
+	props.memoryTypes[0] = { VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0 };
+	props.memoryTypes[1] = { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 1 };
+	props.memoryTypes[2] = { VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 1 };
+	return props;
+}
+
+static VkMemoryRequirements reqs(VkDeviceSize size, VkDeviceSize alignment, uint32_t typeBits = 0x7)
+{
+	VkMemoryRequirements memReqs{};
+	memReqs.size = size;
+	memReqs.alignment = alignment;
+	memReqs.memoryTypeBits = typeBits;
+	return memReqs;
+}
+
+static void test_buddy_split_merge()
+{
+	BuddyRanges buddy(4096, 256);
+	VkDeviceSize offset, rounded;
+	CHECK(buddy.largest_free() == 4096);
+
+	// the first range splits the block down to 256, the buddies of every level stay free
+	CHECK(buddy.alloc(256, 1, offset, rounded));
+	CHECK(offset == 0 && rounded == 256);
+	CHECK(buddy.largest_free() == 2048);
+	// a 300 byte range takes the free 512 buddy, a 256 one the free 256 buddy
+	CHECK(buddy.alloc(300, 1, offset, rounded));
+	CHECK(offset == 512 && rounded == 512);
+	CHECK(buddy.alloc(200, 1, offset, rounded));
+	CHECK(offset == 256 && rounded == 256);
+	CHECK(buddy.used == 1024 && buddy.count == 3);
+	CHECK(buddy.largest_free() == 2048);
+
+	// more than the block never fits, the rest of it does once
+	CHECK(!buddy.alloc(4097, 1, offset, rounded));
+	CHECK(buddy.alloc(2000, 1, offset, rounded));
+	CHECK(offset == 2048 && rounded == 2048);
+	CHECK(!buddy.alloc(2048, 1, offset, rounded));
+	CHECK(buddy.alloc(1024, 1, offset, rounded));
+	CHECK(offset == 1024 && buddy.used == 4096);
+	CHECK(buddy.largest_free() == 0);
+	CHECK(!buddy.alloc(1, 1, offset, rounded));
+
+	// freeing 0 alone can't merge, its buddy at 256 is live. Freeing 256 too merges up to the live 512 range
+	buddy.free(2048);
+	buddy.free(1024);
+	buddy.free(0);
+	CHECK(buddy.largest_free() == 2048);
+	buddy.free(256);
+	CHECK(buddy.alloc(512, 1, offset, rounded));
+	CHECK(offset == 0);
+	buddy.free(0);
+	buddy.free(512);
+	CHECK(buddy.used == 0 && buddy.count == 0);
+	CHECK(buddy.largest_free() == 4096);
+	// freeing an offset that isn't live does nothing
+	buddy.free(768);
+	CHECK(buddy.largest_free() == 4096 && buddy.count == 0);
+	CHECK(buddy.alloc(4096, 1, offset, rounded));
+	CHECK(offset == 0 && rounded == 4096);
+}
+
+static void test_alignment_rounding()
+{
+	// buddy ranges sit at multiples of their size, an alignment bigger than the size rounds the size up to it
+	BuddyRanges buddy(1 << 16, 256);
+	VkDeviceSize offset, rounded;
+	CHECK(buddy.alloc(256, 1, offset, rounded));
+	CHECK(buddy.alloc(100, 4096, offset, rounded));
+	CHECK(offset == 4096 && rounded == 4096);
+	CHECK(buddy.alloc(5000, 256, offset, rounded));
+	CHECK(offset % 8192 == 0 && rounded == 8192);
+
+	// linear ranges pad the start up to the alignment
+	LinearRanges linear(1 << 16);
+	CHECK(linear.alloc(100, 256, offset));
+	CHECK(offset == 0);
+	CHECK(linear.alloc(10, 1024, offset));
+	CHECK(offset == 1024 && linear.head == 1034);
+	CHECK(linear.alloc(10, 4, offset));
+	CHECK(offset == 1036);
+	CHECK(!linear.alloc(1 << 16, 1, offset));
+
+	GPUAllocator allocator(VK_NULL_HANDLE, mock_mem_props(), 64);
+	allocator.BUDDY_BLOCK_SIZE = 1 << 20;
+	allocator.LINEAR_BLOCK_SIZE = 1 << 20;
+	GPUMemoryRange small = allocator.allocate(reqs(64, 16), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	GPUMemoryRange aligned = allocator.allocate(reqs(64, 65536), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	CHECK(aligned.memory == small.memory);
+	CHECK(aligned.offset % 65536 == 0 && aligned.offset != small.offset);
+	GPUMemoryRange lsmall = allocator.allocate(reqs(64, 16), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, false, PRISM_ALLOC_LINEAR);
+	GPUMemoryRange laligned = allocator.allocate(reqs(64, 65536), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, false, PRISM_ALLOC_LINEAR);
+	CHECK(laligned.memory == lsmall.memory);
+	CHECK(laligned.offset == 65536);
+	CHECK((char*)laligned.mapped - (char*)lsmall.mapped == 65536);
+}
+
+static void test_non_coherent_atom_minimum()
+{
+	// two small ranges of a non-coherent type must not share an atom, flushing one would write the other.
+	// The atom is a power of two, this one is above the default minimum
+	const VkDeviceSize atom = 512;
+	GPUAllocator allocator(VK_NULL_HANDLE, mock_mem_props(), atom);
+	allocator.BUDDY_BLOCK_SIZE = 1 << 20;
+	allocator.LINEAR_BLOCK_SIZE = 1 << 20;
+	CHECK(allocator.MIN_RANGE_SIZE == atom);
+	for (int strategy : { PRISM_ALLOC_BUDDY, PRISM_ALLOC_LINEAR }) {
+		GPUMemoryRange a = allocator.allocate(reqs(1, 1), VK_MEMORY_PROPERTY_HOST_CACHED_BIT, false, strategy);
+		GPUMemoryRange b = allocator.allocate(reqs(1, 1), VK_MEMORY_PROPERTY_HOST_CACHED_BIT, false, strategy);
+		CHECK(a.memory == b.memory);
+		CHECK(a.size >= atom && b.size >= atom);
+		CHECK(a.offset % allocator.MIN_RANGE_SIZE == 0 && b.offset % allocator.MIN_RANGE_SIZE == 0);
+		CHECK(a.offset / atom != b.offset / atom);
+		CHECK((a.offset + a.size - 1) / atom < b.offset / atom || (b.offset + b.size - 1) / atom < a.offset / atom);
+	}
+	// an atom smaller than the minimum keeps the minimum
+	GPUAllocator small_atoms(VK_NULL_HANDLE, mock_mem_props(), 64);
+	CHECK(small_atoms.MIN_RANGE_SIZE == 256);
+}
+
+static void test_linear_reset_on_last_free()
+{
+	LinearRanges linear(1 << 16);
+	VkDeviceSize a, b, c;
+	CHECK(linear.alloc(1000, 256, a));
+	CHECK(linear.alloc(1000, 256, b));
+	CHECK(linear.alloc(1000, 256, c));
+	// bump ranges don't reuse holes, only the last free rewinds the head
+	linear.free(b);
+	linear.free(a);
+	CHECK(linear.head == c + 1000 && linear.count == 1);
+	linear.free(c);
+	CHECK(linear.head == 0 && linear.count == 0);
+	CHECK(linear.alloc(10, 256, a));
+	CHECK(a == 0);
+
+	// staging ranges cycle through the same block without new device allocations
+	GPUAllocator allocator(VK_NULL_HANDLE, mock_mem_props(), 64);
+	allocator.LINEAR_BLOCK_SIZE = 1 << 20;
+	size_t allocs_before = mock_allocs;
+	VkDeviceMemory first_memory = VK_NULL_HANDLE;
+	for (int round = 0; round < 100; round++) {
+		std::vector<GPUMemoryRange> staging;
+		for (int i = 0; i < 3; i++) {
+			staging.push_back(allocator.allocate(reqs(100000, 4), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false, PRISM_ALLOC_LINEAR));
+		}
+		if (round == 0) first_memory = staging[0].memory;
+		CHECK(staging[0].memory == first_memory && staging[0].offset == 0);
+		for (GPUMemoryRange& range : staging) allocator.free(range.memory, range.offset);
+	}
+	CHECK(mock_allocs - allocs_before == 1);
+	GPUAllocatorStats stats = allocator.getStats();
+	CHECK(stats.blocks == 1 && stats.live_sub_allocs == 0 && stats.used_bytes == 0);
+}
+
+static void test_find_memory_type()
+{
+	GPUAllocator allocator(VK_NULL_HANDLE, mock_mem_props(), 64);
+	CHECK(allocator.findMemoryType(0x7, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 0);
+	CHECK(allocator.findMemoryType(0x7, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 1);
+	// the first type with all the flags that the resource allows
+	CHECK(allocator.findMemoryType(0x4, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 2);
+	CHECK(allocator.findMemoryType(0x7, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT) == 2);
+
+	// no type has the flags, or none of the ones that do is allowed
+	bool threw = false;
+	try {
+		allocator.findMemoryType(0x7, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+	}
+	catch (std::runtime_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+	threw = false;
+	size_t allocs_before = mock_allocs;
+	try {
+		allocator.allocate(reqs(256, 256, 0x1), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, false);
+	}
+	catch (std::runtime_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+	// nothing was allocated or counted for it
+	CHECK(mock_allocs == allocs_before);
+	GPUAllocatorStats stats = allocator.getStats();
+	CHECK(stats.blocks == 0 && stats.sub_allocs == 0);
+}
+
+static void test_blocks_and_dedicated()
+{
+	size_t live_before = mock_memory.size();
+	{
+		GPUAllocator allocator(VK_NULL_HANDLE, mock_mem_props(), 64);
+		allocator.BUDDY_BLOCK_SIZE = 1 << 20;
+		// buffers and images never share a block
+		GPUMemoryRange buffer = allocator.allocate(reqs(4096, 256), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+		GPUMemoryRange image = allocator.allocate(reqs(4096, 256), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true);
+		CHECK(buffer.memory != image.memory);
+		// more than half a block gets its own allocation
+		GPUMemoryRange big = allocator.allocate(reqs((1 << 19) + 1, 256), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+		CHECK(big.memory != buffer.memory && big.offset == 0 && big.size == VK_WHOLE_SIZE);
+		// a heap without room for a whole block still gets the resource
+		fail_above = 1 << 19;
+		GPUMemoryRange squeezed = allocator.allocate(reqs(4096, 256), VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, false);
+		fail_above = ~VkDeviceSize(0);
+		CHECK(squeezed.memory != VK_NULL_HANDLE && squeezed.size == VK_WHOLE_SIZE && squeezed.mapped != NULL);
+		GPUAllocatorStats stats = allocator.getStats();
+		CHECK(stats.dedicated == 2 && stats.blocks == 4);
+
+		// dedicated allocations go away when freed, the last empty block of a kind stays for the next resource
+		allocator.free(big.memory, big.offset);
+		allocator.free(squeezed.memory, squeezed.offset);
+		allocator.free(buffer.memory, buffer.offset);
+		stats = allocator.getStats();
+		CHECK(stats.dedicated == 0 && stats.blocks == 2);
+		// a second block of a kind is given back once it empties
+		std::vector<GPUMemoryRange> fill;
+		for (int i = 0; i < 3; i++) fill.push_back(allocator.allocate(reqs(1 << 19, 256), VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false));
+		CHECK(allocator.getStats().blocks == 3);
+		allocator.free(fill[2].memory, fill[2].offset);
+		CHECK(allocator.getStats().blocks == 2);
+		allocator.free(fill[0].memory, fill[0].offset);
+		allocator.free(fill[1].memory, fill[1].offset);
+		allocator.free(image.memory, image.offset);
+	}
+	// the destructor gives back and unmaps everything
+	CHECK(mock_memory.size() == live_before);
+	CHECK(mock_maps == 0);
+}
+
+int main()
+{
+	test_buddy_split_merge();
+	test_alignment_rounding();
+	test_non_coherent_atom_minimum();
+	test_linear_reset_on_last_free();
+	test_find_memory_type();
+	test_blocks_and_dedicated();
+	return test_result("gpu_allocator_test");
+}
@@ -0,0 +1,190 @@
+#include "test_common.h"
+#include "LevelReload.h"
+#include "PrismPhysics.h"
+
+#include <sstream>
+#include <filesystem>
+
+// a reload that changes one object has to fit in a frame even in a big level
+const size_t LEVEL_OBJECTS = 10000;
+const float APPLY_BUDGET_MS = 16.0f;
+
+static std::string box_line(size_t i, float height)
+{
+	std::ostringstream ls;
+	ls << "CUVH 0.1 1 " << float(i % 100) * 3.0f << " " << height << " " << float(i / 100) * 3.0f
+		<< " 1 0 0 0 0 1 2 2 2 #box" << i;
+	return ls.str();
+}
+
+static std::vector<LevelEntity> write_and_read(const std::vector<std::string>& lines)
+{
+	std::string path = (std::filesystem::temp_directory_path() / "prism_level_reload_test.txt").string();
+	std::ofstream fw(path, std::ios::binary);
+	for (const std::string& line : lines) fw << line << "\n";
+	fw.close();
+	return readLevelEntities(path);
+}
+
+// what LogicManager::addLevelEntity does for a CUVH line
+static void place_box(PrismPhysics* phy, LevelEntity& ent, int slot)
+{
+	std::istringstream lss(ent.lines[0].substr(4));
+	float thickness, friction, ulen, vlen, tlen;
+	glm::vec3 c, u, v;
+	lss >> thickness >> friction >> c.x >> c.y >> c.z >> u.x >> u.y >> u.z >> v.x >> v.y >> v.z >> ulen >> vlen >> tlen;
+	PolyCollMesh* pcm = PrismPhysics::gen_pcmesh(c, u, v, ulen, vlen, tlen, thickness, friction);
+	if (slot < 0) {
+		phy->add_pcmesh(pcm);
+		ent.slot = int(phy->lmeshes->size() - 1);
+	}
+	else {
+		phy->replace_pcmesh(slot, pcm);
+	}
+}
+
+static void add_slide_anim(PrismPhysics* phy, size_t slot, std::string name)
+{
+	BoneAnimData bad;
+	bad.name = name;
+	for (int i = 0; i < 4; i++) {
+		BoneAnimStep step;
+		step.stepduration_ms = 50;
+		step.initPos = glm::vec3(float(i), 0, 0);
+		step.finalPos = glm::vec3(float(i + 1), 0, 0);
+		bad.steps.push_back(step);
+		bad.total_time += step.stepduration_ms;
+	}
+	bad.events.push_back({ 10, "sound:" + name });
+	for (PolyCollMesh* pm : { phy->lmeshes->at(slot), phy->lmeshes_future->at(slot) }) {
+		pm->anims[name] = bad;
+		pm->running_anims.push_back(name);
+	}
+	phy->compile_anims(slot);
+}
+
+static void test_one_change_in_big_level()
+{
+	PrismPhysics* phy = new PrismPhysics();
+	phy->add_pcmesh(PrismPhysics::gen_pcmesh(glm::vec3(0, 20, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1), 1, 1, 1, 0.1f, 1), true);
+
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < LEVEL_OBJECTS; i++) lines.push_back(box_line(i, 0));
+	std::vector<LevelEntity> ents = write_and_read(lines);
+	CHECK(ents.size() == LEVEL_OBJECTS);
+	for (LevelEntity& ent : ents) place_box(phy, ent, -1);
+
+	lines[LEVEL_OBJECTS / 2] = box_line(LEVEL_OBJECTS / 2, 5);
+	std::vector<LevelEntity> new_ents = write_and_read(lines);
+
+	std::chrono::steady_clock::time_point tstart = std::chrono::steady_clock::now();
+	LevelDiff diff = diffLevelEntities(ents, new_ents);
+	for (auto& oi_ni : diff.changed) place_box(phy, new_ents[oi_ni.second], new_ents[oi_ni.second].slot);
+	float apply_ms = ms_since(tstart);
+	std::cout << "one changed object of " << LEVEL_OBJECTS << ": diff+apply " << apply_ms << "ms\n";
+
+	CHECK(diff.changed.size() == 1);
+	CHECK(diff.added.empty());
+	CHECK(diff.removed.empty());
+	CHECK(!diff.lights_changed);
+	CHECK(diff.changed.size() == 1 && new_ents[diff.changed[0].second].slot == int(LEVEL_OBJECTS / 2));
+	CHECK(phy->lmeshes->at(LEVEL_OBJECTS / 2)->_center.y == 5.0f);
+	CHECK(apply_ms < APPLY_BUDGET_MS);
+	delete phy;
+}
+
+static void test_removed_slot_is_skipped()
+{
+	PrismPhysics* phy = new PrismPhysics();
+	phy->add_pcmesh(PrismPhysics::gen_pcmesh(glm::vec3(0, 20, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1), 1, 1, 1, 0.1f, 1), true);
+
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < 10; i++) lines.push_back(box_line(i, 0));
+	std::vector<LevelEntity> ents = write_and_read(lines);
+	for (LevelEntity& ent : ents) place_box(phy, ent, -1);
+
+	lines.erase(lines.begin() + 3);
+	std::vector<LevelEntity> new_ents = write_and_read(lines);
+	LevelDiff diff = diffLevelEntities(ents, new_ents);
+	CHECK(diff.removed.size() == 1);
+	CHECK(diff.changed.empty());
+	if (diff.removed.size() != 1) {
+		delete phy;
+		return;
+	}
+	int slot = ents[diff.removed[0]].slot;
+	CHECK(slot == 3);
+	phy->deactivate_pcmesh(slot);
+
+	// slots of the other meshes don't move, kept entities keep theirs
+	CHECK(phy->lmeshes->size() == 10);
+	CHECK(phy->lmesh_inactive[slot]);
+	CHECK(new_ents[3].slot == 4);
+
+	// the step loop and the cache rebuild leave the slot's separating plane cache alone
+	phy->dl_ccache[0][slot].sep_plane_idx = 777;
+	phy->run_physics(20);
+	CHECK(phy->dl_ccache[0][slot].sep_plane_idx == 777);
+	CHECK(!phy->find_ray_first_coll(glm::vec3(9, 10, 0), glm::vec3(0, -1, 0)).will_collide);
+	CHECK(phy->find_ray_first_coll(glm::vec3(6, 10, 0), glm::vec3(0, -1, 0)).will_collide);
+
+	// filling the slot again brings it back
+	place_box(phy, ents[diff.removed[0]], slot);
+	CHECK(!phy->lmesh_inactive[slot]);
+	CHECK(phy->dl_ccache[0][slot].sep_plane_idx != 777);
+	delete phy;
+}
+
+static void test_anims_reclaimed_on_reload()
+{
+	PrismPhysics* phy = new PrismPhysics();
+	phy->add_pcmesh(PrismPhysics::gen_pcmesh(glm::vec3(0, 20, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1), 1, 1, 1, 0.1f, 1), true);
+
+	std::vector<std::string> lines = { box_line(0, 0), box_line(1, 0) };
+	std::vector<LevelEntity> ents = write_and_read(lines);
+	for (LevelEntity& ent : ents) place_box(phy, ent, -1);
+	add_slide_anim(phy, 0, "keep");
+	add_slide_anim(phy, 1, "reload0");
+	size_t live_segs = phy->anim_segs.size();
+
+	for (int r = 1; r <= 200; r++) {
+		place_box(phy, ents[1], 1);
+		add_slide_anim(phy, 1, "reload" + std::to_string(r));
+		phy->run_physics(3);
+	}
+	// two live tracks, garbage is compacted once it reaches half the arrays
+	CHECK(phy->anim_tracks.size() <= 4);
+	CHECK(phy->anim_segs.size() <= 2 * live_segs);
+	CHECK(phy->anim_events.size() <= 4);
+	for (size_t i = 0; i < 2; i++) {
+		CHECK(phy->lmeshes_future->at(i)->running_anim >= 0);
+		CHECK(phy->lmeshes_future->at(i)->running_anim < int(phy->anim_tracks.size()));
+	}
+
+	// events fired before a compaction still name the event they were fired for
+	phy->take_anim_events();
+	place_box(phy, ents[1], 1);
+	add_slide_anim(phy, 1, "last");
+	phy->run_physics(20);
+	bool keep_fired = false, last_fired = false;
+	for (FiredAnimEvent& fae : phy->take_anim_events()) {
+		if (fae.lmesh == 0 && fae.name == "sound:keep") keep_fired = true;
+		if (fae.lmesh == 1 && fae.name == "sound:last") last_fired = true;
+	}
+	CHECK(last_fired);
+	// the kept mesh's anim loops every 200ms and was renumbered, it keeps firing its own event
+	phy->run_physics(200);
+	for (FiredAnimEvent& fae : phy->take_anim_events()) {
+		if (fae.lmesh == 0 && fae.name == "sound:keep") keep_fired = true;
+	}
+	CHECK(keep_fired);
+	delete phy;
+}
+
+int main()
+{
+	test_one_change_in_big_level();
+	test_removed_slot_is_skipped();
+	test_anims_reclaimed_on_reload();
+	return test_result("level_reload_test");
+}
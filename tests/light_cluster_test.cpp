@@ -0,0 +1,210 @@
+#include "test_common.h"
+#include "LightClusters.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <random>
+
+// binning 65536 lights once on three threads, the renderer does it every frame
+#ifdef NDEBUG
+const double BIN_BUDGET_MS = 100.0;
+#else
+const double BIN_BUDGET_MS = 400.0;
+#endif
+const uint32_t THREADS = 3;
+
+// looking down a long field of lights
+static ClusterView field_view()
+{
+	ClusterView view;
+	view.camPos = glm::vec3(0, 10, 0);
+	view.camDir = glm::normalize(glm::vec3(0, -0.2f, -1));
+	view.farPlane = 1000;
+	view.viewproj = glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.01f, view.farPlane) * glm::lookAt(view.camPos, view.camPos + view.camDir, glm::vec3(0, 1, 0));
+	return view;
+}
+
+static GPULight make_light(glm::vec3 pos, float radius, int flags = PRISM_LIGHT_EMISSIVE_FLAG)
+{
+	GPULight light;
+	light.pos = glm::vec4(pos, 1);
+	light.color = glm::vec4(1);
+	light.props.y = radius;
+	light.flags.x = flags;
+	return light;
+}
+
+static std::vector<GPULight> light_field(size_t n, std::minstd_rand& rng)
+{
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<GPULight> lights;
+	lights.reserve(n);
+	for (size_t i = 0; i < n; i++) {
+		glm::vec3 pos = glm::vec3(600 * unit(rng) - 300, 40 * unit(rng), -620 * unit(rng) + 20);
+		lights.push_back(make_light(pos, 5 + 20 * unit(rng)));
+	}
+	return lights;
+}
+
+static std::vector<uint32_t> cluster_list(const LightClusterer& lc, size_t c)
+{
+	const uint32_t* list = lc.indices.data() + lc.ranges[c].x;
+	return std::vector<uint32_t>(list, list + lc.ranges[c].y);
+}
+
+// clusters whose list differs from the reference, ranges that run past indices count as differing
+static size_t differing_lists(const LightClusterer& lc, const std::vector<std::vector<uint32_t>>& ref)
+{
+	size_t differing = 0;
+	for (size_t c = 0; c < LIGHT_CLUSTER_COUNT; c++) {
+		if (size_t(lc.ranges[c].x) + lc.ranges[c].y > lc.indices.size() || cluster_list(lc, c) != ref[c]) differing++;
+	}
+	return differing;
+}
+
+static void test_against_reference()
+{
+	SimpleThreadPooler pool(THREADS);
+	pool.run();
+	LightClusterer lc(&pool, THREADS);
+	ClusterView view = field_view();
+	std::minstd_rand rng(11);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	for (size_t n : { 1, 7, 256, 1024, 4096 }) {
+		std::vector<GPULight> lights = light_field(n, rng);
+		std::vector<std::vector<uint32_t>> ref = LightClusterer::binReference(view, lights.data(), n);
+		size_t ref_total = 0;
+		for (auto& list : ref) ref_total += list.size();
+
+		// the SSE and the scalar plane tests have to agree with the reference list for list
+		for (bool simd : { true, false }) {
+			lc.use_simd = simd;
+			lc.bin(view, lights.data(), n);
+			CHECK(lc.droppedIndices == 0);
+			CHECK(lc.indices.size() == ref_total);
+			CHECK(differing_lists(lc, ref) == 0);
+		}
+
+		// every light reaching a point on screen has to be in the list of the point's cluster
+		size_t missed = 0, checked = 0;
+		for (int p = 0; p < 2000; p++) {
+			glm::vec3 pos = glm::vec3(600 * unit(rng) - 300, 40 * unit(rng), -620 * unit(rng) + 20);
+			glm::vec4 clip = view.viewproj * glm::vec4(pos, 1.0f);
+			float depth = glm::dot(pos - view.camPos, view.camDir);
+			if (clip.w <= 0 || std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w || depth > view.farPlane) continue;
+			std::vector<uint32_t> list = cluster_list(lc, LightClusterer::clusterIndex(view, pos));
+			for (uint32_t i = 0; i < n; i++) {
+				if (glm::length(glm::vec3(lights[i].pos) - pos) >= lights[i].props.y) continue;
+				checked++;
+				if (std::find(list.begin(), list.end(), i) == list.end()) missed++;
+			}
+		}
+		std::cout << n << " lights: " << float(lc.indices.size()) / LIGHT_CLUSTER_COUNT << " lights per cluster, " << missed
+			<< " of " << checked << " lit points missed\n";
+		CHECK(missed == 0);
+	}
+}
+
+static void test_special_lights()
+{
+	SimpleThreadPooler pool(THREADS);
+	pool.run();
+	LightClusterer lc(&pool, THREADS);
+	ClusterView view = field_view();
+	glm::vec3 ahead = view.camPos + view.camDir * 50.0f;
+	std::vector<GPULight> lights = {
+		// no diffuse contribution, no range, fully behind the eye and fully past the far plane touch nothing
+		make_light(ahead, 10, PRISM_LIGHT_SHADOW_FLAG),
+		make_light(ahead, 0),
+		make_light(view.camPos - view.camDir * 30.0f, 10),
+		make_light(view.camPos + view.camDir * 1020.0f, 10),
+		// reaching across the eye, every tile of the near slices
+		make_light(view.camPos - view.camDir * 2.0f, 6),
+		// in front of the camera, a handful of tiles
+		make_light(ahead, 3),
+	};
+	for (bool simd : { true, false }) {
+		lc.use_simd = simd;
+		lc.bin(view, lights.data(), lights.size());
+		CHECK(differing_lists(lc, LightClusterer::binReference(view, lights.data(), lights.size())) == 0);
+		size_t per_light[6] = { 0, 0, 0, 0, 0, 0 };
+		for (uint32_t i : lc.indices) per_light[i]++;
+		CHECK(per_light[0] == 0 && per_light[1] == 0 && per_light[2] == 0 && per_light[3] == 0);
+		CHECK(per_light[4] >= LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y);
+		bool every_tile = true;
+		for (size_t c = 0; c < LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y; c++) every_tile = every_tile && cluster_list(lc, c) == std::vector<uint32_t>{ 4 };
+		CHECK(every_tile);
+		CHECK(per_light[5] > 0 && per_light[5] < LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y);
+		std::vector<uint32_t> center = cluster_list(lc, LightClusterer::clusterIndex(view, ahead));
+		CHECK(std::find(center.begin(), center.end(), 5u) != center.end());
+	}
+}
+
+static void test_truncation()
+{
+	SimpleThreadPooler pool(THREADS);
+	pool.run();
+	LightClusterer lc(&pool, THREADS);
+	ClusterView view = field_view();
+	std::minstd_rand rng(5);
+	std::vector<GPULight> lights = light_field(1024, rng);
+	lc.bin(view, lights.data(), lights.size());
+	std::vector<std::vector<uint32_t>> full(LIGHT_CLUSTER_COUNT);
+	for (size_t c = 0; c < LIGHT_CLUSTER_COUNT; c++) full[c] = cluster_list(lc, c);
+	size_t total = lc.indices.size();
+
+	// a full index buffer keeps the start of the lists, clusters past it come out empty
+	lc.max_indices = total / 3;
+	lc.bin(view, lights.data(), lights.size());
+	CHECK(lc.indices.size() == total / 3 && lc.droppedIndices == total - total / 3);
+	bool prefixes = true;
+	size_t kept = 0;
+	for (size_t c = 0; c < LIGHT_CLUSTER_COUNT; c++) {
+		glm::uvec2 range = lc.ranges[c];
+		prefixes = prefixes && size_t(range.x) + range.y <= lc.indices.size() && range.y <= full[c].size();
+		if (!prefixes) break;
+		std::vector<uint32_t> list = cluster_list(lc, c);
+		prefixes = std::equal(list.begin(), list.end(), full[c].begin());
+		kept += range.y;
+	}
+	CHECK(prefixes);
+	CHECK(kept == lc.indices.size());
+
+	// and the next frame with room again is whole
+	lc.max_indices = SIZE_MAX;
+	lc.bin(view, lights.data(), lights.size());
+	CHECK(lc.droppedIndices == 0 && differing_lists(lc, full) == 0);
+}
+
+static void test_throughput()
+{
+	SimpleThreadPooler pool(THREADS);
+	pool.run();
+	LightClusterer lc(&pool, THREADS);
+	ClusterView view = field_view();
+	std::minstd_rand rng(3);
+	const size_t n = 65536;
+	const int iterations = 10;
+	std::vector<GPULight> lights = light_field(n, rng);
+	double ms[2];
+	for (int run = 0; run < 2; run++) {
+		lc.use_simd = run == 0;
+		lc.bin(view, lights.data(), n);
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++) lc.bin(view, lights.data(), n);
+		ms[run] = ms_since(start) / iterations;
+	}
+	uint32_t longest = 0;
+	for (const glm::uvec2& range : lc.ranges) longest = std::max(longest, range.y);
+	std::cout << n << " lights binned in " << ms[0] << " ms (scalar " << ms[1] << " ms), longest list " << longest << "\n";
+	CHECK(ms[0] < BIN_BUDGET_MS);
+}
+
+int main()
+{
+	test_against_reference();
+	test_special_lights();
+	test_truncation();
+	test_throughput();
+	return test_result("light_cluster_test");
+}
@@ -0,0 +1,218 @@
+#include "test_common.h"
+#include "test_meshes.h"
+#include "MeshProcessing.h"
+
+#include <map>
+#include <cmath>
+
+// simplifying the 16k triangle sphere down three levels, generous for an unoptimized build
+const double SIMPLIFY_BUDGET_MS = 5000.0;
+
+static Mesh sphere_mesh(uint32_t rings, uint32_t segments, float radius)
+{
+	Mesh mesh;
+	mesh.add_vertices(sphere_corners(rings, segments, radius));
+	return mesh;
+}
+
+static std::vector<size_t> halving_targets(size_t index_count, uint32_t levels)
+{
+	std::vector<size_t> targets;
+	for (uint32_t l = 1; l <= levels; l++) targets.push_back(((index_count / 3) >> l) * 3);
+	return targets;
+}
+
+// every edge, by position, has to be shared by exactly two triangles
+static bool closed_surface(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices)
+{
+	auto key = [&vertices](uint32_t v) { return std::make_tuple(vertices[v].pos.x, vertices[v].pos.y, vertices[v].pos.z); };
+	std::map<std::pair<std::tuple<float, float, float>, std::tuple<float, float, float>>, int> edges;
+	for (size_t ci = 0; ci < indices.size(); ci++) {
+		auto a = key(indices[ci]), b = key(indices[ci % 3 == 2 ? ci - 2 : ci + 1]);
+		edges[std::make_pair(std::min(a, b), std::max(a, b))]++;
+	}
+	for (auto& edge : edges) {
+		if (edge.second != 2) return false;
+	}
+	return true;
+}
+
+static void test_sphere_levels()
+{
+	const float radius = 2.0f;
+	Mesh mesh = sphere_mesh(64, 128, radius);
+	std::vector<size_t> targets = halving_targets(mesh._indices.size(), 3);
+	std::vector<std::vector<uint32_t>> levels;
+	std::vector<float> errors;
+	auto start = std::chrono::steady_clock::now();
+	meshproc::simplify(mesh._vertices, mesh._indices, targets, levels, errors);
+	double ms = ms_since(start);
+	std::cout << "simplified " << mesh._indices.size() / 3 << " triangles to";
+	for (auto& level : levels) std::cout << " " << level.size() / 3;
+	std::cout << " in " << ms << " ms\n";
+	CHECK(ms < SIMPLIFY_BUDGET_MS);
+
+	CHECK(levels.size() == targets.size() && errors.size() == levels.size());
+	float last_error = 0;
+	for (size_t l = 0; l < levels.size(); l++) {
+		const std::vector<uint32_t>& level = levels[l];
+		CHECK(level.size() % 3 == 0 && level.size() <= targets[l] && level.size() > targets[l] / 2);
+		CHECK(errors[l] >= last_error);
+		last_error = errors[l];
+
+		// vertices only move onto neighbours, so a level indexes the input and stays closed and outward facing
+		bool in_range = true, outward = true, across_seam = false;
+		float deviation = 0;
+		for (size_t t = 0; t < level.size() / 3 && in_range; t++) {
+			uint32_t i0 = level[t * 3], i1 = level[t * 3 + 1], i2 = level[t * 3 + 2];
+			in_range = i0 < mesh._vertices.size() && i1 < mesh._vertices.size() && i2 < mesh._vertices.size();
+			if (!in_range) break;
+			const Vertex& a = mesh._vertices[i0];
+			const Vertex& b = mesh._vertices[i1];
+			const Vertex& c = mesh._vertices[i2];
+			glm::vec3 center = (a.pos + b.pos + c.pos) / 3.0f;
+			outward = outward && glm::dot(glm::cross(b.pos - a.pos, c.pos - a.pos), center) > 0;
+			// corners keep their side of the u = 0 / u = 1 seam
+			float umin = std::min(a.texCoord.x, std::min(b.texCoord.x, c.texCoord.x));
+			float umax = std::max(a.texCoord.x, std::max(b.texCoord.x, c.texCoord.x));
+			across_seam = across_seam || umax - umin > 0.5f;
+			// the centroid is where a flat triangle strays furthest inside the sphere
+			deviation = std::max(deviation, radius - glm::length(center));
+		}
+		std::cout << "  level " << l + 1 << ": error " << errors[l] << ", deepest triangle center " << deviation << "\n";
+		CHECK(in_range);
+		CHECK(outward);
+		CHECK(!across_seam);
+		CHECK(closed_surface(mesh._vertices, level));
+		// the error is an RMS over planes, the worst spot can be a few times that but not more
+		CHECK(errors[l] > 0 && deviation < 4.0f * errors[l]);
+		// half the triangles of a smooth sphere can't cost more than a sliver of its radius
+		CHECK(errors[l] < 0.02f * radius);
+	}
+}
+
+static void test_flat_grid()
+{
+	// collapses inside a plane cost nothing, the locked border keeps the outline and the area
+	Mesh mesh;
+	mesh.add_vertices(grid_corners(40, 40));
+	std::vector<size_t> targets = halving_targets(mesh._indices.size(), 3);
+	std::vector<std::vector<uint32_t>> levels;
+	std::vector<float> errors;
+	meshproc::simplify(mesh._vertices, mesh._indices, targets, levels, errors);
+	CHECK(levels.size() == targets.size());
+	for (size_t l = 0; l < levels.size(); l++) {
+		CHECK(levels[l].size() <= targets[l]);
+		CHECK(errors[l] < 1e-4f);
+		float area = 0;
+		bool up = true;
+		for (size_t t = 0; t < levels[l].size() / 3; t++) {
+			glm::vec3 a = mesh._vertices[levels[l][t * 3]].pos;
+			glm::vec3 n = glm::cross(mesh._vertices[levels[l][t * 3 + 1]].pos - a, mesh._vertices[levels[l][t * 3 + 2]].pos - a);
+			up = up && n.y > 0;
+			area += 0.5f * n.y;
+		}
+		CHECK(up);
+		CHECK(std::abs(area - 1600.0f) < 1e-2f);
+	}
+
+	// a lone triangle has nothing that may collapse, no level comes out
+	std::vector<Vertex> quad = grid_corners(1, 1);
+	Mesh tri;
+	tri.add_vertices(std::vector<Vertex>(quad.begin(), quad.begin() + 3));
+	meshproc::simplify(tri._vertices, tri._indices, { 0 }, levels, errors);
+	CHECK(levels.empty() && errors.empty());
+}
+
+static void test_build_lods()
+{
+	Mesh mesh = sphere_mesh(32, 64, 1.0f);
+	size_t full_vertices = mesh._vertices.size(), full_indices = mesh._indices.size();
+	mesh.optimize_order();
+	mesh.build_lods();
+	CHECK(mesh._lods.size() == MAX_MESH_LODS);
+	CHECK(mesh._lods[0].firstIndex == 0 && mesh._lods[0].indexCount == full_indices && mesh._lods[0].error == 0);
+	// levels follow each other in the index buffer and each one's vertices follow the previous one's
+	uint32_t next_index = 0, vertex_floor = 0;
+	for (size_t l = 0; l < mesh._lods.size(); l++) {
+		const MeshLod& lod = mesh._lods[l];
+		CHECK(lod.firstIndex == next_index);
+		if (l > 0) {
+			CHECK(lod.indexCount <= mesh._lods[l - 1].indexCount * 4 / 5);
+			CHECK(lod.error >= mesh._lods[l - 1].error);
+		}
+		uint32_t vmin = UINT32_MAX, vmax = 0;
+		for (uint32_t i = lod.firstIndex; i < lod.firstIndex + lod.indexCount; i++) {
+			vmin = std::min(vmin, mesh._indices[i]);
+			vmax = std::max(vmax, mesh._indices[i]);
+		}
+		CHECK(vmin >= vertex_floor && vmax < mesh._vertices.size());
+		if (l == 0) CHECK(vmax + 1 == full_vertices);
+		vertex_floor = vmax + 1;
+		next_index += lod.indexCount;
+	}
+	CHECK(next_index == mesh._indices.size() && vertex_floor == mesh._vertices.size());
+
+	// a six triangle bipyramid collapses to nothing, no level may be drawn empty
+	Mesh tiny = sphere_mesh(2, 3, 1.0f);
+	tiny.build_lods();
+	CHECK(tiny._lods.size() >= 1 && tiny._lods.size() <= MAX_MESH_LODS);
+	for (const MeshLod& lod : tiny._lods) CHECK(lod.indexCount > 0);
+}
+
+static void test_lod_pick()
+{
+	MeshLod lods[MAX_MESH_LODS] = { { 0, 300, 0.0f }, { 300, 150, 0.01f }, { 450, 75, 0.04f }, { 525, 36, 0.2f } };
+	// 1 pixel of error allowed: 100 pixels per unit takes the 0.01 level, 25 the 0.04 one
+	CHECK(pickMeshLod(lods, 4, 1000.0f, 1.0f) == 0);
+	CHECK(pickMeshLod(lods, 4, 100.0f, 1.0f) == 1);
+	CHECK(pickMeshLod(lods, 4, 25.0f, 1.0f) == 2);
+	CHECK(pickMeshLod(lods, 4, 0.1f, 1.0f) == 3);
+	CHECK(pickMeshLod(lods, 2, 0.1f, 1.0f) == 1);
+	CHECK(pickMeshLod(lods, 1, 0.1f, 1.0f) == 0);
+	// a shadow view's bias allows more error, it never picks a finer level
+	CHECK(pickMeshLod(lods, 4, 100.0f, 4.0f) == 2);
+}
+
+static void test_triangles_submitted()
+{
+	// a row of unit spheres walking away from a 1080p camera with a 60 degree vertical fov, the gbuffer view and
+	// a shadow view of the same resolution. The pixels a mesh unit covers at the sphere's near side are what the
+	// renderer's culling hands pickMeshLod
+	Mesh mesh = sphere_mesh(32, 64, 1.0f);
+	mesh.optimize_order();
+	mesh.build_lods();
+	const float lod_scale = 0.5f * 1080.0f / std::tan(glm::radians(30.0f));
+	const float shadow_bias = 4.0f;
+	size_t full = 0, with_lods = 0, shadow = 0;
+	uint32_t last_lod = 0;
+	bool monotonic = true;
+	for (uint32_t i = 0; i < 200; i++) {
+		float depth = 3.0f + 1.5f * float(i) - 1.0f;
+		uint32_t lod = pickMeshLod(mesh._lods.data(), uint32_t(mesh._lods.size()), lod_scale / depth, 1.0f);
+		uint32_t shadow_lod = pickMeshLod(mesh._lods.data(), uint32_t(mesh._lods.size()), lod_scale / shadow_bias / depth, 1.0f);
+		monotonic = monotonic && lod >= last_lod && shadow_lod >= lod;
+		last_lod = lod;
+		full += mesh._lods[0].indexCount / 3;
+		with_lods += mesh._lods[lod].indexCount / 3;
+		shadow += mesh._lods[shadow_lod].indexCount / 3;
+	}
+	std::cout << "triangles for 200 spheres: " << full << " at LOD 0, " << with_lods << " with LODs, " << shadow
+		<< " in a shadow view\n";
+	CHECK(monotonic);
+	// the nearest ones are drawn in full, the far ones at the coarsest level
+	CHECK(pickMeshLod(mesh._lods.data(), uint32_t(mesh._lods.size()), lod_scale / 2.0f, 1.0f) == 0);
+	CHECK(last_lod == mesh._lods.size() - 1);
+	CHECK(with_lods < full / 4);
+	CHECK(shadow <= with_lods);
+}
+
+int main()
+{
+	test_sphere_levels();
+	test_flat_grid();
+	test_build_lods();
+	test_lod_pick();
+	test_triangles_submitted();
+	return test_result("mesh_lod_test");
+}
@@ -0,0 +1,275 @@
+#include "test_common.h"
+#include "test_meshes.h"
+#include "MeshProcessing.h"
+#include "MeshCooker.h"
+
+#include <set>
+#include <array>
+#include <random>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_set>
+
+static bool near(glm::vec3 a, glm::vec3 b, float eps = 1e-5f)
+{
+	return glm::length(a - b) < eps;
+}
+
+// triangles as the vertices they reference, rotated so the smallest corner comes first
+static std::multiset<std::array<uint32_t, 3>> triangle_set(const std::vector<uint32_t>& indices)
+{
+	std::multiset<std::array<uint32_t, 3>> tris;
+	for (size_t t = 0; t < indices.size() / 3; t++) {
+		std::array<uint32_t, 3> tri = { indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2] };
+		std::rotate(tri.begin(), std::min_element(tri.begin(), tri.end()), tri.end());
+		tris.insert(tri);
+	}
+	return tris;
+}
+
+static void test_tangent_frames()
+{
+	// u along +x and v along +z on a floor: the frame is the axes, the bitangent follows v
+	std::vector<Vertex> quad = grid_corners(1, 1);
+	meshproc::computeTangentFrames(quad, true);
+	float handedness = glm::dot(glm::cross(quad[0].normal, quad[0].tangent), quad[0].bitangent);
+	CHECK(std::abs(handedness) > 0.99f);
+	for (const Vertex& v : quad) {
+		CHECK(near(v.normal, glm::vec3(0, 1, 0)));
+		CHECK(near(v.tangent, glm::vec3(1, 0, 0)));
+		CHECK(near(v.bitangent, glm::vec3(0, 0, 1)));
+	}
+
+	// mirrored u flips the tangent, and with it the handedness of the frame
+	std::vector<Vertex> mirrored = grid_corners(1, 1);
+	for (Vertex& v : mirrored) v.texCoord.x = -v.texCoord.x;
+	meshproc::computeTangentFrames(mirrored, true);
+	for (const Vertex& v : mirrored) {
+		CHECK(near(v.tangent, glm::vec3(-1, 0, 0)));
+		CHECK(glm::dot(glm::cross(v.normal, v.tangent), v.bitangent) * handedness < 0);
+	}
+
+	// without face normals the file's normals stay, a tilted face still gets its own
+	std::vector<Vertex> tilted = grid_corners(1, 1, [](float x, float z) { return x; });
+	for (Vertex& v : tilted) v.normal = glm::vec3(0, 0, 1);
+	std::vector<Vertex> kept = tilted;
+	meshproc::computeTangentFrames(kept, false);
+	meshproc::computeTangentFrames(tilted, true);
+	for (size_t i = 0; i < tilted.size(); i++) {
+		CHECK(near(kept[i].normal, glm::vec3(0, 0, 1)));
+		CHECK(near(tilted[i].normal, glm::normalize(glm::vec3(-1, 1, 0))));
+		CHECK(near(tilted[i].tangent, glm::normalize(glm::vec3(1, 1, 0))));
+	}
+
+	// no UV gradient at all, any unit frame around the face normal
+	std::vector<Vertex> flat_uv = grid_corners(1, 1);
+	for (Vertex& v : flat_uv) v.texCoord = glm::vec2(0.5f);
+	meshproc::computeTangentFrames(flat_uv, true);
+	for (const Vertex& v : flat_uv) {
+		CHECK(std::isfinite(v.tangent.x) && std::isfinite(v.tangent.y) && std::isfinite(v.tangent.z));
+		CHECK(std::abs(glm::length(v.tangent) - 1.0f) < 1e-5f);
+		CHECK(std::abs(glm::dot(v.tangent, v.normal)) < 1e-5f);
+		CHECK(near(v.bitangent, glm::cross(v.normal, v.tangent)));
+	}
+}
+
+static void test_weld()
+{
+	// a flat grid has one frame everywhere, so every grid point is one vertex
+	std::vector<Vertex> corners = grid_corners(20, 10);
+	meshproc::computeTangentFrames(corners, true);
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	meshproc::weld(corners, vertices, indices);
+	CHECK(vertices.size() == 21 * 11);
+	CHECK(indices.size() == corners.size());
+
+	// nothing is lost or merged that differs, vertices come in order of first use
+	bool same = true, ordered = true;
+	uint32_t next = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		same = same && vertices[indices[i]] == corners[i];
+		if (indices[i] == next) next++;
+		else ordered = ordered && indices[i] < next;
+	}
+	CHECK(same);
+	CHECK(ordered);
+	std::unordered_set<Vertex> distinct(vertices.begin(), vertices.end());
+	CHECK(distinct.size() == vertices.size());
+
+	// a sphere with face normals shares nothing between faces, welding only merges corners of the same face
+	std::vector<Vertex> sphere = sphere_corners(12, 24, 1.0f);
+	meshproc::computeTangentFrames(sphere, true);
+	std::vector<Vertex> svertices;
+	std::vector<uint32_t> sindices;
+	meshproc::weld(sphere, svertices, sindices);
+	same = true;
+	for (size_t i = 0; i < sindices.size(); i++) same = same && svertices[sindices[i]] == sphere[i];
+	CHECK(same);
+	std::unordered_set<Vertex> sdistinct(sphere.begin(), sphere.end());
+	CHECK(svertices.size() == sdistinct.size());
+
+	// -0 and 0 are the same position
+	std::vector<Vertex> signed_zero(3, corners[0]);
+	signed_zero[1].pos.x = -0.0f;
+	signed_zero[2].pos.x = 0.0f;
+	signed_zero[0].pos.x = 1.0f;
+	std::vector<Vertex> zvertices;
+	std::vector<uint32_t> zindices;
+	meshproc::weld(signed_zero, zvertices, zindices);
+	CHECK(zvertices.size() == 2 && zindices[1] == zindices[2]);
+
+	// a second weld appends after what is there
+	size_t before = vertices.size();
+	meshproc::weld(signed_zero, vertices, indices);
+	CHECK(vertices.size() == before + 2);
+	CHECK(indices.back() == before + 1 && indices[indices.size() - 3] == before);
+}
+
+static void test_pool_matches_serial()
+{
+	// big enough to be split into several jobs, the jobs have to give the serial result bit for bit
+	std::vector<Vertex> corners = grid_corners(250, 100, [](float x, float z) { return std::sin(x * 0.3f) * std::cos(z * 0.2f); });
+	CHECK(corners.size() > 2 * meshproc::JOB_CORNERS);
+	std::vector<Vertex> serial = corners, pooled = corners;
+	SimpleThreadPooler pool(4);
+	pool.run();
+	meshproc::computeTangentFrames(serial, true);
+	meshproc::computeTangentFrames(pooled, true, &pool);
+	CHECK(memcmp(serial.data(), pooled.data(), serial.size() * sizeof(Vertex)) == 0);
+
+	std::vector<Vertex> svertices, pvertices;
+	std::vector<uint32_t> sindices, pindices;
+	meshproc::weld(serial, svertices, sindices);
+	meshproc::weld(pooled, pvertices, pindices, &pool);
+	CHECK(svertices.size() == pvertices.size() && sindices == pindices);
+	CHECK(memcmp(svertices.data(), pvertices.data(), svertices.size() * sizeof(Vertex)) == 0);
+}
+
+static void test_order_optimization()
+{
+	// frames are per face, only a flat grid shares its vertices between triangles
+	std::vector<Vertex> corners = grid_corners(60, 60);
+	meshproc::computeTangentFrames(corners, true);
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	meshproc::weld(corners, vertices, indices);
+
+	// triangles in random order, the way exporters tend to leave them
+	std::mt19937 rng(99);
+	std::vector<size_t> tri_order(indices.size() / 3);
+	for (size_t t = 0; t < tri_order.size(); t++) tri_order[t] = t;
+	std::shuffle(tri_order.begin(), tri_order.end(), rng);
+	std::vector<uint32_t> shuffled;
+	for (size_t t : tri_order) shuffled.insert(shuffled.end(), indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+	indices = shuffled;
+
+	float acmr_before = meshproc::acmr(indices, vertices.size());
+	auto tris_before = triangle_set(indices);
+	meshproc::optimizeTriangleOrder(vertices, indices);
+	float acmr_after = meshproc::acmr(indices, vertices.size());
+	std::cout << "60x60 grid ACMR " << acmr_before << " -> " << acmr_after << "\n";
+	// the same triangles with the same winding, much better cached
+	CHECK(triangle_set(indices) == tris_before);
+	CHECK(acmr_after < 0.8f * acmr_before);
+	CHECK(acmr_after < 1.0f);
+
+	std::vector<Vertex> old_vertices = vertices;
+	std::vector<uint32_t> old_indices = indices;
+	meshproc::optimizeVertexOrder(vertices, indices);
+	CHECK(vertices.size() == old_vertices.size());
+	bool same = true, ordered = true;
+	uint32_t next = 0;
+	for (size_t i = 0; i < indices.size(); i++) {
+		same = same && vertices[indices[i]] == old_vertices[old_indices[i]];
+		if (indices[i] == next) next++;
+		else ordered = ordered && indices[i] < next;
+	}
+	CHECK(same);
+	CHECK(ordered);
+	CHECK(meshproc::acmr(indices, vertices.size()) == acmr_after);
+
+	// vertices nothing references are dropped
+	vertices.push_back(vertices[0]);
+	meshproc::optimizeVertexOrder(vertices, indices);
+	CHECK(vertices.size() == old_vertices.size());
+}
+
+static bool same_mesh(const Mesh& a, const Mesh& b)
+{
+	if (a._vertices.size() != b._vertices.size() || a._indices != b._indices || a._lods.size() != b._lods.size()) return false;
+	if (memcmp(a._vertices.data(), b._vertices.data(), a._vertices.size() * sizeof(Vertex)) != 0) return false;
+	for (size_t l = 0; l < a._lods.size(); l++) {
+		if (a._lods[l].firstIndex != b._lods[l].firstIndex || a._lods[l].indexCount != b._lods[l].indexCount || a._lods[l].error != b._lods[l].error) return false;
+	}
+	return a._bounds == b._bounds;
+}
+
+static void test_cooker()
+{
+	// what addMesh does after reading the OBJ
+	Mesh mesh;
+	mesh.add_vertices(sphere_corners(16, 32, 2.0f));
+	mesh.optimize_order();
+	mesh.build_lods();
+	mesh.compute_bounds();
+	CHECK(near(glm::vec3(mesh._bounds), glm::vec3(0), 1e-4f));
+	CHECK(std::abs(mesh._bounds.w - 2.0f) < 1e-4f);
+
+	std::string src = (std::filesystem::temp_directory_path() / "prism_mesh_processing_test.obj").string();
+	std::error_code ec;
+	std::filesystem::remove(meshcook::cachePath(src), ec);
+	{
+		std::ofstream fw(src, std::ios::binary);
+		fw << "# stands in for the source, only its hash goes into the cache\n";
+	}
+	Mesh nothing;
+	CHECK(!meshcook::readCache(nothing, src));
+
+	// 16 bit indices
+	meshcook::writeCache(mesh, src);
+	Mesh cached;
+	CHECK(meshcook::readCache(cached, src));
+	CHECK(same_mesh(mesh, cached));
+
+	// 32 bit indices once the vertices don't fit in 16 bits
+	Mesh big;
+	big.add_vertices(grid_corners(300, 300, [](float x, float z) { return 0.01f * x * z; }));
+	big.compute_bounds();
+	CHECK(big._vertices.size() > 65536);
+	meshcook::writeCache(big, src);
+	Mesh big_cached;
+	CHECK(meshcook::readCache(big_cached, src));
+	CHECK(same_mesh(big, big_cached));
+
+	// a cut off file isn't half read
+	std::string cpath = meshcook::cachePath(src);
+	std::filesystem::resize_file(cpath, std::filesystem::file_size(cpath) / 2, ec);
+	Mesh truncated;
+	CHECK(!meshcook::readCache(truncated, src));
+	CHECK(truncated._vertices.empty() && truncated._indices.empty() && truncated._lods.empty());
+
+	// an edited source isn't read from the old cache
+	meshcook::writeCache(mesh, src);
+	{
+		std::ofstream fw(src, std::ios::binary | std::ios::app);
+		fw << "v 0 0 0\n";
+	}
+	Mesh stale;
+	CHECK(!meshcook::readCache(stale, src));
+
+	std::filesystem::remove(cpath, ec);
+	std::filesystem::remove(src, ec);
+}
+
+int main()
+{
+	test_tangent_frames();
+	test_weld();
+	test_pool_matches_serial();
+	test_order_optimization();
+	test_cooker();
+	return test_result("mesh_processing_test");
+}
@@ -0,0 +1,255 @@
+#include "test_common.h"
+#include "ParticleSystem.h"
+#include "PrismPhysics.h"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+const float DT = 1.0f / 120;
+const size_t BENCH_PARTICLES = 1000000;
+const int BENCH_STEPS = 20;
+// a step of a million particles against the box field on 4 threads. Generous, testing every particle against
+// every collider it might reach took seconds
+#ifdef NDEBUG
+const float STEP_BUDGET_MS = 200.0f;
+#else
+const float STEP_BUDGET_MS = 1000.0f;
+#endif
+
+static float max_diff(const std::vector<float>& a, const std::vector<float>& b)
+{
+	float worst = 0;
+	for (size_t i = 0; i < a.size(); i++) worst = std::max(worst, std::abs(a[i] - b[i]));
+	return worst;
+}
+
+// count particles spread over a box, the odd count leaves a scalar tail after the SSE loop
+static void spawn(ParticleSystem& ps, size_t batch, size_t count, glm::vec3 center, glm::vec3 extent, float speed, uint32_t seed)
+{
+	std::minstd_rand rng(seed);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 pos = center + extent * glm::vec3(unit(rng), unit(rng), unit(rng));
+		glm::vec3 vel = speed * glm::vec3(unit(rng), unit(rng), unit(rng));
+		ps.emit(batch, pos, vel, 1e6f, 0.2f, glm::vec3(unit(rng), 1, unit(rng)), 10 * unit(rng));
+	}
+}
+
+static void test_integration(SimpleThreadPooler* pool)
+{
+	// without drag semi-implicit Euler has a closed form: v_n = v_0 + n g dt, p_n = p_0 + n dt v_0 + g dt^2 n(n+1)/2
+	ParticleParams params;
+	params.drag = 0;
+	params.collide = false;
+	ParticleSystem ps(pool);
+	size_t batch = ps.add_batch(params);
+	spawn(ps, batch, 1001, glm::vec3(0, 50, 0), glm::vec3(10), 5, 1);
+	ParticleBatch start = ps.batches[batch];
+	const int steps = 120;
+	for (int s = 0; s < steps; s++) ps.step(DT);
+	const ParticleBatch& b = ps.batches[batch];
+	CHECK(b.count() == start.count());
+	float n = float(steps), worst_v = 0, worst_p = 0, worst_angle = 0;
+	for (size_t i = 0; i < b.count(); i++) {
+		glm::vec3 v0 = glm::vec3(start.vx[i], start.vy[i], start.vz[i]);
+		glm::vec3 p0 = glm::vec3(start.px[i], start.py[i], start.pz[i]);
+		glm::vec3 v = v0 + n * DT * params.gravity;
+		glm::vec3 p = p0 + n * DT * v0 + params.gravity * DT * DT * n * (n + 1) / 2.0f;
+		worst_v = std::max(worst_v, glm::length(v - glm::vec3(b.vx[i], b.vy[i], b.vz[i])));
+		worst_p = std::max(worst_p, glm::length(p - glm::vec3(b.px[i], b.py[i], b.pz[i])));
+		worst_angle = std::max(worst_angle, std::abs(start.angle[i] + n * DT * start.spin[i] - b.angle[i]));
+	}
+	CHECK(worst_v < 1e-3f);
+	CHECK(worst_p < 1e-3f);
+	CHECK(worst_angle < 1e-3f);
+
+	// drag alone scales the velocity by 1 - drag dt every step
+	params.gravity = glm::vec3(0);
+	params.drag = 0.5f;
+	ParticleSystem damped(pool);
+	batch = damped.add_batch(params);
+	spawn(damped, batch, 99, glm::vec3(0), glm::vec3(10), 5, 2);
+	std::vector<float> vx0 = damped.batches[batch].vx;
+	for (int s = 0; s < steps; s++) damped.step(DT);
+	float factor = std::pow(1.0f - params.drag * DT, n);
+	for (float& v : vx0) v *= factor;
+	CHECK(max_diff(vx0, damped.batches[batch].vx) < 1e-4f);
+}
+
+static void test_simd_matches_scalar(SimpleThreadPooler* pool)
+{
+	// the same particles stepped both ways, with drag and gravity, only rounding may differ
+	ParticleSystem simd(pool), scalar(pool);
+	scalar.use_simd = false;
+	ParticleParams params;
+	params.collide = false;
+	for (ParticleSystem* ps : { &simd, &scalar }) {
+		size_t batch = ps->add_batch(params);
+		spawn(*ps, batch, 50003, glm::vec3(0, 20, 0), glm::vec3(100, 10, 100), 20, 3);
+		for (int s = 0; s < 240; s++) ps->step(DT);
+	}
+	const ParticleBatch& a = simd.batches[0];
+	const ParticleBatch& b = scalar.batches[0];
+	CHECK(a.count() == b.count());
+	CHECK(max_diff(a.px, b.px) < 1e-3f && max_diff(a.py, b.py) < 1e-3f && max_diff(a.pz, b.pz) < 1e-3f);
+	CHECK(max_diff(a.vx, b.vx) < 1e-3f && max_diff(a.vy, b.vy) < 1e-3f && max_diff(a.vz, b.vz) < 1e-3f);
+	CHECK(max_diff(a.angle, b.angle) < 1e-3f && max_diff(a.life, b.life) < 1e-3f);
+}
+
+static void test_lifetimes(SimpleThreadPooler* pool)
+{
+	// particle i lives (i + 0.5) steps, its scale names it. After k steps exactly the ones from k on are left,
+	// every array compacted the same way
+	ParticleSystem ps(pool);
+	ParticleParams params;
+	params.collide = false;
+	size_t batch = ps.add_batch(params);
+	const size_t count = 1000;
+	for (size_t i = 0; i < count; i++) {
+		ps.emit(batch, glm::vec3(float(i), 0, 0), glm::vec3(0), (float(i) + 0.5f) * DT, float(i), glm::vec3(0, 1, 0), float(i));
+	}
+	for (size_t k : { 1, 10, 250, 999 }) {
+		while (count - ps.total_count() < k) ps.step(DT);
+		const ParticleBatch& b = ps.batches[batch];
+		CHECK(b.count() == count - k);
+		bool same_length = true;
+		for (const std::vector<float>* field : { &b.px, &b.py, &b.pz, &b.vx, &b.vy, &b.vz, &b.angle, &b.spin, &b.life, &b.ax, &b.ay, &b.az }) {
+			same_length = same_length && field->size() == b.count();
+		}
+		CHECK(same_length);
+		std::vector<float> ids = b.scale;
+		std::sort(ids.begin(), ids.end());
+		bool survivors = true;
+		for (size_t i = 0; i < ids.size(); i++) survivors = survivors && ids[i] == float(k + i);
+		CHECK(survivors);
+		// the other fields moved with their particle
+		bool moved_together = true;
+		for (size_t i = 0; i < b.count(); i++) moved_together = moved_together && b.px[i] == b.scale[i] && b.spin[i] == b.scale[i];
+		CHECK(moved_together);
+	}
+	ps.step(DT);
+	CHECK(ps.total_count() == 0);
+}
+
+static void test_write_instances(SimpleThreadPooler* pool)
+{
+	ParticleSystem ps(pool);
+	ps.STEP_CHUNK = 1000;
+	size_t batch = ps.add_batch(ParticleParams());
+	spawn(ps, batch, 4321, glm::vec3(0), glm::vec3(5), 1, 4);
+	std::vector<GPUParticleInstance> instances(4321 + 1);
+	instances.back().posScale = glm::vec4(-1);
+	ps.write_instances(batch, instances.data());
+	const ParticleBatch& b = ps.batches[batch];
+	bool same = true;
+	for (size_t i = 0; i < b.count(); i++) {
+		same = same && instances[i].posScale == glm::vec4(b.px[i], b.py[i], b.pz[i], b.scale[i]);
+		same = same && instances[i].axisAngle == glm::vec4(b.ax[i], b.ay[i], b.az[i], b.angle[i]);
+	}
+	CHECK(same);
+	CHECK(instances.back().posScale == glm::vec4(-1));
+}
+
+// a 400x400 floor with a 10x10 grid of 16x8x16 boxes on it
+struct BoxField {
+	std::vector<PolyCollMesh*> meshes;
+	std::vector<glm::vec3> box_centers;
+
+	BoxField()
+	{
+		meshes.push_back(PrismPhysics::gen_pcmesh(glm::vec3(0), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), 400, 400, 0.1f, 100));
+		for (int x = -5; x < 5; x++) {
+			for (int z = -5; z < 5; z++) {
+				box_centers.push_back(glm::vec3(x * 40 + 20, 4, z * 40 + 20));
+				meshes.push_back(PrismPhysics::gen_pcmesh(box_centers.back(), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), 16, 16, 8, 0.1f, 100));
+			}
+		}
+	}
+
+	~BoxField()
+	{
+		for (PolyCollMesh* pm : meshes) delete pm;
+	}
+};
+
+static void test_collision(SimpleThreadPooler* pool)
+{
+	// five seconds of particles raining onto the field: none may end up under the floor or inside a box, and
+	// bouncing with restitution 0.3 and friction they have settled by then
+	BoxField field;
+	ParticleSystem ps(pool);
+	size_t batch = ps.add_batch(ParticleParams());
+	spawn(ps, batch, 20001, glm::vec3(0, 20, 0), glm::vec3(190, 15, 190), 5, 5);
+	for (int s = 0; s < 600; s++) {
+		ps.set_colliders(field.meshes);
+		ps.step(DT);
+	}
+	const ParticleBatch& b = ps.batches[batch];
+	size_t below = 0, inside = 0, moving = 0;
+	for (size_t i = 0; i < b.count(); i++) {
+		glm::vec3 p = glm::vec3(b.px[i], b.py[i], b.pz[i]);
+		if (p.y < -0.1f) below++;
+		for (glm::vec3 c : field.box_centers) {
+			glm::vec3 d = glm::abs(p - c);
+			if (d.x < 7.9f && d.y < 3.9f && d.z < 7.9f) inside++;
+		}
+		if (glm::length(glm::vec3(b.vx[i], b.vy[i], b.vz[i])) > 1.0f) moving++;
+	}
+	std::cout << "after 5s: " << below << " under the floor, " << inside << " inside a box, " << moving << " still moving of " << b.count() << "\n";
+	CHECK(b.count() == 20001);
+	CHECK(below == 0);
+	CHECK(inside == 0);
+	CHECK(moving < b.count() / 100);
+}
+
+static void test_throughput(SimpleThreadPooler* pool)
+{
+	// the million particle step the system was built for: SSE against the scalar loop, with collision against the
+	// box field, then the per frame instance write
+	BoxField field;
+	ParticleSystem ps(pool);
+	size_t batch = ps.add_batch(ParticleParams());
+	std::cout << "particles: " << BENCH_PARTICLES << ", " << BENCH_STEPS << " steps of " << DT * 1000 << "ms\n";
+	const char* names[] = { "integrate (SSE)", "integrate (scalar)", "integrate + collide" };
+	float collide_ms = 0;
+	for (int run = 0; run < 3; run++) {
+		ps.use_simd = run != 1;
+		ps.batches[batch] = ParticleBatch{ ps.batches[batch].params };
+		ps.batches[batch].params.collide = run == 2;
+		spawn(ps, batch, BENCH_PARTICLES, glm::vec3(0, 12, 0), glm::vec3(190, 8, 190), 5, 7);
+		// the collision run prints the system's own stats, collider tests per particle among them
+		ps.print_step_stats = run == 2;
+		ps.STATS_INTERVAL_STEPS = BENCH_STEPS;
+		auto start = std::chrono::steady_clock::now();
+		for (int s = 0; s < BENCH_STEPS; s++) {
+			if (run == 2) ps.set_colliders(field.meshes);
+			ps.step(DT);
+		}
+		float ms = ms_since(start) / BENCH_STEPS;
+		std::cout << "  " << names[run] << ": " << ms << "ms per step, " << float(BENCH_PARTICLES) / ms / 1000 << "M particles/s\n";
+		if (run == 2) collide_ms = ms;
+	}
+	CHECK(ps.total_count() == BENCH_PARTICLES);
+	CHECK(collide_ms < STEP_BUDGET_MS);
+
+	std::vector<GPUParticleInstance> instances(BENCH_PARTICLES);
+	auto start = std::chrono::steady_clock::now();
+	for (int s = 0; s < BENCH_STEPS; s++) ps.write_instances(batch, instances.data());
+	float ms = ms_since(start) / BENCH_STEPS;
+	std::cout << "  instance write: " << ms << "ms per frame, " << float(BENCH_PARTICLES * sizeof(GPUParticleInstance)) / (1024 * 1024) << "MB\n";
+	CHECK(ms < STEP_BUDGET_MS);
+}
+
+int main()
+{
+	SimpleThreadPooler pool(4);
+	pool.run();
+	test_integration(&pool);
+	test_simd_matches_scalar(&pool);
+	test_lifetimes(&pool);
+	test_write_instances(&pool);
+	test_collision(&pool);
+	test_throughput(&pool);
+	return test_result("particle_system_test");
+}
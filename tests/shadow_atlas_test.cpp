@@ -0,0 +1,234 @@
+#include "test_common.h"
+#include "ShadowAtlas.h"
+
+#include <fstream>
+#include <random>
+
+// the renderer's defaults
+const uint32_t ATLAS_SIZE = 1 << 12, MIN_TILE = 64, DIR_SIZE = 1 << 11, FACE_SIZE = 1 << 10;
+const uint32_t MAX_DIR = 8, MAX_POINT = 8;
+const uint32_t KEYS = MAX_DIR + MAX_POINT * 6;
+
+// an update runs once a frame with at most KEYS tiles
+#ifdef NDEBUG
+const double UPDATE_BUDGET_MS = 1.0;
+#else
+const double UPDATE_BUDGET_MS = 5.0;
+#endif
+
+// every request has a tile inside the atlas, aligned to its size, no larger than asked and within the budget,
+// and no two tiles overlap
+static bool valid(const ShadowAtlas& atlas, const std::vector<ShadowTileRequest>& requests)
+{
+	if (atlas.unplacedTiles != 0 || atlas.tiles.size() != requests.size()) return false;
+	if (atlas.usedTexels() > size_t(double(atlas.budget) * atlas.atlasSize * atlas.atlasSize)) return false;
+	for (const ShadowTileRequest& request : requests) {
+		const ShadowTile* t = atlas.tile(request.key);
+		if (!t) return false;
+		if (t->size < atlas.minTile || (t->size & (t->size - 1)) != 0 || t->size > std::max(request.size, atlas.minTile)) return false;
+		if (t->x + t->size > atlas.atlasSize || t->y + t->size > atlas.atlasSize || t->x % t->size != 0 || t->y % t->size != 0) return false;
+		for (const ShadowTileRequest& other : requests) {
+			const ShadowTile* o = atlas.tile(other.key);
+			if (other.key == request.key || !o) continue;
+			if (!(t->x + t->size <= o->x || o->x + o->size <= t->x || t->y + t->size <= o->y || o->y + o->size <= t->y)) return false;
+		}
+	}
+	return true;
+}
+
+static bool same_place(const ShadowTile& a, const ShadowTile& b)
+{
+	return a.x == b.x && a.y == b.y && a.size == b.size && a.generation == b.generation;
+}
+
+static void test_random_requests()
+{
+	std::minstd_rand rng(5);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	ShadowAtlas atlas(ATLAS_SIZE, MIN_TILE);
+	size_t invalid = 0, updates = 0, repacks = 0, stable_moves = 0, bystander_moves = 0, resized_rounds = 0, single_moves = 0;
+	double update_ms = 0;
+	auto timed_update = [&](const std::vector<ShadowTileRequest>& requests) {
+		auto start = std::chrono::steady_clock::now();
+		atlas.update(requests);
+		update_ms += ms_since(start);
+		updates++;
+		repacks += atlas.repacked;
+		if (!valid(atlas, requests)) invalid++;
+	};
+
+	const size_t rounds = 2000;
+	for (size_t round = 0; round < rounds; round++) {
+		atlas.budget = round % 4 == 3 ? 0.5f : 1.0f;
+		std::vector<ShadowTileRequest> requests;
+		for (uint32_t key = 0; key < KEYS; key++) {
+			if (unit(rng) < 0.6f) continue;
+			uint32_t max_size = key < MAX_DIR ? DIR_SIZE : FACE_SIZE;
+			requests.push_back({ key, 0.1f + unit(rng), ShadowAtlas::pickSize(unit(rng) * max_size, 0, MIN_TILE, max_size) });
+		}
+		timed_update(requests);
+
+		// the same requests again move nothing, cached contents stay valid
+		std::unordered_map<uint32_t, ShadowTile> before = atlas.tiles;
+		timed_update(requests);
+		stable_moves += atlas.movedTiles + atlas.repacked;
+		for (auto& it : before) {
+			const ShadowTile* t = atlas.tile(it.first);
+			if (!t || !same_place(*t, it.second)) stable_moves++;
+		}
+
+		// one request resized, without a repack only its tile moves. The budget may hand others a new size, the
+		// ones that keep theirs keep their place and generation
+		if (requests.empty()) continue;
+		before = atlas.tiles;
+		ShadowTileRequest& changed = requests[rng() % requests.size()];
+		changed.size = changed.size > MIN_TILE ? changed.size / 2 : changed.size * 2;
+		timed_update(requests);
+		if (atlas.repacked) continue;
+		resized_rounds++;
+		single_moves += atlas.movedTiles;
+		for (auto& it : before) {
+			const ShadowTile* t = atlas.tile(it.first);
+			if (it.first == changed.key || (t && t->size != it.second.size)) continue;
+			if (!t || !same_place(*t, it.second)) bystander_moves++;
+		}
+	}
+	std::cout << rounds << " rounds: " << invalid << " invalid packings, " << stable_moves << " tiles moved by repeated requests, "
+		<< bystander_moves << " bystanders moved, " << repacks << " repacks in " << updates << " updates, "
+		<< update_ms / updates << " ms per update\n";
+	CHECK(invalid == 0);
+	CHECK(stable_moves == 0);
+	CHECK(bystander_moves == 0);
+	CHECK(resized_rounds > rounds / 2 && single_moves <= resized_rounds);
+	CHECK(update_ms / updates < UPDATE_BUDGET_MS);
+}
+
+static void test_budget()
+{
+	// every slot asks for its largest tile, 80M texels for a 16M atlas. The least important give texels back first,
+	// one that matters a thousand times more keeps its tile as long as the budget holds it
+	ShadowAtlas atlas(ATLAS_SIZE, MIN_TILE);
+	std::vector<ShadowTileRequest> requests;
+	for (uint32_t key = 0; key < KEYS; key++) {
+		requests.push_back({ key, key == 0 ? 1000.0f : key == 1 ? 0.01f : 1.0f, key < MAX_DIR ? DIR_SIZE : FACE_SIZE });
+	}
+	for (float budget : { 1.0f, 0.5f, 0.25f }) {
+		atlas.budget = budget;
+		atlas.update(requests);
+		CHECK(valid(atlas, requests));
+		bool largest = true;
+		for (auto& it : atlas.tiles) largest = largest && it.second.size <= atlas.tile(0)->size;
+		CHECK(largest);
+		CHECK(budget < 0.5f || atlas.tile(0)->size == DIR_SIZE);
+		CHECK(atlas.tile(1)->size <= atlas.tile(2)->size && atlas.tile(1)->size < DIR_SIZE);
+	}
+
+	// a budget nothing fits in keeps every tile at the smallest size rather than dropping any
+	atlas.budget = 0.0f;
+	atlas.update(requests);
+	CHECK(atlas.unplacedTiles == 0 && atlas.tiles.size() == requests.size());
+	bool smallest = true;
+	for (auto& it : atlas.tiles) smallest = smallest && it.second.size == MIN_TILE;
+	CHECK(smallest);
+}
+
+static void test_release()
+{
+	// freed tiles merge back, after the last one goes a tile as large as the atlas fits without a repack
+	ShadowAtlas atlas(ATLAS_SIZE, MIN_TILE);
+	std::vector<ShadowTileRequest> requests;
+	for (uint32_t key = 0; key < 40; key++) requests.push_back({ key, 1.0f, MIN_TILE << (key % 4) });
+	atlas.update(requests);
+	CHECK(valid(atlas, requests));
+	atlas.update({});
+	CHECK(atlas.tiles.empty() && atlas.usedTexels() == 0);
+	atlas.update({ { 7, 1.0f, ATLAS_SIZE } });
+	CHECK(!atlas.repacked && atlas.unplacedTiles == 0);
+	CHECK(atlas.tile(7) && atlas.tile(7)->size == ATLAS_SIZE);
+	// generations are never reused, a stale cache can't mistake a new tile for its old one
+	ShadowTile whole = *atlas.tile(7);
+	atlas.update({ { 7, 1.0f, ATLAS_SIZE / 2 } });
+	atlas.update({ { 7, 1.0f, ATLAS_SIZE } });
+	CHECK(atlas.tile(7)->generation > whole.generation);
+}
+
+static void test_pick_size()
+{
+	CHECK(ShadowAtlas::pickSize(0.0f, 0, MIN_TILE, FACE_SIZE) == MIN_TILE);
+	CHECK(ShadowAtlas::pickSize(300.0f, 0, MIN_TILE, FACE_SIZE) == 512);
+	CHECK(ShadowAtlas::pickSize(5000.0f, 0, MIN_TILE, FACE_SIZE) == FACE_SIZE);
+	// near the current size it stays, far from it it moves
+	CHECK(ShadowAtlas::pickSize(280.0f, 256, MIN_TILE, FACE_SIZE) == 256);
+	CHECK(ShadowAtlas::pickSize(200.0f, 512, MIN_TILE, FACE_SIZE) == 512);
+	CHECK(ShadowAtlas::pickSize(100.0f, 512, MIN_TILE, FACE_SIZE) == 128);
+	CHECK(ShadowAtlas::pickSize(400.0f, 256, MIN_TILE, FACE_SIZE) == 512);
+	// a current size outside the limits is brought back inside
+	CHECK(ShadowAtlas::pickSize(2048.0f, 2048, MIN_TILE, FACE_SIZE) == FACE_SIZE);
+}
+
+static void test_levels()
+{
+	// every shadow light of the shipped levels close enough to want its full resolution gets it
+	for (const char* path : { "levels/1.txt", "levels/3.txt", "levels/4.txt", "levels/6.txt", "levels/stream_test.txt" }) {
+		std::ifstream level(path);
+		CHECK(level.is_open());
+		uint32_t dirs = 0, points = 0;
+		std::string line;
+		while (std::getline(level, line)) {
+			if (line.compare(0, 4, "DLES") == 0) dirs++;
+			if (line.compare(0, 4, "PLES") == 0) points++;
+		}
+		dirs = std::min(dirs, MAX_DIR);
+		points = std::min(points, MAX_POINT);
+
+		ShadowAtlas atlas(ATLAS_SIZE, MIN_TILE);
+		std::vector<ShadowTileRequest> requests;
+		size_t wanted = 0;
+		for (uint32_t l = 0; l < dirs; l++) requests.push_back({ l, 1.0f, DIR_SIZE });
+		for (uint32_t l = 0; l < points * 6; l++) requests.push_back({ MAX_DIR + l, 1.0f, FACE_SIZE });
+		for (const ShadowTileRequest& request : requests) wanted += size_t(request.size) * request.size;
+		atlas.update(requests);
+		std::cout << path << ": " << dirs << " directional and " << points << " point shadow lights, "
+			<< atlas.usedTexels() * 4 / (1024 * 1024) << " MB of tiles\n";
+		CHECK(valid(atlas, requests));
+		CHECK(atlas.usedTexels() == wanted);
+	}
+}
+
+// finalimage.frag's cube_forward, cube_side and cube_up
+const glm::vec3 CUBE_FORWARD[6] = { {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1} };
+const glm::vec3 CUBE_SIDE[6] = { {0, 0, 1}, {0, 0, -1}, {-1, 0, 0}, {-1, 0, 0}, {-1, 0, 0}, {1, 0, 0} };
+const glm::vec3 CUBE_UP[6] = { {0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0} };
+
+static void test_cube_faces()
+{
+	// a point around a light is inside the pass of the face finalimage.frag picks for it, at the spot the shader
+	// reads. The shadow viewport is flipped, tile uv (0.5 + x / 2, 0.5 - y / 2) holds what the pass drew at ndc x, y
+	std::minstd_rand rng(9);
+	std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+	size_t outside = 0, misplaced = 0;
+	for (int i = 0; i < 10000; i++) {
+		glm::vec3 d(coord(rng), coord(rng), coord(rng));
+		glm::vec3 ad = glm::abs(d);
+		if (std::max(ad.x, std::max(ad.y, ad.z)) < 0.1f) continue;
+		int face = ad.x >= ad.y && ad.x >= ad.z ? (d.x < 0 ? 0 : 1) : (ad.y >= ad.z ? (d.y < 0 ? 2 : 3) : (d.z < 0 ? 4 : 5));
+		glm::vec2 ndc = glm::vec2(glm::dot(CUBE_SIDE[face], d), glm::dot(CUBE_UP[face], d)) / glm::dot(CUBE_FORWARD[face], d);
+		glm::vec4 clip = cubeFaceViewProj(uint32_t(face)) * glm::vec4(d, 1);
+		glm::vec2 drawn = glm::vec2(clip) / clip.w;
+		if (clip.w <= 0 || std::abs(drawn.x) > 1.0001f || std::abs(drawn.y) > 1.0001f) outside++;
+		else if (glm::length(drawn - ndc) > 1e-4f) misplaced++;
+	}
+	CHECK(outside == 0);
+	CHECK(misplaced == 0);
+}
+
+int main()
+{
+	test_random_requests();
+	test_budget();
+	test_release();
+	test_pick_size();
+	test_levels();
+	test_cube_faces();
+	return test_result("shadow_atlas_test");
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+
+// checks count their failures and carry on, a test's main returns test_result() so ctest sees them
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n"; \
+		test_failures++; \
+	} \
+} while (0)
+
+inline int test_result(const char* name)
+{
+	if (test_failures > 0) {
+		std::cout << name << ": " << test_failures << " checks failed\n";
+		return 1;
+	}
+	std::cout << name << ": passed\n";
+	return 0;
+}
+
+inline float ms_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "vkstructs.h"
+
+#include <cmath>
+#include <functional>
+
+// triangle lists (3 corners per triangle) for the mesh processing tests, counter-clockwise seen from outside.
+// Only positions, UVs and normals are filled, tangent frames are left to meshproc
+
+static void push_tri(std::vector<Vertex>& corners, Vertex a, Vertex b, Vertex c, glm::vec3 outward)
+{
+	if (glm::dot(glm::cross(b.pos - a.pos, c.pos - a.pos), outward) < 0) std::swap(b, c);
+	corners.push_back(a);
+	corners.push_back(b);
+	corners.push_back(c);
+}
+
+// a grid of cells_x by cells_z unit cells in the xz plane, facing +y with y = height(x, z). UVs are the position
+// over the grid size
+static std::vector<Vertex> grid_corners(uint32_t cells_x, uint32_t cells_z, std::function<float(float, float)> height = NULL)
+{
+	auto vert = [&](uint32_t x, uint32_t z) {
+		Vertex v{};
+		v.pos = glm::vec3(float(x), height ? height(float(x), float(z)) : 0.0f, float(z));
+		v.normal = glm::vec3(0, 1, 0);
+		v.texCoord = glm::vec2(float(x) / cells_x, float(z) / cells_z);
+		return v;
+	};
+	std::vector<Vertex> corners;
+	corners.reserve(size_t(cells_x) * cells_z * 6);
+	for (uint32_t z = 0; z < cells_z; z++) {
+		for (uint32_t x = 0; x < cells_x; x++) {
+			push_tri(corners, vert(x, z), vert(x + 1, z), vert(x + 1, z + 1), glm::vec3(0, 1, 0));
+			push_tri(corners, vert(x, z), vert(x + 1, z + 1), vert(x, z + 1), glm::vec3(0, 1, 0));
+		}
+	}
+	return corners;
+}
+
+// a UV sphere around the origin. The column at u = 0 and u = 1 is a UV seam, the poles are fans
+static std::vector<Vertex> sphere_corners(uint32_t rings, uint32_t segments, float radius)
+{
+	const float pi = 3.14159265358979f;
+	auto vert = [&](uint32_t r, uint32_t s) {
+		float theta = pi * float(r) / rings, phi = 2.0f * pi * float(s % segments) / segments;
+		Vertex v{};
+		v.normal = glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+		if (r == 0) v.normal = glm::vec3(0, 1, 0);
+		if (r == rings) v.normal = glm::vec3(0, -1, 0);
+		v.pos = v.normal * radius;
+		v.texCoord = glm::vec2(float(s) / segments, float(r) / rings);
+		return v;
+	};
+	std::vector<Vertex> corners;
+	for (uint32_t r = 0; r < rings; r++) {
+		for (uint32_t s = 0; s < segments; s++) {
+			Vertex a = vert(r, s), b = vert(r, s + 1), c = vert(r + 1, s), d = vert(r + 1, s + 1);
+			glm::vec3 out = (a.pos + b.pos + c.pos + d.pos) * 0.25f;
+			if (r == 0) {
+				push_tri(corners, a, d, c, out);
+			}
+			else if (r == rings - 1) {
+				push_tri(corners, a, b, c, out);
+			}
+			else {
+				push_tri(corners, a, b, d, out);
+				push_tri(corners, a, d, c, out);
+			}
+		}
+	}
+	return corners;
+}
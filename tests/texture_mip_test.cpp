@@ -0,0 +1,195 @@
+#include "test_common.h"
+#include "TextureCooker.h"
+
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <filesystem>
+
+static size_t level_offset(uint32_t width, uint32_t height, uint32_t level)
+{
+	size_t off = 0;
+	for (uint32_t i = 0; i < level; i++) off += size_t(std::max(1u, width >> i)) * std::max(1u, height >> i) * 4;
+	return off;
+}
+
+static std::vector<uint8_t> solid(uint32_t width, uint32_t height, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	std::vector<uint8_t> pixels(size_t(width) * height * 4);
+	for (size_t i = 0; i < pixels.size(); i += 4) {
+		pixels[i] = r;
+		pixels[i + 1] = g;
+		pixels[i + 2] = b;
+		pixels[i + 3] = a;
+	}
+	return pixels;
+}
+
+// uncompressed 32 bit TGA with the origin at the top left, stb_image reads it as RGBA
+static void write_tga(std::string path, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgba)
+{
+	uint8_t head[18] = { 0, 0, 2 };
+	head[12] = uint8_t(width & 255);
+	head[13] = uint8_t(width >> 8);
+	head[14] = uint8_t(height & 255);
+	head[15] = uint8_t(height >> 8);
+	head[16] = 32;
+	head[17] = 0x28;
+	std::ofstream fw(path, std::ios::binary);
+	fw.write((const char*)head, sizeof(head));
+	for (size_t i = 0; i < rgba.size(); i += 4) {
+		uint8_t bgra[4] = { rgba[i + 2], rgba[i + 1], rgba[i], rgba[i + 3] };
+		fw.write((const char*)bgra, 4);
+	}
+}
+
+static void test_mip_count()
+{
+	CHECK(texcook::mipCount(1, 1) == 1);
+	CHECK(texcook::mipCount(2, 1) == 2);
+	CHECK(texcook::mipCount(256, 256) == 9);
+	CHECK(texcook::mipCount(300, 200) == 9);
+	CHECK(texcook::mipCount(1, 1024) == 11);
+	CHECK(texcook::mipCount(1024, 3) == 11);
+}
+
+static void test_chain_layout()
+{
+	// every level is there, tightly packed, down to 1x1
+	for (auto dims : { std::make_pair(37u, 13u), std::make_pair(64u, 64u), std::make_pair(1u, 9u) }) {
+		std::vector<uint8_t> pixels = solid(dims.first, dims.second, 1, 2, 3, 4);
+		texcook::generateMips(pixels, dims.first, dims.second, false);
+		uint32_t levels = texcook::mipCount(dims.first, dims.second);
+		CHECK(pixels.size() == level_offset(dims.first, dims.second, levels));
+		CHECK(std::max(1u, dims.first >> (levels - 1)) == 1 && std::max(1u, dims.second >> (levels - 1)) == 1);
+	}
+}
+
+static void test_solid_colors_stay()
+{
+	// a flat texture has to stay flat at every level, in sRGB too where it goes through linear and back
+	for (int v = 0; v < 256; v++) {
+		for (bool srgb : { false, true }) {
+			std::vector<uint8_t> pixels = solid(8, 4, uint8_t(v), uint8_t(255 - v), uint8_t(v / 2), uint8_t(255 - v / 3));
+			std::vector<uint8_t> level0 = pixels;
+			texcook::generateMips(pixels, 8, 4, srgb);
+			bool same = true;
+			for (size_t i = 0; i < pixels.size(); i++) same = same && pixels[i] == level0[i % 4];
+			CHECK(same);
+		}
+	}
+}
+
+static void test_box_filter()
+{
+	// black and white checker, RGB averages in linear space for sRGB textures, alpha always averages as is
+	std::vector<uint8_t> pixels = { 0, 0, 0, 0,  255, 255, 255, 255,  255, 255, 255, 255,  0, 0, 0, 0 };
+	std::vector<uint8_t> srgb_pixels = pixels;
+	texcook::generateMips(pixels, 2, 2, false);
+	texcook::generateMips(srgb_pixels, 2, 2, true);
+	CHECK(pixels.size() == 20 && srgb_pixels.size() == 20);
+	for (int c = 0; c < 4; c++) CHECK(pixels[16 + c] == 128);
+	// linear 0.5 is sRGB 187.5
+	for (int c = 0; c < 3; c++) CHECK(srgb_pixels[16 + c] == 188);
+	CHECK(srgb_pixels[19] == 128);
+
+	// a one pixel wide texture repeats its only column, each level averages pairs of rows
+	std::vector<uint8_t> column;
+	for (uint8_t v : { 0, 100, 200, 40 }) {
+		for (int c = 0; c < 4; c++) column.push_back(v);
+	}
+	texcook::generateMips(column, 1, 4, false);
+	CHECK(column.size() == (4 + 2 + 1) * 4);
+	CHECK(column[16] == 50 && column[20] == 120);
+	CHECK(column[24] == 85);
+}
+
+static void test_mean_kept()
+{
+	// power of two levels each average whole 2x2 blocks, the last level is the mean up to rounding
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<uint8_t> pixels(64 * 64 * 4);
+	double sum[4] = { 0, 0, 0, 0 };
+	for (size_t i = 0; i < pixels.size(); i++) {
+		pixels[i] = uint8_t(byte(rng));
+		sum[i % 4] += pixels[i];
+	}
+	texcook::generateMips(pixels, 64, 64, false);
+	size_t last = level_offset(64, 64, 6);
+	for (int c = 0; c < 4; c++) {
+		double mean = sum[c] / (64 * 64);
+		CHECK(std::abs(double(pixels[last + c]) - mean) <= 4.0);
+	}
+}
+
+static void test_cook_and_cache()
+{
+	std::string path = (std::filesystem::temp_directory_path() / "prism_texture_mip_test.tga").string();
+	std::string cpath = texcook::cachePath(path);
+	std::error_code ec;
+	std::filesystem::remove(cpath, ec);
+
+	const uint32_t w = 33, h = 17;
+	std::vector<uint8_t> rgba(size_t(w) * h * 4);
+	for (size_t i = 0; i < rgba.size(); i++) rgba[i] = uint8_t(i * 7 + i / 5);
+	write_tga(path, w, h, rgba);
+	std::vector<uint8_t> expected = rgba;
+	texcook::generateMips(expected, w, h, false);
+
+	CookedTexture cooked;
+	cooked.path = path;
+	texcook::cook(&cooked);
+	CHECK(cooked.done && !cooked.failed && !cooked.from_cache);
+	CHECK(cooked.width == w && cooked.height == h && cooked.mipLevels == texcook::mipCount(w, h));
+	CHECK(cooked.pixels == expected);
+	CHECK(std::filesystem::exists(cpath));
+
+	// the second cook reads the same chain back
+	CookedTexture cached;
+	cached.path = path;
+	texcook::cook(&cached);
+	CHECK(cached.done && !cached.failed && cached.from_cache);
+	CHECK(cached.width == w && cached.height == h && cached.mipLevels == cooked.mipLevels);
+	CHECK(cached.pixels == expected);
+
+	// the chain of the other color space isn't the cached one
+	CookedTexture srgb;
+	srgb.path = path;
+	srgb.srgb = true;
+	texcook::cook(&srgb);
+	CHECK(!srgb.failed && !srgb.from_cache);
+	std::vector<uint8_t> expected_srgb = rgba;
+	texcook::generateMips(expected_srgb, w, h, true);
+	CHECK(srgb.pixels == expected_srgb);
+
+	// an edited source is cooked again
+	std::vector<uint8_t> smaller(20 * 10 * 4, 77);
+	write_tga(path, 20, 10, smaller);
+	CookedTexture edited;
+	edited.path = path;
+	edited.srgb = true;
+	texcook::cook(&edited);
+	CHECK(!edited.failed && !edited.from_cache);
+	CHECK(edited.width == 20 && edited.height == 10 && edited.mipLevels == 5);
+
+	// a file that can't be decoded fails without leaving a cache file
+	std::filesystem::remove(path, ec);
+	std::filesystem::remove(cpath, ec);
+	CookedTexture missing;
+	missing.path = path;
+	texcook::cook(&missing);
+	CHECK(missing.done && missing.failed);
+	CHECK(!std::filesystem::exists(cpath));
+}
+
+int main()
+{
+	test_mip_count();
+	test_chain_layout();
+	test_solid_colors_stay();
+	test_box_filter();
+	test_mean_kept();
+	test_cook_and_cache();
+	return test_result("texture_mip_test");
+}
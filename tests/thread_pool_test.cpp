@@ -0,0 +1,77 @@
+#include "test_common.h"
+#include "SimpleThreadPooler.h"
+
+#include <ctime>
+
+static void add_one(std::atomic<uint32_t>* counter)
+{
+	counter->fetch_add(1);
+}
+
+static void sleep_then_add(std::atomic<uint32_t>* counter, int ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	counter->fetch_add(1);
+}
+
+static void test_all_tasks_run()
+{
+	SimpleThreadPooler pool(4);
+	pool.run();
+	std::atomic<uint32_t> counter(0);
+	// rounds stay under the ring's 1000 tasks, like the renderer's and physics' batches
+	for (int round = 0; round < 200; round++) {
+		for (int t = 0; t < 500; t++) pool.add_task(&add_one, &counter);
+		pool.wait_till_done();
+		CHECK(counter == uint32_t(round + 1) * 500);
+	}
+	// a task still running keeps wait_till_done waiting after the ring is empty
+	counter = 0;
+	pool.add_task(&sleep_then_add, &counter, 50);
+	pool.wait_till_done();
+	CHECK(counter == 1);
+	// nothing queued returns right away
+	auto start = std::chrono::steady_clock::now();
+	pool.wait_till_done();
+	CHECK(ms_since(start) < 50.0f);
+}
+
+static void test_idle_workers_sleep()
+{
+	// 8 idle workers over 300ms of wall time may take a sliver of CPU time, polling would take all of it
+	SimpleThreadPooler pool(8);
+	pool.run();
+	std::atomic<uint32_t> counter(0);
+	pool.add_task(&add_one, &counter);
+	pool.wait_till_done();
+	std::clock_t cpu_start = std::clock();
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	double cpu_ms = 1000.0 * double(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+	std::cout << "8 idle workers took " << cpu_ms << " ms of CPU time in 300 ms\n";
+	CHECK(cpu_ms < 30.0);
+}
+
+static void test_stop()
+{
+	// stop runs what is queued first, a second stop and the destructor's find nothing to join
+	SimpleThreadPooler pool(3);
+	pool.run();
+	std::atomic<uint32_t> counter(0);
+	for (int t = 0; t < 30; t++) pool.add_task(&sleep_then_add, &counter, 1);
+	pool.stop();
+	CHECK(counter == 30);
+	pool.stop();
+	// and the pool can be started again
+	pool.run();
+	pool.add_task(&add_one, &counter);
+	pool.wait_till_done();
+	CHECK(counter == 31);
+}
+
+int main()
+{
+	test_all_tasks_run();
+	test_idle_workers_sleep();
+	test_stop();
+	return test_result("thread_pool_test");
+}
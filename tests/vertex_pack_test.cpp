@@ -0,0 +1,113 @@
+#include "test_common.h"
+#include "vkstructs.h"
+
+#include <random>
+#include <cmath>
+
+// 10 bits over [-1, 1] is a step of 2/1023, rounding is off by at most half a step in each component
+const float MAX_DIR_ERROR_DEG = 0.1f;
+const float MAX_LENGTH_ERROR = 0.002f;
+const size_t ROUND_TRIPS = 200000;
+
+static float angle_deg(glm::vec3 a, glm::vec3 b)
+{
+	float c = glm::dot(glm::normalize(a), glm::normalize(b));
+	return std::acos(std::min(1.0f, std::max(-1.0f, c))) * 180.0f / 3.14159265f;
+}
+
+static glm::vec3 random_unit(std::mt19937& rng)
+{
+	std::normal_distribution<float> nd(0.0f, 1.0f);
+	glm::vec3 v;
+	do {
+		v = glm::vec3(nd(rng), nd(rng), nd(rng));
+	} while (glm::length(v) < 1e-3f);
+	return glm::normalize(v);
+}
+
+static void test_random_frames()
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> uvd(-300.0f, 300.0f);
+	float worst_normal = 0, worst_tangent = 0, worst_bitangent = 0, worst_length = 0;
+	size_t sign_errors = 0, exact_errors = 0;
+	for (size_t i = 0; i < ROUND_TRIPS; i++) {
+		Vertex vert;
+		vert.pos = glm::vec3(uvd(rng), uvd(rng), uvd(rng));
+		vert.normal = random_unit(rng);
+		glm::vec3 t = random_unit(rng);
+		t = t - vert.normal * glm::dot(vert.normal, t);
+		if (glm::length(t) < 1e-3f) continue;
+		vert.tangent = glm::normalize(t);
+		// mirrored UVs give a flipped bitangent, half of the frames are left handed
+		vert.bitangent = glm::cross(vert.normal, vert.tangent) * (i % 2 == 0 ? 1.0f : -1.0f);
+		vert.texCoord = glm::vec2(uvd(rng), uvd(rng));
+
+		Vertex back = PackedVertex::unpack(vert.pos, PackedVertex::pack(vert));
+		worst_normal = std::max(worst_normal, angle_deg(vert.normal, back.normal));
+		worst_tangent = std::max(worst_tangent, angle_deg(vert.tangent, back.tangent));
+		worst_bitangent = std::max(worst_bitangent, angle_deg(vert.bitangent, back.bitangent));
+		worst_length = std::max(worst_length, std::abs(glm::length(back.normal) - 1.0f));
+		worst_length = std::max(worst_length, std::abs(glm::length(back.tangent) - 1.0f));
+		if (glm::dot(vert.bitangent, back.bitangent) <= 0.0f) sign_errors++;
+		if (back.pos != vert.pos || back.texCoord != vert.texCoord) exact_errors++;
+	}
+	std::cout << "worst error over " << ROUND_TRIPS << " frames: normal " << worst_normal << " deg, tangent "
+		<< worst_tangent << " deg, bitangent " << worst_bitangent << " deg, length " << worst_length << "\n";
+	CHECK(worst_normal < MAX_DIR_ERROR_DEG);
+	CHECK(worst_tangent < MAX_DIR_ERROR_DEG);
+	// the bitangent is rebuilt from both, so it carries both errors
+	CHECK(worst_bitangent < 2.0f * MAX_DIR_ERROR_DEG);
+	CHECK(worst_length < MAX_LENGTH_ERROR);
+	CHECK(sign_errors == 0);
+	// positions go in the other stream and UVs stay full floats
+	CHECK(exact_errors == 0);
+}
+
+static void test_axis_frames()
+{
+	// level geometry is mostly axis aligned, those frames have to keep their signs in every orientation
+	glm::vec3 axes[] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+	for (glm::vec3 n : axes) {
+		for (glm::vec3 t : axes) {
+			if (std::abs(glm::dot(n, t)) > 0.5f) continue;
+			for (float sign : { 1.0f, -1.0f }) {
+				Vertex vert;
+				vert.pos = glm::vec3(0);
+				vert.normal = n;
+				vert.tangent = t;
+				vert.bitangent = glm::cross(n, t) * sign;
+				vert.texCoord = glm::vec2(0);
+				Vertex back = PackedVertex::unpack(vert.pos, PackedVertex::pack(vert));
+				CHECK(angle_deg(n, back.normal) < MAX_DIR_ERROR_DEG);
+				CHECK(angle_deg(t, back.tangent) < MAX_DIR_ERROR_DEG);
+				CHECK(angle_deg(vert.bitangent, back.bitangent) < 2.0f * MAX_DIR_ERROR_DEG);
+			}
+		}
+	}
+}
+
+static void test_degenerate_tangent()
+{
+	// degenerate UVs leave NaN or zero tangents, they must not turn into NaN in the shaders
+	for (glm::vec3 t : { glm::vec3(NAN, NAN, NAN), glm::vec3(0), glm::vec3(INFINITY, 0, 0) }) {
+		Vertex vert;
+		vert.pos = glm::vec3(0);
+		vert.normal = glm::vec3(0, 1, 0);
+		vert.tangent = t;
+		vert.bitangent = glm::vec3(0);
+		vert.texCoord = glm::vec2(0);
+		Vertex back = PackedVertex::unpack(vert.pos, PackedVertex::pack(vert));
+		CHECK(std::isfinite(back.tangent.x) && std::isfinite(back.tangent.y) && std::isfinite(back.tangent.z));
+		CHECK(std::abs(glm::length(back.tangent) - 1.0f) < MAX_LENGTH_ERROR);
+		CHECK(angle_deg(vert.normal, back.normal) < MAX_DIR_ERROR_DEG);
+	}
+}
+
+int main()
+{
+	test_random_frames();
+	test_axis_frames();
+	test_degenerate_tangent();
+	return test_result("vertex_pack_test");
+}
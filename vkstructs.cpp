@@ -9,7 +9,10 @@
 #include <glm/mat4x4.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 #include "CollisionStructs.h"
+#include "MeshProcessing.h"
 
 
 void GPULight::set_vp_mat(float fov, float aspect, float near_plane, float far_plane)
@@ -17,96 +20,143 @@ void GPULight::set_vp_mat(float fov, float aspect, float near_plane, float far_p
 	proj = glm::perspective(fov, aspect, near_plane, far_plane);
 }
 
-void Mesh::add_vertices(std::vector<Vertex> verts)
+static uint32_t pack_unorm_1010102(glm::vec3 dir, uint32_t w)
 {
-	Vertex tri_vert[3];
-	int tvi = 0;
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-	for (int i = 0; i < verts.size(); i++) {
-		Vertex v = verts[i];
-		tri_vert[tvi] = v;
-
-		if (tvi == 2) {
-			glm::vec3 e1 = tri_vert[1].pos - tri_vert[0].pos;
-			glm::vec3 e2 = tri_vert[2].pos - tri_vert[0].pos;
-			glm::vec3 tnormal = glm::normalize(glm::cross(e1, e2));
-			glm::vec2 duv1 = tri_vert[1].texCoord - tri_vert[0].texCoord;
-			glm::vec2 duv2 = tri_vert[2].texCoord - tri_vert[0].texCoord;
-			glm::vec3 tang;
-			glm::vec3 bitang;
-			float denom = 1.0f / ((duv1.x * duv2.y) - (duv2.x * duv1.y));
-			//std::cout << denom;
-			tang.x = denom * ((duv2.y * e1.x) - (duv1.y * e2.x));
-			tang.y = denom * ((duv2.y * e1.y) - (duv1.y * e2.y));
-			tang.z = denom * ((duv2.y * e1.z) - (duv1.y * e2.z));
-			//std::cout << tang.x << "," << tang.y << "," << tang.z;
-			tang = collutils::normalize_vec_in_dir(tang, tnormal);
-			bitang.x = denom * (-(duv2.x * e1.x) + (duv1.x * e2.x));
-			bitang.y = denom * (-(duv2.x * e1.y) + (duv1.x * e2.y));
-			bitang.z = denom * (-(duv2.x * e1.z) + (duv1.x * e2.z));
-			bitang = collutils::normalize_vec_in_dir(bitang, tnormal);
-			//std::cout << tang.x << "," << tang.y << "," << tang.z << "\n";
-			//std::cout << bitang.x << "," << bitang.y << "," << bitang.z << "\n";
-			//std::cout << tnormal.x << "," << tnormal.y << "," << tnormal.z << "\n";
-			for (int i = 0; i < 3; i++) {
-				tri_vert[i].tangent = glm::normalize(tang);
-				tri_vert[i].bitangent = glm::normalize(bitang);
-				tri_vert[i].normal = tnormal;
-				if (uniqueVertices.count(tri_vert[i]) == 0) {
-					uniqueVertices[tri_vert[i]] = static_cast<uint32_t>(_vertices.size());
-					_vertices.push_back(tri_vert[i]);
-				}
-				_indices.push_back(uniqueVertices[tri_vert[i]]);
-			}
-		}
-		tvi = (tvi + 1) % 3;
-	}
+	// degenerate UVs leave NaN tangents, they get some unit vector instead of garbage bits
+	if (!std::isfinite(dir.x) || !std::isfinite(dir.y) || !std::isfinite(dir.z) || glm::length(dir) < 1e-12f) dir = glm::vec3(0, 0, 1);
+	dir = glm::normalize(dir);
+	uint32_t x = uint32_t(std::lround(std::clamp(dir.x * 0.5f + 0.5f, 0.0f, 1.0f) * 1023.0f));
+	uint32_t y = uint32_t(std::lround(std::clamp(dir.y * 0.5f + 0.5f, 0.0f, 1.0f) * 1023.0f));
+	uint32_t z = uint32_t(std::lround(std::clamp(dir.z * 0.5f + 0.5f, 0.0f, 1.0f) * 1023.0f));
+	return x | (y << 10) | (z << 20) | (w << 30);
 }
 
-void MaintainedMesh::add_vertices(std::vector<Vertex> verts)
+static glm::vec3 unpack_unorm_1010102(uint32_t packed)
 {
-	Vertex tri_vert[3];
-	int tvi = 0;
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-	for (int i = 0; i < verts.size(); i++) {
-		Vertex v = verts[i];
-		tri_vert[tvi] = v;
-
-		if (tvi == 2) {
-			glm::vec3 e1 = tri_vert[1].pos - tri_vert[0].pos;
-			glm::vec3 e2 = tri_vert[2].pos - tri_vert[0].pos;
-			glm::vec3 tnormal = glm::normalize(glm::cross(e1, e2));
-			glm::vec2 duv1 = tri_vert[1].texCoord - tri_vert[0].texCoord;
-			glm::vec2 duv2 = tri_vert[2].texCoord - tri_vert[0].texCoord;
-			glm::vec3 tang;
-			glm::vec3 bitang;
-			float denom = 1.0f / ((duv1.x * duv2.y) - (duv2.x * duv1.y));
-			//std::cout << denom;
-			tang.x = denom * ((duv2.y * e1.x) - (duv1.y * e2.x));
-			tang.y = denom * ((duv2.y * e1.y) - (duv1.y * e2.y));
-			tang.z = denom * ((duv2.y * e1.z) - (duv1.y * e2.z));
-			//std::cout << tang.x << "," << tang.y << "," << tang.z;
-			//tang = collutils::normalize_vec_in_dir(tang, tnormal);
-			bitang.x = denom * (-(duv2.x * e1.x) + (duv1.x * e2.x));
-			bitang.y = denom * (-(duv2.x * e1.y) + (duv1.x * e2.y));
-			bitang.z = denom * (-(duv2.x * e1.z) + (duv1.x * e2.z));
-			//bitang = collutils::normalize_vec_in_dir(bitang, tnormal);
-			//std::cout << tang.x << "," << tang.y << "," << tang.z << "\n";
-			//std::cout << bitang.x << "," << bitang.y << "," << bitang.z << "\n";
-			//std::cout << tnormal.x << "," << tnormal.y << "," << tnormal.z << "\n";
-			for (int i = 0; i < 3; i++) {
-				tri_vert[i].tangent = glm::normalize(tang);
-				tri_vert[i].bitangent = glm::normalize(bitang);
-				tri_vert[i].normal = tnormal;
-				if (uniqueVertices.count(tri_vert[i]) == 0) {
-					uniqueVertices[tri_vert[i]] = static_cast<uint32_t>(_vertices.size());
-					_vertices.push_back(tri_vert[i]);
-				}
-				_indices.push_back(uniqueVertices[tri_vert[i]]);
-			}
-		}
-		tvi = (tvi + 1) % 3;
+	return glm::vec3(
+		float(packed & 1023) / 1023.0f,
+		float((packed >> 10) & 1023) / 1023.0f,
+		float((packed >> 20) & 1023) / 1023.0f
+	) * 2.0f - 1.0f;
+}
+
+PackedVertex PackedVertex::pack(const Vertex& vert)
+{
+	PackedVertex pvert;
+	pvert.normal = pack_unorm_1010102(vert.normal, 3);
+	bool flipped = glm::dot(glm::cross(vert.normal, vert.tangent), vert.bitangent) < 0.0f;
+	pvert.tangent = pack_unorm_1010102(vert.tangent, flipped ? 0 : 3);
+	pvert.texCoord = vert.texCoord;
+	return pvert;
+}
+
+Vertex PackedVertex::unpack(glm::vec3 pos, const PackedVertex& pvert)
+{
+	Vertex vert;
+	vert.pos = pos;
+	vert.normal = unpack_unorm_1010102(pvert.normal);
+	vert.tangent = unpack_unorm_1010102(pvert.tangent);
+	vert.bitangent = glm::cross(vert.normal, vert.tangent) * ((pvert.tangent >> 30) ? 1.0f : -1.0f);
+	vert.texCoord = pvert.texCoord;
+	return vert;
+}
+
+std::vector<VkVertexInputBindingDescription> PackedVertex::getBindingDescriptions(bool position_only)
+{
+	std::vector<VkVertexInputBindingDescription> bindingDescriptions(position_only ? 1 : 2);
+	bindingDescriptions[0].binding = 0;
+	bindingDescriptions[0].stride = sizeof(glm::vec3);
+	bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	if (!position_only) {
+		bindingDescriptions[1].binding = 1;
+		bindingDescriptions[1].stride = sizeof(PackedVertex);
+		bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	}
+	return bindingDescriptions;
+}
+
+std::vector<VkVertexInputAttributeDescription> PackedVertex::getAttributeDescriptions(bool position_only)
+{
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(position_only ? 1 : 4);
+	attributeDescriptions[0].binding = 0;
+	attributeDescriptions[0].location = 0;
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[0].offset = 0;
+	if (position_only) return attributeDescriptions;
+
+	// the UNORM variant is the one every device can fetch, the shaders map it back to [-1, 1]
+	attributeDescriptions[1].binding = 1;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	attributeDescriptions[1].offset = offsetof(PackedVertex, normal);
+
+	attributeDescriptions[2].binding = 1;
+	attributeDescriptions[2].location = 2;
+	attributeDescriptions[2].format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+	attributeDescriptions[2].offset = offsetof(PackedVertex, tangent);
+
+	attributeDescriptions[3].binding = 1;
+	attributeDescriptions[3].location = 3;
+	attributeDescriptions[3].format = VK_FORMAT_R32G32_SFLOAT;
+	attributeDescriptions[3].offset = offsetof(PackedVertex, texCoord);
+	return attributeDescriptions;
+}
+
+VkVertexInputBindingDescription GPUParticleInstance::getBindingDescription()
+{
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding = 2;
+	bindingDescription.stride = sizeof(GPUParticleInstance);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	return bindingDescription;
+}
+
+std::vector<VkVertexInputAttributeDescription> GPUParticleInstance::getAttributeDescriptions()
+{
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
+	attributeDescriptions[0].binding = 2;
+	attributeDescriptions[0].location = 4;
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	attributeDescriptions[0].offset = offsetof(GPUParticleInstance, posScale);
+
+	attributeDescriptions[1].binding = 2;
+	attributeDescriptions[1].location = 5;
+	attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+	attributeDescriptions[1].offset = offsetof(GPUParticleInstance, axisAngle);
+	return attributeDescriptions;
+}
+
+VkVertexInputBindingDescription GPUObjectInstance::getBindingDescription()
+{
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding = 3;
+	bindingDescription.stride = sizeof(GPUObjectInstance);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+	return bindingDescription;
+}
+
+VkVertexInputAttributeDescription GPUObjectInstance::getAttributeDescription()
+{
+	VkVertexInputAttributeDescription attributeDescription{};
+	attributeDescription.binding = 3;
+	attributeDescription.location = 4;
+	attributeDescription.format = VK_FORMAT_R32_UINT;
+	attributeDescription.offset = offsetof(GPUObjectInstance, objIdx);
+	return attributeDescription;
+}
+
+void Mesh::add_vertices(const std::vector<Vertex>& verts)
+{
+	std::vector<Vertex> corners = verts;
+	meshproc::computeTangentFrames(corners, true);
+	meshproc::weld(corners, _vertices, _indices);
+}
+
+void MaintainedMesh::add_vertices(const std::vector<Vertex>& verts)
+{
+	std::vector<Vertex> corners = verts;
+	meshproc::computeTangentFrames(corners, true);
+	meshproc::weld(corners, _vertices, _indices);
 }
 
 void Mesh::make_cuboid(glm::vec3 center, glm::vec3 u, glm::vec3 v, float ulen, float vlen, float tlen)
@@ -121,7 +171,7 @@ void Mesh::make_cuboid(glm::vec3 center, glm::vec3 u, glm::vec3 v, float ulen, f
 	// LMAO LEFT AT HALF
 }
 
-bool Mesh::load_from_obj(const char* filename)
+static bool load_obj_corners(const char* filename, std::vector<Vertex>& corners)
 {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -133,12 +183,10 @@ bool Mesh::load_from_obj(const char* filename)
 		return false;
 	}
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-
-	Vertex tri_vert[3];
-
+	size_t total_indices = 0;
+	for (const auto& shape : shapes) total_indices += shape.mesh.indices.size();
+	corners.reserve(total_indices);
 	for (const auto& shape : shapes) {
-		int tvi = 0;
 		for (const auto& index : shape.mesh.indices) {
 			Vertex vertex{};
 
@@ -159,118 +207,109 @@ bool Mesh::load_from_obj(const char* filename)
 				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
 			};
 
-			vertex.color = { 1.0f, 1.0f, 1.0f };
-
-			tri_vert[tvi] = vertex;
-
-			if (tvi == 2) {
-				glm::vec3 e1 = tri_vert[1].pos - tri_vert[0].pos;
-				glm::vec3 e2 = tri_vert[2].pos - tri_vert[0].pos;
-				glm::vec3 tnormal = glm::normalize(glm::cross(e1, e2));
-				glm::vec2 duv1 = tri_vert[1].texCoord - tri_vert[0].texCoord;
-				glm::vec2 duv2 = tri_vert[2].texCoord - tri_vert[0].texCoord;
-				glm::vec3 tang;
-				glm::vec3 bitang;
-				float denom = 1.0f / ((duv1.x * duv2.y) - (duv2.x * duv1.y));
-				//std::cout << denom;
-				tang.x = denom * ((duv2.y * e1.x) - (duv1.y * e2.x));
-				tang.y = denom * ((duv2.y * e1.y) - (duv1.y * e2.y));
-				tang.z = denom * ((duv2.y * e1.z) - (duv1.y * e2.z));
-				//std::cout << tang.x << "," << tang.y << "," << tang.z;
-				//tang = collutils::normalize_vec_in_dir(tang, tnormal);
-				bitang.x = denom * (-(duv2.x * e1.x) + (duv1.x * e2.x));
-				bitang.y = denom * (-(duv2.x * e1.y) + (duv1.x * e2.y));
-				bitang.z = denom * (-(duv2.x * e1.z) + (duv1.x * e2.z));
-				//bitang = collutils::normalize_vec_in_dir(bitang, tnormal);
-				//std::cout << tang.x << "," << tang.y << "," << tang.z << "\n";
-				//std::cout << bitang.x << "," << bitang.y << "," << bitang.z << "\n";
-				//std::cout << tnormal.x << "," << tnormal.y << "," << tnormal.z << "\n";
-				for (int i = 0; i < 3; i++) {
-					tri_vert[i].tangent = glm::normalize(tang);
-					tri_vert[i].bitangent = glm::normalize(bitang);
-					tri_vert[i].normal = tnormal;
-					if (uniqueVertices.count(tri_vert[i]) == 0) {
-						uniqueVertices[tri_vert[i]] = static_cast<uint32_t>(_vertices.size());
-						_vertices.push_back(tri_vert[i]);
-					}
-					_indices.push_back(uniqueVertices[tri_vert[i]]);
-				}
-			}
-			tvi = (tvi + 1) % 3;
+			corners.push_back(vertex);
 		}
-
 	}
 	return true;
 }
 
-bool MaintainedMesh::load_from_obj(const char* filename)
+bool Mesh::load_from_obj(const char* filename, SimpleThreadPooler* pool)
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn, err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename)) {
-		std::cout << (warn + err) << std::endl;
-		return false;
-	}
-
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};
-
-	Vertex tri_vert[3];
+	std::vector<Vertex> corners;
+	if (!load_obj_corners(filename, corners)) return false;
+	meshproc::computeTangentFrames(corners, true, pool);
+	meshproc::weld(corners, _vertices, _indices, pool);
+	return true;
+}
 
-	for (const auto& shape : shapes) {
-		int tvi = 0;
-		for (const auto& index : shape.mesh.indices) {
-			Vertex vertex{};
+void Mesh::optimize_order()
+{
+	meshproc::optimizeTriangleOrder(_vertices, _indices);
+	meshproc::optimizeVertexOrder(_vertices, _indices);
+}
 
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+void Mesh::build_lods()
+{
+	std::vector<size_t> targets;
+	for (uint32_t l = 1; l < MAX_MESH_LODS; l++) targets.push_back(((_indices.size() / 3) >> l) * 3);
+	std::vector<std::vector<uint32_t>> levels;
+	std::vector<float> errors;
+	meshproc::simplify(_vertices, _indices, targets, levels, errors);
+
+	_lods.clear();
+	_lods.push_back({ 0, uint32_t(_indices.size()), 0.0f });
+	for (size_t l = 0; l < levels.size(); l++) {
+		// a mesh with next to nothing to collapse can end up with no triangles, that isn't a level to draw
+		if (levels[l].empty() || levels[l].size() > _lods.back().indexCount * 4 / 5) break;
+		// the triangles changed, so the face normals and tangents are built again like load_from_obj does
+		std::vector<Vertex> corners(levels[l].size());
+		for (size_t ci = 0; ci < corners.size(); ci++) corners[ci] = _vertices[levels[l][ci]];
+		meshproc::computeTangentFrames(corners, true);
+		std::vector<Vertex> lod_vertices;
+		std::vector<uint32_t> lod_indices;
+		meshproc::weld(corners, lod_vertices, lod_indices);
+		meshproc::optimizeTriangleOrder(lod_vertices, lod_indices);
+		meshproc::optimizeVertexOrder(lod_vertices, lod_indices);
+
+		uint32_t base = uint32_t(_vertices.size());
+		for (uint32_t& vi : lod_indices) vi += base;
+		_lods.push_back({ uint32_t(_indices.size()), uint32_t(lod_indices.size()), errors[l] });
+		_vertices.insert(_vertices.end(), lod_vertices.begin(), lod_vertices.end());
+		_indices.insert(_indices.end(), lod_indices.begin(), lod_indices.end());
+	}
+}
 
-			vertex.normal = {
-				attrib.normals[3 * index.normal_index + 0],
-				attrib.normals[3 * index.normal_index + 1],
-				attrib.normals[3 * index.normal_index + 2]
-			};
+uint32_t pickMeshLod(const MeshLod* lods, uint32_t lod_count, float px_per_unit, float max_error_px)
+{
+	uint32_t lod = 0;
+	while (lod + 1 < lod_count && lods[lod + 1].error * px_per_unit <= max_error_px) lod++;
+	return lod;
+}
 
-			vertex.texCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
+void Mesh::compute_bounds()
+{
+	// sphere around the AABB center, not minimal but cheap and tight enough for culling
+	if (_vertices.size() == 0) {
+		_bounds = glm::vec4(0);
+		return;
+	}
+	glm::vec3 bmin = _vertices[0].pos, bmax = _vertices[0].pos;
+	for (Vertex& vert : _vertices) {
+		bmin = glm::min(bmin, vert.pos);
+		bmax = glm::max(bmax, vert.pos);
+	}
+	glm::vec3 center = (bmin + bmax) * 0.5f;
+	float radius = 0;
+	for (Vertex& vert : _vertices) {
+		radius = std::max(radius, glm::length(vert.pos - center));
+	}
+	_bounds = glm::vec4(center, radius);
+}
 
-			vertex.color = { 1.0f, 1.0f, 1.0f };
-
-			tri_vert[tvi] = vertex;
-
-			if (tvi == 2) {
-				glm::vec3 e1 = tri_vert[1].pos - tri_vert[0].pos;
-				glm::vec3 e2 = tri_vert[2].pos - tri_vert[0].pos;
-				glm::vec2 duv1 = tri_vert[1].texCoord - tri_vert[0].texCoord;
-				glm::vec2 duv2 = tri_vert[2].texCoord - tri_vert[0].texCoord;
-				glm::vec3 tang;
-				float denom = 1.0f / (duv1.x * duv2.y - duv2.x * duv1.y);
-				tang.x = denom * (duv2.y * e1.x - duv1.y * e2.x);
-				tang.y = denom * (duv2.y * e1.y - duv1.y * e2.y);
-				tang.z = denom * (duv2.y * e1.z - duv1.y * e2.z);
-				for (int i = 0; i < 3; i++) {
-					tri_vert[i].tangent = tang;
-					if (uniqueVertices.count(tri_vert[i]) == 0) {
-						uniqueVertices[tri_vert[i]] = static_cast<uint32_t>(_vertices.size());
-						_vertices.push_back(tri_vert[i]);
-					}
-					_indices.push_back(uniqueVertices[tri_vert[i]]);
-				}
-			}
-			tvi = (tvi + 1) % 3;
+void MaintainedMesh::mark_dirty(size_t first, size_t count)
+{
+	size_t vcount = _vertices.size();
+	if (first >= vcount || count == 0) return;
+	size_t end = (count > vcount - first) ? vcount : first + count;
+	for (std::pair<uint32_t, uint32_t>& range : _dirty) {
+		if (range.first == range.second) {
+			range = { uint32_t(first), uint32_t(end) };
+		}
+		else {
+			range = { std::min(range.first, uint32_t(first)), std::max(range.second, uint32_t(end)) };
 		}
-
 	}
-	return true;
 }
 
+bool MaintainedMesh::load_from_obj(const char* filename)
+{
+	// keeps the file's normals, maintained meshes are usually smooth shaded
+	std::vector<Vertex> corners;
+	if (!load_obj_corners(filename, corners)) return false;
+	meshproc::computeTangentFrames(corners, false);
+	meshproc::weld(corners, _vertices, _indices);
+	return true;
+}
 
 void GPUPipeline::bindPipeline(VkCommandBuffer cmdBuffer)
 {
@@ -286,9 +325,11 @@ void GPUPipeline::bindPipelineDSets(VkCommandBuffer cmdBuffer, std::vector<VkDes
 void RenderObject::drawMesh(VkCommandBuffer cmdBuffer, size_t obj_idx)
 {
 	if (!maintained_mesh) {
-		vkCmdDrawIndexed(cmdBuffer, uint32_t(mesh->_indices.size()), 1, 0, 0, uint32_t(obj_idx));
+		uint32_t indexCount = uint32_t(mesh->_lods.empty() ? mesh->_indices.size() : mesh->_lods[0].indexCount);
+		vkCmdDrawIndexed(cmdBuffer, indexCount, 1, mesh->_firstIndex, mesh->_vertexOffset, uint32_t(obj_idx));
 	}
 	else {
-		vkCmdDrawIndexed(cmdBuffer, uint32_t(mmesh->_indices.size()), 1, 0, 0, uint32_t(obj_idx));
+		// the first frame's copy
+		vkCmdDrawIndexed(cmdBuffer, uint32_t(mmesh->_indices.size()), 1, mmesh->_firstIndex, mmesh->_vertexOffset, uint32_t(obj_idx));
 	}
 }
@@ -10,8 +10,11 @@
 #include <glm/gtx/hash.hpp>
 
 #include <array>
+#include <map>
 #include <optional>
 
+class SimpleThreadPooler;
+
 #define PRISM_LIGHT_SHADOW_FLAG 0x01
 #define PRISM_LIGHT_DIFFUSE_FLAG 0x02
 #define PRISM_LIGHT_SPECULAR_FLAG 0x04
@@ -40,69 +43,46 @@ struct MeshPushConstants {
 	glm::mat4 render_matrix;
 };
 
+// a vertex as meshes are built and processed on the CPU, PackedVertex is what the GPU gets
 struct Vertex {
 	glm::vec3 pos;
 	glm::vec3 normal;
 	glm::vec3 tangent;
 	glm::vec3 bitangent;
-	glm::vec3 color;
 	glm::vec2 texCoord;
 
-	static VkVertexInputBindingDescription getBindingDescription() {
-		VkVertexInputBindingDescription bindingDescription{};
-		bindingDescription.binding = 0;
-		bindingDescription.stride = sizeof(Vertex);
-		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-		return bindingDescription;
+	// compares every attribute, vertices that differ in any of them can't share an index
+	bool operator==(const Vertex& other) const {
+		return pos == other.pos && normal == other.normal && tangent == other.tangent && bitangent == other.bitangent
+			&& texCoord == other.texCoord;
 	}
+};
 
-	static std::array<VkVertexInputAttributeDescription, 6> getAttributeDescriptions() {
-		std::array<VkVertexInputAttributeDescription, 6> attributeDescriptions{};
-		attributeDescriptions[0].binding = 0;
-		attributeDescriptions[0].location = 0;
-		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-		attributeDescriptions[1].binding = 0;
-		attributeDescriptions[1].location = 1;
-		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[1].offset = offsetof(Vertex, normal);
-
-		attributeDescriptions[2].binding = 0;
-		attributeDescriptions[2].location = 2;
-		attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[2].offset = offsetof(Vertex, tangent);
-
-		attributeDescriptions[3].binding = 0;
-		attributeDescriptions[3].location = 3;
-		attributeDescriptions[3].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[3].offset = offsetof(Vertex, bitangent);
-
-		attributeDescriptions[4].binding = 0;
-		attributeDescriptions[4].location = 4;
-		attributeDescriptions[4].format = VK_FORMAT_R32G32B32_SFLOAT;
-		attributeDescriptions[4].offset = offsetof(Vertex, color);
-
-		attributeDescriptions[5].binding = 0;
-		attributeDescriptions[5].location = 5;
-		attributeDescriptions[5].format = VK_FORMAT_R32G32_SFLOAT;
-		attributeDescriptions[5].offset = offsetof(Vertex, texCoord);
-
-		return attributeDescriptions;
-	}
+// vertex data goes to the GPU in two streams so shadow passes only fetch positions. Binding 0 holds the vec3
+// positions, binding 1 the shading attributes packed here. Normal and tangent are A2B10G10R10_UNORM with xyz mapped
+// from [-1, 1], the tangent's alpha is 1 when the bitangent is cross(normal, tangent) and 0 when it is flipped
+struct PackedVertex {
+	uint32_t normal;
+	uint32_t tangent;
+	glm::vec2 texCoord;
 
-	bool operator==(const Vertex& other) const {
-		return pos == other.pos && color == other.color && texCoord == other.texCoord;
-	}
+	static PackedVertex pack(const Vertex& vert);
+	// what the vertex shaders decode, bitangent is unit length and color isn't stored
+	static Vertex unpack(glm::vec3 pos, const PackedVertex& pvert);
+
+	static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool position_only);
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool position_only);
 };
 
 namespace std {
+	// hashes a subset of what operator== compares, so equal vertices always hash equal
 	template<> struct hash<Vertex> {
 		size_t operator()(Vertex const& vertex) const {
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1);
+			size_t h = hash<glm::vec3>()(vertex.pos);
+			h = h * 31 + hash<glm::vec3>()(vertex.normal);
+			h = h * 31 + hash<glm::vec3>()(vertex.tangent);
+			h = h * 31 + hash<glm::vec2>()(vertex.texCoord);
+			return h;
 		}
 	};
 }
@@ -126,9 +106,14 @@ struct RunnableGPUPipeline {
 	std::vector<GPUPushConstant> pushConstants;
 };
 
+// _bufferMemory is shared with other resources, the buffer is bound at _memoryOffset.
+// Host visible buffers are always mapped through _mapped, _memorySize is the range to flush
 struct GPUBuffer {
 	VkBuffer _buffer;
 	VkDeviceMemory _bufferMemory;
+	VkDeviceSize _memoryOffset = 0;
+	VkDeviceSize _memorySize = VK_WHOLE_SIZE;
+	void* _mapped = NULL;
 };
 
 struct GPUSetBuffer {
@@ -136,34 +121,84 @@ struct GPUSetBuffer {
 	VkDescriptorSet _dSet;
 };
 
+const uint32_t MAX_MESH_LODS = 4;
+
+// a LOD's range of its mesh's indices and how far its surface strays from the full mesh, in mesh units
+struct MeshLod {
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	float error = 0;
+};
+
+// the coarsest of lod_count LODs whose error stays within max_error_px when a mesh unit covers px_per_unit pixels
+uint32_t pickMeshLod(const MeshLod* lods, uint32_t lod_count, float px_per_unit, float max_error_px);
+
 struct Mesh {
 	std::vector<Vertex> _vertices;
 	std::vector<uint32_t> _indices;
+	// LOD 0 is the full mesh, each coarser one has its own vertices and indices appended after it. Empty for meshes
+	// without LODs, they draw all of _indices
+	std::vector<MeshLod> _lods;
 
+	// positions and packed attributes, see PackedVertex
 	GPUBuffer _vertexBuffer;
+	GPUBuffer _attribBuffer;
 	GPUBuffer _indexBuffer;
 	VkSampler _textureSampler;
-
-	void add_vertices(std::vector<Vertex> verts);
+	// bounding sphere in mesh space, xyz center and w radius
+	glm::vec4 _bounds = glm::vec4(0);
+	// the mesh's range in its pool, the buffers are the pool's
+	int32_t _pool = -1;
+	int32_t _vertexOffset = 0;
+	uint32_t _firstIndex = 0;
+	// upload batch the mesh's data is in, it isn't drawn before the batch finished
+	uint64_t _uploadTicket = 0;
+
+	void add_vertices(const std::vector<Vertex>& verts);
 	void make_cuboid(glm::vec3 center, glm::vec3 u, glm::vec3 v, float ulen, float vlen, float tlen);
-	bool load_from_obj(const char* filename);
+	// the pool, if given, takes the tangent and weld work and has to be idle
+	bool load_from_obj(const char* filename, SimpleThreadPooler* pool = NULL);
+	// vertex cache, overdraw and vertex fetch order, see meshproc. Before build_lods, it reorders all of _indices
+	void optimize_order();
+	// simplifies the mesh to half the triangles of the previous level until MAX_MESH_LODS levels, levels that
+	// barely get smaller are left out
+	void build_lods();
+	void compute_bounds();
 };
 
+// a mesh rewritten from the CPU while it is drawn. Its range of the renderer's dynamic pool has a copy of the
+// vertices per frame in flight, the indices are written once when it is added and its counts stay fixed after that
 struct MaintainedMesh {
 	std::vector<Vertex> _vertices;
 	std::vector<uint32_t> _indices;
 
-	GPUBuffer _vertexBuffer[3];
-	GPUBuffer _indexBuffer[3];
-	VkSampler _textureSampler;
+	int32_t _vertexOffset = -1;
+	uint32_t _firstIndex = 0;
+	// vertices each frame's copy is missing, [first, end) and empty when first == end
+	std::vector<std::pair<uint32_t, uint32_t>> _dirty;
 
-	void add_vertices(std::vector<Vertex> verts);
+	void add_vertices(const std::vector<Vertex>& verts);
 	bool load_from_obj(const char* filename);
+	// call after changing vertices, refreshes only write what was marked to the copies
+	void mark_dirty(size_t first = 0, size_t count = SIZE_MAX);
+};
+
+// a big vertex and index buffer pair static meshes are sub-allocated from, draws of meshes in the same
+// pool share one bind and can go out as one indirect draw. Free ranges are offset -> count, in vertices and indices.
+// The dynamic pool repeats its vertex ranges per frame in flight, _frameVertices apart
+struct GPUMeshPool {
+	GPUBuffer _vertexBuffer;
+	GPUBuffer _attribBuffer;
+	GPUBuffer _indexBuffer;
+	std::map<uint32_t, uint32_t> _freeVertices;
+	std::map<uint32_t, uint32_t> _freeIndices;
+	uint32_t _frameVertices = 0;
 };
 
 struct GPUImage {
 	VkImage _image;
 	VkDeviceMemory _imageMemory;
+	VkDeviceSize _memoryOffset = 0;
 	VkImageViewCreateInfo _imageViewInfo;
 	VkImageView _imageView;
 };
@@ -171,6 +206,7 @@ struct GPUImage {
 struct GPUTextureSet {
 	std::vector<GPUImage> _gImages;
 	VkDescriptorSet _dSet;
+	uint64_t _uploadTicket = 0;
 };
 
 struct GPUCameraData {
@@ -224,11 +260,117 @@ public:
 	void drawMesh(VkCommandBuffer cmdBuffer, size_t obj_idx = 0);
 };
 
+// a RenderObject resolved to the handles and counts its draws need. Pool -1 marks maintained meshes, frame n
+// draws their copy at vertexOffset + n * frameVertices of the dynamic pool
+struct RenderListItem {
+	VkBuffer vertexBuffer;
+	VkBuffer attribBuffer;
+	VkBuffer indexBuffer;
+	VkDescriptorSet texDSet;
+	// index ranges are absolute in the index buffer. Meshes without LODs have the whole mesh as their one level
+	MeshLod lods[MAX_MESH_LODS];
+	uint32_t lodCount;
+	int32_t vertexOffset;
+	uint32_t frameVertices;
+	int32_t pool;
+	uint32_t objIdx;
+	bool renderable;
+	bool shadowcasting;
+	// mesh space bounding sphere
+	glm::vec4 bounds;
+};
+
+// draw list entries are an object index with the LOD to draw it at in the top bits
+const uint32_t DRAW_LOD_SHIFT = 30;
+const uint32_t DRAW_OBJ_MASK = (1u << DRAW_LOD_SHIFT) - 1;
+
+// a view the objects are culled against, one per pass slot with a shadowcasting light plus the camera
+struct CullView {
+	uint32_t passSlot;
+	bool shadow_pass = false;
+	glm::mat4 viewproj = glm::mat4(1);
+	// pixels one world unit covers at view depth 1, over the pass's LOD bias. 0 draws everything at LOD 0
+	float lodScale = 0;
+};
+
+// what a particle draw takes per instance: position and uniform scale, spin axis and angle around it
+struct GPUParticleInstance {
+	glm::vec4 posScale;
+	glm::vec4 axisAngle;
+
+	// binding 2, stepped per instance after the position and attribute streams
+	static VkVertexInputBindingDescription getBindingDescription();
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions();
+};
+
+// what a mesh draw takes per instance: the index of its object in the object buffer. Draws of the same mesh and LOD
+// in a pass are one instanced draw over consecutive entries of the frame's instance buffer
+struct GPUObjectInstance {
+	uint32_t objIdx;
+
+	// binding 3 at location 4, next to the position and attribute streams of the gbuffer and shadow pipelines
+	static VkVertexInputBindingDescription getBindingDescription();
+	static VkVertexInputAttributeDescription getAttributeDescription();
+};
+
+// a mesh drawn once per particle in a single instanced draw. Every frame in flight has its own instance buffer,
+// grown when the frame is handed more particles than it holds
+struct GPUParticleType {
+	std::string id;
+	Mesh* mesh = NULL;
+	GPUTextureSet* texmaps = NULL;
+	std::vector<GPUBuffer> instanceBuffers;
+	std::vector<uint32_t> capacities;
+	std::vector<uint32_t> counts;
+};
+
+// a range of a pass's draw list drawn inside one render pass, recorded into a secondary command buffer
+struct SecondaryCmdJob {
+	uint32_t passSlot;
+	uint32_t worker;
+	VkRenderPass renderPass;
+	VkFramebuffer frameBuffer;
+	GPUPipeline pipeline;
+	std::vector<VkDescriptorSet> dSets;
+	bool shadow_pass = false;
+	// the pass's atlas tile, set as viewport and scissor of shadow passes
+	VkRect2D area = {};
+	GPULightPC lightPC;
+	const std::vector<uint32_t>* drawList = NULL;
+	size_t draw_start = 0, draw_end = 0;
+	VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+};
+
 struct GPUFrameData {
 	std::unordered_map<std::string, GPUSetBuffer> setBuffers;
 
 	VkCommandPool commandPool;
 	VkCommandBuffer commandBuffer;
+	// graphics side of the ownership transfers of finished uploads, submitted before commandBuffer when there are any
+	VkCommandBuffer acquireCmdBuffer;
+	// one pool per renderer worker. The secondaries of each pass slot are kept until the pass gets dirty,
+	// buffer k of a slot belongs to worker (slot + k) % workers
+	std::vector<VkCommandPool> workerCmdPools;
+	std::vector<std::vector<VkCommandBuffer>> passCmdBuffers;
+	std::vector<size_t> passCmdCounts;
+	std::vector<std::vector<uint32_t>> passDrawLists;
+	std::vector<bool> passDirty;
+	bool primaryDirty = true;
+	// per shadow pass slot, the atlas tile its secondaries were recorded for and whether this frame's primary renders it
+	std::vector<uint64_t> shadowTileGenerations;
+	std::vector<bool> shadowRender;
+	// indirect draw commands, MAX_OBJECTS per pass slot, written by the workers when they record the pass.
+	// The particle types' commands follow, their instance counts are rewritten every frame
+	GPUBuffer indirectBuffer;
+	VkDrawIndexedIndirectCommand* indirectCmds = NULL;
+	// object indices the pass slots' draws instance over, laid out like the commands and written with them
+	GPUBuffer instanceBuffer;
+	uint32_t* instanceObjs = NULL;
+	// executed in the gbuffer pass after its secondaries, recorded again when a particle type or instance buffer changes
+	VkCommandBuffer particleCmdBuffer;
+	bool particlesDirty = true;
+	// clusteredLightsVersion the cluster_light buffer was last written from
+	uint64_t clusterLightsVersion = 0;
 
 	GPUImage swapChainImage;
 	GPUImage colorImage;
@@ -236,21 +378,11 @@ struct GPUFrameData {
 	GPUImage normalImage;
 	GPUImage seImage;
 	GPUImage ambientImage;
-	GPUImage pShadowMapTemp;
-	GPUImage dShadowMapTemp;
-	GPUImage pShadowDepthImage;
-	GPUImage dShadowDepthImage;
-	std::vector<GPUImage> shadow_cube_maps;
-	std::vector<GPUImage> shadow_dir_maps;
 
 	VkFramebuffer swapChainFrameBuffer;
 	VkFramebuffer gbufferFrameBuffer;
 	VkFramebuffer ambientFrameBuffer;
-	VkFramebuffer pShadowFrameBuffer;
-	VkFramebuffer dShadowFrameBuffer;
 	
-	VkDescriptorSet shadow_cube_dset;
-	VkDescriptorSet shadow_dir_dset;
 	VkDescriptorSet positionDset;
 	VkDescriptorSet normalImageDset;
 	VkDescriptorSet finalComposeDset;
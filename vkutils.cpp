@@ -334,17 +334,36 @@ VkExtent2D vkutils::chooseSwapExtent(GLFWwindow* window, const VkSurfaceCapabili
 	}
 }
 
-uint32_t findMemoryType(VkPhysicalDevice physicalDevice, uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+static GPUAllocator* gpu_allocator = NULL;
+static VkDeviceSize non_coherent_atom = 256;
 
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-			return i;
-		}
+GPUAllocator* vkutils::getAllocator(VkDevice device, VkPhysicalDevice physicalDevice)
+{
+	if (gpu_allocator == NULL) {
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		gpu_allocator = new GPUAllocator(device, memProperties, deviceProperties.limits.nonCoherentAtomSize);
+		non_coherent_atom = std::max(deviceProperties.limits.nonCoherentAtomSize, VkDeviceSize(1));
 	}
+	return gpu_allocator;
+}
+
+void vkutils::destroyAllocator()
+{
+	delete gpu_allocator;
+	gpu_allocator = NULL;
+}
+
+static GPUMemoryRange bind_image_memory(VkDevice device, VkPhysicalDevice physicalDevice, VkImage image, VkMemoryPropertyFlags memFlag)
+{
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	throw std::runtime_error("failed to find suitable memory type!");
+	GPUMemoryRange range = vkutils::getAllocator(device, physicalDevice)->allocate(memRequirements, memFlag, true);
+	vkBindImageMemory(device, image, range.memory, range.offset);
+	return range;
 }
 
 GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewCreateInfo imageViewInfo)
@@ -358,7 +377,7 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewCrea
 	return timg;
 }
 
-GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewType viewType, VkFormat format, VkImageAspectFlags aspectFlag)
+GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewType viewType, VkFormat format, VkImageAspectFlags aspectFlag, uint32_t mipLevels)
 {
 	VkImageViewCreateInfo viewInfo{};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -367,7 +386,7 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewType
 	viewInfo.format = format;
 	viewInfo.subresourceRange.aspectMask = aspectFlag;
 	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.levelCount = mipLevels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -377,7 +396,7 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkImage image, VkImageViewType
 	return createGPUImage(device, image, viewInfo);
 }
 
-GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlag, VkMemoryPropertyFlags memFlag, VkImageViewType viewType, VkImageAspectFlags aspectFlag)
+GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usageFlag, VkMemoryPropertyFlags memFlag, VkImageViewType viewType, VkImageAspectFlags aspectFlag, uint32_t mipLevels)
 {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -385,7 +404,7 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevic
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
@@ -397,21 +416,11 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevic
 	VkImage tImg;
 	if (vkCreateImage(device, &imageInfo, NULL, &tImg) != VK_SUCCESS) throw std::runtime_error("failed to create image!");
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, tImg, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memFlag);
-
-	VkDeviceMemory tImgMem;
-	if (vkAllocateMemory(device, &allocInfo, NULL, &tImgMem) != VK_SUCCESS) throw std::runtime_error("failed to allocate image memory!");
-
-	vkBindImageMemory(device, tImg, tImgMem, 0);
+	GPUMemoryRange tImgMem = bind_image_memory(device, physicalDevice, tImg, memFlag);
 
-	GPUImage res = createGPUImage(device, tImg, viewType, format, aspectFlag);
-	res._imageMemory = tImgMem;
+	GPUImage res = createGPUImage(device, tImg, viewType, format, aspectFlag, mipLevels);
+	res._imageMemory = tImgMem.memory;
+	res._memoryOffset = tImgMem.offset;
 	return res;
 }
 
@@ -436,21 +445,11 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevic
 	VkImage tImg;
 	if (vkCreateImage(device, &imageInfo, NULL, &tImg) != VK_SUCCESS) throw std::runtime_error("failed to create image!");
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, tImg, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memFlag);
-
-	VkDeviceMemory tImgMem;
-	if (vkAllocateMemory(device, &allocInfo, NULL, &tImgMem) != VK_SUCCESS) throw std::runtime_error("failed to allocate image memory!");
-
-	vkBindImageMemory(device, tImg, tImgMem, 0);
+	GPUMemoryRange tImgMem = bind_image_memory(device, physicalDevice, tImg, memFlag);
 
 	GPUImage res = createGPUImage(device, tImg, viewType, format, aspectFlag);
-	res._imageMemory = tImgMem;
+	res._imageMemory = tImgMem.memory;
+	res._memoryOffset = tImgMem.offset;
 	return res;
 }
 
@@ -476,23 +475,11 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevic
 		throw std::runtime_error("failed to create image!");
 	}
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, tImg, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memFlag);
-
-	VkDeviceMemory tImgMem;
-	if (vkAllocateMemory(device, &allocInfo, NULL, &tImgMem) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(device, tImg, tImgMem, 0);
+	GPUMemoryRange tImgMem = bind_image_memory(device, physicalDevice, tImg, memFlag);
 
 	GPUImage res = createGPUImage(device, tImg, imageViewInfo);
-	res._imageMemory = tImgMem;
+	res._imageMemory = tImgMem.memory;
+	res._memoryOffset = tImgMem.offset;
 	return res;
 }
 
@@ -519,23 +506,11 @@ GPUImage vkutils::createGPUImage(VkDevice device, VkPhysicalDevice physicalDevic
 		throw std::runtime_error("failed to create image!");
 	}
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, tImg, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, memFlag);
-
-	VkDeviceMemory tImgMem;
-	if (vkAllocateMemory(device, &allocInfo, NULL, &tImgMem) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(device, tImg, tImgMem, 0);
+	GPUMemoryRange tImgMem = bind_image_memory(device, physicalDevice, tImg, memFlag);
 
 	GPUImage res = createGPUImage(device, tImg, imageViewInfo);
-	res._imageMemory = tImgMem;
+	res._imageMemory = tImgMem.memory;
+	res._memoryOffset = tImgMem.offset;
 	return res;
 }
 
@@ -543,14 +518,14 @@ void vkutils::destroyGPUImage(VkDevice device, GPUImage image, bool memory_alrea
 {
 	vkDestroyImageView(device, image._imageView, NULL);
 	vkDestroyImage(device, image._image, NULL);
-	if (!memory_already_freed) vkFreeMemory(device, image._imageMemory, NULL);
+	if (!memory_already_freed && gpu_allocator != NULL) gpu_allocator->free(image._imageMemory, image._memoryOffset);
 }
 
-VkCommandBuffer vkutils::createCmdBuffer(VkDevice device, VkCommandPool cmdPool) {
+VkCommandBuffer vkutils::createCmdBuffer(VkDevice device, VkCommandPool cmdPool, VkCommandBufferLevel level) {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = cmdPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.level = level;
 	allocInfo.commandBufferCount = 1;
 
 	VkCommandBuffer cmdBuffer;
@@ -596,7 +571,7 @@ void vkutils::transitionImageLayout(VkCommandBuffer cmdBuffer, VkImage image, Vk
 	barrier.oldLayout = oldLayout;
 	barrier.newLayout = newLayout;
 	barrier.srcQueueFamilyIndex = srcQFI;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = dstQFI;
 	barrier.image = image;
 
 	barrier.subresourceRange = subresourceRange;
@@ -684,7 +659,7 @@ void vkutils::transitionImageLayout(VkDevice device, VkCommandPool cmdPool, VkQu
 {
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, cmdPool);
 
-	transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, srcStageMask, dstStageMask, subresourceRange);
+	transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, srcStageMask, dstStageMask, subresourceRange, srcQFI, dstQFI);
 
 	endSingleTimeCommands(device, cmdPool, commandBuffer, queue);
 }
@@ -710,17 +685,17 @@ VkFramebuffer vkutils::createFrameBuffer(VkDevice device, VkRenderPass renderPas
 	return fBuffer;
 }
 
-void vkutils::beginRenderPass(VkRenderPass rPass, VkFramebuffer fBuffer, VkExtent2D rpExtent, VkCommandBuffer cmdBuffer, std::vector<VkClearValue> clearValues) {
+void vkutils::beginRenderPass(VkRenderPass rPass, VkFramebuffer fBuffer, VkExtent2D rpExtent, VkCommandBuffer cmdBuffer, std::vector<VkClearValue> clearValues, VkSubpassContents contents, VkOffset2D rpOffset) {
 	VkRenderPassBeginInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.renderPass = rPass;
 	renderPassInfo.framebuffer = fBuffer;
-	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.offset = rpOffset;
 	renderPassInfo.renderArea.extent = rpExtent;
 	renderPassInfo.clearValueCount = uint32_t(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
-	vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(cmdBuffer, &renderPassInfo, contents);
 }
 
 bool vkutils::hasStencilComponent(VkFormat format) {
@@ -778,18 +753,27 @@ VkDescriptorSetLayout vkutils::createDescriptorSetLayout(
 	return dSetLayout;
 }
 
-GPUBuffer vkutils::createBuffer(
+static GPUBuffer create_buffer(
 	VkDevice device,
 	VkPhysicalDevice physicalDevice,
 	VkDeviceSize size,
 	VkBufferUsageFlags usage,
-	VkMemoryPropertyFlags properties
+	VkMemoryPropertyFlags properties,
+	int strategy,
+	std::vector<uint32_t> queueFamilies = {}
 ) {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.size = size;
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	std::sort(queueFamilies.begin(), queueFamilies.end());
+	queueFamilies.erase(std::unique(queueFamilies.begin(), queueFamilies.end()), queueFamilies.end());
+	if (queueFamilies.size() > 1) {
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = uint32_t(queueFamilies.size());
+		bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
 
 	GPUBuffer gBuff;
 	if (vkCreateBuffer(device, &bufferInfo, NULL, &gBuff._buffer) != VK_SUCCESS) {
@@ -799,26 +783,48 @@ GPUBuffer vkutils::createBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, gBuff._buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
+	GPUMemoryRange range = vkutils::getAllocator(device, physicalDevice)->allocate(memRequirements, properties, false, strategy);
+	gBuff._bufferMemory = range.memory;
+	gBuff._memoryOffset = range.offset;
+	gBuff._memorySize = range.size;
+	gBuff._mapped = range.mapped;
+	vkBindBufferMemory(device, gBuff._buffer, gBuff._bufferMemory, gBuff._memoryOffset);
 
-	if (vkAllocateMemory(device, &allocInfo, NULL, &gBuff._bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate buffer memory!");
-	}
+	return gBuff;
+}
 
-	vkBindBufferMemory(device, gBuff._buffer, gBuff._bufferMemory, 0);
+GPUBuffer vkutils::createBuffer(
+	VkDevice device,
+	VkPhysicalDevice physicalDevice,
+	VkDeviceSize size,
+	VkBufferUsageFlags usage,
+	VkMemoryPropertyFlags properties,
+	std::vector<uint32_t> queueFamilies
+) {
+	return create_buffer(device, physicalDevice, size, usage, properties, PRISM_ALLOC_BUDDY, queueFamilies);
+}
 
-	return gBuff;
+// staging buffers are freed as soon as their copy finished, they come from the linear blocks
+static GPUBuffer create_staging_buffer(VkDevice device, VkPhysicalDevice physicalDevice, VkDeviceSize size, void* data)
+{
+	GPUBuffer stageBuffer = create_buffer(
+		device,
+		physicalDevice,
+		size,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		PRISM_ALLOC_LINEAR
+	);
+	memcpy(stageBuffer._mapped, data, (size_t)size);
+	return stageBuffer;
 }
 
-void vkutils::copyBuffer(VkDevice device, VkCommandPool cmdPool, VkQueue queue, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+void vkutils::copyBuffer(VkDevice device, VkCommandPool cmdPool, VkQueue queue, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize dstOffset) {
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands(device, cmdPool);
 
 	VkBufferCopy copyRegion{};
 	copyRegion.srcOffset = 0; // Optional
-	copyRegion.dstOffset = 0; // Optional
+	copyRegion.dstOffset = dstOffset;
 	copyRegion.size = size;
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
@@ -912,18 +918,7 @@ GPUBuffer vkutils::createBuffer(
 	VkCommandPool cmdPool,
 	VkQueue queue
 ) {
-	GPUBuffer stageBuffer = createBuffer(
-		device,
-		physicalDevice,
-		buffSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
-
-	void* temp;
-	vkMapMemory(device, stageBuffer._bufferMemory, 0, buffSize, 0, &temp);
-	memcpy(temp, data, (size_t)buffSize);
-	vkUnmapMemory(device, stageBuffer._bufferMemory);
+	GPUBuffer stageBuffer = create_staging_buffer(device, physicalDevice, buffSize, data);
 
 	GPUBuffer resBuffer;
 	resBuffer = createBuffer(
@@ -939,45 +934,50 @@ GPUBuffer vkutils::createBuffer(
 	return resBuffer;
 }
 
-void vkutils::writeToBuffer(VkDevice device, VkPhysicalDevice physicalDevice, GPUBuffer buffer, VkDeviceSize buffSize, void* data, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkCommandPool cmdPool, VkQueue queue)
+void vkutils::writeToBuffer(VkDevice device, VkPhysicalDevice physicalDevice, GPUBuffer buffer, VkDeviceSize buffSize, void* data, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkCommandPool cmdPool, VkQueue queue, VkDeviceSize dstOffset)
 {
-	GPUBuffer stageBuffer = createBuffer(
-		device,
-		physicalDevice,
-		buffSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
-
-	void* temp;
-	vkMapMemory(device, stageBuffer._bufferMemory, 0, buffSize, 0, &temp);
-	memcpy(temp, data, (size_t)buffSize);
-	vkUnmapMemory(device, stageBuffer._bufferMemory);
+	GPUBuffer stageBuffer = create_staging_buffer(device, physicalDevice, buffSize, data);
 
-	copyBuffer(device, cmdPool, queue, stageBuffer._buffer, buffer._buffer, buffSize);
+	copyBuffer(device, cmdPool, queue, stageBuffer._buffer, buffer._buffer, buffSize, dstOffset);
 	destroyBuffer(device, stageBuffer);
 }
 
 void vkutils::destroyBuffer(VkDevice device, GPUBuffer buffer)
 {
 	vkDestroyBuffer(device, buffer._buffer, NULL);
-	vkFreeMemory(device, buffer._bufferMemory, NULL);
+	if (gpu_allocator != NULL) gpu_allocator->free(buffer._bufferMemory, buffer._memoryOffset);
 }
 
-void vkutils::copyDataToImage(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool cmdPool, VkQueue queue, VkDeviceSize dataSize, void* data, GPUImage image, VkOffset3D imgOffset, VkExtent3D imgExtent)
+void vkutils::flushBuffer(VkDevice device, GPUBuffer buffer)
 {
-	GPUBuffer stageBuffer = createBuffer(
-		device,
-		physicalDevice,
-		dataSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-	);
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = buffer._bufferMemory;
+	range.offset = buffer._memoryOffset;
+	range.size = buffer._memorySize;
+	vkFlushMappedMemoryRanges(device, 1, &range);
+}
 
-	void* temp;
-	vkMapMemory(device, stageBuffer._bufferMemory, 0, dataSize, 0, &temp);
-	memcpy(temp, data, (size_t)dataSize);
-	vkUnmapMemory(device, stageBuffer._bufferMemory);
+void vkutils::flushBuffer(VkDevice device, GPUBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+	// allocator ranges start on an atom and are rounded up to whole atoms, so the widened range stays inside the
+	// buffer's. Dedicated allocations have no size to clamp to and flush to their end
+	VkDeviceSize start = buffer._memoryOffset + offset;
+	VkDeviceSize end = start + size;
+	start -= start % non_coherent_atom;
+	end = ((end + non_coherent_atom - 1) / non_coherent_atom) * non_coherent_atom;
+	VkMappedMemoryRange range{};
+	range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+	range.memory = buffer._bufferMemory;
+	range.offset = start;
+	if (buffer._memorySize == VK_WHOLE_SIZE) range.size = VK_WHOLE_SIZE;
+	else range.size = std::min(end, buffer._memoryOffset + buffer._memorySize) - start;
+	vkFlushMappedMemoryRanges(device, 1, &range);
+}
+
+void vkutils::copyDataToImage(VkDevice device, VkPhysicalDevice physicalDevice, VkCommandPool cmdPool, VkQueue queue, VkDeviceSize dataSize, void* data, GPUImage image, VkOffset3D imgOffset, VkExtent3D imgExtent)
+{
+	GPUBuffer stageBuffer = create_staging_buffer(device, physicalDevice, dataSize, data);
 
 	VkCommandBuffer cmdBuffer = beginSingleTimeCommands(device, cmdPool);
 	VkBufferImageCopy region{};
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "vkstructs.h"
+#include "GPUAllocator.h"
 
 #include <vector>
 #include <array>
@@ -41,7 +41,8 @@ namespace vkutils {
 		VkImage image,
 		VkImageViewType viewType,
 		VkFormat format,
-		VkImageAspectFlags aspectFlag
+		VkImageAspectFlags aspectFlag,
+		uint32_t mipLevels = 1
 	);
 	GPUImage createGPUImage(
 		VkDevice device,
@@ -65,7 +66,8 @@ namespace vkutils {
 		VkImageUsageFlags usageFlag,
 		VkMemoryPropertyFlags memFlag,
 		VkImageViewType viewType,
-		VkImageAspectFlags aspectFlag
+		VkImageAspectFlags aspectFlag,
+		uint32_t mipLevels = 1
 	);
 	GPUImage createGPUImage(
 		VkDevice device,
@@ -92,7 +94,7 @@ namespace vkutils {
 
 	void destroyGPUImage(VkDevice device, GPUImage image, bool memory_already_freed = false);
 
-	VkCommandBuffer createCmdBuffer(VkDevice device, VkCommandPool cmdPool);
+	VkCommandBuffer createCmdBuffer(VkDevice device, VkCommandPool cmdPool, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
 	void transitionImageLayout(
 		VkDevice device,
@@ -136,7 +138,9 @@ namespace vkutils {
 		VkFramebuffer fBuffer,
 		VkExtent2D rpExtent,
 		VkCommandBuffer cmdBuffer,
-		std::vector<VkClearValue> clearValues
+		std::vector<VkClearValue> clearValues,
+		VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE,
+		VkOffset2D rpOffset = { 0, 0 }
 	);
 
 	bool hasStencilComponent(VkFormat format);
@@ -157,14 +161,17 @@ namespace vkutils {
 		VkPhysicalDevice physicalDevice,
 		VkDeviceSize size,
 		VkBufferUsageFlags usage,
-		VkMemoryPropertyFlags properties
+		VkMemoryPropertyFlags properties,
+		// more than one family makes the buffer concurrently shared between them
+		std::vector<uint32_t> queueFamilies = {}
 	);
 	void copyBuffer(
 		VkDevice device,
 		VkCommandPool cmdPool,
 		VkQueue queue,
 		VkBuffer srcBuffer, VkBuffer dstBuffer,
-		VkDeviceSize size
+		VkDeviceSize size,
+		VkDeviceSize dstOffset = 0
 	);
 	GPUBuffer createBuffer(
 		VkDevice device,
@@ -185,9 +192,18 @@ namespace vkutils {
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkCommandPool cmdPool,
-		VkQueue queue
+		VkQueue queue,
+		VkDeviceSize dstOffset = 0
 	);
 	void destroyBuffer(VkDevice device, GPUBuffer buffer);
+	// makes host writes to a mapped, non-coherent buffer visible to the device
+	void flushBuffer(VkDevice device, GPUBuffer buffer);
+	// only offset..offset + size of it, widened to whole atoms
+	void flushBuffer(VkDevice device, GPUBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+
+	// every buffer and image allocation goes through one allocator, created on first use
+	GPUAllocator* getAllocator(VkDevice device, VkPhysicalDevice physicalDevice);
+	void destroyAllocator();
 
 	void copyDataToImage(
 		VkDevice device,